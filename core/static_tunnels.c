@@ -54,6 +54,10 @@
 #include "tunnels/layer3/tcp/manipulator/tcp_manipulator.h"
 #endif
 
+#ifdef INCLUDE_LAYER3_TCP_TERMINATOR
+#include "tunnels/layer3/tcp/terminator/tcp_terminator.h"
+#endif
+
 #ifdef INCLUDE_TCP_LISTENER
 #include "tunnels/adapters/listener/tcp/tcp_listener.h"
 #endif
@@ -186,6 +190,10 @@
 #include "tunnels/client/mux/mux_client.h"
 #endif
 
+#ifdef INCLUDE_WIREGUARD
+#include "tunnels/client/wireguard/wireguard_client.h"
+#endif
+
 void loadStaticTunnelsIntoCore(void)
 {
 
@@ -225,6 +233,10 @@ void loadStaticTunnelsIntoCore(void)
     USING(Layer3TcpManipulator);
 #endif
 
+#ifdef INCLUDE_LAYER3_TCP_TERMINATOR
+    USING(Layer3TcpTerminator);
+#endif
+
 #ifdef INCLUDE_TCP_LISTENER
     USING(TcpListener);
 #endif
@@ -356,4 +368,8 @@ void loadStaticTunnelsIntoCore(void)
 #ifdef INCLUDE_MUX_CLIENT
     USING(MuxServer);
 #endif
+
+#ifdef INCLUDE_WIREGUARD
+    USING(WireGuard);
+#endif
 }
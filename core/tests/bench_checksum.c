@@ -0,0 +1,101 @@
+// throughput of the internet checksum kernels against the old 16 bit scalar loop, across packet sizes
+// build: use this file as the Waterwall source instead of core/main.c
+
+#include "checksum.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define BUFFER_SIZE  (1U << 16)
+#define TOTAL_BYTES  (1ULL << 32)
+#define UNALIGNED_BY 2
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ((double) ts.tv_nsec / 1e9);
+}
+
+// what standardCheckSum used to be, not folded or inverted here so it can be compared with the kernels
+static uint16_t checkSumClassic(const void *buf, uint32_t len, uint64_t initial)
+{
+    const uint16_t *ptr = buf;
+    uint32_t        sum = (uint32_t) initial;
+    while (len > 1)
+    {
+        sum += *ptr++;
+        len -= 2;
+    }
+    if (len)
+    {
+        sum += *(const uint8_t *) ptr;
+    }
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+    return (uint16_t) sum;
+}
+
+int main(void)
+{
+    static const uint32_t kSizes[] = {20, 40, 64, 128, 576, 1500, 4096, 9000, 65000};
+
+    uint8_t *buffer = malloc(BUFFER_SIZE + UNALIGNED_BY);
+    srand(1234);
+    for (uint32_t i = 0; i < BUFFER_SIZE + UNALIGNED_BY; i++)
+    {
+        buffer[i] = (uint8_t) rand();
+    }
+    // packets start after the 14 byte ethernet or at any offset, do not measure only the aligned case
+    const uint8_t *data = buffer + UNALIGNED_BY;
+
+    printf("%-8s", "size");
+    printf("%10s", "classic");
+    for (int k = 0; k < kChecksumKernelsCount; k++)
+    {
+        printf("%10s", getCheckSumKernelName(k));
+    }
+    printf("    (GB/s)\n");
+
+    for (size_t s = 0; s < sizeof(kSizes) / sizeof(kSizes[0]); s++)
+    {
+        const uint32_t size       = kSizes[s];
+        const uint64_t iterations = TOTAL_BYTES / 16 / size;
+        const uint16_t expected   = checkSumClassic(data, size, 0);
+
+        printf("%-8u", size);
+
+        for (int k = -1; k < kChecksumKernelsCount; k++)
+        {
+            checksum_kernel_t kernel = k < 0 ? checkSumClassic : getCheckSumKernel(k);
+            if (kernel == NULL)
+            {
+                printf("%10s", "-");
+                continue;
+            }
+            if (kernel(data, size, 0) != expected)
+            {
+                printf("\nkernel %s returned a wrong sum for size %u\n", getCheckSumKernelName(k), size);
+                return 1;
+            }
+
+            volatile uint16_t sink  = 0;
+            double            start = nowSeconds();
+            for (uint64_t i = 0; i < iterations; i++)
+            {
+                // the offset changes so the sum can not be hoisted out of the loop
+                sink += kernel(data + ((i & 7) * 2), size, sink);
+            }
+            double elapsed = nowSeconds() - start;
+            printf("%10.2f", (double) (iterations * size) / elapsed / 1e9);
+        }
+        printf("\n");
+    }
+
+    printf("selected: checkSumPartial(...) = %04x, expected %04x\n", checkSumPartial(data, 1500, 0),
+           checkSumClassic(data, 1500, 0));
+
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,99 @@
+// pps benchmark of the Layer3IpRoutingTable lookup, longest prefix match table against the old linear scan
+// build: use this file and tunnels/shared/layer3/ip_lpm.c as the Waterwall sources instead of core/main.c
+
+#include "managers/memory_manager.h"
+#include "tunnels/shared/layer3/ip_lpm.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define ROUTES         10000
+#define LOOKUPS        (1U << 24)
+#define LINEAR_LOOKUPS (1U << 14)
+
+typedef struct
+{
+    uint32_t addr; // network order
+    uint32_t mask; // network order
+    uint8_t  len;
+} route_t;
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ((double) ts.tv_nsec / 1e9);
+}
+
+int main(void)
+{
+    initMemoryManager();
+    srand(1234);
+
+    route_t  *routes = malloc(sizeof(route_t) * ROUTES);
+    uint32_t *probes = malloc(sizeof(uint32_t) * LOOKUPS);
+
+    ip_lpm_t *lpm = newIpLpm(32);
+
+    // mostly country-list like prefixes (/8 - /24) and some customer /25 - /32
+    for (int i = 0; i < ROUTES; i++)
+    {
+        uint8_t  len  = (uint8_t) ((rand() % 10) == 0 ? 25 + (rand() % 8) : 8 + (rand() % 17));
+        uint32_t mask = len == 0 ? 0 : (0xFFFFFFFFU << (32 - len));
+        uint32_t addr = ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+
+        routes[i] = (route_t) {.addr = htonl(addr & mask), .mask = htonl(mask), .len = len};
+    }
+    for (int i = ROUTES - 1; i >= 0; i--)
+    {
+        ipLpmInsert(lpm, (const uint8_t *) &(routes[i].addr), routes[i].len, (uint32_t) i + 1);
+    }
+
+    // half of the probes hit a route, the rest are random
+    for (uint32_t i = 0; i < LOOKUPS; i++)
+    {
+        if (i % 2 == 0)
+        {
+            const route_t *r = &routes[rand() % ROUTES];
+            probes[i]        = r->addr | (htonl((uint32_t) rand()) & ~r->mask);
+        }
+        else
+        {
+            probes[i] = ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+        }
+    }
+
+    volatile uint32_t sink = 0;
+    double            start;
+    double            elapsed;
+
+    start = nowSeconds();
+    for (uint32_t i = 0; i < LOOKUPS; i++)
+    {
+        sink += ipLpmLookup4(lpm, probes[i]);
+    }
+    elapsed = nowSeconds() - start;
+    printf("lpm    : %u routes, %u chunks, %.2f Mpps\n", ROUTES, lpm->chunks_count, LOOKUPS / elapsed / 1e6);
+
+    start = nowSeconds();
+    for (uint32_t i = 0; i < LINEAR_LOOKUPS; i++)
+    {
+        for (int j = 0; j < ROUTES; j++)
+        {
+            if ((probes[i] & routes[j].mask) == routes[j].addr)
+            {
+                sink += (uint32_t) j;
+                break;
+            }
+        }
+    }
+    elapsed = nowSeconds() - start;
+    printf("linear : %u routes, %.2f Mpps\n", ROUTES, LINEAR_LOOKUPS / elapsed / 1e6);
+
+    destroyIpLpm(lpm);
+    free(routes);
+    free(probes);
+    return (int) (sink & 0);
+}
@@ -0,0 +1,120 @@
+// frame dispatch benchmark of the mux nodes, cid table against the old children list scan, for a growing number
+// of streams on one carrier; every frame carries 1 KiB so the rate is also shown as payload throughput
+// build: use this file as the Waterwall source instead of core/main.c (tunnels/shared/mux in the include path)
+
+#include "managers/memory_manager.h"
+#include "tunnels/shared/mux/mux_cid_table.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define FRAMES        (1U << 22)
+#define LINEAR_FRAMES (1U << 18)
+#define FRAME_PAYLOAD 1024
+
+typedef struct child_s
+{
+    struct child_s *next, *prev;
+    uint64_t        received;
+    cid_t           cid;
+    uint8_t         other_state[96]; // the rest of a child con state, so the list walk touches as many lines
+
+} child_t;
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ((double) ts.tv_nsec / 1e9);
+}
+
+static child_t *listFind(child_t *root, cid_t cid)
+{
+    for (child_t *i = root->next; i; i = i->next)
+    {
+        if (i->cid == cid)
+        {
+            return i;
+        }
+    }
+    return NULL;
+}
+
+static void report(const char *name, uint32_t streams, uint32_t frames, double elapsed)
+{
+    const double fps = frames / elapsed;
+    printf("%-6s %5u streams: %8.2f Mframes/s  %8.2f Gbit/s dispatch ceiling at 1 KiB\n", name, streams, fps / 1e6,
+           fps * FRAME_PAYLOAD * 8 / 1e9);
+}
+
+int main(void)
+{
+    initMemoryManager();
+    srand(1234);
+
+    static const uint32_t kStreams[] = {1, 16, 128, 512, 2048, 8192};
+    cid_t                *frames     = malloc(sizeof(cid_t) * FRAMES);
+    volatile uint64_t     sink       = 0;
+
+    for (size_t s = 0; s < sizeof(kStreams) / sizeof(kStreams[0]); s++)
+    {
+        const uint32_t  streams = kStreams[s];
+        child_t         root    = {0};
+        mux_cid_table_t table;
+        initMuxCidTable(&table);
+
+        // children opened one by one like the client does, newest at the head of the list
+        for (uint32_t i = 0; i < streams; i++)
+        {
+            child_t *child = globalMalloc(sizeof(child_t));
+            *child         = (child_t) {.cid = (cid_t) i, .next = root.next, .prev = &root};
+            if (root.next)
+            {
+                root.next->prev = child;
+            }
+            root.next = child;
+            muxCidTableInsert(&table, child->cid, child);
+        }
+        // frames of random streams, as they interleave on a busy carrier
+        for (uint32_t i = 0; i < FRAMES; i++)
+        {
+            frames[i] = (cid_t) (rand() % streams);
+        }
+
+        double start = nowSeconds();
+        for (uint32_t i = 0; i < FRAMES; i++)
+        {
+            child_t *child = muxCidTableFind(&table, frames[i]);
+            child->received += FRAME_PAYLOAD;
+        }
+        report("table", streams, FRAMES, nowSeconds() - start);
+
+        start = nowSeconds();
+        for (uint32_t i = 0; i < LINEAR_FRAMES; i++)
+        {
+            child_t *child = listFind(&root, frames[i]);
+            child->received += FRAME_PAYLOAD;
+        }
+        report("list", streams, LINEAR_FRAMES, nowSeconds() - start);
+
+        for (child_t *i = root.next; i;)
+        {
+            child_t *next = i->next;
+            sink += i->received;
+            muxCidTableRemove(&table, i->cid);
+            globalFree(i);
+            i = next;
+        }
+        if (table.count != 0)
+        {
+            printf("cid table not empty after removing every stream\n");
+            return 1;
+        }
+        dropMuxCidTable(&table);
+    }
+
+    free(frames);
+    return (int) (sink & 0);
+}
@@ -0,0 +1,160 @@
+// pps benchmark of the WireGuard per packet lookups with 5k peers, receiver index table and allowed ip lpm
+// against the old linear scans
+// build: use this file, tunnels/shared/layer3/ip_lpm.c, tunnels/shared/wireguard/wireguard.c and
+// tunnels/shared/wireguard/crypto.c as the Waterwall sources instead of core/main.c (links OpenSSL::Crypto)
+
+#include "managers/memory_manager.h"
+#include "tunnels/shared/layer3/ip_lpm.h"
+#include "tunnels/shared/wireguard/crypto.h"
+#include "tunnels/shared/wireguard/wireguard.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PEERS          5000
+#define LOOKUPS        (1U << 24)
+#define LINEAR_LOOKUPS (1U << 14)
+
+typedef struct
+{
+    uint32_t addr; // network order
+    uint32_t mask; // network order
+    uint8_t  len;
+} allowed_ip_t;
+
+// every peer has its tunnel address and a /24 behind it
+static allowed_ip_t allowed_ips[PEERS][2];
+
+static double nowSeconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + ((double) ts.tv_nsec / 1e9);
+}
+
+static wireguard_peer_t *linearLookupByHandshake(wireguard_device_t *device, uint32_t receiver)
+{
+    for (uint32_t x = 0; x < device->peers_count; x++)
+    {
+        wireguard_peer_t *tmp = &device->peers[x];
+        if (tmp->valid && tmp->handshake.valid && tmp->handshake.initiator && (tmp->handshake.local_index == receiver))
+        {
+            return tmp;
+        }
+    }
+    return NULL;
+}
+
+static uint32_t linearLookupByIp(uint32_t addr)
+{
+    for (uint32_t i = 0; i < PEERS; i++)
+    {
+        for (int j = 0; j < 2; j++)
+        {
+            if ((addr & allowed_ips[i][j].mask) == allowed_ips[i][j].addr)
+            {
+                return i + 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(void)
+{
+    initMemoryManager();
+    wireguard_init();
+    srand(1234);
+
+    wireguard_device_t device = {0};
+    uint8_t            private_key[kWgPrivateKeyLen];
+    wireguard_random_bytes(private_key, sizeof(private_key));
+    wireguard_device_init(&device, private_key);
+
+    const uint32_t table_len = wireguard_index_table_len(PEERS);
+    device.peers             = calloc(PEERS, sizeof(wireguard_peer_t));
+    device.peers_count       = PEERS;
+    device.index_table       = calloc(table_len, sizeof(wireguard_index_entry_t));
+    device.index_table_mask  = table_len - 1;
+
+    // a handshake in flight with every peer, so every peer has an index in the table
+    uint32_t *indices = malloc(sizeof(uint32_t) * PEERS);
+    for (uint32_t i = 0; i < PEERS; i++)
+    {
+        uint8_t                             public_key[kWgPublicKeyLen];
+        struct message_handshake_initiation msg;
+        wireguard_random_bytes(public_key, sizeof(public_key));
+        wireguard_peer_init(&device, &device.peers[i], public_key, NULL);
+        wireguard_create_handshake_initiation(&device, &device.peers[i], &msg);
+        indices[i] = msg.sender;
+    }
+
+    ip_lpm_t *lpm = newIpLpm(32);
+    for (uint32_t i = 0; i < PEERS; i++)
+    {
+        const uint32_t host = 0x0A000000U | (i + 1);        // 10.0.x.y/32
+        const uint32_t net  = 0x64000000U | ((i + 1) << 8); // 100.x.y.0/24
+        allowed_ips[i][0]   = (allowed_ip_t) {.addr = htonl(host), .mask = 0xFFFFFFFFU, .len = 32};
+        allowed_ips[i][1]   = (allowed_ip_t) {.addr = htonl(net), .mask = htonl(0xFFFFFF00U), .len = 24};
+        ipLpmInsert(lpm, (const uint8_t *) &(allowed_ips[i][0].addr), 32, i + 1);
+        ipLpmInsert(lpm, (const uint8_t *) &(allowed_ips[i][1].addr), 24, i + 1);
+    }
+
+    // destinations spread over all peers, half of them into the /24s
+    uint32_t *probes   = malloc(sizeof(uint32_t) * LOOKUPS);
+    uint32_t *receiver = malloc(sizeof(uint32_t) * LOOKUPS);
+    for (uint32_t i = 0; i < LOOKUPS; i++)
+    {
+        const allowed_ip_t *a = &allowed_ips[rand() % PEERS][i % 2];
+        probes[i]             = a->addr | (htonl((uint32_t) rand()) & ~a->mask);
+        receiver[i]           = indices[rand() % PEERS];
+    }
+
+    volatile uintptr_t sink = 0;
+    double             start;
+    double             elapsed;
+
+    start = nowSeconds();
+    for (uint32_t i = 0; i < LOOKUPS; i++)
+    {
+        sink += (uintptr_t) peer_lookup_by_handshake(&device, receiver[i]);
+    }
+    elapsed = nowSeconds() - start;
+    printf("receiver table : %u peers, %u indices, %.2f Mpps\n", PEERS, device.index_table_count,
+           LOOKUPS / elapsed / 1e6);
+
+    start = nowSeconds();
+    for (uint32_t i = 0; i < LINEAR_LOOKUPS; i++)
+    {
+        sink += (uintptr_t) linearLookupByHandshake(&device, receiver[i]);
+    }
+    elapsed = nowSeconds() - start;
+    printf("receiver linear: %u peers, %.2f Mpps\n", PEERS, LINEAR_LOOKUPS / elapsed / 1e6);
+
+    start = nowSeconds();
+    for (uint32_t i = 0; i < LOOKUPS; i++)
+    {
+        sink += ipLpmLookup4(lpm, probes[i]);
+    }
+    elapsed = nowSeconds() - start;
+    printf("allowed ip lpm : %u prefixes, %.2f Mpps\n", lpm->prefixes_count, LOOKUPS / elapsed / 1e6);
+
+    start = nowSeconds();
+    for (uint32_t i = 0; i < LINEAR_LOOKUPS; i++)
+    {
+        sink += linearLookupByIp(probes[i]);
+    }
+    elapsed = nowSeconds() - start;
+    printf("allowed ip scan: %u prefixes, %.2f Mpps\n", PEERS * 2, LINEAR_LOOKUPS / elapsed / 1e6);
+
+    destroyIpLpm(lpm);
+    free(probes);
+    free(receiver);
+    free(indices);
+    free(device.index_table);
+    free(device.peers);
+    return (int) (sink & 0);
+}
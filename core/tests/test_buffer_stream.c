@@ -0,0 +1,131 @@
+// buffer stream checks: pushing onto a tail buffer whose data already reaches into its right padding, then a
+// randomized push/read/segment run compared byte by byte against a flat copy; exits non zero on a mismatch
+// build: use this file as the Waterwall source instead of core/main.c (best with -fsanitize=address)
+
+#include "buffer_pool.h"
+#include "buffer_stream.h"
+#include "managers/memory_manager.h"
+#include "master_pool.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RANDOM_OPS (1U << 18)
+#define MODEL_SIZE (1U << 22)
+
+static uint8_t model[MODEL_SIZE];
+static size_t  model_head;
+static size_t  model_tail;
+static uint8_t next_byte;
+
+static void fillBuffer(shift_buffer_t *buf, uint32_t len)
+{
+    setLen(buf, len);
+    for (uint32_t i = 0; i < len; i++)
+    {
+        rawBufMut(buf)[i]    = next_byte;
+        model[model_tail++] = next_byte++;
+    }
+}
+
+static int readAndCompare(buffer_stream_t *stream, size_t len)
+{
+    shift_buffer_t *buf = bufferStreamRead(stream, len);
+    int             bad = bufLen(buf) != len || memcmp(rawBuf(buf), model + model_head, len) != 0;
+    model_head += len;
+    reuseBuffer(stream->pool, buf);
+    return bad;
+}
+
+// the tail is a buffer of 64 bytes with 32 bytes of right padding that holds 80 bytes, nothing may be appended to it
+static int testPushOntoPaddedTail(buffer_pool_t *pool)
+{
+    buffer_stream_t *stream = newBufferStream(pool);
+
+    shift_buffer_t *first = popBuffer(pool);
+    fillBuffer(first, 100);
+    bufferStreamPush(stream, first);
+
+    shift_buffer_t *tail = newShiftBufferWithPad(64, 0, 32);
+    fillBuffer(tail, 80);
+    bufferStreamPush(stream, tail);
+
+    shift_buffer_t *small = popBuffer(pool);
+    fillBuffer(small, 16);
+    bufferStreamPush(stream, small);
+
+    int bad = bufferStreamLen(stream) != 196 || readAndCompare(stream, 196);
+    destroyBufferStream(stream);
+    return bad;
+}
+
+static int testRandomOps(buffer_pool_t *pool)
+{
+    buffer_stream_t *stream = newBufferStream(pool);
+
+    for (uint32_t op = 0; op < RANDOM_OPS; op++)
+    {
+        const int kind = rand() % 4;
+        if (kind <= 1 || bufferStreamLen(stream) == 0)
+        {
+            // every third buffer runs into its right padding, like a reserved or sliced payload can
+            const bool      padded = rand() % 3 == 0;
+            shift_buffer_t *buf    = padded ? newShiftBufferWithPad(512, 0, 64) : popBuffer(pool);
+            fillBuffer(buf, 1 + (uint32_t) (rand() % (padded ? 560 : 1000)));
+            bufferStreamPush(stream, buf);
+        }
+        else if (kind == 2)
+        {
+            if (readAndCompare(stream, 1 + (size_t) rand() % bufferStreamLen(stream)))
+            {
+                return 1;
+            }
+        }
+        else
+        {
+            shift_buffer_t *buf = bufferStreamReadSegment(stream, 1 + (size_t) rand() % 700);
+            if (bufLen(buf) == 0 || memcmp(rawBuf(buf), model + model_head, bufLen(buf)) != 0)
+            {
+                return 1;
+            }
+            model_head += bufLen(buf);
+            reuseBuffer(pool, buf);
+        }
+        if (bufferStreamLen(stream) != model_tail - model_head)
+        {
+            return 1;
+        }
+        if (model_tail > MODEL_SIZE / 2)
+        {
+            memmove(model, model + model_head, model_tail - model_head);
+            model_tail -= model_head;
+            model_head = 0;
+        }
+    }
+    destroyBufferStream(stream);
+    return 0;
+}
+
+int main(void)
+{
+    initMemoryManager();
+    srand(7);
+
+    buffer_pool_t *pool = createBufferPool(newMasterPoolWithCap(64), newMasterPoolWithCap(64), 1);
+
+    if (testPushOntoPaddedTail(pool))
+    {
+        printf("push onto a padded tail: FAILED\n");
+        return 1;
+    }
+    printf("push onto a padded tail: ok\n");
+
+    if (testRandomOps(pool))
+    {
+        printf("random push/read/segment: FAILED\n");
+        return 1;
+    }
+    printf("random push/read/segment: ok\n");
+    return 0;
+}
@@ -22,9 +22,18 @@ enum capturedevice_filter_type_dynamic_value_status
     kDvsDestIp
 };
 
+enum
+{
+    kCmdBufSize = 200
+};
+
 static const char *ip_tables_enable_queue_mi  = "iptables -I INPUT -s %s -j NFQUEUE --queue-num %d";
 static const char *ip_tables_disable_queue_mi = "iptables -D INPUT -s %s -j NFQUEUE --queue-num %d";
 
+// the kernel spreads flows across the queue range, each queue is read by its own thread
+static const char *ip_tables_enable_queue_balance_mi  = "iptables -I INPUT -s %s -j NFQUEUE --queue-balance %d:%d";
+static const char *ip_tables_disable_queue_balance_mi = "iptables -D INPUT -s %s -j NFQUEUE --queue-balance %d:%d";
+
 typedef struct capture_device_state_s
 {
     capture_device_t *cdev;
@@ -33,6 +42,7 @@ typedef struct capture_device_state_s
     char             *name;
     char             *exitcmd;
     uint32_t          queue_number;
+    uint32_t          queues_count;
     uint32_t          except_fwmark;
 
 } capture_device_state_t;
@@ -168,6 +178,15 @@ tunnel_t *newCaptureDevice(node_instance_context_t *instance_info)
         LOGF("JSON Error: CaptureDevice->settings->filter-mode (string field) : mode is not specified or invalid");
         return NULL;
     }
+    int queues_count = 0;
+    // one queue unless asked for more, more than one switches the iptables rule to --queue-balance
+    getIntFromJsonObjectOrDefault(&queues_count, settings, "queues", 1);
+    if (queues_count <= 0 || queues_count > 64)
+    {
+        LOGF("JSON Error: CaptureDevice->settings->queues (int field) : must be between 1 and 64");
+        return NULL;
+    }
+    state->queues_count = (uint32_t) queues_count;
     state->queue_number = 200 + (fastRand() % 200);
     state->ip           = NULL;
     if (! getStringFromJsonObject(&state->ip, settings, "ip"))
@@ -175,22 +194,52 @@ tunnel_t *newCaptureDevice(node_instance_context_t *instance_info)
         LOGF("JSON Error: CaptureDevice->settings->ip (string field) : mode is not specified or invalid");
     }
 
-    char     *cmdbuf = globalMalloc(200);
+    char     *cmdbuf = globalMalloc(kCmdBufSize);
     tunnel_t *t      = newTunnel();
 
     if ((int) directoin.status == kDvsIncoming)
     {
         if ((int) fmode.status == kDvsSourceIp)
         {
-            snprintf(cmdbuf, 100, ip_tables_enable_queue_mi, state->ip, (int) state->queue_number);
+            const int queue_last = (int) (state->queue_number + state->queues_count - 1);
+            int       written;
+            if (state->queues_count == 1)
+            {
+                written =
+                    snprintf(cmdbuf, kCmdBufSize, ip_tables_enable_queue_mi, state->ip, (int) state->queue_number);
+            }
+            else
+            {
+                written = snprintf(cmdbuf, kCmdBufSize, ip_tables_enable_queue_balance_mi, state->ip,
+                                   (int) state->queue_number, queue_last);
+            }
+            if (written < 0 || written >= kCmdBufSize)
+            {
+                LOGF("CaptureDevicer: the iptables command does not fit in %d bytes", (int) kCmdBufSize);
+                return NULL;
+            }
             if (execCmd(cmdbuf).exit_code != 0)
             {
                 LOGF("CaptureDevicer: command failed: %s", cmdbuf);
                 return NULL;
             }
 
+            if (state->queues_count == 1)
+            {
+                written =
+                    snprintf(cmdbuf, kCmdBufSize, ip_tables_disable_queue_mi, state->ip, (int) state->queue_number);
+            }
+            else
+            {
+                written = snprintf(cmdbuf, kCmdBufSize, ip_tables_disable_queue_balance_mi, state->ip,
+                                   (int) state->queue_number, queue_last);
+            }
+            if (written < 0 || written >= kCmdBufSize)
+            {
+                LOGF("CaptureDevicer: the iptables command does not fit in %d bytes", (int) kCmdBufSize);
+                return NULL;
+            }
             state->exitcmd = cmdbuf;
-            snprintf(cmdbuf, 100, ip_tables_disable_queue_mi, state->ip, (int) state->queue_number);
             registerAtExitCallback(exitHook, t);
         }
         else
@@ -205,7 +254,7 @@ tunnel_t *newCaptureDevice(node_instance_context_t *instance_info)
         state->thread_lines[i] = newLine(i);
     }
 
-    state->cdev = createCaptureDevice(state->name, state->queue_number, t, onIPPacketReceived);
+    state->cdev = createCaptureDevice(state->name, state->queue_number, state->queues_count, t, onIPPacketReceived);
 
     if (state->cdev == NULL)
     {
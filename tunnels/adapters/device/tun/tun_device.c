@@ -96,21 +96,37 @@ static void downStream(tunnel_t *self, context_t *c)
     destroyContext(c);
 }
 
-static void onIPPacketReceived(struct tun_device_s *tdev, void *userdata, shift_buffer_t *buf, tid_t tid)
+static void upStreamBatch(tunnel_t *self, packet_batch_t *batch)
+{
+    tun_device_state_t *state = TSTATE((tunnel_t *) self);
+
+    for (uint16_t i = 0; i < batch->count; i++)
+    {
+        if (! writeToTunDevce(state->tdev, batch->bufs[i]))
+        {
+            reuseBuffer(getLineBufferPool(batch->line), batch->bufs[i]);
+        }
+    }
+}
+
+static void onIPPacketsReceived(struct tun_device_s *tdev, void *userdata, shift_buffer_t **bufs, uint16_t count,
+                                tid_t tid)
 {
     (void) tdev;
     tunnel_t           *self  = userdata;
     tun_device_state_t *state = TSTATE((tunnel_t *) self);
 
+    packet_batch_t batch = {.line = state->thread_lines[tid], .count = 0};
+
+    for (uint16_t i = 0; i < count; i++)
+    {
 #if LOG_PACKET_INFO
-    printIPPacketInfo(rawBuf(buf), bufLen(buf));
+        printIPPacketInfo(rawBuf(bufs[i]), bufLen(bufs[i]));
 #endif
+        packetBatchPush(&batch, bufs[i], false);
+    }
 
-    // reuseBuffer(getWorkerBufferPool(tid), buf);
-
-    context_t *ctx = newContext(state->thread_lines[tid]);
-    ctx->payload   = buf;
-    self->up->upStream(self->up, ctx);
+    upStreamPacketBatch(self->up, &batch);
 }
 
 tunnel_t *newTunDevice(node_instance_context_t *instance_info)
@@ -154,7 +170,7 @@ tunnel_t *newTunDevice(node_instance_context_t *instance_info)
 
     tunnel_t *t = newTunnel();
 
-    state->tdev = createTunDevice(state->name, false, t, onIPPacketReceived);
+    state->tdev = createTunDevice(state->name, false, t, onIPPacketsReceived);
 
     if (state->tdev == NULL)
     {
@@ -164,9 +180,10 @@ tunnel_t *newTunDevice(node_instance_context_t *instance_info)
     assignIpToTunDevice(state->tdev, state->ip_present, state->subnet_mask);
     bringTunDeviceUP(state->tdev);
 
-    t->state      = state;
-    t->upStream   = &upStream;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->fnPacketBatchU = &upStreamBatch;
 
     return t;
 }
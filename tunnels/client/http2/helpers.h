@@ -7,7 +7,8 @@
 
 enum
 {
-    kPingInterval = 10000
+    kPingInterval      = 10000,
+    kIdleCheckInterval = 1000
 };
 
 static void onPingTimer(htimer_t *timer);
@@ -45,6 +46,7 @@ static void onH2LinePaused(void *arg)
 {
     http2_client_con_state_t *con  = (http2_client_con_state_t *) arg;
     tunnel_t                 *self = con->tunnel;
+    con->paused                    = true;
 
     line_t *stream_line = con->current_stream_write_line;
     if (stream_line && isAlive(stream_line))
@@ -69,6 +71,7 @@ static void onH2LinePaused(void *arg)
 static void onH2LineResumed(void *arg)
 {
     http2_client_con_state_t *con = (http2_client_con_state_t *) arg;
+    con->paused                   = false;
     // con->pause_counter            = con->pause_counter > 0 ? (con->pause_counter - 1) : con->pause_counter;
     http2_client_child_con_state_t *stream_i;
     for (stream_i = con->root.next; stream_i;)
@@ -91,15 +94,20 @@ static void addStraem(http2_client_con_state_t *con, http2_client_child_con_stat
     {
         stream->next->prev = stream;
     }
+    con->active_streams += 1;
 }
 static void removeStream(http2_client_con_state_t *con, http2_client_child_con_state_t *stream)
 {
-    (void) con;
     stream->prev->next = stream->next;
     if (stream->next)
     {
         stream->next->prev = stream->prev;
     }
+    con->active_streams -= 1;
+    if (con->active_streams == 0)
+    {
+        con->idle_since = hloop_now_ms(getWorkerLoop(con->line->tid));
+    }
 }
 
 static http2_client_child_con_state_t *createHttp2Stream(http2_client_con_state_t *con, line_t *child_line)
@@ -180,6 +188,7 @@ static http2_client_con_state_t *createHttp2Connection(tunnel_t *self, int tid)
                                                                   .scheme       = state->scheme,
                                                                   .method       = state->content_type == kApplicationGrpc ? kHttpPost : kHttpGet,
                                                                   .line         = newLine(tid),
+                                                                  .idle_since   = hloop_now_ms(getWorkerLoop(tid)),
                                                                   .ping_timer   = htimer_add(getWorkerLoop(tid), onPingTimer, kPingInterval, INFINITE),
                                                                   .tunnel       = self,
                                                                   .actions      = action_queue_t_with_capacity(16)};
@@ -190,10 +199,13 @@ static http2_client_con_state_t *createHttp2Connection(tunnel_t *self, int tid)
     nghttp2_session_client_new2(&con->session, state->cbs, con, state->ngoptions);
     nghttp2_settings_entry settings[] = {{NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, kMaxConcurrentStreams},
                                          {NGHTTP2_SETTINGS_MAX_FRAME_SIZE, (1U << 18)},
-                                         {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, (1U << 18)}
+                                         {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, kHttp2InitialWindowSize}
 
     };
     nghttp2_submit_settings(con->session, NGHTTP2_FLAG_NONE, settings, ARRAY_SIZE(settings));
+    // the connection window would stay at 64 KiB, less than what a single stream may have in flight
+    nghttp2_session_set_local_window_size(con->session, NGHTTP2_FLAG_NONE, 0, kHttp2InitialWindowSize);
+    initHttp2Bdp(&(con->bdp), kHttp2InitialWindowSize, state->max_window_size);
 
     return con;
 }
@@ -239,43 +251,67 @@ static void deleteHttp2Connection(http2_client_con_state_t *con)
     globalFree(con);
 }
 
+// active streams are the load, paused carriers and the ones at connection-stream-limit are busy
+static uint64_t http2ConnectionLoad(void *owner, void *c, bool *busy)
+{
+    http2_client_state_t     *state = owner;
+    http2_client_con_state_t *con   = c;
+
+    *busy = con->paused || con->active_streams >= state->connection_stream_limit;
+    return con->active_streams;
+}
+
+/*
+    the pool policy picks the connection of a new stream; a connection that took concurrency streams leaves the
+    pool and is closed once its streams are done
+*/
 static http2_client_con_state_t *takeHttp2Connection(tunnel_t *self, int tid)
 {
+    http2_client_state_t *state  = TSTATE(self);
+    vec_cons             *vector = &(state->thread_cpool[tid].cons);
 
-    http2_client_state_t *state = TSTATE(self);
-    // return createHttp2Connection(self, tid, io);
-    vec_cons *vector = &(state->thread_cpool[tid].cons);
+    http2_client_con_state_t *con = connectionPoolPick(&(state->pool_policy), (void *const *) vector->data,
+                                                       (size_t) vec_cons_size(vector), http2ConnectionLoad, state);
+    if (con == NULL)
+    {
+        con = createHttp2Connection(self, tid);
+        vec_cons_push(vector, con);
+    }
 
-    if (vec_cons_size(vector) > 0)
+    con->childs_added += 1;
+    if (con->childs_added >= state->concurrency)
     {
-        http2_client_con_state_t *con = NULL;
-        c_foreach(k, vec_cons, *vector)
+        vec_cons_iter it = vec_cons_find(vector, con);
+        if (it.ref != vec_cons_end(vector).ref)
         {
-            if ((*k.ref)->childs_added < state->concurrency)
-            {
-                (*k.ref)->childs_added += 1;
-                con = (*k.ref);
-                break;
-            }
+            vec_cons_erase_at(vector, it);
         }
+    }
+    return con;
+}
+
+static void onIdleCheckTimer(htimer_t *timer)
+{
+    thread_connection_pool_t *pool  = hevent_userdata(timer);
+    http2_client_state_t     *state = TSTATE(pool->tunnel);
+    const uint64_t            now   = hloop_now_ms(getWorkerLoop(pool->tid));
+    size_t                    i     = 0;
+
+    while (i < (size_t) vec_cons_size(&(pool->cons)))
+    {
+        http2_client_con_state_t *con = *vec_cons_at(&(pool->cons), i);
 
-        if (con)
+        if (! connectionPoolShouldRetire(&(state->pool_policy), (size_t) vec_cons_size(&(pool->cons)),
+                                         con->active_streams > 0, con->idle_since, now))
         {
-            if (con->childs_added >= state->concurrency)
-            {
-                vec_cons_pop(vector);
-            }
-            return con;
+            i++;
+            continue;
         }
-
-        con = createHttp2Connection(self, tid);
-        vec_cons_push(vector, con);
-        return con;
+        context_t *con_fc   = newFinContext(con->line);
+        tunnel_t  *con_dest = con->tunnel->up;
+        deleteHttp2Connection(con); // also erases it from the pool, the same index is the next connection
+        con_dest->upStream(con_dest, con_fc);
     }
-
-    http2_client_con_state_t *con = createHttp2Connection(self, tid);
-    vec_cons_push(vector, con);
-    return con;
 }
 
 static void onPingTimer(htimer_t *timer)
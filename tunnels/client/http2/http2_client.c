@@ -8,7 +8,8 @@
 
 enum
 {
-    kDefaultConcurrency = 64 // cons will be muxed into 1
+    kDefaultConcurrency       = 64, // cons will be muxed into 1
+    kMaxCoalescedControlWrite = 16 * 1024
 };
 
 static int onStreamClosedCallback(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *userdata)
@@ -102,6 +103,11 @@ static int onDataChunkRecvCallback(nghttp2_session *session, uint8_t flags, int3
     }
     http2_client_con_state_t *con = (http2_client_con_state_t *) userdata;
 
+    if (http2BdpReceived(&(con->bdp), (uint32_t) len, hloop_now_us(getWorkerLoop(con->line->tid))))
+    {
+        nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, kHttp2BdpProbeData);
+    }
+
     http2_client_child_con_state_t *stream = nghttp2_session_get_stream_user_data(session, stream_id);
 
     if (WW_UNLIKELY(! stream))
@@ -109,9 +115,8 @@ static int onDataChunkRecvCallback(nghttp2_session *session, uint8_t flags, int3
         return 0;
     }
 
-    shift_buffer_t *buf = popBuffer(getLineBufferPool(con->line));
-    setLen(buf, len);
-    writeRaw(buf, data, len);
+    shift_buffer_t *buf =
+        http2RecvSliceData(&(con->recv_slice), getLineBufferPool(con->line), data, (uint32_t) len);
     lockLine(stream->line);
 
     action_queue_t_push(
@@ -121,6 +126,19 @@ static int onDataChunkRecvCallback(nghttp2_session *session, uint8_t flags, int3
     return 0;
 }
 
+static void onBdpProbeAck(http2_client_con_state_t *con)
+{
+    const uint32_t window = http2BdpProbeAcked(&(con->bdp), hloop_now_us(getWorkerLoop(con->line->tid)));
+    if (window == 0)
+    {
+        return;
+    }
+    // the connection window grows with a WINDOW_UPDATE, the stream windows by the new initial size
+    nghttp2_session_set_local_window_size(con->session, NGHTTP2_FLAG_NONE, 0, (int32_t) window);
+    nghttp2_settings_entry settings[] = {{NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, window}};
+    nghttp2_submit_settings(con->session, NGHTTP2_FLAG_NONE, settings, ARRAY_SIZE(settings));
+}
+
 static int onFrameRecvCallback(nghttp2_session *session, const nghttp2_frame *frame, void *userdata)
 {
     (void) session;
@@ -144,6 +162,10 @@ static int onFrameRecvCallback(nghttp2_session *session, const nghttp2_frame *fr
         break;
     case NGHTTP2_PING:
         con->no_ping_ack = false;
+        if ((frame->hd.flags & NGHTTP2_FLAG_ACK) && isHttp2BdpProbe(frame->ping.opaque_data))
+        {
+            onBdpProbeAck(con);
+        }
         break;
     case NGHTTP2_RST_STREAM:
     case NGHTTP2_WINDOW_UPDATE:
@@ -234,13 +256,23 @@ static bool sendNgHttp2Data(tunnel_t *self, http2_client_con_state_t *con)
 {
     line_t *main_line = con->line;
     char   *buf       = NULL;
-    size_t  len       = nghttp2_session_mem_send(con->session, (const uint8_t **) &buf);
+    ssize_t len       = nghttp2_session_mem_send(con->session, (const uint8_t **) &buf);
 
     if (len > 0)
     {
-        shift_buffer_t *send_buf = popBuffer(getLineBufferPool(main_line));
+        shift_buffer_t *send_buf = reserveBufSpace(popBuffer(getLineBufferPool(main_line)), len);
         setLen(send_buf, len);
         writeRaw(send_buf, buf, len);
+
+        // the other frames nghttp2 has ready (settings, window updates, headers...) go out in the same write
+        while (bufLen(send_buf) < kMaxCoalescedControlWrite &&
+               (len = nghttp2_session_mem_send(con->session, (const uint8_t **) &buf)) > 0)
+        {
+            const uint32_t filled = bufLen(send_buf);
+            send_buf              = reserveBufSpace(send_buf, filled + len);
+            setLen(send_buf, filled + len);
+            memcpy(rawBufMut(send_buf) + filled, buf, len);
+        }
         context_t *data = newContext(main_line);
         data->payload   = send_buf;
         self->up->upStream(self->up, data);
@@ -289,11 +321,11 @@ static void doHttp2Action(const http2_action_t action, http2_client_con_state_t
             {
                 if (stream->grpc_bytes_needed == 0 && bufferStreamLen(stream->grpc_buffer_stream) >= GRPC_MESSAGE_HDLEN)
                 {
-                    shift_buffer_t *gheader_buf = bufferStreamRead(stream->grpc_buffer_stream, GRPC_MESSAGE_HDLEN);
+                    uint8_t         gheader[GRPC_MESSAGE_HDLEN];
                     grpc_message_hd msghd;
-                    grpcMessageHdUnpack(&msghd, rawBuf(gheader_buf));
+                    bufferStreamReadBytes(stream->grpc_buffer_stream, gheader, GRPC_MESSAGE_HDLEN);
+                    grpcMessageHdUnpack(&msghd, gheader);
                     stream->grpc_bytes_needed = msghd.length;
-                    reuseBuffer(getLineBufferPool(con->line), gheader_buf);
                 }
                 if (stream->grpc_bytes_needed > 0 &&
                     bufferStreamLen(stream->grpc_buffer_stream) >= stream->grpc_bytes_needed)
@@ -479,9 +511,12 @@ static void downStream(tunnel_t *self, context_t *c)
         size_t len = 0;
         while ((len = bufLen(c->payload)) > 0)
         {
-            size_t  consumed = min(1 << 15UL, (ssize_t) len);
-            ssize_t ret      = nghttp2_session_mem_recv2(con->session, (const uint8_t *) rawBuf(c->payload), consumed);
-            shiftr(c->payload, consumed);
+            size_t consumed = min(1 << 15UL, (ssize_t) len);
+            http2RecvSliceBegin(&(con->recv_slice), c->payload);
+            ssize_t  ret  = nghttp2_session_mem_recv2(con->session, (const uint8_t *) rawBuf(c->payload), consumed);
+            uint32_t skip = (uint32_t) consumed;
+            c->payload    = http2RecvSliceEnd(&(con->recv_slice), &skip);
+            shiftr(c->payload, skip);
 
             if (ret != (ssize_t) consumed)
             {
@@ -601,6 +636,16 @@ tunnel_t *newHttp2Client(node_instance_context_t *instance_info)
     getIntFromJsonObjectOrDefault(&(int_concurrency), settings, "concurrency", kDefaultConcurrency);
     state->concurrency = int_concurrency;
 
+    // upper bound of the stream and connection receive windows, 0 keeps them fixed
+    int max_window_size;
+    getIntFromJsonObjectOrDefault(&(max_window_size), settings, "max-window-size", kHttp2DefaultMaxWindowSize);
+    state->max_window_size = max(0, max_window_size);
+
+    int stream_limit;
+    parseConnectionPoolPolicy(&(state->pool_policy), settings);
+    getIntFromJsonObjectOrDefault(&stream_limit, settings, "connection-stream-limit", 16);
+    state->connection_stream_limit = (uint32_t) max(1, stream_limit);
+
     nghttp2_option_new(&(state->ngoptions));
     nghttp2_option_set_peer_max_concurrent_streams(state->ngoptions, 0xffffffffU);
     nghttp2_option_set_no_closed_streams(state->ngoptions, 1);
@@ -612,6 +657,15 @@ tunnel_t *newHttp2Client(node_instance_context_t *instance_info)
     t->upStream   = &upStream;
     t->downStream = &downStream;
 
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        thread_connection_pool_t *pool = &(state->thread_cpool[i]);
+        pool->tunnel                   = t;
+        pool->tid                      = (int) i;
+        pool->idle_timer               = htimer_add(getWorkerLoop(i), onIdleCheckTimer, kIdleCheckInterval, INFINITE);
+        hevent_set_userdata(pool->idle_timer, pool);
+    }
+
     return t;
 }
 
@@ -1,8 +1,11 @@
 #pragma once
 #include "api.h"
 #include "buffer_stream.h"
+#include "connection_pool_policy.h"
 #include "grpc_def.h"
 #include "http2_def.h"
+#include "http2_bdp.h"
+#include "http2_recv_slice.h"
 #include "http_def.h"
 #include "loggers/network_logger.h"
 #include "nghttp2/nghttp2.h"
@@ -45,6 +48,8 @@ typedef struct http2_client_con_state_s
 {
     http2_client_child_con_state_t root;
     action_queue_t                 actions;
+    http2_recv_slice_t             recv_slice;
+    http2_bdp_t                    bdp;
     nghttp2_session               *session;
     context_queue_t               *queue;
     htimer_t                      *ping_timer;
@@ -56,7 +61,9 @@ typedef struct http2_client_con_state_s
     const char                    *scheme;
     enum http_method               method;
     enum http_content_type         content_type;
+    uint64_t                       idle_since; // ms, when the last stream left
     size_t                         childs_added;
+    uint32_t                       active_streams;
     uint32_t                       pause_counter;
     int                            error;
     int                            frame_type_when_stream_closed;
@@ -64,6 +71,7 @@ typedef struct http2_client_con_state_s
     bool                           handshake_completed;
     bool                           init_sent;
     bool                           no_ping_ack;
+    bool                           paused; // the carrier asked us to stop writing
 
 } http2_client_con_state_t;
 
@@ -74,8 +82,11 @@ typedef struct http2_client_con_state_s
 
 typedef struct thread_connection_pool_s
 {
-    vec_cons cons;
-    size_t   round_index;
+    vec_cons  cons;
+    size_t    round_index;
+    htimer_t *idle_timer; // closes the connections that stayed without streams
+    tunnel_t *tunnel;
+    int       tid;
 } thread_connection_pool_t;
 
 typedef struct http2_client_state_s
@@ -89,5 +100,8 @@ typedef struct http2_client_state_s
     size_t                     concurrency;
     int                        host_port;
     int                        last_iid;
+    uint32_t                   max_window_size;
+    connection_pool_policy_t   pool_policy;
+    uint32_t                   connection_stream_limit;
     thread_connection_pool_t   thread_cpool[];
 } http2_client_state_t;
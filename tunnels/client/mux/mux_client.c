@@ -1,13 +1,23 @@
 #include "mux_client.h"
 #include "buffer_stream.h"
+#include "connection_pool_policy.h"
 #include "loggers/network_logger.h"
+#include "mux_cid_table.h"
 #include "mux_frame.h"
+#include "mux_scheduler.h"
 #include "utils/jsonutils.h"
+#include "utils/mathutils.h"
 
 enum concurrency_mode
 {
-    kCuncurrencyModeTimer   = 1,
-    kCuncurrencyModeCounter = 2
+    kCuncurrencyModeTimer    = 1,
+    kCuncurrencyModeCounter  = 2,
+    kCuncurrencyModeAdaptive = 3
+};
+
+enum
+{
+    kMuxAdaptiveStreamCost = 16 * 1024 // load of one open stream, so streams spread even while they are quiet
 };
 
 #define i_type    vec_cons                        // NOLINT
@@ -17,8 +27,11 @@ enum concurrency_mode
 
 typedef struct thread_connection_pool_s
 {
-    vec_cons cons;
-    size_t   round_index;
+    vec_cons  cons;
+    size_t    round_index;
+    htimer_t *timer; // adaptive mode, pings the connections and retires idle ones
+    tunnel_t *tunnel;
+    tid_t     tid;
 
 } thread_connection_pool_t;
 
@@ -28,6 +41,10 @@ typedef struct mux_client_state_s
     uint32_t                 connection_cunc_duration;
     uint32_t                 connection_cunc_capacity;
     uint32_t                 width;
+    connection_pool_policy_t pool_policy;
+    uint32_t                 connection_load_limit; // bytes queued and in flight that make a connection busy
+    uint32_t                 ping_interval;
+    uint8_t                  max_frame_version;
     thread_connection_pool_t threadlocal_cons[];
 
 } mux_client_state_t;
@@ -39,6 +56,7 @@ typedef struct mux_client_child_con_state_s
     tunnel_t                            *tunnel;
     line_t                              *line;
     line_t                              *parent;
+    mux_sched_stream_t                   stream;
     uint32_t                             sent_nack;
     uint32_t                             recv_nack;
     uint16_t                             cid;
@@ -50,16 +68,26 @@ typedef struct mux_client_child_con_state_s
 typedef struct mux_client_con_state_s
 {
     struct mux_client_child_con_state_s children_root;
+    mux_cid_table_t                     children; // cid -> child
+    mux_scheduler_t                     scheduler;
 
     tunnel_t        *tunnel;
     line_t          *line;
-    line_t          *current_writing_line;
     buffer_stream_t *read_stream;
     uint64_t         creation_epoch;
+    uint64_t         sent_bytes;      // written to the main line
+    uint64_t         ping_sent_bytes; // sent_bytes when the outstanding ping went out
+    uint64_t         ping_sent_ms;
+    uint64_t         inflight;        // bytes written during the last measured round trip
+    uint64_t         idle_since;      // ms, since the connection has no children
+    uint32_t         srtt;            // ms, 0 until the first pong
+    bool             ping_outstanding;
     uint16_t         last_cid;
     uint16_t         cid_min;
     uint16_t         cid_max;
     uint16_t         contained;
+    uint8_t          read_version;
+    uint8_t          write_version;
 
 } mux_client_con_state_t;
 
@@ -74,38 +102,92 @@ static void onChildLineResumed(void *arg)
     resumeLineUpSide(stream->parent);
 }
 
-static void onMainLinePaused(void *arg)
+static void writeMainLine(void *carrier, context_t *c)
 {
-    mux_client_con_state_t *con  = (mux_client_con_state_t *) arg;
+    mux_client_con_state_t *con  = (mux_client_con_state_t *) carrier;
     tunnel_t               *self = con->tunnel;
-
-    line_t *wline = con->current_writing_line;
-    if (wline && isAlive(wline))
-    {
-        mux_client_child_con_state_t *child_con = LSTATE(wline);
-        child_con->paused                       = true;
-        pauseLineDownSide(child_con->line);
-    }
+    con->sent_bytes += bufLen(c->payload);
+    self->up->upStream(self->up, c);
 }
 
-static void onMainLineResumed(void *arg)
+// false when the main connection was closed meanwhile
+static bool flushMainConnection(mux_client_con_state_t *con, bool drain)
 {
-    mux_client_con_state_t       *con = (mux_client_con_state_t *) arg;
-    mux_client_child_con_state_t *child_con_i;
-    for (child_con_i = con->children_root.next; child_con_i;)
+    muxSchedHold(&(con->scheduler));
+    muxSchedFlush(&(con->scheduler), drain);
+
+    // children that were paused for the backlog can write again once it is out
+    mux_client_child_con_state_t *child_con_i = con->children_root.next;
+    while (child_con_i && ! con->scheduler.closed && ! con->scheduler.paused)
     {
+        mux_client_child_con_state_t *next = child_con_i->next;
         if (child_con_i->paused)
         {
             child_con_i->paused = false;
             resumeLineDownSide(child_con_i->line);
         }
-        child_con_i = child_con_i->next;
+        child_con_i = next;
     }
+
+    const bool closed = con->scheduler.closed;
+    if (muxSchedRelease(&(con->scheduler)))
+    {
+        globalFree(con);
+    }
+    return ! closed;
+}
+
+static void onFlushEvent(hevent_t *ev)
+{
+    mux_client_con_state_t *con  = hevent_userdata(ev);
+    con->scheduler.flush_pending = false;
+    if (! con->scheduler.closed)
+    {
+        flushMainConnection(con, false);
+    }
+    if (muxSchedRelease(&(con->scheduler)))
+    {
+        globalFree(con);
+    }
+}
+
+// child writes of this loop iteration are collected and go out together
+static void requestFlush(mux_client_con_state_t *con)
+{
+    if (con->scheduler.flush_pending)
+    {
+        return;
+    }
+    con->scheduler.flush_pending = true;
+    muxSchedHold(&(con->scheduler));
+
+    hevent_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.loop = getWorkerLoop(con->line->tid);
+    ev.cb   = onFlushEvent;
+    hevent_set_userdata(&ev, con);
+    hloop_post_event(getWorkerLoop(con->line->tid), &ev);
+}
+
+static void onMainLinePaused(void *arg)
+{
+    mux_client_con_state_t *con = (mux_client_con_state_t *) arg;
+    con->scheduler.paused       = true;
+}
+
+static void onMainLineResumed(void *arg)
+{
+    mux_client_con_state_t *con = (mux_client_con_state_t *) arg;
+    con->scheduler.paused       = false;
+    requestFlush(con);
 }
 
 static void destroyChildConnecton(mux_client_child_con_state_t *child)
 {
-    tunnel_t *self    = child->tunnel;
+    tunnel_t               *self   = child->tunnel;
+    mux_client_con_state_t *parent = LSTATE(child->parent);
+    muxCidTableRemove(&(parent->children), child->cid);
+    muxSchedDropStream(&(parent->scheduler), &(child->stream));
     child->prev->next = child->next;
     if (child->next)
     {
@@ -113,8 +195,11 @@ static void destroyChildConnecton(mux_client_child_con_state_t *child)
     }
     else
     {
-        mux_client_con_state_t *parent = LSTATE(child->parent);
-        parent->children_root.prev     = NULL;
+        parent->children_root.prev = NULL;
+    }
+    if (parent->children.count == 0)
+    {
+        parent->idle_since = hloop_now_ms(getWorkerLoop(parent->line->tid));
     }
     doneLineUpSide(child->line);
     LSTATE_DROP(child->line);
@@ -123,11 +208,19 @@ static void destroyChildConnecton(mux_client_child_con_state_t *child)
 
 static mux_client_child_con_state_t *createChildConnection(mux_client_con_state_t *parent, line_t *child_line)
 {
-    mux_client_child_con_state_t *child = globalMalloc(sizeof(mux_client_con_state_t));
+    mux_client_child_con_state_t *child = globalMalloc(sizeof(mux_client_child_con_state_t));
+
+    // after a wrap around the cids of streams that are still open are skipped
+    cid_t cid = parent->last_cid++;
+    while (muxCidTableFind(&(parent->children), cid) != NULL)
+    {
+        cid = parent->last_cid++;
+    }
 
     *child = (mux_client_child_con_state_t) {.tunnel = parent->tunnel,
                                              .line   = child_line,
-                                             .cid    = parent->last_cid++,
+                                             .parent = parent->line,
+                                             .cid    = cid,
                                              .next   = parent->children_root.next,
                                              .prev   = &(parent->children_root)
 
@@ -143,20 +236,31 @@ static mux_client_child_con_state_t *createChildConnection(mux_client_con_state_
     {
         child->next->prev = child;
     }
+    initMuxSchedStream(&(child->stream));
     setupLineUpSide(child->line, onChildLinePaused, child, onChildLineResumed);
+    muxCidTableInsert(&(parent->children), cid, child);
 
     return child;
 }
 
 static void destroyMainConnecton(mux_client_con_state_t *con)
 {
-    tunnel_t *self = con->tunnel;
+    tunnel_t           *self   = con->tunnel;
+    mux_client_state_t *state  = TSTATE(self);
+    vec_cons           *vector = &(state->threadlocal_cons[con->line->tid].cons);
+
+    // a connection that is closing must not be handed out again
+    vec_cons_iter find_result = vec_cons_find(vector, con);
+    if (find_result.ref != vec_cons_end(vector).ref)
+    {
+        vec_cons_erase_at(vector, find_result);
+    }
 
     mux_client_child_con_state_t *child_con_i;
     for (child_con_i = con->children_root.next; child_con_i;)
     {
 
-        mux_client_child_con_state_t *next    = child_con_i;
+        mux_client_child_con_state_t *next    = child_con_i->next;
         context_t                    *fin_ctx = newFinContext(child_con_i->line);
         tunnel_t                     *dest    = con->tunnel->dw;
 
@@ -164,10 +268,14 @@ static void destroyMainConnecton(mux_client_con_state_t *con)
         dest->downStream(dest, fin_ctx);
         child_con_i = next;
     }
+    dropMuxCidTable(&(con->children));
     destroyBufferStream(con->read_stream);
     doneLineDownSide(con->line);
     LSTATE_DROP(con->line);
-    globalFree(con);
+    if (muxSchedClose(&(con->scheduler)))
+    {
+        globalFree(con);
+    }
 }
 
 static mux_client_con_state_t *createMainConnection(tunnel_t *self, tid_t tid)
@@ -178,19 +286,195 @@ static mux_client_con_state_t *createMainConnection(tunnel_t *self, tid_t tid)
                                      .line           = newLine(tid),
                                      .children_root  = {0},
                                      .creation_epoch = hloop_now(getWorkerLoop(tid)),
-                                     .read_stream    = newBufferStream(getWorkerBufferPool(tid))};
+                                     .idle_since     = hloop_now_ms(getWorkerLoop(tid)),
+                                     .read_stream    = newBufferStream(getWorkerBufferPool(tid)),
+                                     .read_version   = kMuxFrameV1,
+                                     .write_version  = kMuxFrameV1};
 
+    initMuxCidTable(&(con->children));
+    initMuxScheduler(&(con->scheduler), writeMainLine, con);
     setupLineDownSide(con->line, onMainLinePaused, con, onMainLineResumed);
 
     LSTATE_MUT(con->line) = con;
+    self->up->upStream(self->up, newInitContext(con->line));
+
+    mux_client_state_t *state = TSTATE(self);
+    if (state->max_frame_version >= kMuxFrameV2)
+    {
+        // the first frame of the connection, an old server drops it
+        context_t *hello_ctx = newContext(con->line);
+        hello_ctx->payload   = popBuffer(getLineBufferPool(con->line));
+        setLen(hello_ctx->payload, sizeof(state->max_frame_version));
+        writeRaw(hello_ctx->payload, &(state->max_frame_version), sizeof(state->max_frame_version));
+        makeMuxFrame(hello_ctx->payload, 0, kMuxFlagHello, kMuxFrameV1);
+        muxSchedEnqueueControl(&(con->scheduler), hello_ctx);
+        requestFlush(con);
+    }
+    return con;
+}
+
+// false when the main connection was closed meanwhile
+static bool onHelloAnswer(tunnel_t *self, mux_client_con_state_t *con, shift_buffer_t *buf)
+{
+    mux_client_state_t *state   = TSTATE(self);
+    uint8_t             version = 0;
+    if (bufLen(buf) >= 1)
+    {
+        readRaw(buf, &version, 1);
+    }
+    reuseBuffer(getLineBufferPool(con->line), buf);
+    if (version < kMuxFrameV2 || version > state->max_frame_version || con->write_version != kMuxFrameV1)
+    {
+        return true;
+    }
+    con->read_version = version;
+
+    // the v1 frames that are already queued go out first, the upgrade frame is the last v1 frame we write
+    muxSchedHold(&(con->scheduler));
+    muxSchedFlush(&(con->scheduler), true);
+    if (! con->scheduler.closed)
+    {
+        context_t *upgrade_ctx = newContext(con->line);
+        upgrade_ctx->payload   = popBuffer(getLineBufferPool(con->line));
+        makeMuxFrame(upgrade_ctx->payload, 0, kMuxFlagUpgrade, kMuxFrameV1);
+        con->write_version = version;
+        writeMainLine(con, upgrade_ctx);
+    }
+    const bool closed = con->scheduler.closed;
+    if (muxSchedRelease(&(con->scheduler)))
+    {
+        globalFree(con);
+    }
+    return ! closed;
+}
+
+static void sendPing(mux_client_con_state_t *con, uint64_t now)
+{
+    context_t *ping_ctx = newContext(con->line);
+    ping_ctx->payload   = popBuffer(getLineBufferPool(con->line));
+    setLen(ping_ctx->payload, sizeof(now));
+    writeRaw(ping_ctx->payload, &now, sizeof(now));
+    makePingFrame(ping_ctx->payload, con->write_version);
+
+    con->ping_outstanding = true;
+    con->ping_sent_ms     = now;
+    con->ping_sent_bytes  = con->sent_bytes;
+    muxSchedEnqueueControl(&(con->scheduler), ping_ctx);
+    requestFlush(con);
+}
+
+static void onPong(mux_client_con_state_t *con, shift_buffer_t *payload)
+{
+    if (! con->ping_outstanding || bufLen(payload) != sizeof(uint64_t))
+    {
+        return;
+    }
+    uint64_t sent_ms;
+    readRaw(payload, &sent_ms, sizeof(sent_ms));
+    const uint64_t rtt = hloop_now_ms(getWorkerLoop(con->line->tid)) - sent_ms;
+
+    con->srtt             = con->srtt == 0 ? (uint32_t) rtt : (uint32_t) (((7 * (uint64_t) con->srtt) + rtt) / 8);
+    con->inflight         = con->sent_bytes - con->ping_sent_bytes;
+    con->ping_outstanding = false;
+}
+
+// what the connection still has to deliver, queued here and sent during the last round trip
+static uint64_t connectionBacklog(mux_client_con_state_t *con)
+{
+    uint64_t inflight = con->inflight;
+    if (con->ping_outstanding)
+    {
+        inflight = max(inflight, con->sent_bytes - con->ping_sent_bytes);
+    }
+    return con->scheduler.queued + inflight;
+}
+
+static uint64_t connectionRtt(mux_client_con_state_t *con, uint64_t now)
+{
+    uint64_t rtt = con->srtt;
+    if (con->ping_outstanding)
+    {
+        // a pong that is already late says the path got slower
+        rtt = max(rtt, now - con->ping_sent_ms);
+    }
+    return max(rtt, (uint64_t) 1);
+}
+
+static bool isConnectionBusy(mux_client_state_t *state, mux_client_con_state_t *con)
+{
+    return con->scheduler.paused || connectionBacklog(con) >= state->connection_load_limit ||
+           con->children.count >= state->connection_cunc_capacity;
+}
+
+// backlog with open streams counted in (so streams spread even while they are quiet), weighted by the round trip
+static uint64_t connectionLoad(void *owner, void *c, bool *busy)
+{
+    mux_client_state_t     *state = TSTATE((tunnel_t *) owner);
+    mux_client_con_state_t *con   = c;
+    const uint64_t          now   = hloop_now_ms(getWorkerLoop(con->line->tid));
+
+    *busy = isConnectionBusy(state, con);
+    return (connectionBacklog(con) + (((uint64_t) con->children.count + 1) * kMuxAdaptiveStreamCost)) *
+           connectionRtt(con, now);
+}
+
+// adaptive mode, the pool policy picks the connection, more of them spread the load over more tcp windows
+static mux_client_con_state_t *grabLeastLoadedConnection(tunnel_t *self, tid_t tid)
+{
+    mux_client_state_t *state  = TSTATE(self);
+    vec_cons           *vector = &(state->threadlocal_cons[tid].cons);
+    const size_t        count  = (size_t) vec_cons_size(vector);
+
+    mux_client_con_state_t *con =
+        connectionPoolPick(&(state->pool_policy), (void *const *) vector->data, count, connectionLoad, self);
+    if (con == NULL)
+    {
+        con = createMainConnection(self, tid);
+        vec_cons_push(vector, con);
+    }
+    con->contained += 1;
     return con;
 }
 
+// adaptive mode, measures the round trip of every connection of the worker and closes the idle extra ones
+static void onAdaptiveTimer(htimer_t *timer)
+{
+    thread_connection_pool_t *pool  = hevent_userdata(timer);
+    tunnel_t                 *self  = pool->tunnel;
+    mux_client_state_t       *state = TSTATE(self);
+    const uint64_t            now   = hloop_now_ms(getWorkerLoop(pool->tid));
+
+    for (size_t i = 0; i < (size_t) vec_cons_size(&(pool->cons));)
+    {
+        mux_client_con_state_t *con = *vec_cons_at(&(pool->cons), i);
+
+        if (connectionPoolShouldRetire(&(state->pool_policy), (size_t) vec_cons_size(&(pool->cons)),
+                                       con->children.count > 0, con->idle_since, now))
+        {
+            // destroying takes the connection out of the pool, i is the next one then
+            context_t *fin_ctx = newFinContext(con->line);
+            destroyMainConnecton(con);
+            self->up->upStream(self->up, fin_ctx);
+            continue;
+        }
+        if (! con->ping_outstanding)
+        {
+            sendPing(con, now);
+        }
+        i++;
+    }
+}
+
 static mux_client_con_state_t *grabConnection(tunnel_t *self, tid_t tid)
 {
     mux_client_state_t *state  = TSTATE(self);
     vec_cons           *vector = &(state->threadlocal_cons[tid].cons);
 
+    if (state->mode == kCuncurrencyModeAdaptive)
+    {
+        return grabLeastLoadedConnection(self, tid);
+    }
+
     while (true)
     {
         unsigned int i = state->threadlocal_cons[tid].round_index;
@@ -279,6 +563,10 @@ static bool shouldClose(tunnel_t *self, mux_client_con_state_t *main_con)
         }
 
         break;
+
+    case kCuncurrencyModeAdaptive:
+        // idle connections are retired by the worker timer
+        break;
     }
     return false;
 }
@@ -288,65 +576,50 @@ static void upStream(tunnel_t *self, context_t *c)
     mux_client_child_con_state_t *child_con = CSTATE(c);
     if (c->payload != NULL)
     {
-        line_t *current_writing_line = c->line;
-        line_t *main_line            = child_con->parent;
+        line_t *main_line = child_con->parent;
 
         switchLine(c, main_line);
         mux_client_con_state_t *main_con = CSTATE(c);
 
-        lockLine(main_line);
-        lockLine(current_writing_line);
-        main_con->current_writing_line = current_writing_line;
-
-        while (bufLen(c->payload) > kMuxMaxFrameLength)
+        const uint32_t max_frame = muxMaxFrameLength(main_con->write_version);
+        while (bufLen(c->payload) > max_frame)
         {
             shift_buffer_t *chunk = popBuffer(getContextBufferPool(c));
-            chunk = sliceBufferTo(chunk, c->payload, kMuxMaxFrameLength);
+            chunk = sliceBufferTo(chunk, c->payload, max_frame);
 
             if (! child_con->first_sent)
             {
                 child_con->first_sent = true;
-                makeOpenFrame(chunk, child_con->cid);
+                makeOpenFrame(chunk, child_con->cid, main_con->write_version);
             }
             else
             {
-                makeDataFrame(chunk, child_con->cid);
+                makeDataFrame(chunk, child_con->cid, main_con->write_version);
             }
 
             context_t *data_chunk_ctx = newContextFrom(c);
             data_chunk_ctx->payload   = chunk;
-            self->up->upStream(self->up, data_chunk_ctx);
-
-            if (! isAlive(main_line))
-            {
-                unLockLine(main_line);
-                unLockLine(current_writing_line);
-
-                reuseContextPayload(c);
-                destroyContext(c);
-                return;
-            }
+            muxSchedEnqueue(&(main_con->scheduler), &(child_con->stream), data_chunk_ctx);
         }
 
         if (! child_con->first_sent)
         {
             child_con->first_sent = true;
-            makeOpenFrame(c->payload, child_con->cid);
+            makeOpenFrame(c->payload, child_con->cid, main_con->write_version);
         }
         else
         {
-            makeDataFrame(c->payload, child_con->cid);
+            makeDataFrame(c->payload, child_con->cid, main_con->write_version);
         }
+        muxSchedEnqueue(&(main_con->scheduler), &(child_con->stream), c);
 
-        self->up->upStream(self->up, c);
-
-        if (isAlive(main_line))
+        if (! child_con->paused &&
+            (main_con->scheduler.paused || child_con->stream.queued >= kMuxSchedStreamLimit))
         {
-            main_con->current_writing_line = NULL;
+            child_con->paused = true;
+            pauseLineDownSide(child_con->line);
         }
-
-        unLockLine(main_line);
-        unLockLine(current_writing_line);
+        requestFlush(main_con);
     }
     else
     {
@@ -365,23 +638,25 @@ static void upStream(tunnel_t *self, context_t *c)
 
             context_t *data_fin_ctx = newContext(child_con->parent);
             data_fin_ctx->payload   = popBuffer(getLineBufferPool(child_con->parent));
-            makeCloseFrame(data_fin_ctx->payload, child_con->cid);
+            makeCloseFrame(data_fin_ctx->payload, child_con->cid, main_con->write_version);
+
+            muxSchedRetireStream(&(main_con->scheduler), &(child_con->stream));
+            muxSchedEnqueueControl(&(main_con->scheduler), data_fin_ctx);
             destroyChildConnecton(child_con);
-            lockLine(main_con->line);
-            self->up->upStream(self->up, data_fin_ctx);
 
-            if (! isAlive(main_con->line))
+            if (shouldClose(self, main_con))
             {
-                unLockLine(main_con->line);
-                return;
+                // whatever is still queued, the close frames at least, goes out before the main line fin
+                if (flushMainConnection(main_con, true))
+                {
+                    context_t *main_con_fin_ctx = newFinContext(main_con->line);
+                    destroyMainConnecton(main_con);
+                    self->up->upStream(self->up, main_con_fin_ctx);
+                }
             }
-            unLockLine(main_con->line);
-
-            if (shouldClose(self, main_con))
+            else
             {
-                context_t *main_con_fin_ctx = newFinContext(main_con->line);
-                destroyMainConnecton(main_con);
-                self->up->upStream(self->up, main_con_fin_ctx);
+                requestFlush(main_con);
             }
 
             destroyContext(c);
@@ -407,112 +682,170 @@ static void downStream(tunnel_t *self, context_t *c)
     assert(c->payload != NULL);
 
     bufferStreamPushContextPayload(main_con->read_stream, c);
-    while (bufferStreamLen(main_con->read_stream) > sizeof(mux_frame_t))
+    while (true)
     {
-        mux_length_t length;
-        bufferStreamViewBytesAt(main_con->read_stream, 0, (uint8_t *) &length, 2);
-        if (WW_UNLIKELY(length < kMuxMinFrameLength))
+        mux_frame_info_t frame;
+        const int        peeked = muxPeekFrame(main_con->read_stream, main_con->read_version, &frame);
+        if (peeked == 0)
         {
-            LOGE("MuxClient: payload length < kMuxMinFrameLength");
+            break;
+        }
+        if (WW_UNLIKELY(peeked < 0))
+        {
+            LOGE("MuxClient: malformed frame header");
             destroyMainConnecton(main_con);
             self->up->upStream(self->up, newFinContext(c->line));
             destroyContext(c);
             return;
         }
 
-        if (bufferStreamLen(main_con->read_stream) >= length + sizeof(length))
+        shift_buffer_t *frame_payload = bufferStreamRead(main_con->read_stream, frame.length);
+        shiftr(frame_payload, frame.header_length);
+
+        if (main_con->read_version == kMuxFrameV1 && frame.flags == kMuxFlagHello)
         {
-            shift_buffer_t *frame_payload = bufferStreamRead(main_con->read_stream, length + sizeof(length));
+            if (! onHelloAnswer(self, main_con, frame_payload))
+            {
+                destroyContext(c);
+                return;
+            }
+            continue;
+        }
 
-            mux_frame_t frame;
-            memcpy(&frame, rawBuf(frame_payload), sizeof(mux_frame_t));
-            shiftr(frame_payload, sizeof(mux_frame_t));
+        if (frame.flags == kMuxFlagPong)
+        {
+            onPong(main_con, frame_payload);
+            reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+            continue;
+        }
 
-            mux_client_child_con_state_t *child_con_i;
-            for (child_con_i = main_con->children_root.next; child_con_i;)
+        mux_client_child_con_state_t *child_con_i = muxCidTableFind(&(main_con->children), frame.cid);
+        if (child_con_i != NULL)
+        {
+            switch (frame.flags)
             {
-                if (child_con_i->cid == frame.cid)
-                {
+            case kMuxFlagClose: {
+                reuseBuffer(getLineBufferPool(c->line), frame_payload);
+                context_t *fin_ctx = newFinContext(child_con_i->line);
+                destroyChildConnecton(child_con_i);
+                self->dw->downStream(self->dw, fin_ctx);
+                frame_payload = NULL;
+            }
+
+            break;
+
+            case kMuxFlagData: {
 
-                    switch (frame.flags)
-                    {
-                    case kMuxFlagClose: {
-                        reuseBuffer(getLineBufferPool(c->line), frame_payload);
-                        context_t *fin_ctx = newFinContext(child_con_i->line);
-                        destroyChildConnecton(child_con_i);
-                        self->dw->downStream(self->dw, fin_ctx);
-                        frame_payload = NULL;
-                    }
-
-                    break;
-
-                    case kMuxFlagData: {
-
-                        if (WW_UNLIKELY(bufLen(frame_payload) <= 0))
-                        {
-                            LOGE("MuxClient: payload length <= 0");
-                            reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                            destroyMainConnecton(main_con);
-                            self->up->upStream(self->up, newFinContext(c->line));
-                            destroyContext(c);
-                            return;
-                        }
-                        context_t *data_ctx = newContext(child_con_i->line);
-                        data_ctx->payload   = frame_payload;
-                        self->dw->downStream(self->dw, data_ctx);
-                        frame_payload = NULL;
-                    }
-
-                    break;
-
-                    case kMuxFlagFlow:
-                        LOGE("MuxClient: kMuxFlagFlow not implemented"); // fall through
-                    case kMuxFlagOpen:
-                    default:
-                        LOGE("MuxClient: incorrect frame flag");
-                        reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                        destroyMainConnecton(main_con);
-                        self->up->upStream(self->up, newFinContext(c->line));
-                        destroyContext(c);
-                        return;
-                        break;
-                    }
-                    break;
+                if (WW_UNLIKELY(bufLen(frame_payload) <= 0))
+                {
+                    LOGE("MuxClient: payload length <= 0");
+                    reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                    destroyMainConnecton(main_con);
+                    self->up->upStream(self->up, newFinContext(c->line));
+                    destroyContext(c);
+                    return;
                 }
-                child_con_i = child_con_i->next;
+                context_t *data_ctx = newContext(child_con_i->line);
+                data_ctx->payload   = frame_payload;
+                self->dw->downStream(self->dw, data_ctx);
+                frame_payload = NULL;
             }
-            if (frame_payload != NULL)
-            {
-                LOGW("MuxClient: a frame could not find consumer cid: %d", (int) frame.cid);
+
+            break;
+
+            case kMuxFlagFlow:
+                LOGE("MuxClient: kMuxFlagFlow not implemented"); // fall through
+            case kMuxFlagOpen:
+            default:
+                LOGE("MuxClient: incorrect frame flag");
                 reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-            }
-            else if (! isAlive(c->line))
-            {
+                destroyMainConnecton(main_con);
+                self->up->upStream(self->up, newFinContext(c->line));
                 destroyContext(c);
                 return;
+                break;
             }
         }
-        else
+        if (frame_payload != NULL)
         {
-            break;
+            LOGW("MuxClient: a frame could not find consumer cid: %d", (int) frame.cid);
+            reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+        }
+        else if (! isAlive(c->line))
+        {
+            destroyContext(c);
+            return;
         }
     }
+    destroyContext(c);
 }
 
 tunnel_t *newMuxClient(node_instance_context_t *instance_info)
 {
+    const size_t state_size = sizeof(mux_client_state_t) + (getWorkersCount() * sizeof(thread_connection_pool_t));
 
-    mux_client_state_t *state = globalMalloc(sizeof(mux_client_state_t));
-    memset(state, 0, sizeof(mux_client_state_t));
+    mux_client_state_t *state = globalMalloc(state_size);
+    memset(state, 0, state_size);
 
     const cJSON *settings = instance_info->node_settings_json;
-    (void) settings;
+
+    dynamic_value_t mode = parseDynamicNumericValueFromJsonObject(settings, "mode", 3, "timer", "counter", "adaptive");
+    // options in order: timer, counter, adaptive; counter when not set
+    if (mode.status == kDvsFirstOption)
+    {
+        state->mode = kCuncurrencyModeTimer;
+    }
+    else if ((int) mode.status == kDvsFirstOption + 2)
+    {
+        state->mode = kCuncurrencyModeAdaptive;
+    }
+    else
+    {
+        state->mode = kCuncurrencyModeCounter;
+    }
+    destroyDynamicValue(mode);
+
+    int width;
+    int capacity;
+    int duration;
+    getIntFromJsonObjectOrDefault(&width, settings, "connections", 1);
+    getIntFromJsonObjectOrDefault(&capacity, settings, "connection-capacity", 32);
+    getIntFromJsonObjectOrDefault(&duration, settings, "connection-duration", 600);
+    state->width                    = (uint32_t) max(1, width);
+    state->connection_cunc_capacity = (uint32_t) max(1, capacity);
+    state->connection_cunc_duration = (uint32_t) max(1, duration);
+
+    int load_limit;
+    int ping_interval;
+    parseConnectionPoolPolicy(&(state->pool_policy), settings);
+    getIntFromJsonObjectOrDefault(&load_limit, settings, "connection-load-limit", 1024 * 1024);
+    getIntFromJsonObjectOrDefault(&ping_interval, settings, "ping-interval", 1000);
+    state->connection_load_limit = (uint32_t) max(1, load_limit);
+    state->ping_interval         = (uint32_t) max(10, ping_interval);
+
+    // 2 offers the varint framing to the server, 1 never asks for it
+    int frame_version;
+    getIntFromJsonObjectOrDefault(&frame_version, settings, "frame-version", kMuxFrameV2);
+    state->max_frame_version = (uint8_t) (frame_version >= kMuxFrameV2 ? kMuxFrameV2 : kMuxFrameV1);
 
     tunnel_t *t   = newTunnel();
     t->state      = state;
     t->upStream   = &upStream;
     t->downStream = &downStream;
 
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        state->threadlocal_cons[i].tunnel = t;
+        state->threadlocal_cons[i].tid    = (tid_t) i;
+        if (state->mode == kCuncurrencyModeAdaptive)
+        {
+            // pings are only sent in this mode, the server must know the ping frame
+            state->threadlocal_cons[i].timer =
+                htimer_add(getWorkerLoop(i), onAdaptiveTimer, state->ping_interval, INFINITE);
+            hevent_set_userdata(state->threadlocal_cons[i].timer, &(state->threadlocal_cons[i]));
+        }
+    }
+
     return t;
 }
 
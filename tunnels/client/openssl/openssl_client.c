@@ -3,8 +3,13 @@
 #include "buffer_stream.h"
 #include "loggers/network_logger.h"
 #include "managers/node_manager.h"
+#include "openssl_bio.h"
 #include "openssl_globals.h"
+#include "openssl_record_sizing.h"
+#include "session_store.h"
+#include "utils/hashutils.h"
 #include "utils/jsonutils.h"
+#include "utils/mathutils.h"
 #include <openssl/bio.h>
 #include <openssl/err.h>
 #include <openssl/pem.h>
@@ -13,21 +18,30 @@
 typedef struct oss_client_state_s
 {
 
-    ssl_ctx_t *threadlocal_ssl_context;
+    ssl_ctx_t                  *threadlocal_ssl_context;
+    oss_client_session_store_t *session_store; // shared by the contexts of all workers
     // settings
-    char *alpn;
-    char *sni;
-    bool  verify;
+    char    *alpn;
+    char    *sni;
+    bool     verify;
+    bool     session_reuse;
+    bool     early_data;
+    int      early_data_wait;  // ms
+    uint32_t record_size_ramp; // bytes written in small records after start or idle, 0 for always full
+    uint32_t record_size_idle_ms;
 
 } oss_client_state_t;
 
 typedef struct oss_client_con_state_s
 {
-    SSL             *ssl;
-    BIO             *rbio;
-    BIO             *wbio;
-    context_queue_t *queue;
-    bool             handshake_completed;
+    SSL               *ssl;
+    BIO               *bio; // owned by ssl
+    context_queue_t   *queue;
+    context_t         *early_ctx; // the payload sent as early data, kept until the server accepts or rejects it
+    size_t             early_written;
+    tls_record_sizer_t record_sizer;
+    bool               early_data_pending;
+    bool               handshake_completed;
 
 } oss_client_con_state_t;
 
@@ -57,6 +71,11 @@ static enum sslstatus getSslStatus(SSL *ssl, int n)
 static void cleanup(tunnel_t *self, context_t *c)
 {
     oss_client_con_state_t *cstate = CSTATE(c);
+    if (cstate->early_ctx != NULL)
+    {
+        reuseContextPayload(cstate->early_ctx);
+        destroyContext(cstate->early_ctx);
+    }
     SSL_free(cstate->ssl); /* free the SSL object and its BIO's */
     destroyContextQueue(cstate->queue);
     globalFree(cstate);
@@ -73,6 +92,130 @@ static void flushWriteQueue(tunnel_t *self, context_t *c)
     }
 }
 
+// sends the records ssl wrote into the bio, false if the line is closed meanwhile
+static bool flushSslOutput(tunnel_t *self, context_t *c)
+{
+    oss_client_con_state_t *cstate = CSTATE(c);
+    shift_buffer_t         *buf;
+
+    while ((buf = wwBioPopOutput(cstate->bio)) != NULL)
+    {
+        context_t *send_context = newContextFrom(c);
+        send_context->payload   = buf;
+        self->up->upStream(self->up, send_context);
+        if (! isAlive(c->line))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static hash_t destinationOf(oss_client_state_t *state, line_t *l)
+{
+    return CALC_HASH_BYTES_WITH_SEED(state->sni, strlen(state->sni), sockaddr_port(&(l->dest_ctx.address)));
+}
+
+/*
+    the first payload goes out in the first flight together with the client hello, it stays in early_ctx until
+    the handshake tells whether the server took it, a rejected one is sent again as normal data
+
+    early data can be replayed by whoever sees it on the wire, that is why it is off unless enabled
+*/
+static void sendEarlyData(tunnel_t *self, context_t *c)
+{
+    oss_client_con_state_t *cstate = CSTATE(c);
+    cstate->early_data_pending     = false;
+
+    const size_t max_early = SSL_SESSION_get_max_early_data(SSL_get_session(cstate->ssl));
+    size_t       written   = 0;
+    if (1 != SSL_write_early_data(cstate->ssl, rawBuf(c->payload), min((size_t) bufLen(c->payload), max_early),
+                                  &written))
+    {
+        // not taken as early data, the handshake starts plainly and the payload waits for it
+        written = 0;
+        int n   = SSL_connect(cstate->ssl);
+        if (getSslStatus(cstate->ssl, n) == kSslstatusFail)
+        {
+            printSSLError();
+            self->up->upStream(self->up, newFinContextFrom(c));
+            context_t *fail_context = newFinContextFrom(c);
+            reuseContextPayload(c);
+            cleanup(self, c);
+            destroyContext(c);
+            self->dw->downStream(self->dw, fail_context);
+            return;
+        }
+    }
+
+    if (! flushSslOutput(self, c))
+    {
+        reuseContextPayload(c);
+        destroyContext(c);
+        return;
+    }
+    cstate->early_ctx     = c;
+    cstate->early_written = written;
+}
+
+// once the handshake is done, what the server did not take as early data goes first in the write queue
+static void settleEarlyData(oss_client_con_state_t *cstate)
+{
+    context_t *early  = cstate->early_ctx;
+    cstate->early_ctx = NULL;
+
+    if (SSL_get_early_data_status(cstate->ssl) == SSL_EARLY_DATA_ACCEPTED)
+    {
+        shiftr(early->payload, (uint32_t) cstate->early_written);
+    }
+    else
+    {
+        LOGD("OpensslClient: early data was rejected, sending it again after the handshake");
+    }
+
+    if (bufLen(early->payload) > 0)
+    {
+        contextQueuePushFront(cstate->queue, early);
+    }
+    else
+    {
+        reuseContextPayload(early);
+        destroyContext(early);
+    }
+}
+
+struct timer_eventdata
+{
+    tunnel_t  *self;
+    context_t *c;
+};
+
+static void startHandshake(tunnel_t *self, context_t *c);
+
+// nodes above that wait for est before writing anything would never give a first payload, so the client hello
+// does not wait forever; when the timer wins the handshake starts without early data
+static void onEarlyDataWaitTimer(htimer_t *timer)
+{
+    struct timer_eventdata *data = hevent_userdata(timer);
+    tunnel_t               *self = data->self;
+    context_t              *c    = data->c;
+
+    globalFree(data);
+    htimer_del(timer);
+
+    if (isAlive(c->line))
+    {
+        oss_client_con_state_t *cstate = CSTATE(c);
+        if (cstate->early_data_pending)
+        {
+            cstate->early_data_pending = false;
+            startHandshake(self, c);
+            return;
+        }
+    }
+    destroyContext(c);
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     oss_client_state_t *state = TSTATE(self);
@@ -83,6 +226,11 @@ static void upStream(tunnel_t *self, context_t *c)
 
         if (! cstate->handshake_completed)
         {
+            if (cstate->early_data_pending)
+            {
+                sendEarlyData(self, c);
+                return;
+            }
             contextQueuePush(cstate->queue, c);
             return;
         }
@@ -92,7 +240,9 @@ static void upStream(tunnel_t *self, context_t *c)
 
         while (len > 0 && isAlive(c->line))
         {
-            int n  = SSL_write(cstate->ssl, rawBuf(c->payload), len);
+            const int limit = (int) tlsRecordSizeLimit(&(cstate->record_sizer), state->record_size_ramp,
+                                                       state->record_size_idle_ms, hloop_now_ms(getLineLoop(c->line)));
+            int n  = SSL_write(cstate->ssl, rawBuf(c->payload), min(len, limit));
             status = getSslStatus(cstate->ssl, n);
 
             if (n > 0)
@@ -100,37 +250,14 @@ static void upStream(tunnel_t *self, context_t *c)
                 /* consume the waiting bytes that have been used by SSL */
                 shiftr(c->payload, n);
                 len -= n;
-                /* take the output of the SSL object and queue it for socket write */
-                do
+                tlsRecordSizerSent(&(cstate->record_sizer), (uint32_t) n);
+                /* the records are already in pool buffers, send them */
+                if (! flushSslOutput(self, c))
                 {
-                    shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                    int             avail = (int) rCapNoPadding(buf);
-                    n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                    if (n > 0)
-                    {
-                        setLen(buf, n);
-                        context_t *send_context = newContextFrom(c);
-                        send_context->payload   = buf;
-                        self->up->upStream(self->up, send_context);
-                        if (! isAlive(c->line))
-                        {
-                            reuseContextPayload(c);
-                            destroyContext(c);
-                            return;
-                        }
-                    }
-                    else if (! BIO_should_retry(cstate->wbio))
-                    {
-                        // If BIO_should_retry() is false then the cause is an error condition.
-                        reuseBuffer(getContextBufferPool(c), buf);
-                        reuseContextPayload(c);
-                        goto failed;
-                    }
-                    else
-                    {
-                        reuseBuffer(getContextBufferPool(c), buf);
-                    }
-                } while (n > 0);
+                    reuseContextPayload(c);
+                    destroyContext(c);
+                    return;
+                }
             }
 
             if (status == kSslstatusFail)
@@ -156,13 +283,23 @@ static void upStream(tunnel_t *self, context_t *c)
             CSTATE_MUT(c)                  = globalMalloc(sizeof(oss_client_con_state_t));
             oss_client_con_state_t *cstate = CSTATE(c);
             memset(cstate, 0, sizeof(oss_client_con_state_t));
-            cstate->rbio  = BIO_new(BIO_s_mem());
-            cstate->wbio  = BIO_new(BIO_s_mem());
+            cstate->bio   = newWwBio(getContextBufferPool(c));
             cstate->ssl   = SSL_new(state->threadlocal_ssl_context[c->line->tid]);
             cstate->queue = newContextQueue();
             SSL_set_connect_state(cstate->ssl); /* sets ssl to work in client mode. */
-            SSL_set_bio(cstate->ssl, cstate->rbio, cstate->wbio);
+            SSL_set_bio(cstate->ssl, cstate->bio, cstate->bio);
             SSL_set_tlsext_host_name(cstate->ssl, state->sni);
+
+            SSL_SESSION *session = NULL;
+            if (state->session_reuse)
+            {
+                session =
+                    ossClientSessionStoreResume(state->session_store, cstate->ssl, destinationOf(state, c->line));
+            }
+            // with early data the client hello waits for the first payload so that it can carry it
+            cstate->early_data_pending =
+                state->early_data && session != NULL && SSL_SESSION_get_max_early_data(session) > 0;
+
             context_t *client_hello_ctx = newContextFrom(c);
             self->up->upStream(self->up, c);
             if (! isAlive(client_hello_ctx->line))
@@ -170,38 +307,16 @@ static void upStream(tunnel_t *self, context_t *c)
                 destroyContext(client_hello_ctx);
                 return;
             }
-
-            // printSSLState(cstate->ssl);
-            int n = SSL_connect(cstate->ssl);
-            // printSSLState(cstate->ssl);
-            enum sslstatus status = getSslStatus(cstate->ssl, n);
-            /* Did SSL request to write bytes? */
-            if (status == kSslstatusWantIo)
-            {
-                shift_buffer_t *buf   = popBuffer(getContextBufferPool(client_hello_ctx));
-                int             avail = (int) rCapNoPadding(buf);
-                n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                if (n > 0)
-                {
-                    setLen(buf, n);
-                    client_hello_ctx->payload = buf;
-                    self->up->upStream(self->up, client_hello_ctx);
-                }
-                else if (! BIO_should_retry(cstate->rbio))
-                {
-                    // If BIO_should_retry() is false then the cause is an error condition.
-                    reuseBuffer(getContextBufferPool(client_hello_ctx), buf);
-                    goto failed;
-                }
-                else
-                {
-                    reuseBuffer(getContextBufferPool(client_hello_ctx), buf);
-                }
-            }
-            if (status == kSslstatusFail)
+            if (cstate->early_data_pending)
             {
-                goto failed;
+                htimer_t               *t    = htimer_add(getLineLoop(c->line), onEarlyDataWaitTimer,
+                                                          state->early_data_wait, 1);
+                struct timer_eventdata *data = globalMalloc(sizeof(struct timer_eventdata));
+                *data                        = (struct timer_eventdata) {.self = self, .c = client_hello_ctx};
+                hevent_set_userdata(t, data);
+                return;
             }
+            startHandshake(self, client_hello_ctx);
         }
         else if (c->fin)
         {
@@ -222,6 +337,31 @@ failed:
     self->dw->downStream(self->dw, fail_context);
 }
 
+// writes the client hello, c is a context of the line without payload and is consumed
+static void startHandshake(tunnel_t *self, context_t *c)
+{
+    oss_client_con_state_t *cstate = CSTATE(c);
+
+    // printSSLState(cstate->ssl);
+    int n = SSL_connect(cstate->ssl);
+    // printSSLState(cstate->ssl);
+    enum sslstatus status = getSslStatus(cstate->ssl, n);
+    if (status == kSslstatusFail)
+    {
+        printSSLError();
+        self->up->upStream(self->up, newFinContextFrom(c));
+
+        context_t *fail_context = newFinContextFrom(c);
+        cleanup(self, c);
+        destroyContext(c);
+        self->dw->downStream(self->dw, fail_context);
+        return;
+    }
+    /* Did SSL request to write bytes? */
+    flushSslOutput(self, c);
+    destroyContext(c);
+}
+
 static void downStream(tunnel_t *self, context_t *c)
 {
     oss_client_con_state_t *cstate = CSTATE(c);
@@ -231,155 +371,106 @@ static void downStream(tunnel_t *self, context_t *c)
         int            n;
         enum sslstatus status;
 
-        int len = (int) bufLen(c->payload);
+        /* the bio keeps the buffer, ssl reads the records straight out of it */
+        wwBioPushInput(cstate->bio, c->payload);
+        dropContexPayload(c);
 
-        while (len > 0 && isAlive(c->line))
+        if (! cstate->handshake_completed)
         {
-            n = BIO_write(cstate->rbio, rawBuf(c->payload), len);
+            // printSSLState(cstate->ssl);
+            n = SSL_connect(cstate->ssl);
+            // printSSLState(cstate->ssl);
+            status = getSslStatus(cstate->ssl, n);
 
-            if (n <= 0)
+            if (status == kSslstatusFail)
             {
-                /* if BIO write fails, assume unrecoverable */
-                reuseContextPayload(c);
+                SSL_get_verify_result(cstate->ssl);
+                printSSLError();
                 goto failed;
             }
-            shiftr(c->payload, n);
-            len -= n;
 
-            if (! cstate->handshake_completed)
+            /* Did SSL request to write bytes? */
+            if (! flushSslOutput(self, c))
             {
-                // printSSLState(cstate->ssl);
-                n = SSL_connect(cstate->ssl);
-                // printSSLState(cstate->ssl);
-                status = getSslStatus(cstate->ssl, n);
-
-                /* Did SSL request to write bytes? */
-                if (status == kSslstatusWantIo)
-                {
-                    do
-                    {
-                        shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                        int             avail = (int) rCapNoPadding(buf);
-                        n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-
-                        if (n > 0)
-                        {
-                            setLen(buf, n);
-                            context_t *req_cont = newContextFrom(c);
-                            req_cont->payload   = buf;
-                            self->up->upStream(self->up, req_cont);
-                            if (! isAlive(c->line))
-                            {
-                                reuseContextPayload(c);
-                                destroyContext(c);
-                                return;
-                            }
-                        }
-                        else if (! BIO_should_retry(cstate->rbio))
-                        {
-                            // If BIO_should_retry() is false then the cause is an error condition.
-                            reuseContextPayload(c);
-                            reuseBuffer(getContextBufferPool(c), buf);
-                            goto failed;
-                        }
-                        else
-                        {
-                            reuseBuffer(getContextBufferPool(c), buf);
-                        }
-                    } while (n > 0);
-                }
-                if (status == kSslstatusFail)
-                {
-                    SSL_get_verify_result(cstate->ssl);
-                    printSSLError();
-                    reuseContextPayload(c);
-                    goto failed;
-                }
+                destroyContext(c);
+                return;
+            }
 
-                /* Did SSL request to write bytes? */
-                shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                int             avail = (int) rCapNoPadding(buf);
-                n                     = BIO_read(cstate->wbio, rawBufMut(buf), avail);
-                if (n > 0)
-                {
-                    setLen(buf, n);
-                    context_t *data_ctx = newContext(c->line);
-                    data_ctx->payload   = buf;
-                    self->up->upStream(self->up, data_ctx);
-                    if (! isAlive(c->line))
-                    {
-                        reuseContextPayload(c);
-                        destroyContext(c);
-                        return;
-                    }
-                }
-                else
-                {
-                    reuseBuffer(getContextBufferPool(c), buf);
-                }
+            if (! SSL_is_init_finished(cstate->ssl))
+            {
+                destroyContext(c);
+                return;
+            }
 
-                if (! cstate->handshake_completed && SSL_is_init_finished(cstate->ssl))
-                {
-                    LOGD("OpensslClient: Tls handshake complete");
-                    cstate->handshake_completed = true;
-                    flushWriteQueue(self, c);
-
-                    context_t *dw_est_ctx = newContextFrom(c);
-                    dw_est_ctx->est       = true;
-                    self->dw->downStream(self->dw, dw_est_ctx);
-
-                    // queue is flushed and we are done
-                    // reuseContextPayload(c);
-                    // destroyContext(c);
-                    // return;
-                }
+            LOGD("OpensslClient: Tls handshake complete");
+            cstate->handshake_completed = true;
+            if (cstate->early_ctx != NULL)
+            {
+                settleEarlyData(cstate);
+            }
+            flushWriteQueue(self, c);
+            if (! isAlive(c->line))
+            {
+                destroyContext(c);
+                return;
+            }
 
-                reuseContextPayload(c);
+            context_t *dw_est_ctx = newContextFrom(c);
+            dw_est_ctx->est       = true;
+            self->dw->downStream(self->dw, dw_est_ctx);
+            if (! isAlive(c->line))
+            {
                 destroyContext(c);
                 return;
             }
+            // records that came together with the last handshake message are read below
+        }
 
-            /* The encrypted data is now in the input bio so now we can perform actual
-             * read of unencrypted data. */
+        /* The encrypted data is now in the bio so now we can perform actual
+         * read of unencrypted data. */
 
-            do
-            {
-                shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
+        do
+        {
+            shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
 
-                setLen(buf, 0);
-                int avail = (int) rCapNoPadding(buf);
-                n         = SSL_read(cstate->ssl, rawBufMut(buf), avail);
+            setLen(buf, 0);
+            int avail = (int) rCapNoPadding(buf);
+            n         = SSL_read(cstate->ssl, rawBufMut(buf), avail);
 
-                if (n > 0)
-                {
-                    setLen(buf, n);
-                    context_t *data_ctx = newContextFrom(c);
-                    data_ctx->payload   = buf;
-                    self->dw->downStream(self->dw, data_ctx);
-                    if (! isAlive(c->line))
-                    {
-                        reuseContextPayload(c);
-                        destroyContext(c);
-                        return;
-                    }
-                }
-                else
+            if (n > 0)
+            {
+                setLen(buf, n);
+                context_t *data_ctx = newContextFrom(c);
+                data_ctx->payload   = buf;
+                self->dw->downStream(self->dw, data_ctx);
+                if (! isAlive(c->line))
                 {
-                    reuseBuffer(getContextBufferPool(c), buf);
+                    destroyContext(c);
+                    return;
                 }
+            }
+            else
+            {
+                reuseBuffer(getContextBufferPool(c), buf);
+            }
 
-            } while (n > 0);
+        } while (n > 0);
 
-            status = getSslStatus(cstate->ssl, n);
+        status = getSslStatus(cstate->ssl, n);
 
-            if (status == kSslstatusFail)
-            {
-                reuseContextPayload(c);
-                goto failed;
-            }
+        if (status == kSslstatusFail)
+        {
+            goto failed;
+        }
+
+        /* key updates and alerts ssl may have written while reading */
+        if (! flushSslOutput(self, c))
+        {
+            destroyContext(c);
+            return;
         }
+
         // done with socket data
-        reuseContextPayload(c);
         destroyContext(c);
     }
     else
@@ -440,6 +531,30 @@ tunnel_t *newOpenSSLClient(node_instance_context_t *instance_info)
 
     getStringFromJsonObjectOrDefault(&(state->alpn), settings, "alpn", "http/1.1");
 
+    getBoolFromJsonObjectOrDefault(&(state->session_reuse), settings, "session-reuse", true);
+
+    getBoolFromJsonObjectOrDefault(&(state->early_data), settings, "early-data", false);
+    if (state->early_data && ! state->session_reuse)
+    {
+        LOGW("OpenSSLClient: early-data needs session-reuse, early data stays off");
+        state->early_data = false;
+    }
+    getIntFromJsonObjectOrDefault(&(state->early_data_wait), settings, "early-data-wait", 50);
+    state->early_data_wait = max(1, state->early_data_wait);
+
+    int record_size_ramp    = 0;
+    int record_size_idle_ms = 0;
+    getIntFromJsonObjectOrDefault(&record_size_ramp, settings, "record-size-ramp", 65536);
+    getIntFromJsonObjectOrDefault(&record_size_idle_ms, settings, "record-size-idle-reset", 1000);
+    if (record_size_ramp < 0 || record_size_idle_ms < 0)
+    {
+        LOGF("JSON Error: OpenSSLClient->settings->record-size-ramp/record-size-idle-reset (int field) : The data was invalid");
+        exit(1);
+    }
+    state->record_size_ramp    = (uint32_t) record_size_ramp;
+    state->record_size_idle_ms = (uint32_t) record_size_idle_ms;
+    state->session_store = newOssClientSessionStore();
+
     ssl_param->verify_peer = state->verify ? 1 : 0;
     ssl_param->endpoint    = kSslClient;
 
@@ -465,6 +580,10 @@ tunnel_t *newOpenSSLClient(node_instance_context_t *instance_info)
         }
 
         SSL_CTX_set_alpn_protos(state->threadlocal_ssl_context[i], (const unsigned char *) ossl_alpn, 1 + alpn_len);
+        if (state->session_reuse)
+        {
+            attachOssClientSessionStore(state->session_store, state->threadlocal_ssl_context[i]);
+        }
     }
 
     globalFree(ssl_param);
@@ -0,0 +1,228 @@
+#include "session_store.h"
+#include "hmutex.h"
+#include "loggers/network_logger.h"
+#include <string.h>
+#include <time.h>
+
+enum
+{
+    kStoreDestinations      = 32,
+    kSessionsPerDestination = 8,
+    kMaxSessionDerLen       = 16384 // client sessions carry the server certificate chain
+};
+
+typedef struct stored_session_s
+{
+    uint8_t *der;
+    uint32_t der_len;
+    uint64_t expire; // seconds
+    bool     single_use;
+
+} stored_session_t;
+
+typedef struct destination_sessions_s
+{
+    hash_t           key;
+    uint64_t         last_used;
+    uint32_t         count;
+    stored_session_t sessions[kSessionsPerDestination]; // oldest first
+
+} destination_sessions_t;
+
+struct oss_client_session_store_s
+{
+    hmutex_t               lock;
+    uint64_t               tick;
+    destination_sessions_t destinations[kStoreDestinations];
+};
+
+static int destination_ex_index = -1;
+
+static uint64_t nowSeconds(void)
+{
+    return (uint64_t) time(NULL);
+}
+
+static void removeAt(destination_sessions_t *d, uint32_t i)
+{
+    memmove(&(d->sessions[i]), &(d->sessions[i + 1]), sizeof(stored_session_t) * (d->count - i - 1));
+    d->count--;
+}
+
+// the destination slot for key, an unused or the least recently used one is taken over when create is set
+static destination_sessions_t *findDestination(oss_client_session_store_t *store, hash_t key, bool create,
+                                               uint8_t **evicted, uint32_t *evicted_count)
+{
+    destination_sessions_t *victim = &(store->destinations[0]);
+    for (int i = 0; i < kStoreDestinations; i++)
+    {
+        destination_sessions_t *d = &(store->destinations[i]);
+        if (d->count > 0 && d->key == key)
+        {
+            d->last_used = ++store->tick;
+            return d;
+        }
+        if (d->count == 0 || d->last_used < victim->last_used)
+        {
+            victim = d;
+        }
+    }
+    if (! create)
+    {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < victim->count; i++)
+    {
+        evicted[(*evicted_count)++] = victim->sessions[i].der;
+    }
+    victim->count     = 0;
+    victim->key       = key;
+    victim->last_used = ++store->tick;
+    return victim;
+}
+
+static int onNewSession(SSL *ssl, SSL_SESSION *sess)
+{
+    oss_client_session_store_t *store = SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+    const hash_t                key   = (hash_t) (uintptr_t) SSL_get_ex_data(ssl, destination_ex_index);
+
+    if (! SSL_SESSION_is_resumable(sess))
+    {
+        return 0;
+    }
+    const int der_len = i2d_SSL_SESSION(sess, NULL);
+    if (der_len <= 0 || der_len > kMaxSessionDerLen)
+    {
+        return 0;
+    }
+
+    // serialized before the lock, the lock only moves pointers
+    stored_session_t entry = {.der        = globalMalloc((size_t) der_len),
+                              .der_len    = (uint32_t) der_len,
+                              .expire     = (uint64_t) SSL_SESSION_get_time(sess) + SSL_SESSION_get_timeout(sess),
+                              .single_use = SSL_SESSION_get_protocol_version(sess) >= TLS1_3_VERSION};
+    uint8_t         *p     = entry.der;
+    i2d_SSL_SESSION(sess, &p);
+
+    uint8_t *evicted[kSessionsPerDestination + 1];
+    uint32_t evicted_count = 0;
+
+    hmutex_lock(&(store->lock));
+    destination_sessions_t *d = findDestination(store, key, true, evicted, &evicted_count);
+    for (uint32_t i = 0; i < d->count;)
+    {
+        // one tls 1.2 session per destination is enough, the newest one
+        if (! entry.single_use && ! d->sessions[i].single_use)
+        {
+            evicted[evicted_count++] = d->sessions[i].der;
+            removeAt(d, i);
+            continue;
+        }
+        i++;
+    }
+    if (d->count == kSessionsPerDestination)
+    {
+        evicted[evicted_count++] = d->sessions[0].der;
+        removeAt(d, 0);
+    }
+    d->sessions[d->count++] = entry;
+    hmutex_unlock(&(store->lock));
+
+    for (uint32_t i = 0; i < evicted_count; i++)
+    {
+        globalFree(evicted[i]);
+    }
+    return 0; // no reference kept, the store holds the serialized form
+}
+
+oss_client_session_store_t *newOssClientSessionStore(void)
+{
+    // node construction runs on the main thread, the index is made once for every store
+    if (destination_ex_index < 0)
+    {
+        destination_ex_index = SSL_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    }
+
+    oss_client_session_store_t *store = globalMalloc(sizeof(oss_client_session_store_t));
+    memset(store, 0, sizeof(oss_client_session_store_t));
+    hmutex_init(&(store->lock));
+    return store;
+}
+
+void destroyOssClientSessionStore(oss_client_session_store_t *store)
+{
+    for (int i = 0; i < kStoreDestinations; i++)
+    {
+        for (uint32_t s = 0; s < store->destinations[i].count; s++)
+        {
+            globalFree(store->destinations[i].sessions[s].der);
+        }
+    }
+    hmutex_destroy(&(store->lock));
+    globalFree(store);
+}
+
+void attachOssClientSessionStore(oss_client_session_store_t *store, SSL_CTX *ctx)
+{
+    SSL_CTX_set_app_data(ctx, store);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx, onNewSession);
+}
+
+SSL_SESSION *ossClientSessionStoreResume(oss_client_session_store_t *store, SSL *ssl, hash_t destination)
+{
+    SSL_set_ex_data(ssl, destination_ex_index, (void *) (uintptr_t) destination);
+
+    uint8_t       *der     = NULL;
+    uint32_t       der_len = 0;
+    const uint64_t now     = nowSeconds();
+    uint8_t       *expired[kSessionsPerDestination];
+    uint32_t       expired_count = 0;
+
+    hmutex_lock(&(store->lock));
+    destination_sessions_t *d = findDestination(store, destination, false, NULL, NULL);
+    while (d != NULL && d->count > 0)
+    {
+        stored_session_t *newest = &(d->sessions[d->count - 1]);
+        if (newest->expire <= now)
+        {
+            expired[expired_count++] = newest->der;
+            d->count--;
+            continue;
+        }
+        der_len = newest->der_len;
+        if (newest->single_use)
+        {
+            der = newest->der; // taken out, the ticket is offered once
+            d->count--;
+        }
+        else
+        {
+            der = globalMalloc(der_len);
+            memcpy(der, newest->der, der_len);
+        }
+        break;
+    }
+    hmutex_unlock(&(store->lock));
+
+    for (uint32_t i = 0; i < expired_count; i++)
+    {
+        globalFree(expired[i]);
+    }
+    if (der == NULL)
+    {
+        return NULL;
+    }
+
+    const uint8_t *p    = der;
+    SSL_SESSION   *sess = d2i_SSL_SESSION(NULL, &p, (long) der_len);
+    globalFree(der);
+    if (sess == NULL)
+    {
+        return NULL;
+    }
+
+    int ok = SSL_set_session(ssl, sess);
+    SSL_SESSION_free(sess); // ssl holds its own reference
+    return ok == 1 ? SSL_get_session(ssl) : NULL;
+}
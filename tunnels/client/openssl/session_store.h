@@ -0,0 +1,26 @@
+#pragma once
+#include "basic_types.h"
+#include "ww.h"
+#include <openssl/ssl.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    Sessions the servers gave to OpenSSLClient, shared by the ssl contexts of all workers
+
+    kept per destination (sni + port), newest first; tls 1.3 tickets are taken out when they are offered since a
+    ticket should be used once (and an early data ticket must be), tls 1.2 sessions stay until they expire or the
+    server replaces them
+
+*/
+
+typedef struct oss_client_session_store_s oss_client_session_store_t;
+
+oss_client_session_store_t *newOssClientSessionStore(void);
+void                        destroyOssClientSessionStore(oss_client_session_store_t *store);
+
+// installs the new session callback into the context of a worker, the store must outlive the context
+void attachOssClientSessionStore(oss_client_session_store_t *store, SSL_CTX *ctx);
+
+// tags the connection with its destination and offers a stored session, returns the session set (owned by ssl) or NULL
+SSL_SESSION *ossClientSessionStoreResume(oss_client_session_store_t *store, SSL *ssl, hash_t destination);
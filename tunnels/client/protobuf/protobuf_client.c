@@ -3,6 +3,7 @@
 #include "buffer_stream.h"
 #include "loggers/network_logger.h"
 #include "node.h"
+#include "protobuf_frame.h"
 #include "shiftbuffer.h"
 #include "tunnel.h"
 #include "uleb128.h"
@@ -28,9 +29,10 @@ typedef struct protobuf_client_state_s
 
 typedef struct protobuf_client_con_state_s
 {
-    buffer_stream_t *stream_buf;
-    size_t           bytes_sent_nack;
-    size_t           bytes_received_nack;
+    buffer_stream_t        *stream_buf;
+    protobuf_frame_reader_t reader;
+    size_t                  bytes_sent_nack;
+    size_t                  bytes_received_nack;
 
 } protobuf_client_con_state_t;
 
@@ -85,61 +87,48 @@ static void downStream(tunnel_t *self, context_t *c)
 
         while (true)
         {
-            if (bufferStreamLen(bstream) < 2)
+            const enum protobuf_frame_status_e status = protobufFrameParse(&(cstate->reader), bstream, kMaxPacketSize);
+            if (status == kProtobufFrameIncomplete)
             {
                 destroyContext(c);
                 return;
             }
-            shift_buffer_t *full_data = bufferStreamFullRead(bstream);
-            uint8_t         flags;
-            readUnAlignedUI8(full_data, &flags);
-            shiftr(full_data, 1); // first byte is  (protobuf flag)
-
-            const uint8_t *uleb_data    = rawBuf(full_data);
-            uint64_t       data_len     = 0;
-            size_t         bytes_passed = readUleb128ToUint64(uleb_data, uleb_data + bufLen(full_data), &data_len);
-            if (data_len == 0 || (bufLen(full_data) - (bytes_passed)) < data_len)
+            if (status == kProtobufFrameTooLarge)
             {
-                shiftl(full_data, 1); // bring the data back to its original form
-
-                bufferStreamPush(bstream, full_data);
-                destroyContext(c);
-                return;
+                LOGE("ProtoBufClient: rejected, size too large");
+                goto disconnect;
             }
-
-            if (data_len > kMaxPacketSize)
+            if (status == kProtobufFrameMalformed)
             {
-                LOGE("ProtoBufServer: rejected, size too large");
-                reuseBuffer(getContextBufferPool(c), full_data);
+                LOGE("ProtoBufClient: rejected, invalid length");
                 goto disconnect;
             }
 
-            shiftr(full_data, bytes_passed);
+            const uint8_t   flags     = cstate->reader.flags;
+            const uint64_t  data_len  = cstate->reader.data_len;
+            shift_buffer_t *full_data = protobufFrameRead(&(cstate->reader), bstream);
 
             if (flags == 0x1 && data_len == sizeof(uint32_t))
             {
                 uint32_t consumed;
                 memcpy(&consumed, rawBuf(full_data), sizeof(uint32_t));
                 consumed = ntohl(consumed);
-                shiftr(full_data, sizeof(uint32_t));
+                reuseBuffer(getContextBufferPool(c), full_data);
+
                 cstate->bytes_sent_nack -= consumed;
 
                 if (cstate->bytes_sent_nack <= kMaxSendBeforeAck / 2)
                 {
                     resumeLineDownSide(c->line);
                 }
-
-                if (bufLen(full_data) > 0)
-                {
-                    bufferStreamPush(bstream, full_data);
-                }
-                else
-                {
-                    reuseBuffer(getContextBufferPool(c), full_data);
-                }
             }
             else if (flags == '\n')
             {
+                if (data_len == 0)
+                {
+                    reuseBuffer(getContextBufferPool(c), full_data);
+                    continue;
+                }
 
                 cstate->bytes_received_nack += (size_t) data_len;
                 if (cstate->bytes_received_nack >= kMaxRecvBeforeAck)
@@ -168,20 +157,9 @@ static void downStream(tunnel_t *self, context_t *c)
                     }
                 }
 
+                // the frame was read on its own, its payload goes on as it is
                 context_t *downstream_ctx = newContextFrom(c);
-                downstream_ctx->payload   = popBuffer(getContextBufferPool(c));
-
-                downstream_ctx->payload = sliceBufferTo(downstream_ctx->payload, full_data, data_len);
-
-                if (bufLen(full_data) > 0)
-                {
-                    bufferStreamPush(bstream, full_data);
-                }
-                else
-                {
-                    reuseBuffer(getContextBufferPool(c), full_data);
-                }
-
+                downstream_ctx->payload   = full_data;
                 self->dw->downStream(self->dw, downstream_ctx);
 
                 if (! isAlive(c->line))
@@ -192,7 +170,8 @@ static void downStream(tunnel_t *self, context_t *c)
             }
             else
             {
-                LOGE("ProtoBufServer: rejected, invalid flag");
+                LOGE("ProtoBufClient: rejected, invalid flag");
+                reuseBuffer(getContextBufferPool(c), full_data);
                 goto disconnect;
             }
         }
@@ -30,6 +30,8 @@ typedef struct reality_client_state_s
     char   *password;
     bool    verify;
     int     password_length;
+    int     protocol;
+    uint8_t aead_cipher;
 
 } reality_client_state_t;
 
@@ -44,6 +46,8 @@ typedef struct reality_client_con_state_s
     EVP_CIPHER_CTX  *cipher_context;
     buffer_stream_t *read_stream;
     context_queue_t *queue;
+    reality_aead_t   aead_up;
+    reality_aead_t   aead_dw;
     bool             handshake_completed;
 
 } reality_client_con_state_t;
@@ -82,6 +86,8 @@ static void cleanup(tunnel_t *self, context_t *c)
     // EVP_MD_CTX_free(cstate->sign_context);
     EVP_MD_free(cstate->msg_digest);
     EVP_PKEY_free(cstate->sign_key);
+    destroyRealityAead(&(cstate->aead_up));
+    destroyRealityAead(&(cstate->aead_dw));
 
     SSL_free(cstate->ssl); /* free the SSL object and its BIO's */
     destroyContextQueue(cstate->queue);
@@ -100,6 +106,40 @@ static void flushWriteQueue(tunnel_t *self, context_t *c)
     }
 }
 
+static shift_buffer_t *sealRecord(reality_client_state_t *state, reality_client_con_state_t *cstate,
+                                  shift_buffer_t *buf, buffer_pool_t *pool)
+{
+    if (state->protocol == kRealityProtocolAead)
+    {
+        buf = realityAeadSeal(&(cstate->aead_up), buf, state->password, true, pool);
+    }
+    else
+    {
+        buf = genericEncrypt(buf, cstate->cipher_context, state->context_password, pool);
+        signMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
+        assert(bufLen(buf) % 16 == 0);
+    }
+    appendTlsHeader(buf);
+    return buf;
+}
+
+// the record without its tls header, decrypted in place for protocol 2
+static shift_buffer_t *openRecord(reality_client_state_t *state, reality_client_con_state_t *cstate,
+                                  shift_buffer_t *buf, buffer_pool_t *pool, bool *ok)
+{
+    if (state->protocol == kRealityProtocolAead)
+    {
+        *ok = realityAeadOpen(&(cstate->aead_dw), buf, state->password, false, state->aead_cipher);
+        return buf;
+    }
+    *ok = verifyMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
+    if (*ok)
+    {
+        buf = genericDecrypt(buf, cstate->cipher_context, state->context_password, pool);
+    }
+    return buf;
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     reality_client_state_t *state = TSTATE(self);
@@ -117,16 +157,14 @@ static void upStream(tunnel_t *self, context_t *c)
         shift_buffer_t *buf = c->payload;
         c->payload          = NULL;
 
-        const unsigned int chunk_size = (kMaxSSLChunkSize - (kSignLen + (2 * kEncryptionBlockSize) + kIVlen));
+        const unsigned int chunk_size =
+            state->protocol == kRealityProtocolAead
+                ? (kMaxSSLChunkSize - (kAeadPreambleLen + kAeadTagLen))
+                : (kMaxSSLChunkSize - (kSignLen + (2 * kEncryptionBlockSize) + kIVlen));
 
         if (bufLen(buf) < chunk_size)
         {
-
-            buf = genericEncrypt(buf, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-            signMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
-            appendTlsHeader(buf);
-            assert(bufLen(buf) % 16 == 5);
-            c->payload = buf;
+            c->payload = sealRecord(state, cstate, buf, getContextBufferPool(c));
 
             self->up->upStream(self->up, c);
         }
@@ -138,12 +176,8 @@ static void upStream(tunnel_t *self, context_t *c)
                 shift_buffer_t *chunk  = popBuffer(getContextBufferPool(c));
                 chunk = sliceBufferTo( chunk,buf, remain);
 
-                chunk = genericEncrypt(chunk, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-                signMessage(chunk, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
-                appendTlsHeader(chunk);
                 context_t *cout = newContextFrom(c);
-                cout->payload   = chunk;
-                assert(bufLen(chunk) % 16 == 5);
+                cout->payload   = sealRecord(state, cstate, chunk, getContextBufferPool(c));
                 self->up->upStream(self->up, cout);
             }
             reuseBuffer(getContextBufferPool(c), buf);
@@ -166,6 +200,11 @@ static void upStream(tunnel_t *self, context_t *c)
             cstate->msg_digest     = (EVP_MD *) EVP_get_digestbynid(MSG_DIGEST_ALG);
             int sk_size            = EVP_MD_size(cstate->msg_digest);
             cstate->sign_key       = EVP_PKEY_new_mac_key(EVP_PKEY_HMAC, NULL, state->hashes, sk_size);
+            if (state->protocol == kRealityProtocolAead)
+            {
+                initRealityAead(&(cstate->aead_up), state->aead_cipher);
+                initRealityAead(&(cstate->aead_dw), 0);
+            }
 
             SSL_set_connect_state(cstate->ssl); /* sets ssl to work in client mode. */
             SSL_set_bio(cstate->ssl, cstate->rbio, cstate->wbio);
@@ -256,16 +295,18 @@ static void downStream(tunnel_t *self, context_t *c)
 
                     shiftr(buf, kTLSHeaderlen);
 
-                    if (! verifyMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key) ||
-                        ! is_tls_applicationdata || ! is_tls_33)
+                    bool verified = false;
+                    if (is_tls_applicationdata && is_tls_33)
+                    {
+                        buf = openRecord(state, cstate, buf, getContextBufferPool(c), &verified);
+                    }
+                    if (! verified)
                     {
                         LOGE("RealityClient: verifyMessage failed");
                         reuseBuffer(getContextBufferPool(c), buf);
                         goto failed;
                     }
 
-                    buf = genericDecrypt(buf, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-
                     context_t *plain_data_ctx = newContextFrom(c);
                     plain_data_ctx->payload   = buf;
                     self->dw->downStream(self->dw, plain_data_ctx);
@@ -465,6 +506,14 @@ tunnel_t *newRealityClient(node_instance_context_t *instance_info)
     // memset already made buff 0
     memcpy(state->context_password, state->password, state->password_length);
 
+    getIntFromJsonObjectOrDefault(&(state->protocol), settings, "protocol", kRealityProtocolCbcHmac);
+    if (state->protocol != kRealityProtocolCbcHmac && state->protocol != kRealityProtocolAead)
+    {
+        LOGF("JSON Error: RealityClient->settings->protocol (int field) : only 1 and 2 are supported");
+        return NULL;
+    }
+    state->aead_cipher = cpuHasAesInstructions() ? kAeadCipherAes128Gcm : kAeadCipherChaCha20Poly1305;
+
     if (EVP_MAX_MD_SIZE % sizeof(uint64_t) != 0)
     {
         LOGF("Assert Error: RealityClient-> EVP_MAX_MD_SIZE not a multiple of 8");
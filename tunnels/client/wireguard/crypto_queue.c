@@ -0,0 +1,313 @@
+#include "crypto_queue.h"
+#include "crypto.h"
+#include "hloop.h"
+#include "loggers/network_logger.h"
+
+/*
+    the crypto ring is the bounded mpmc queue of Dmitry Vyukov, each cell carries a sequence number that tells
+    producers and consumers whose turn it is, so a push or a pop is one cas on the position plus one store
+*/
+
+typedef struct wg_crypto_cell_s
+{
+    atomic_size_t    sequence;
+    wg_crypto_job_t *job;
+
+} wg_crypto_cell_t;
+
+typedef struct wg_crypto_ring_s
+{
+    atomic_size_t enqueue_pos ATTR_ALIGNED_LINE_CACHE;
+    atomic_size_t dequeue_pos ATTR_ALIGNED_LINE_CACHE;
+    atomic_bool   wake_pending ATTR_ALIGNED_LINE_CACHE;
+    struct wg_crypto_pool_s *pool;
+    tid_t                    tid;
+    wg_crypto_cell_t         cells[kWgCryptoRingSize];
+
+} ATTR_ALIGNED_LINE_CACHE wg_crypto_ring_t;
+
+struct wg_crypto_pool_s
+{
+    WgJobsReadyCb     on_ready;
+    tid_t             rings_count;
+    wg_crypto_ring_t *rings;    // aligned to the line cache inside rings_mem
+    void             *rings_mem;
+};
+
+static void initRing(wg_crypto_ring_t *ring, wg_crypto_pool_t *pool, tid_t tid)
+{
+    for (size_t i = 0; i < kWgCryptoRingSize; i++)
+    {
+        atomic_init(&(ring->cells[i].sequence), i);
+        ring->cells[i].job = NULL;
+    }
+    atomic_init(&(ring->enqueue_pos), 0);
+    atomic_init(&(ring->dequeue_pos), 0);
+    atomic_init(&(ring->wake_pending), false);
+    ring->pool = pool;
+    ring->tid  = tid;
+}
+
+static bool ringPush(wg_crypto_ring_t *ring, wg_crypto_job_t *job)
+{
+    wg_crypto_cell_t *cell;
+    size_t            pos = atomic_load_explicit(&(ring->enqueue_pos), memory_order_relaxed);
+    for (;;)
+    {
+        cell                = &(ring->cells[pos & (kWgCryptoRingSize - 1)]);
+        const size_t   seq  = atomic_load_explicit(&(cell->sequence), memory_order_acquire);
+        const intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&(ring->enqueue_pos), &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&(ring->enqueue_pos), memory_order_relaxed);
+        }
+    }
+    cell->job = job;
+    atomic_store_explicit(&(cell->sequence), pos + 1, memory_order_release);
+    return true;
+}
+
+static wg_crypto_job_t *ringPop(wg_crypto_ring_t *ring)
+{
+    wg_crypto_cell_t *cell;
+    size_t            pos = atomic_load_explicit(&(ring->dequeue_pos), memory_order_relaxed);
+    for (;;)
+    {
+        cell                = &(ring->cells[pos & (kWgCryptoRingSize - 1)]);
+        const size_t   seq  = atomic_load_explicit(&(cell->sequence), memory_order_acquire);
+        const intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&(ring->dequeue_pos), &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            return NULL;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&(ring->dequeue_pos), memory_order_relaxed);
+        }
+    }
+    wg_crypto_job_t *job = cell->job;
+    atomic_store_explicit(&(cell->sequence), pos + kWgCryptoRingSize, memory_order_release);
+    return job;
+}
+
+static void runJob(wg_crypto_job_t *job)
+{
+    if (job->encrypt)
+    {
+        wireguard_aead_encrypt(job->data, job->data, job->len, NULL, 0, job->counter, job->key);
+        job->ok = true;
+    }
+    else
+    {
+        job->ok = wireguard_aead_decrypt(job->data, job->data, job->len, NULL, 0, job->counter, job->key);
+    }
+    crypto_zero(job->key, sizeof(job->key));
+}
+
+// tid is the worker that runs this, the buffers left in the slots go to its pool
+static void releaseQueue(wg_reorder_queue_t *queue, tid_t tid)
+{
+    if (atomic_fetch_sub_explicit(&(queue->refs), 1, memory_order_acq_rel) != 1)
+    {
+        return;
+    }
+    for (; queue->head != queue->tail; queue->head++)
+    {
+        wg_crypto_job_t *job = &(queue->jobs[queue->head & (kWgReorderRingSize - 1)]);
+        if (job->buf != NULL)
+        {
+            reuseBuffer(getWorkerBufferPool(tid), job->buf);
+        }
+    }
+    globalFree(queue);
+}
+
+static void onQueueReady(hevent_t *ev)
+{
+    wg_crypto_pool_t   *pool  = hevent_userdata(ev);
+    wg_reorder_queue_t *queue = (wg_reorder_queue_t *) ev->privdata;
+
+    // cleared before the drain, a job that finishes after this point schedules another one
+    atomic_store_explicit(&(queue->drain_scheduled), false, memory_order_seq_cst);
+    if (! queue->closing)
+    {
+        pool->on_ready(queue);
+    }
+    releaseQueue(queue, queue->owner);
+}
+
+static void finishJob(wg_crypto_pool_t *pool, wg_crypto_job_t *job, tid_t tid)
+{
+    wg_reorder_queue_t *queue = job->queue;
+
+    atomic_store_explicit(&(job->done), true, memory_order_release);
+
+    if (! atomic_exchange_explicit(&(queue->drain_scheduled), true, memory_order_seq_cst))
+    {
+        atomic_fetch_add_explicit(&(queue->refs), 1, memory_order_relaxed);
+
+        hevent_t ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.loop     = getWorkerLoop(queue->owner);
+        ev.cb       = onQueueReady;
+        ev.privdata = queue;
+        hevent_set_userdata(&ev, pool);
+        hloop_post_event(getWorkerLoop(queue->owner), &ev);
+    }
+    releaseQueue(queue, tid);
+}
+
+static void wakeRing(wg_crypto_ring_t *ring);
+
+static void onRingWake(hevent_t *ev)
+{
+    wg_crypto_ring_t *ring = hevent_userdata(ev);
+    wg_crypto_pool_t *pool = ring->pool;
+
+    atomic_store_explicit(&(ring->wake_pending), false, memory_order_seq_cst);
+
+    // own ring first, then steal from the others until every ring is empty or the budget of this wakeup is spent
+    uint32_t budget = kWgCryptoJobsPerWake;
+    for (tid_t offset = 0; offset < pool->rings_count;)
+    {
+        if (budget == 0)
+        {
+            // the other events of this loop get their turn, the rest is done on the next wakeup
+            wakeRing(ring);
+            return;
+        }
+        wg_crypto_ring_t *victim = &(pool->rings[(ring->tid + offset) % pool->rings_count]);
+        wg_crypto_job_t  *job    = ringPop(victim);
+        if (job == NULL)
+        {
+            offset++;
+            continue;
+        }
+        runJob(job);
+        finishJob(pool, job, ring->tid);
+        budget--;
+    }
+}
+
+static void wakeRing(wg_crypto_ring_t *ring)
+{
+    if (! atomic_exchange_explicit(&(ring->wake_pending), true, memory_order_seq_cst))
+    {
+        hevent_t ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.loop = getWorkerLoop(ring->tid);
+        ev.cb   = onRingWake;
+        hevent_set_userdata(&ev, ring);
+        hloop_post_event(getWorkerLoop(ring->tid), &ev);
+    }
+}
+
+wg_crypto_pool_t *newWgCryptoPool(WgJobsReadyCb on_ready)
+{
+    wg_crypto_pool_t *pool = globalMalloc(sizeof(wg_crypto_pool_t));
+    pool->on_ready         = on_ready;
+    pool->rings_count      = getWorkersCount();
+    // globalMalloc does not promise line cache alignment, allocate one line more and align the rings into it
+    pool->rings_mem = globalMalloc((sizeof(wg_crypto_ring_t) * pool->rings_count) + kCpuLineCacheSize);
+    pool->rings     = (wg_crypto_ring_t *) ALIGN2((uintptr_t) pool->rings_mem, kCpuLineCacheSize); // NOLINT
+
+    for (tid_t i = 0; i < pool->rings_count; i++)
+    {
+        initRing(&(pool->rings[i]), pool, i);
+    }
+    return pool;
+}
+
+void initWgReorderQueue(wg_reorder_queue_t *queue, tid_t owner, void *userdata)
+{
+    memset(queue, 0, sizeof(wg_reorder_queue_t));
+    queue->owner     = owner;
+    queue->userdata  = userdata;
+    queue->next_ring = owner;
+    atomic_init(&(queue->drain_scheduled), false);
+    atomic_init(&(queue->refs), 1);
+    for (uint32_t i = 0; i < kWgReorderRingSize; i++)
+    {
+        atomic_init(&(queue->jobs[i].done), false);
+    }
+}
+
+wg_crypto_job_t *wgReorderQueueReserve(wg_reorder_queue_t *queue)
+{
+    if (queue->tail - queue->head == kWgReorderRingSize)
+    {
+        return NULL;
+    }
+    wg_crypto_job_t *job = &(queue->jobs[queue->tail & (kWgReorderRingSize - 1)]);
+    queue->tail++;
+
+    atomic_store_explicit(&(job->done), false, memory_order_relaxed);
+    job->ok    = false;
+    job->queue = queue;
+    return job;
+}
+
+void destroyWgReorderQueue(wg_reorder_queue_t *queue)
+{
+    queue->closing = true;
+    releaseQueue(queue, queue->owner);
+}
+
+void submitWgCryptoJob(wg_crypto_pool_t *pool, wg_reorder_queue_t *queue, wg_crypto_job_t *job)
+{
+    atomic_fetch_add_explicit(&(queue->refs), 1, memory_order_relaxed);
+
+    // spread the jobs of a peer, the stealing evens out whatever the spreading misses
+    for (tid_t tries = 0; tries < pool->rings_count; tries++)
+    {
+        wg_crypto_ring_t *ring = &(pool->rings[queue->next_ring++ % pool->rings_count]);
+        if (ringPush(ring, job))
+        {
+            wakeRing(ring);
+            return;
+        }
+    }
+
+    // every ring is full, the owner does it itself, order is still kept by the reorder ring
+    runJob(job);
+    finishJob(pool, job, queue->owner);
+}
+
+wg_crypto_job_t *wgReorderQueuePeek(wg_reorder_queue_t *queue)
+{
+    if (queue->head == queue->tail)
+    {
+        return NULL;
+    }
+    wg_crypto_job_t *job = &(queue->jobs[queue->head & (kWgReorderRingSize - 1)]);
+    if (! atomic_load_explicit(&(job->done), memory_order_acquire))
+    {
+        return NULL;
+    }
+    return job;
+}
+
+void wgReorderQueuePop(wg_reorder_queue_t *queue)
+{
+    queue->head++;
+}
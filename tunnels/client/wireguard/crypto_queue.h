@@ -0,0 +1,79 @@
+#pragma once
+#include "api.h"
+#include "defs.h"
+#include <stdatomic.h>
+
+/*
+    Parallel AEAD for the WireGuard node
+
+    the owner worker of a peer stays the only one that picks keypairs, assigns sending counters and runs the
+    replay check, only the ChaCha20-Poly1305 part of a packet leaves it
+
+    owner:   packet -> slot at the tail of the peer reorder ring (tx or rx) -> crypto ring of some worker
+    any:     pops its own crypto ring, steals from the rings of the others when it is empty, seals/opens, marks done
+    owner:   takes done slots from the head of the reorder ring, so packets come out in the order they went in
+
+    the crypto rings are bounded lock-free mpmc queues (one per worker, so a worker can steal from any of them),
+    a reorder ring is only touched by its owner except for the done flag of its slots
+
+    a reorder ring is counted: one reference for its owner, one per job in flight and one per posted drain, the
+    last one to let go of it frees it together with the buffers still in its slots
+
+
+*/
+
+enum
+{
+    kWgCryptoRingSize    = 1024, // power of 2
+    kWgReorderRingSize   = 256,  // power of 2, packets in flight per peer and direction
+    kWgCryptoJobsPerWake = 64    // jobs a worker runs per wakeup before it lets the loop run other events
+};
+
+typedef struct wg_crypto_job_s
+{
+    atomic_bool                done;
+    bool                       ok;
+    bool                       encrypt;
+    uint32_t                   receiver;
+    uint64_t                   counter;
+    uint8_t                   *data;
+    uint32_t                   len; // plain text length to seal, cipher text length with the tag to open
+    shift_buffer_t            *buf;
+    struct wg_reorder_queue_s *queue;
+    uint8_t                    key[kWgSessionKeyLen]; // a copy, the keypair may rotate while the job is in flight
+
+} wg_crypto_job_t;
+
+typedef struct wg_reorder_queue_s
+{
+    wg_crypto_job_t jobs[kWgReorderRingSize];
+    uint32_t        head;
+    uint32_t        tail;
+    uint32_t        next_ring;
+    tid_t           owner;
+    void           *userdata;
+    atomic_bool     drain_scheduled;
+    atomic_uint     refs;
+    bool            closing; // owner only
+
+} wg_reorder_queue_t;
+
+typedef void (*WgJobsReadyCb)(wg_reorder_queue_t *queue);
+
+typedef struct wg_crypto_pool_s wg_crypto_pool_t;
+
+wg_crypto_pool_t *newWgCryptoPool(WgJobsReadyCb on_ready);
+void              initWgReorderQueue(wg_reorder_queue_t *queue, tid_t owner, void *userdata);
+
+// owner only, drops the owner reference of a queue made with globalMalloc, the jobs still in flight finish first
+void destroyWgReorderQueue(wg_reorder_queue_t *queue);
+
+// a free slot at the tail of the reorder ring, NULL when the peer already has a full ring in flight
+wg_crypto_job_t *wgReorderQueueReserve(wg_reorder_queue_t *queue);
+
+// hands the reserved slot to the workers, must be called by the owner right after the reserve
+void submitWgCryptoJob(wg_crypto_pool_t *pool, wg_reorder_queue_t *queue, wg_crypto_job_t *job);
+
+// the oldest slot if its crypto is done, then wgReorderQueuePop releases it; owner only
+wg_crypto_job_t *wgReorderQueuePeek(wg_reorder_queue_t *queue);
+void             wgReorderQueuePop(wg_reorder_queue_t *queue);
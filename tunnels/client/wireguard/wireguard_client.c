@@ -1 +1,1209 @@
-// again another empty file going to be filled with the dirtiest code in the world :(
\ No newline at end of file
+#include "wireguard_client.h"
+#include "buffer_pool.h"
+#include "crypto.h"
+#include "crypto_queue.h"
+#include "hloop.h"
+#include "hmutex.h"
+#include "ip_lpm.h"
+#include "loggers/network_logger.h"
+#include "managers/node_manager.h"
+#include "master_pool.h"
+#include "packet_types.h"
+#include "utils/jsonutils.h"
+#include "utils/sockutils.h"
+#include "wireguard.h"
+
+/*
+    WireGuard on shift buffers, ip packets come up from the layer3 chain and leave as udp datagrams of the
+    peer lines (the next node is a UdpConnector with "address": "dest_context->address" and
+    "port": "dest_context->port"), datagrams of the peer lines are decrypted and written to the tun device,
+    like Layer3Sender does
+
+    encryption is in place: the 16 byte transport header goes to the left padding of the buffer and the
+    zero padding plus the 16 byte tag to the right of it, TunDevice reads with that much room around the
+    packet, a packet without the room is copied once into a buffer that has it
+
+    every peer is owned by one worker (index % workers), its line, keypairs, replay windows and timers are
+    only touched on that worker, packets of a peer read on other workers are posted to the owner
+
+    the handshakes are the Noise code of tunnels/shared/wireguard/wireguard.c, it reads the indices of all
+    peers and the device cookie secret, so it runs under a device wide mutex (handshakes are rare)
+
+    with "parallel-crypto" (on by default when there is more than one worker) the owner still does all of the
+    above but hands the AEAD of each packet to crypto_queue.c, so one busy peer can use every core, the
+    packets come back to the owner in their original order and the replay check runs there after decryption
+
+*/
+
+enum
+{
+    kWgTransportHeaderLen = sizeof(struct message_transport_data),
+    kWgPaddingMultiple    = 16,
+    kWgStagedPacketsMax   = 32,
+    kWgTimerIntervalMs    = 400,
+    kDefaultMtu           = 1420,
+    kMasterMessagePoolCap = 64
+};
+
+typedef struct wireguard_client_peer_s
+{
+    tunnel_t              *tunnel;
+    wireguard_peer_t      *wgpeer;
+    line_t                *line; // udp line to the endpoint, opened when something has to be sent
+    socket_context_t       endpoint;
+    char                  *endpoint_host;
+    uint8_t                staged_count;
+    shift_buffer_t        *staged[kWgStagedPacketsMax]; // packets waiting for a session
+    tid_t                  owner;
+    wg_reorder_queue_t    *tx_queue; // created by the owner with the first packet that goes to the crypto pool
+    wg_reorder_queue_t    *rx_queue;
+
+} wireguard_client_peer_t;
+
+typedef struct wireguard_client_worker_s
+{
+    tunnel_t *tunnel;
+    htimer_t *timer;
+    tid_t     tid;
+
+} wireguard_client_worker_t;
+
+typedef struct wireguard_client_state_s
+{
+    char                      *device_name;
+    tunnel_t                  *device_tunnel;
+    line_t                   **thread_lines;
+    master_pool_t             *steer_message_pool;
+    wireguard_client_worker_t *workers;
+    wireguard_device_t         device;
+    wireguard_client_peer_t   *peers;
+    ip_lpm_t                  *allowed_ips4; // cryptokey routing, prefix -> peer index + 1
+    ip_lpm_t                  *allowed_ips6;
+    wg_crypto_pool_t          *crypto_pool; // NULL when the owners do their own crypto
+    hmutex_t                   handshake_mutex;
+    int                        mtu;
+
+} wireguard_client_state_t;
+
+struct steer_msg_s
+{
+    tunnel_t                *tunnel;
+    wireguard_client_peer_t *peer;
+    shift_buffer_t          *buf;
+};
+
+static pool_item_t *allocSteerMsgPoolHandle(struct master_pool_s *pool, void *userdata)
+{
+    (void) userdata;
+    (void) pool;
+    return globalMalloc(sizeof(struct steer_msg_s));
+}
+
+static void destroySteerMsgPoolHandle(struct master_pool_s *pool, master_pool_item_t *item, void *userdata)
+{
+    (void) pool;
+    (void) userdata;
+    globalFree(item);
+}
+
+// an empty buffer that a packet of len bytes can be encrypted into without growing
+static shift_buffer_t *newTransportBuffer(tid_t tid, uint32_t len)
+{
+    shift_buffer_t *buf = popBuffer(getWorkerBufferPool(tid));
+    resetBuffer(buf);
+    buf = reserveBufSpace(buf, kWgTransportHeaderLen + len + kWgPaddingMultiple + kWgAuthTagLen);
+    setLen(buf, kWgTransportHeaderLen);
+    shiftr(buf, kWgTransportHeaderLen);
+    return buf;
+}
+
+// the udp line of a peer, opened on its owner worker, NULL if the connector refused it
+static line_t *getPeerLine(tunnel_t *self, wireguard_client_peer_t *peer)
+{
+    if (peer->line != NULL)
+    {
+        return peer->line;
+    }
+
+    line_t *line     = newLine(peer->owner);
+    LSTATE_MUT(line) = peer;
+    peer->line       = line;
+
+    line->dest_ctx.address_protocol = kSapUdp;
+    socketContextAddrCopy(&(line->dest_ctx), &(peer->endpoint));
+    socketContextPortCopy(&(line->dest_ctx), &(peer->endpoint));
+
+    lockLine(line);
+    self->up->upStream(self->up, newInitContext(line));
+    if (! isAlive(line))
+    {
+        LOGW("WireGuard: could not open the udp line to the endpoint of a peer");
+    }
+    unLockLine(line);
+
+    return peer->line;
+}
+
+static void sendToPeer(tunnel_t *self, wireguard_client_peer_t *peer, shift_buffer_t *buf)
+{
+    line_t *line = getPeerLine(self, peer);
+    if (line == NULL)
+    {
+        reuseBuffer(getWorkerBufferPool(peer->owner), buf);
+        return;
+    }
+    context_t *c = newContext(line);
+    c->payload   = buf;
+    self->up->upStream(self->up, c);
+}
+
+static void sendHandshakeInitiation(tunnel_t *self, wireguard_client_peer_t *peer)
+{
+    wireguard_client_state_t           *state  = TSTATE(self);
+    wireguard_peer_t                   *wgpeer = peer->wgpeer;
+    struct message_handshake_initiation msg;
+
+    hmutex_lock(&(state->handshake_mutex));
+    bool created = wireguard_create_handshake_initiation(&(state->device), wgpeer, &msg);
+    hmutex_unlock(&(state->handshake_mutex));
+
+    if (! created)
+    {
+        return;
+    }
+
+    wgpeer->send_handshake       = false;
+    wgpeer->last_initiation_tx   = wireguard_sys_now();
+    wgpeer->handshake_mac1_valid = true;
+    memcpy(wgpeer->handshake_mac1, msg.mac1, kWgCookieLen);
+
+    shift_buffer_t *buf = newTransportBuffer(peer->owner, sizeof(msg));
+    setLen(buf, sizeof(msg));
+    writeRaw(buf, &msg, sizeof(msg));
+    sendToPeer(self, peer, buf);
+}
+
+static bool canSendInitiation(wireguard_peer_t *wgpeer)
+{
+    return wgpeer->last_initiation_tx == 0 || wireguard_expired(wgpeer->last_initiation_tx, kWgRekeyTimeout);
+}
+
+// drops the keypair and its receiver index, the index table is shared by the workers
+static void releaseKeypair(wireguard_client_state_t *state, wireguard_peer_t *wgpeer, wireguard_keypair_t *keypair)
+{
+    hmutex_lock(&(state->handshake_mutex));
+    keypair_release(&(state->device), wgpeer, keypair);
+    hmutex_unlock(&(state->handshake_mutex));
+}
+
+// the keypair that data can be sent with, a responder can not send before the initiator used the new keys
+static wireguard_keypair_t *getSendingKeypair(wireguard_client_state_t *state, wireguard_peer_t *wgpeer)
+{
+    wireguard_keypair_t *keypair = &(wgpeer->curr_keypair);
+
+    if (keypair->valid && ! keypair->initiator && keypair->last_rx == 0)
+    {
+        keypair = &(wgpeer->prev_keypair);
+    }
+    if (! keypair->valid || (! keypair->initiator && keypair->last_rx == 0))
+    {
+        return NULL;
+    }
+    if (wireguard_expired(keypair->keypair_millis, kWgRejectAfterTime) ||
+        keypair->sending_counter >= kWgRejectAfterMessage)
+    {
+        releaseKeypair(state, wgpeer, keypair);
+        return NULL;
+    }
+    return keypair;
+}
+
+static uint32_t paddedLength(uint32_t len, int mtu)
+{
+    uint32_t last_unit = len;
+    if (last_unit > (uint32_t) mtu)
+    {
+        last_unit %= (uint32_t) mtu;
+    }
+    uint32_t padded = (last_unit + (kWgPaddingMultiple - 1)) & ~(uint32_t) (kWgPaddingMultiple - 1);
+    if (padded > (uint32_t) mtu)
+    {
+        padded = (uint32_t) mtu;
+    }
+    return len + (padded - last_unit);
+}
+
+static wg_reorder_queue_t *getReorderQueue(wireguard_client_peer_t *peer, wg_reorder_queue_t **queue)
+{
+    if (*queue == NULL)
+    {
+        *queue = globalMalloc(sizeof(wg_reorder_queue_t));
+        initWgReorderQueue(*queue, peer->owner, peer);
+    }
+    return *queue;
+}
+
+/*
+    encrypts the packet in the buffer it came in and sends it, false if the peer has no session yet
+
+    before:  [ lCap >= 16 ][ ip packet ][ rCap >= pad + 16 ]
+    after:   [ header 16  ][ cipher text of packet + zero pad ][ tag 16 ]
+*/
+static bool sendTransportPacket(tunnel_t *self, wireguard_client_peer_t *peer, shift_buffer_t *buf)
+{
+    wireguard_client_state_t *state   = TSTATE(self);
+    wireguard_peer_t         *wgpeer  = peer->wgpeer;
+    wireguard_keypair_t      *keypair = getSendingKeypair(state, wgpeer);
+
+    if (keypair == NULL)
+    {
+        return false;
+    }
+
+    const uint32_t len    = bufLen(buf);
+    const uint32_t padded = paddedLength(len, state->mtu);
+
+    if (WW_UNLIKELY(lCap(buf) < kWgTransportHeaderLen || rCap(buf) < padded + kWgAuthTagLen))
+    {
+        shift_buffer_t *roomy = newTransportBuffer(peer->owner, padded);
+        setLen(roomy, len);
+        copyBuf(roomy, buf, len);
+        reuseBuffer(getWorkerBufferPool(peer->owner), buf);
+        buf = roomy;
+    }
+
+    /*
+        when the ring of this peer is full the owner seals the packet itself, that slows the owner down to the pace
+        of the pool instead of dropping; the packet may leave before the ones still in the ring, the replay window
+        of the receiver accepts that
+    */
+    wg_crypto_job_t *job = NULL;
+    if (state->crypto_pool != NULL)
+    {
+        job = wgReorderQueueReserve(getReorderQueue(peer, &(peer->tx_queue)));
+    }
+
+    uint8_t *data = rawBufMut(buf);
+    memset(data + len, 0, padded - len);
+    setLen(buf, padded + kWgAuthTagLen);
+
+    const uint64_t counter = keypair->sending_counter;
+    if (job == NULL)
+    {
+        wireguard_encrypt_packet(data, data, padded, keypair);
+    }
+    else
+    {
+        // the counter is taken here on the owner, the sealing can then happen anywhere
+        keypair->sending_counter = counter + 1;
+        job->encrypt             = true;
+        job->counter             = counter;
+        job->data                = data;
+        job->len                 = padded;
+        memcpy(job->key, keypair->sending_key, sizeof(job->key));
+    }
+
+    shiftl(buf, kWgTransportHeaderLen);
+    struct message_transport_data *hdr = (struct message_transport_data *) rawBufMut(buf);
+    hdr->type                          = kMessageTransportData;
+    memset(hdr->reserved, 0, sizeof(hdr->reserved));
+    memcpy(&(hdr->receiver), &(keypair->remote_index), sizeof(hdr->receiver));
+    U64TO8_LITTLE(hdr->counter, counter);
+
+    const uint32_t now = wireguard_sys_now();
+    keypair->last_tx   = now;
+    wgpeer->last_tx    = now;
+
+    if (keypair->sending_counter >= kWgReKeyAfterMessages ||
+        (keypair->initiator && wireguard_expired(keypair->keypair_millis, kWgRekeyAfterTime)))
+    {
+        wgpeer->send_handshake = true;
+    }
+
+    if (job == NULL)
+    {
+        sendToPeer(self, peer, buf);
+    }
+    else
+    {
+        job->buf = buf;
+        submitWgCryptoJob(state->crypto_pool, peer->tx_queue, job);
+    }
+    return true;
+}
+
+static void sendKeepAlive(tunnel_t *self, wireguard_client_peer_t *peer)
+{
+    shift_buffer_t *buf = newTransportBuffer(peer->owner, 0);
+    if (! sendTransportPacket(self, peer, buf))
+    {
+        reuseBuffer(getWorkerBufferPool(peer->owner), buf);
+    }
+}
+
+static void stagePacket(tunnel_t *self, wireguard_client_peer_t *peer, shift_buffer_t *buf)
+{
+    if (peer->staged_count == kWgStagedPacketsMax)
+    {
+        // the oldest one goes, like wireguard-go does
+        reuseBuffer(getWorkerBufferPool(peer->owner), peer->staged[0]);
+        memmove(&(peer->staged[0]), &(peer->staged[1]), sizeof(peer->staged[0]) * (kWgStagedPacketsMax - 1));
+        peer->staged_count--;
+    }
+    peer->staged[peer->staged_count++] = buf;
+
+    if (canSendInitiation(peer->wgpeer))
+    {
+        sendHandshakeInitiation(self, peer);
+    }
+}
+
+static void flushStagedPackets(tunnel_t *self, wireguard_client_peer_t *peer)
+{
+    uint8_t i = 0;
+    for (; i < peer->staged_count; i++)
+    {
+        if (! sendTransportPacket(self, peer, peer->staged[i]))
+        {
+            break;
+        }
+    }
+    memmove(&(peer->staged[0]), &(peer->staged[i]), sizeof(peer->staged[0]) * (peer->staged_count - i));
+    peer->staged_count = (uint8_t) (peer->staged_count - i);
+}
+
+// runs on the owner of the peer
+static void encryptAndSend(tunnel_t *self, wireguard_client_peer_t *peer, shift_buffer_t *buf)
+{
+    if (peer->staged_count > 0 || ! sendTransportPacket(self, peer, buf))
+    {
+        stagePacket(self, peer, buf);
+    }
+}
+
+static void onSteeredPacket(hevent_t *ev)
+{
+    struct steer_msg_s       *msg   = hevent_userdata(ev);
+    wireguard_client_state_t *state = TSTATE(msg->tunnel);
+
+    encryptAndSend(msg->tunnel, msg->peer, msg->buf);
+
+    reuseMasterPoolItems(state->steer_message_pool, (void **) &msg, 1, msg->tunnel);
+}
+
+static void steerPacket(tunnel_t *self, wireguard_client_peer_t *peer, shift_buffer_t *buf)
+{
+    wireguard_client_state_t *state = TSTATE(self);
+    struct steer_msg_s       *msg;
+    popMasterPoolItems(state->steer_message_pool, (const void **) &(msg), 1, self);
+
+    *msg = (struct steer_msg_s) {.tunnel = self, .peer = peer, .buf = buf};
+
+    hevent_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.loop = getWorkerLoop(peer->owner);
+    ev.cb   = onSteeredPacket;
+    hevent_set_userdata(&ev, msg);
+    hloop_post_event(getWorkerLoop(peer->owner), &ev);
+}
+
+// the peer whose allowed ips have the longest match for the address, NULL if none
+static wireguard_client_peer_t *lookupPeerByIp4(wireguard_client_state_t *state, uint32_t addr)
+{
+    const uint32_t value = ipLpmLookup4(state->allowed_ips4, addr);
+    return value == 0 ? NULL : &(state->peers[value - 1]);
+}
+
+static wireguard_client_peer_t *lookupPeerByIp6(wireguard_client_state_t *state, const uint8_t *addr)
+{
+    const uint32_t value = ipLpmLookup6(state->allowed_ips6, addr);
+    return value == 0 ? NULL : &(state->peers[value - 1]);
+}
+
+// the peer the packet is routed to by its destination address
+static wireguard_client_peer_t *findPeerByDest(wireguard_client_state_t *state, shift_buffer_t *buf)
+{
+    const packet_mask *packet = (const packet_mask *) rawBuf(buf);
+
+    if (packet->ip4_header.version == 4 && bufLen(buf) >= sizeof(struct ipv4header))
+    {
+        return lookupPeerByIp4(state, packet->ip4_header.daddr);
+    }
+    if (packet->ip6_header.version == 6 && bufLen(buf) >= sizeof(struct ipv6header))
+    {
+        return lookupPeerByIp6(state, (const uint8_t *) &(packet->ip6_header.daddr));
+    }
+    return NULL;
+}
+
+static void routePacket(tunnel_t *self, tid_t tid, shift_buffer_t *buf, bool checksum_clean)
+{
+    wireguard_client_state_t *state = TSTATE(self);
+    wireguard_client_peer_t  *peer  = findPeerByDest(state, buf);
+
+    if (peer == NULL)
+    {
+        reuseBuffer(getWorkerBufferPool(tid), buf);
+        return;
+    }
+    if (! checksum_clean)
+    {
+        // the packet leaves the layer3 chain here, nobody after us fixes the checksums
+        recalculatePacketCheckSums(rawBufMut(buf));
+    }
+    if (peer->owner == tid)
+    {
+        encryptAndSend(self, peer, buf);
+    }
+    else
+    {
+        steerPacket(self, peer, buf);
+    }
+}
+
+static void upStream(tunnel_t *self, context_t *c)
+{
+    if (c->payload == NULL)
+    {
+        destroyContext(c);
+        return;
+    }
+
+    shift_buffer_t *buf            = c->payload;
+    const tid_t     tid            = c->line->tid;
+    const bool      checksum_clean = c->checksum_clean;
+    dropContexPayload(c);
+    destroyContext(c);
+
+    routePacket(self, tid, buf, checksum_clean);
+}
+
+static void upStreamBatch(tunnel_t *self, packet_batch_t *batch)
+{
+    const tid_t tid = batch->line->tid;
+
+    for (uint16_t i = 0; i < batch->count; i++)
+    {
+        routePacket(self, tid, batch->bufs[i], batch->checksum_clean[i]);
+    }
+    batch->count = 0;
+}
+
+// the decrypted packet must be a whole ip packet from an address that routes back to the same peer
+static bool validateInnerPacket(wireguard_client_state_t *state, wireguard_client_peer_t *peer, shift_buffer_t *buf)
+{
+    const packet_mask *packet = (const packet_mask *) rawBuf(buf);
+    const uint32_t     len    = bufLen(buf);
+
+    if (len >= sizeof(struct ipv4header) && packet->ip4_header.version == 4)
+    {
+        const uint32_t tot_len = ntohs(packet->ip4_header.tot_len);
+        if (tot_len < sizeof(struct ipv4header) || tot_len > len)
+        {
+            return false;
+        }
+        // drops the zero padding
+        setLen(buf, tot_len);
+        return lookupPeerByIp4(state, packet->ip4_header.saddr) == peer;
+    }
+    if (len >= sizeof(struct ipv6header) && packet->ip6_header.version == 6)
+    {
+        const uint32_t tot_len = sizeof(struct ipv6header) + ntohs(packet->ip6_header.payload_len);
+        if (tot_len > len)
+        {
+            return false;
+        }
+        setLen(buf, tot_len);
+        return lookupPeerByIp6(state, (const uint8_t *) &(packet->ip6_header.saddr)) == peer;
+    }
+    return false;
+}
+
+// the part after a successful decryption, in the order the packets arrived, false to drop the buffer
+static bool finishTransportData(tunnel_t *self, wireguard_client_peer_t *peer, shift_buffer_t *buf, uint32_t receiver,
+                                uint64_t counter)
+{
+    wireguard_client_state_t *state  = TSTATE(self);
+    wireguard_peer_t         *wgpeer = peer->wgpeer;
+
+    // looked up again, the keypair may have rotated away while the packet was being opened
+    wireguard_keypair_t *keypair = get_peer_keypair_for_idx(wgpeer, receiver);
+    if (keypair == NULL || ! wireguard_check_replay(keypair, counter))
+    {
+        return false;
+    }
+
+    const uint32_t now = wireguard_sys_now();
+    keypair->last_rx   = now;
+    wgpeer->last_rx    = now;
+
+    if (keypair->initiator &&
+        wireguard_expired(keypair->keypair_millis, kWgRejectAfterTime - kWgKeepAliveTimeOut - kWgRekeyTimeout))
+    {
+        wgpeer->send_handshake = true;
+    }
+
+    // the first packet with the next keypair confirms it
+    if (keypair == &(wgpeer->next_keypair))
+    {
+        hmutex_lock(&(state->handshake_mutex));
+        keypair_update(&(state->device), wgpeer, keypair);
+        hmutex_unlock(&(state->handshake_mutex));
+    }
+
+    const uint32_t enc_len = bufLen(buf) - kWgTransportHeaderLen;
+    shiftr(buf, kWgTransportHeaderLen);
+    setLen(buf, enc_len - kWgAuthTagLen);
+
+    if (peer->staged_count > 0)
+    {
+        flushStagedPackets(self, peer);
+    }
+
+    if (bufLen(buf) == 0)
+    {
+        // keep alive
+        return false;
+    }
+    if (! validateInnerPacket(state, peer, buf))
+    {
+        return false;
+    }
+
+    context_t *c      = newContext(state->thread_lines[peer->owner]);
+    c->payload        = buf;
+    c->checksum_clean = true;
+    state->device_tunnel->upStream(state->device_tunnel, c);
+    return true;
+}
+
+// decrypts in place, the header is shifted away and the tag is cut from the right, false to drop the buffer
+static bool processTransportData(tunnel_t *self, wireguard_client_peer_t *peer, shift_buffer_t *buf)
+{
+    wireguard_client_state_t      *state  = TSTATE(self);
+    wireguard_peer_t              *wgpeer = peer->wgpeer;
+    struct message_transport_data *hdr    = (struct message_transport_data *) rawBufMut(buf);
+    uint32_t                       receiver;
+
+    memcpy(&receiver, &(hdr->receiver), sizeof(receiver));
+
+    wireguard_keypair_t *keypair = get_peer_keypair_for_idx(wgpeer, receiver);
+    if (keypair == NULL || ! keypair->receiving_valid || wireguard_expired(keypair->keypair_millis, kWgRejectAfterTime))
+    {
+        return false;
+    }
+
+    const uint64_t counter = U8TO64_LITTLE(hdr->counter);
+    const uint32_t enc_len = bufLen(buf) - kWgTransportHeaderLen;
+
+    if (counter >= kWgRejectAfterMessage)
+    {
+        return false;
+    }
+
+    if (state->crypto_pool != NULL)
+    {
+        wg_crypto_job_t *job = wgReorderQueueReserve(getReorderQueue(peer, &(peer->rx_queue)));
+        if (job == NULL)
+        {
+            return false;
+        }
+        job->encrypt  = false;
+        job->receiver = receiver;
+        job->counter  = counter;
+        job->data     = hdr->enc_packet;
+        job->len      = enc_len;
+        job->buf      = buf;
+        memcpy(job->key, keypair->receiving_key, sizeof(job->key));
+        submitWgCryptoJob(state->crypto_pool, peer->rx_queue, job);
+        return true;
+    }
+
+    if (! wireguard_decrypt_packet(hdr->enc_packet, hdr->enc_packet, enc_len, counter, keypair))
+    {
+        return false;
+    }
+    return finishTransportData(self, peer, buf, receiver, counter);
+}
+
+// runs on the owner, takes the packets whose crypto is done from the head of the ring, stops at the first one in flight
+static void onCryptoJobsReady(wg_reorder_queue_t *queue)
+{
+    wireguard_client_peer_t *peer = queue->userdata;
+    tunnel_t                *self = peer->tunnel;
+    wg_crypto_job_t         *job;
+
+    while ((job = wgReorderQueuePeek(queue)) != NULL)
+    {
+        shift_buffer_t *buf      = job->buf;
+        bool            consumed = false;
+        job->buf                 = NULL;
+
+        if (job->encrypt)
+        {
+            sendToPeer(self, peer, buf);
+            consumed = true;
+        }
+        else if (job->ok)
+        {
+            consumed = finishTransportData(self, peer, buf, job->receiver, job->counter);
+        }
+        wgReorderQueuePop(queue);
+
+        if (! consumed)
+        {
+            reuseBuffer(getWorkerBufferPool(peer->owner), buf);
+        }
+    }
+}
+
+// runs on the owner of the peer, the handshake is dropped only if it is still the one that was seen on the other worker
+static void onHandshakeInvalidated(hevent_t *ev)
+{
+    wireguard_client_peer_t  *peer        = ev->privdata;
+    const uint32_t            local_index = (uint32_t) (uintptr_t) hevent_userdata(ev);
+    wireguard_client_state_t *state       = TSTATE(peer->tunnel);
+    wireguard_peer_t         *wgpeer      = peer->wgpeer;
+
+    hmutex_lock(&(state->handshake_mutex));
+    if (wgpeer->handshake.valid && wgpeer->handshake.local_index == local_index)
+    {
+        wgpeer->handshake.valid = false;
+    }
+    hmutex_unlock(&(state->handshake_mutex));
+}
+
+static void postHandshakeInvalidation(wireguard_client_state_t *state, wireguard_peer_t *wgpeer)
+{
+    wireguard_client_peer_t *peer = &(state->peers[wgpeer - state->device.peers]);
+
+    hevent_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.loop     = getWorkerLoop(peer->owner);
+    ev.cb       = onHandshakeInvalidated;
+    ev.privdata = peer;
+    hevent_set_userdata(&ev, (void *) (uintptr_t) wgpeer->handshake.local_index);
+    hloop_post_event(getWorkerLoop(peer->owner), &ev);
+}
+
+static void processHandshakeInitiation(tunnel_t *self, wireguard_client_peer_t *peer, shift_buffer_t *buf)
+{
+    wireguard_client_state_t            *state = TSTATE(self);
+    struct message_handshake_initiation *msg   = (struct message_handshake_initiation *) rawBufMut(buf);
+    struct message_handshake_response    response;
+    bool                                 created = false;
+
+    if (! wireguard_check_mac1(&(state->device), rawBuf(buf), sizeof(*msg) - (2 * kWgCookieLen), msg->mac1))
+    {
+        return;
+    }
+
+    hmutex_lock(&(state->handshake_mutex));
+    wireguard_peer_t *wgpeer = wireguard_process_initiation_message(&(state->device), msg);
+    if (wgpeer == peer->wgpeer)
+    {
+        created = wireguard_create_handshake_response(&(state->device), wgpeer, &response);
+        if (created)
+        {
+            wireguard_start_session(&(state->device), wgpeer, false);
+        }
+    }
+    else if (wgpeer != NULL)
+    {
+        // another peer knocking from this endpoint, its handshake state belongs to its own worker
+        postHandshakeInvalidation(state, wgpeer);
+    }
+    hmutex_unlock(&(state->handshake_mutex));
+
+    if (created)
+    {
+        shift_buffer_t *out = newTransportBuffer(peer->owner, sizeof(response));
+        setLen(out, sizeof(response));
+        writeRaw(out, &response, sizeof(response));
+        sendToPeer(self, peer, out);
+    }
+}
+
+static void processHandshakeResponse(tunnel_t *self, wireguard_client_peer_t *peer, shift_buffer_t *buf)
+{
+    wireguard_client_state_t          *state = TSTATE(self);
+    struct message_handshake_response *msg   = (struct message_handshake_response *) rawBufMut(buf);
+    bool                               done  = false;
+
+    if (! wireguard_check_mac1(&(state->device), rawBuf(buf), sizeof(*msg) - (2 * kWgCookieLen), msg->mac1))
+    {
+        return;
+    }
+
+    hmutex_lock(&(state->handshake_mutex));
+    wireguard_peer_t *wgpeer = peer_lookup_by_handshake(&(state->device), msg->receiver);
+    if (wgpeer == peer->wgpeer && wireguard_process_handshake_response(&(state->device), wgpeer, msg))
+    {
+        wireguard_start_session(&(state->device), wgpeer, true);
+        done = true;
+    }
+    hmutex_unlock(&(state->handshake_mutex));
+
+    if (done)
+    {
+        if (peer->staged_count > 0)
+        {
+            flushStagedPackets(self, peer);
+        }
+        else
+        {
+            // the responder can only send after it has seen data with the new keys
+            sendKeepAlive(self, peer);
+        }
+    }
+}
+
+static void processCookieReply(wireguard_client_peer_t *peer, shift_buffer_t *buf)
+{
+    struct message_cookie_reply *msg    = (struct message_cookie_reply *) rawBufMut(buf);
+    wireguard_peer_t            *wgpeer = peer->wgpeer;
+
+    if (wgpeer->handshake.valid && wgpeer->handshake.initiator && wgpeer->handshake.local_index == msg->receiver)
+    {
+        wireguard_process_cookie_message(NULL, wgpeer, msg);
+    }
+}
+
+static void onPeerLineClosed(tunnel_t *self, wireguard_client_peer_t *peer, line_t *line)
+{
+    LSTATE_DROP(line);
+    peer->line = NULL;
+    destroyLine(line);
+}
+
+static void downStream(tunnel_t *self, context_t *c)
+{
+    wireguard_client_peer_t *peer = CSTATE(c);
+
+    if (c->payload != NULL)
+    {
+        shift_buffer_t *buf = c->payload;
+        dropContexPayload(c);
+        destroyContext(c);
+
+        bool consumed = false;
+        switch (wireguard_get_message_type(rawBuf(buf), bufLen(buf)))
+        {
+        case kMessageTransportData:
+            consumed = processTransportData(self, peer, buf);
+            break;
+        case kMessageHandshakeInitiation:
+            processHandshakeInitiation(self, peer, buf);
+            break;
+        case kMessageHandshakeResponse:
+            processHandshakeResponse(self, peer, buf);
+            break;
+        case kMessageCookieReply:
+            processCookieReply(peer, buf);
+            break;
+        default:
+            break;
+        }
+        if (! consumed)
+        {
+            reuseBuffer(getWorkerBufferPool(peer->owner), buf);
+        }
+        return;
+    }
+
+    if (c->fin)
+    {
+        // the connector closed the socket, the next packet opens a new line
+        line_t *line = c->line;
+        destroyContext(c);
+        onPeerLineClosed(self, peer, line);
+        return;
+    }
+
+    destroyContext(c);
+}
+
+// the periodic part of wireguardif.c, for the peers of one worker
+static void onWorkerTimer(htimer_t *timer)
+{
+    wireguard_client_worker_t *worker = hevent_userdata(timer);
+    tunnel_t                  *self   = worker->tunnel;
+    wireguard_client_state_t  *state  = TSTATE(self);
+
+    for (uint32_t i = worker->tid; i < state->device.peers_count; i += getWorkersCount())
+    {
+        wireguard_client_peer_t *peer   = &(state->peers[i]);
+        wireguard_peer_t        *wgpeer = peer->wgpeer;
+
+        if (wgpeer->curr_keypair.valid && wireguard_expired(wgpeer->curr_keypair.keypair_millis, kWgRejectAfterTime * 3))
+        {
+            // nothing back for too long, wipe all crypto state
+            hmutex_lock(&(state->handshake_mutex));
+            keypair_release(&(state->device), wgpeer, &(wgpeer->next_keypair));
+            keypair_release(&(state->device), wgpeer, &(wgpeer->curr_keypair));
+            keypair_release(&(state->device), wgpeer, &(wgpeer->prev_keypair));
+            hmutex_unlock(&(state->handshake_mutex));
+        }
+        if (wgpeer->curr_keypair.valid && (wireguard_expired(wgpeer->curr_keypair.keypair_millis, kWgRejectAfterTime) ||
+                                           wgpeer->curr_keypair.sending_counter >= kWgRejectAfterMessage))
+        {
+            releaseKeypair(state, wgpeer, &(wgpeer->curr_keypair));
+        }
+        if (wgpeer->keepalive_interval > 0 && (wgpeer->curr_keypair.valid || wgpeer->prev_keypair.valid) &&
+            wireguard_expired(wgpeer->last_tx, wgpeer->keepalive_interval))
+        {
+            sendKeepAlive(self, peer);
+        }
+        if (canSendInitiation(wgpeer) &&
+            (wgpeer->send_handshake ||
+             (wgpeer->curr_keypair.valid && ! wgpeer->curr_keypair.initiator &&
+              wireguard_expired(wgpeer->curr_keypair.keypair_millis, kWgRejectAfterTime - wgpeer->keepalive_interval)) ||
+             (! wgpeer->curr_keypair.valid && wgpeer->active)))
+        {
+            sendHandshakeInitiation(self, peer);
+        }
+    }
+}
+
+static bool parseKey(const char *b64, uint8_t *out)
+{
+    size_t len = kWgPublicKeyLen;
+    return wireguard_base64_decode(b64, out, &len) && len == kWgPublicKeyLen;
+}
+
+// "host:port", ipv6 hosts are written in brackets
+static bool parseEndpoint(wireguard_client_peer_t *peer, const char *endpoint)
+{
+    const char *colon = strrchr(endpoint, ':');
+    if (colon == NULL || colon == endpoint || colon[1] == '\0')
+    {
+        return false;
+    }
+    const int port = atoi(colon + 1);
+    if (port <= 0 || port > 65535)
+    {
+        return false;
+    }
+
+    const char *host     = endpoint;
+    size_t      host_len = (size_t) (colon - endpoint);
+    if (host[0] == '[' && host[host_len - 1] == ']')
+    {
+        host++;
+        host_len -= 2;
+    }
+    if (host_len == 0 || host_len > 255)
+    {
+        return false;
+    }
+
+    peer->endpoint_host = globalMalloc(host_len + 1);
+    memcpy(peer->endpoint_host, host, host_len);
+    peer->endpoint_host[host_len] = '\0';
+
+    peer->endpoint.address_protocol = kSapUdp;
+    peer->endpoint.address_type     = getHostAddrType(peer->endpoint_host);
+    if (peer->endpoint.address_type == kSatDomainName)
+    {
+        socketContextDomainSetConstMem(&(peer->endpoint), peer->endpoint_host, (uint8_t) host_len);
+    }
+    else
+    {
+        sockaddr_set_ip(&(peer->endpoint.address), peer->endpoint_host);
+    }
+    socketContextPortSet(&(peer->endpoint), (uint16_t) port);
+    return true;
+}
+
+static uint8_t maskPrefixLength(const struct in6_addr *mask, int ipver)
+{
+    uint8_t len = 0;
+    for (int i = 0; i < (ipver == 4 ? 4 : 16); i++)
+    {
+        len += (uint8_t) __builtin_popcount(mask->s6_addr[i]);
+    }
+    return len;
+}
+
+// a prefix given to several peers belongs to the last one, like wg(8) does
+static bool parseAllowedIps(wireguard_client_state_t *state, uint32_t index, const cJSON *peer_obj)
+{
+    const cJSON *list = cJSON_GetObjectItemCaseSensitive(peer_obj, "allowed-ips");
+    if (! cJSON_IsArray(list) || cJSON_GetArraySize(list) <= 0 || cJSON_GetArraySize(list) > kWgMaxSrcIPs)
+    {
+        LOGF("JSON Error: WireGuard->settings->peers->allowed-ips (array field) : must have 1 to %d cidrs",
+             kWgMaxSrcIPs);
+        return false;
+    }
+
+    const cJSON *item = NULL;
+    cJSON_ArrayForEach(item, list)
+    {
+        if (! cJSON_IsString(item) || ! verifyIpCdir(item->valuestring, getNetworkLogger()))
+        {
+            LOGF("JSON Error: WireGuard->settings->peers->allowed-ips : invalid cidr");
+            return false;
+        }
+        struct in6_addr addr  = {0};
+        struct in6_addr mask  = {0};
+        const int       ipver = parseIPWithSubnetMask(&addr, item->valuestring, &mask);
+        if (ipver != 4 && ipver != 6)
+        {
+            LOGF("JSON Error: WireGuard->settings->peers->allowed-ips : could not parse %s", item->valuestring);
+            return false;
+        }
+        ipLpmInsert(ipver == 4 ? state->allowed_ips4 : state->allowed_ips6, addr.s6_addr,
+                    maskPrefixLength(&mask, ipver), index + 1);
+    }
+    return true;
+}
+
+static bool parsePeer(wireguard_client_state_t *state, uint32_t index, const cJSON *peer_obj)
+{
+    wireguard_client_peer_t *peer   = &(state->peers[index]);
+    wireguard_peer_t        *wgpeer = &(state->device.peers[index]);
+    char                    *temp   = NULL;
+    uint8_t                  public_key[kWgPublicKeyLen];
+    uint8_t                  preshared_key[kWgSessionKeyLen];
+    bool                     has_preshared_key = false;
+
+    if (! getStringFromJsonObject(&temp, peer_obj, "public-key") || ! parseKey(temp, public_key))
+    {
+        LOGF("JSON Error: WireGuard->settings->peers->public-key (string field) : must be a base64 key");
+        globalFree(temp);
+        return false;
+    }
+    globalFree(temp);
+    temp = NULL;
+
+    if (getStringFromJsonObject(&temp, peer_obj, "preshared-key"))
+    {
+        if (! parseKey(temp, preshared_key))
+        {
+            LOGF("JSON Error: WireGuard->settings->peers->preshared-key (string field) : must be a base64 key");
+            globalFree(temp);
+            return false;
+        }
+        has_preshared_key = true;
+        globalFree(temp);
+        temp = NULL;
+    }
+
+    if (! getStringFromJsonObject(&temp, peer_obj, "endpoint") || ! parseEndpoint(peer, temp))
+    {
+        LOGF("JSON Error: WireGuard->settings->peers->endpoint (string field) : must be host:port");
+        globalFree(temp);
+        return false;
+    }
+    globalFree(temp);
+
+    if (! parseAllowedIps(state, index, peer_obj))
+    {
+        return false;
+    }
+
+    int keepalive = 0;
+    getIntFromJsonObjectOrDefault(&keepalive, peer_obj, "persistent-keepalive", 0);
+
+    if (! wireguard_peer_init(&(state->device), wgpeer, public_key, has_preshared_key ? preshared_key : NULL))
+    {
+        LOGF("WireGuard: the public key of peer %u is not usable", index);
+        return false;
+    }
+    crypto_zero(preshared_key, sizeof(preshared_key));
+
+    wgpeer->keepalive_interval = (uint16_t) keepalive;
+    // we are the client side, handshakes start as soon as the timers run
+    wgpeer->active = true;
+
+    peer->wgpeer = wgpeer;
+    peer->owner  = (tid_t) (index % getWorkersCount());
+    return true;
+}
+
+tunnel_t *newWireGuard(node_instance_context_t *instance_info)
+{
+    wireguard_client_state_t *state = globalMalloc(sizeof(wireguard_client_state_t));
+    memset(state, 0, sizeof(wireguard_client_state_t));
+    cJSON *settings = instance_info->node_settings_json;
+
+    if (! (cJSON_IsObject(settings) && settings->child != NULL))
+    {
+        LOGF("JSON Error: WireGuard->settings (object field) : The object was empty or invalid");
+        globalFree(state);
+        return NULL;
+    }
+
+    if (! getStringFromJsonObject(&(state->device_name), settings, "device"))
+    {
+        LOGF("JSON Error: WireGuard->settings->device (string field) : The string was empty or invalid");
+        globalFree(state);
+        return NULL;
+    }
+
+    getIntFromJsonObjectOrDefault(&(state->mtu), settings, "mtu", kDefaultMtu);
+    if (state->mtu < 576 || state->mtu > 0xFFFF)
+    {
+        LOGF("JSON Error: WireGuard->settings->mtu (number field) : must be between 576 and 65535");
+        exit(1);
+    }
+
+    bool parallel_crypto = false;
+    getBoolFromJsonObjectOrDefault(&parallel_crypto, settings, "parallel-crypto", true);
+
+    wireguard_init();
+
+    char   *private_key_b64 = NULL;
+    uint8_t private_key[kWgPrivateKeyLen];
+    if (! getStringFromJsonObject(&private_key_b64, settings, "private-key") || ! parseKey(private_key_b64, private_key))
+    {
+        LOGF("JSON Error: WireGuard->settings->private-key (string field) : must be a base64 key");
+        exit(1);
+    }
+    globalFree(private_key_b64);
+
+    if (! wireguard_device_init(&(state->device), private_key))
+    {
+        LOGF("WireGuard: the private key is not usable");
+        exit(1);
+    }
+    crypto_zero(private_key, sizeof(private_key));
+
+    const cJSON *peers = cJSON_GetObjectItemCaseSensitive(settings, "peers");
+    if (! cJSON_IsArray(peers) || cJSON_GetArraySize(peers) <= 0 || cJSON_GetArraySize(peers) > kWgMaxPeers)
+    {
+        LOGF("JSON Error: WireGuard->settings->peers (array field) : must have 1 to %d peers", kWgMaxPeers);
+        exit(1);
+    }
+
+    const uint32_t peers_count = (uint32_t) cJSON_GetArraySize(peers);
+    state->device.peers        = globalMalloc(sizeof(wireguard_peer_t) * peers_count);
+    state->device.peers_count  = peers_count;
+    state->peers               = globalMalloc(sizeof(wireguard_client_peer_t) * peers_count);
+    memset(state->device.peers, 0, sizeof(wireguard_peer_t) * peers_count);
+    memset(state->peers, 0, sizeof(wireguard_client_peer_t) * peers_count);
+
+    const uint32_t index_table_len = wireguard_index_table_len(peers_count);
+    state->device.index_table      = globalMalloc(sizeof(wireguard_index_entry_t) * index_table_len);
+    state->device.index_table_mask = index_table_len - 1;
+    memset(state->device.index_table, 0, sizeof(wireguard_index_entry_t) * index_table_len);
+
+    state->allowed_ips4 = newIpLpm(32);
+    state->allowed_ips6 = newIpLpm(128);
+
+    uint32_t     index    = 0;
+    const cJSON *peer_obj = NULL;
+    cJSON_ArrayForEach(peer_obj, peers)
+    {
+        if (! parsePeer(state, index++, peer_obj))
+        {
+            exit(1);
+        }
+    }
+    LOGD("WireGuard: %u peers, %u v4 and %u v6 allowed ip prefixes", peers_count, state->allowed_ips4->prefixes_count,
+         state->allowed_ips6->prefixes_count);
+
+    hash_t  hash_tdev_name = CALC_HASH_BYTES(state->device_name, strlen(state->device_name));
+    node_t *tundevice_node = getNode(instance_info->node_manager_config, hash_tdev_name);
+
+    if (tundevice_node == NULL)
+    {
+        LOGF("WireGuard: could not find tun device node \"%s\"", state->device_name);
+        exit(1);
+    }
+
+    if (tundevice_node->instance == NULL)
+    {
+        runNode(instance_info->node_manager_config, tundevice_node, 0);
+    }
+
+    if (tundevice_node->instance == NULL)
+    {
+        exit(1);
+    }
+
+    state->device_tunnel = tundevice_node->instance;
+
+    tunnel_t *t = newTunnel();
+
+    hmutex_init(&(state->handshake_mutex));
+
+    state->thread_lines = globalMalloc(sizeof(line_t *) * getWorkersCount());
+    state->workers      = globalMalloc(sizeof(wireguard_client_worker_t) * getWorkersCount());
+
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        state->thread_lines[i] = newLine(i);
+        state->workers[i]      = (wireguard_client_worker_t) {.tunnel = t, .tid = (tid_t) i};
+        state->workers[i].timer =
+            htimer_add(getWorkerLoop(i), onWorkerTimer, kWgTimerIntervalMs, INFINITE);
+        hevent_set_userdata(state->workers[i].timer, &(state->workers[i]));
+    }
+
+    for (uint32_t i = 0; i < peers_count; i++)
+    {
+        state->peers[i].tunnel = t;
+    }
+
+    if (parallel_crypto && getWorkersCount() > 1)
+    {
+        state->crypto_pool = newWgCryptoPool(onCryptoJobsReady);
+    }
+
+    state->steer_message_pool = newMasterPoolWithCap(kMasterMessagePoolCap);
+    installMasterPoolAllocCallbacks(state->steer_message_pool, allocSteerMsgPoolHandle, destroySteerMsgPoolHandle);
+
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->fnPacketBatchU = &upStreamBatch;
+
+    return t;
+}
+
+api_result_t apiWireGuard(tunnel_t *self, const char *msg)
+{
+    (void) (self);
+    (void) (msg);
+    return (api_result_t) {0};
+}
+
+// runs on the owner of the peer, its reorder rings go away once the jobs they still have in flight are done
+static void onPeerTeardown(hevent_t *ev)
+{
+    wireguard_client_peer_t *peer = hevent_userdata(ev);
+
+    if (peer->tx_queue != NULL)
+    {
+        destroyWgReorderQueue(peer->tx_queue);
+        peer->tx_queue = NULL;
+    }
+    if (peer->rx_queue != NULL)
+    {
+        destroyWgReorderQueue(peer->rx_queue);
+        peer->rx_queue = NULL;
+    }
+}
+
+tunnel_t *destroyWireGuard(tunnel_t *self)
+{
+    wireguard_client_state_t *state = TSTATE(self);
+
+    for (uint32_t i = 0; i < state->device.peers_count; i++)
+    {
+        wireguard_client_peer_t *peer = &(state->peers[i]);
+
+        hevent_t ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.loop = getWorkerLoop(peer->owner);
+        ev.cb   = onPeerTeardown;
+        hevent_set_userdata(&ev, peer);
+        hloop_post_event(getWorkerLoop(peer->owner), &ev);
+    }
+    return NULL;
+}
+
+tunnel_metadata_t getMetadataWireGuard(void)
+{
+    return (tunnel_metadata_t) {.version = 0001, .flags = 0x0};
+}
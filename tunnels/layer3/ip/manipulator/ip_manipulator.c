@@ -69,45 +69,87 @@ typedef struct layer3_ip_manipulator_con_state_s
 
 } layer3_ip_manipulator_con_state_t;
 
-static inline void handleProtocolAction4(struct ipv4header *ip_header, dynamic_value_t *protocol_action)
+/*
+    the ip header checksum is patched in place (rfc 1624), but a packet that turns into (or stops being) tcp needs
+    the sender to compute its tcp checksum from scratch
+*/
+static inline void handleProtocolAction4(bool *checksum_clean, struct ipv4header *ip_header,
+                                         dynamic_value_t *protocol_action)
 {
     if (protocol_action->status != kDvsEmpty)
     {
+        const uint8_t  old_protocol = ip_header->protocol;
+        const uint16_t old_word     = ip4ProtocolWord(ip_header);
+
         ip_header->protocol = protocol_action->value;
+
+        if (*checksum_clean && old_protocol != ip_header->protocol)
+        {
+            ip_header->check = checkSumUpdate16(ip_header->check, old_word, ip4ProtocolWord(ip_header));
+            if (old_protocol == IPPROTO_TCP || ip_header->protocol == IPPROTO_TCP)
+            {
+                *checksum_clean = false;
+            }
+        }
     }
 }
 
-static inline void handleProtocolAction6(struct ipv6header *ip_header, dynamic_value_t *protocol_action)
+static inline void handleProtocolAction6(bool *checksum_clean, struct ipv6header *ip_header,
+                                         dynamic_value_t *protocol_action)
 {
     if (protocol_action->status != kDvsEmpty)
     {
+        const uint8_t old_protocol = ip_header->nexthdr;
+
         ip_header->nexthdr = protocol_action->value;
+
+        if (old_protocol != ip_header->nexthdr && (old_protocol == IPPROTO_TCP || ip_header->nexthdr == IPPROTO_TCP))
+        {
+            *checksum_clean = false;
+        }
     }
 }
 
-static void upStream(tunnel_t *self, context_t *c)
+static void handlePacket(layer3_ip_manipulator_state_t *state, shift_buffer_t *buf, bool *checksum_clean)
 {
-    layer3_ip_manipulator_state_t *state = TSTATE(self);
-
-    packet_mask *packet = (packet_mask *) (rawBufMut(c->payload));
+    packet_mask *packet = (packet_mask *) (rawBufMut(buf));
 
     if (packet->ip4_header.version == 4)
     {
-        handleProtocolAction4(&packet->ip4_header, &state->protocol_action);
+        handleProtocolAction4(checksum_clean, &packet->ip4_header, &state->protocol_action);
     }
     else if (packet->ip6_header.version == 6)
     {
-        handleProtocolAction6(&packet->ip6_header, &state->protocol_action);
+        handleProtocolAction6(checksum_clean, &packet->ip6_header, &state->protocol_action);
     }
     else
     {
         LOGF("IPManipulator: non ip packets is assumed to be pre-filtered by receiver node");
         exit(1);
     }
+}
+
+static void upStream(tunnel_t *self, context_t *c)
+{
+    layer3_ip_manipulator_state_t *state = TSTATE(self);
+
+    handlePacket(state, c->payload, &c->checksum_clean);
 
     self->up->upStream(self->up, c);
 }
 
+static void upStreamBatch(tunnel_t *self, packet_batch_t *batch)
+{
+    layer3_ip_manipulator_state_t *state = TSTATE(self);
+
+    for (uint16_t i = 0; i < batch->count; i++)
+    {
+        handlePacket(state, batch->bufs[i], &batch->checksum_clean[i]);
+    }
+
+    upStreamPacketBatch(self->up, batch);
+}
+
 static void downStream(tunnel_t *self, context_t *c)
 {
     (void) (self);
@@ -148,9 +190,10 @@ tunnel_t *newLayer3IpManipulator(node_instance_context_t *instance_info)
 
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = &upStream;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->fnPacketBatchU = &upStreamBatch;
 
     return t;
 }
@@ -26,48 +26,111 @@ typedef struct layer3_ip_overrider_con_state_s
 
 } layer3_ip_overrider_con_state_t;
 
-static void upStreamSrcMode(tunnel_t *self, context_t *c)
+// the address is part of the ip header checksum and of the tcp pseudo header, both are patched (rfc 1624)
+static void updateChecksumsForAddr4(shift_buffer_t *buf, packet_mask *packet, uint32_t old_addr, uint32_t new_addr)
 {
-    layer3_ip_overrider_state_t *state = TSTATE(self);
+    packet->ip4_header.check = checkSumUpdate32(packet->ip4_header.check, old_addr, new_addr);
 
-    packet_mask *packet = (packet_mask *) (rawBufMut(c->payload));
+    if (hasTcpHeader4(&(packet->ip4_header), bufLen(buf)))
+    {
+        struct tcpheader *tcp_header = (struct tcpheader *) (rawBufMut(buf) + (packet->ip4_header.ihl * 4));
+        tcp_header->check            = checkSumUpdate32(tcp_header->check, old_addr, new_addr);
+    }
+}
+
+static void updateChecksumsForAddr6(shift_buffer_t *buf, packet_mask *packet, const void *old_addr, const void *new_addr)
+{
+    if (hasTcpHeader6(&(packet->ip6_header), bufLen(buf)))
+    {
+        struct tcpheader *tcp_header = (struct tcpheader *) (rawBufMut(buf) + sizeof(struct ipv6header));
+        tcp_header->check = checkSumUpdateBytes(tcp_header->check, old_addr, new_addr, sizeof(struct in6_addr));
+    }
+}
+
+static void overrideSource(layer3_ip_overrider_state_t *state, shift_buffer_t *buf, bool checksum_clean)
+{
+    packet_mask *packet = (packet_mask *) (rawBufMut(buf));
 
     if (state->support4 && packet->ip4_header.version == 4)
     {
+        if (checksum_clean)
+        {
+            updateChecksumsForAddr4(buf, packet, packet->ip4_header.saddr, state->ov_4);
+        }
         // alignment assumed to be correct
         packet->ip4_header.saddr = state->ov_4;
     }
     else if (state->support6 && packet->ip6_header.version == 6)
     {
-
+        if (checksum_clean)
+        {
+            updateChecksumsForAddr6(buf, packet, ((uint8_t *) packet) + offsetof(struct ipv6header, saddr),
+                                    &(state->ov_6));
+        }
         // alignment assumed to be correct
         packet->ip6_header.saddr = state->ov_6;
     }
-
-    self->up->upStream(self->up, c);
 }
 
-static void upStreamDestMode(tunnel_t *self, context_t *c)
+static void overrideDest(layer3_ip_overrider_state_t *state, shift_buffer_t *buf, bool checksum_clean)
 {
-    layer3_ip_overrider_state_t *state = TSTATE(self);
-
-    packet_mask *packet = (packet_mask *) (rawBufMut(c->payload));
+    packet_mask *packet = (packet_mask *) (rawBufMut(buf));
 
     if (packet->ip4_header.version == 4)
     {
+        if (checksum_clean)
+        {
+            updateChecksumsForAddr4(buf, packet, packet->ip4_header.daddr, state->ov_4);
+        }
         // alignment assumed to be correct
         packet->ip4_header.daddr = state->ov_4;
     }
     else if (packet->ip6_header.version == 6)
     {
-
+        if (checksum_clean)
+        {
+            updateChecksumsForAddr6(buf, packet, ((uint8_t *) packet) + offsetof(struct ipv6header, daddr),
+                                    &(state->ov_6));
+        }
         // alignment assumed to be correct
         packet->ip6_header.daddr = state->ov_6;
     }
+}
 
+static void upStreamSrcMode(tunnel_t *self, context_t *c)
+{
+    overrideSource(TSTATE(self), c->payload, c->checksum_clean);
+    self->up->upStream(self->up, c);
+}
+
+static void upStreamDestMode(tunnel_t *self, context_t *c)
+{
+    overrideDest(TSTATE(self), c->payload, c->checksum_clean);
     self->up->upStream(self->up, c);
 }
 
+static void upStreamBatchSrcMode(tunnel_t *self, packet_batch_t *batch)
+{
+    layer3_ip_overrider_state_t *state = TSTATE(self);
+
+    for (uint16_t i = 0; i < batch->count; i++)
+    {
+        overrideSource(state, batch->bufs[i], batch->checksum_clean[i]);
+    }
+    upStreamPacketBatch(self->up, batch);
+}
+
+static void upStreamBatchDestMode(tunnel_t *self, packet_batch_t *batch)
+{
+    layer3_ip_overrider_state_t *state = TSTATE(self);
+
+    for (uint16_t i = 0; i < batch->count; i++)
+    {
+        overrideDest(state, batch->bufs[i], batch->checksum_clean[i]);
+    }
+    upStreamPacketBatch(self->up, batch);
+}
+
 static void downStream(tunnel_t *self, context_t *c)
 {
     (void) (self);
@@ -130,9 +193,10 @@ tunnel_t *newLayer3IpOverrider(node_instance_context_t *instance_info)
 
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = ((int) mode_dv.status == kDvsDestMode) ? &upStreamDestMode : &upStreamSrcMode;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = ((int) mode_dv.status == kDvsDestMode) ? &upStreamDestMode : &upStreamSrcMode;
+    t->downStream     = &downStream;
+    t->fnPacketBatchU = ((int) mode_dv.status == kDvsDestMode) ? &upStreamBatchDestMode : &upStreamBatchSrcMode;
 
     return t;
 }
@@ -1,4 +1,6 @@
 #include "ip_routing_table.h"
+#include "hmutex.h"
+#include "ip_lpm.h"
 #include "loggers/network_logger.h"
 #include "managers/node_manager.h"
 #include "packet_types.h"
@@ -16,118 +18,164 @@ enum default_action_dynamic_value_status
     kDvsDrop = kDvsFirstOption
 };
 
-typedef struct
+/*
+    The rules are compiled into 2 longest prefix match tables (v4 and v6), per packet lookup cost does not grow
+    with the number of routes
+
+    the compiled table is never modified, a reload builds a new one and swaps the pointer; a worker only reads the
+    table inside a packet callback, so once every worker loop ran an event posted after the swap none of them can
+    still hold the old one and it is freed by the last of those events
+*/
+typedef struct routing_table_s
 {
-    union {
-        struct in_addr  ip4;
-        struct in6_addr ip6;
-    } ip;
+    ip_lpm_t  *lpm4;
+    ip_lpm_t  *lpm6;
+    tunnel_t **nexts; // (lpm value - 1) is the rule index
+    tunnel_t  *default_next;
+    uint32_t   rules_len;
 
-    union {
-        struct in_addr  mask4;
-        struct in6_addr mask6;
-    } mask;
+} routing_table_t;
 
-    tunnel_t *next;
-    bool      v4;
+typedef struct retired_table_s
+{
+    routing_table_t *table;
+    atomic_uint      pending_workers;
 
-} routing_rule_t;
+} retired_table_t;
 
-typedef struct layer3_ip_overrider_state_s
+typedef struct layer3_ip_routing_table_state_s
 {
-    routing_rule_t routes[8];
-    int            default_rule;
-    bool           default_drop;
-    uint8_t        routes_len;
+    _Atomic(routing_table_t *)    table;
+    struct node_manager_config_s *node_manager_config;
+    hmutex_t                      reload_lock;
+    unsigned int                  chain_index;
 
-} layer3_ip_overrider_state_t;
+} layer3_ip_routing_table_state_t;
 
-typedef struct layer3_ip_overrider_con_state_s
+typedef struct layer3_ip_routing_table_con_state_s
 {
     void *_;
-} layer3_ip_overrider_con_state_t;
+} layer3_ip_routing_table_con_state_t;
 
-static void upStreamSrcMode(tunnel_t *self, context_t *c)
+// NULL means drop
+static tunnel_t *nextOf(routing_table_t *table, uint32_t value)
 {
-    layer3_ip_overrider_state_t *state = TSTATE(self);
+    if (WW_LIKELY(value != 0))
+    {
+        return table->nexts[value - 1];
+    }
+    return table->default_next;
+}
 
-    packet_mask *packet = (packet_mask *) (rawBufMut(c->payload));
+static void routePacket(routing_table_t *table, uint32_t value, context_t *c)
+{
+    tunnel_t *next = nextOf(table, value);
+
+    if (next == NULL)
+    {
+        LOGD("Layer3IpRoutingTable: dropped a packet that did not match any rule");
+        reuseContextPayload(c);
+        destroyContext(c);
+        return;
+    }
+    next->upStream(next, c);
+}
+
+static uint32_t lookupSource(routing_table_t *table, shift_buffer_t *buf)
+{
+    packet_mask *packet = (packet_mask *) (rawBufMut(buf));
 
     if (packet->ip4_header.version == 4)
     {
-        for (unsigned int i = 0; i < state->routes_len; i++)
-        {
-            const struct in_addr addr = {.s_addr = packet->ip4_header.saddr};
-            if (state->routes[i].v4 && checkIPRange4(addr, state->routes[i].ip.ip4, state->routes[i].mask.mask4))
-            {
-                state->routes[i].next->upStream(state->routes[i].next, c);
-                return;
-            }
-        }
+        return ipLpmLookup4(table->lpm4, packet->ip4_header.saddr);
     }
-    else if (packet->ip6_header.version == 6)
+    if (packet->ip6_header.version == 6)
     {
-        for (unsigned int i = 0; i < state->routes_len; i++)
-        {
-            if ((! state->routes[i].v4) &&
-                checkIPRange6(packet->ip6_header.saddr, state->routes[i].ip.ip6, state->routes[i].mask.mask6))
-            {
-                state->routes[i].next->upStream(state->routes[i].next, c);
-                return;
-            }
-        }
+        return ipLpmLookup6(table->lpm6, (const uint8_t *) &(packet->ip6_header.saddr));
     }
+    return 0;
+}
+
+static uint32_t lookupDest(routing_table_t *table, shift_buffer_t *buf)
+{
+    packet_mask *packet = (packet_mask *) (rawBufMut(buf));
 
-    if (state->default_drop)
+    if (packet->ip4_header.version == 4)
     {
-        LOGD("Layer3IpRoutingTable: dropped a packet that did not match any rule");
-        reuseContextPayload(c);
-        destroyContext(c);
+        return ipLpmLookup4(table->lpm4, packet->ip4_header.daddr);
     }
-    else
+    if (packet->ip6_header.version == 6)
     {
-        state->routes[state->default_rule].next->upStream(state->routes[state->default_rule].next, c);
+        return ipLpmLookup6(table->lpm6, (const uint8_t *) &(packet->ip6_header.daddr));
     }
+    return 0;
+}
+
+static void upStreamSrcMode(tunnel_t *self, context_t *c)
+{
+    layer3_ip_routing_table_state_t *state = TSTATE(self);
+    routing_table_t                 *table = atomic_load_explicit(&(state->table), memory_order_acquire);
+
+    routePacket(table, lookupSource(table, c->payload), c);
 }
 
 static void upStreamDestMode(tunnel_t *self, context_t *c)
 {
-    layer3_ip_overrider_state_t *state = TSTATE(self);
+    layer3_ip_routing_table_state_t *state = TSTATE(self);
+    routing_table_t                 *table = atomic_load_explicit(&(state->table), memory_order_acquire);
 
-    packet_mask *packet = (packet_mask *) (rawBufMut(c->payload));
+    routePacket(table, lookupDest(table, c->payload), c);
+}
 
-    if (packet->ip4_header.version == 4)
+/*
+    consecutive packets that go to the same next node are passed on as one sub batch, packets of a flow usually
+    arrive back to back so the batch is rarely split much
+*/
+static void routeBatch(routing_table_t *table, packet_batch_t *batch, bool dest_mode)
+{
+    packet_batch_t out      = {.line = batch->line, .count = 0};
+    tunnel_t      *out_next = NULL;
+
+    for (uint16_t i = 0; i < batch->count; i++)
     {
-        for (unsigned int i = 0; i < state->routes_len; i++)
+        shift_buffer_t *buf   = batch->bufs[i];
+        uint32_t        value = dest_mode ? lookupDest(table, buf) : lookupSource(table, buf);
+        tunnel_t       *next  = nextOf(table, value);
+
+        if (next == NULL)
         {
-            const struct in_addr addr = {.s_addr = packet->ip4_header.saddr};
-            if (checkIPRange4(addr, state->routes[i].ip.ip4, state->routes[i].mask.mask4))
-            {
-                state->routes[i].next->upStream(state->routes[i].next, c);
-            }
+            LOGD("Layer3IpRoutingTable: dropped a packet that did not match any rule");
+            reuseBuffer(getLineBufferPool(batch->line), buf);
+            continue;
         }
-    }
-    else if (packet->ip4_header.version == 6)
-    {
-        for (unsigned int i = 0; i < state->routes_len; i++)
+        if (next != out_next && out.count > 0)
         {
-            if (checkIPRange6(packet->ip6_header.daddr, state->routes[i].ip.ip6, state->routes[i].mask.mask6))
-            {
-                state->routes[i].next->upStream(state->routes[i].next, c);
-            }
+            upStreamPacketBatch(out_next, &out);
+            out.count = 0;
         }
+        out_next = next;
+        packetBatchPush(&out, buf, batch->checksum_clean[i]);
     }
 
-    if (state->default_drop)
+    if (out.count > 0)
     {
-        LOGD("Layer3IpRoutingTable: dropped a packet that did not match any rule");
-        reuseContextPayload(c);
-        destroyContext(c);
-    }
-    else
-    {
-        state->routes[state->default_rule].next->upStream(state->routes[state->default_rule].next, c);
+        upStreamPacketBatch(out_next, &out);
     }
+    batch->count = 0;
+}
+
+static void upStreamBatchSrcMode(tunnel_t *self, packet_batch_t *batch)
+{
+    layer3_ip_routing_table_state_t *state = TSTATE(self);
+
+    routeBatch(atomic_load_explicit(&(state->table), memory_order_acquire), batch, false);
+}
+
+static void upStreamBatchDestMode(tunnel_t *self, packet_batch_t *batch)
+{
+    layer3_ip_routing_table_state_t *state = TSTATE(self);
+
+    routeBatch(atomic_load_explicit(&(state->table), memory_order_acquire), batch, true);
 }
 
 static void downStream(tunnel_t *self, context_t *c)
@@ -143,131 +191,296 @@ static void downStream(tunnel_t *self, context_t *c)
     destroyContext(c);
 }
 
-static routing_rule_t parseRule(struct node_manager_config_s *cfg, unsigned int chain_index, const cJSON *rule_obj)
+static uint8_t maskPrefixLength(const struct in6_addr *mask, int ipver)
 {
-    char *temp = NULL;
+    uint8_t len = 0;
+    for (int i = 0; i < (ipver == 4 ? 4 : 16); i++)
+    {
+        len += (uint8_t) __builtin_popcount(mask->s6_addr[i]);
+    }
+    return len;
+}
 
-    if (! getStringFromJsonObject(&(temp), rule_obj, "ip") || ! verifyIpCdir(temp, getNetworkLogger()))
+static bool insertRuleIp(routing_table_t *table, const char *ip, uint32_t value)
+{
+    if (! verifyIpCdir(ip, getNetworkLogger()))
     {
-        LOGF("JSON Error: Layer3IpRoutingTable->settings->rules invalid rule");
-        exit(1);
+        LOGE("JSON Error: Layer3IpRoutingTable->settings->rules invalid ip %s", ip);
+        return false;
     }
 
-    routing_rule_t rule  = {0};
-    int            ipver = parseIPWithSubnetMask((struct in6_addr *) &rule.ip, temp, (struct in6_addr *) &rule.mask);
+    struct in6_addr addr  = {0};
+    struct in6_addr mask  = {0};
+    int             ipver = parseIPWithSubnetMask(&addr, ip, &mask);
     if (ipver != 4 && ipver != 6)
     {
-        LOGF("JSON Error: Layer3IpRoutingTable->settings->rules rule parse failed");
+        LOGE("JSON Error: Layer3IpRoutingTable->settings->rules rule parse failed %s", ip);
+        return false;
     }
-    rule.v4 = ipver == 4;
-    globalFree(temp);
-    temp = NULL;
 
+    return ipLpmInsert(ipver == 4 ? table->lpm4 : table->lpm6, addr.s6_addr, maskPrefixLength(&mask, ipver), value);
+}
+
+static tunnel_t *parseRuleNext(struct node_manager_config_s *cfg, unsigned int chain_index, const cJSON *rule_obj,
+                               bool allow_run)
+{
+    char *temp = NULL;
     if (! getStringFromJsonObject(&(temp), rule_obj, "next"))
     {
-        LOGF("JSON Error: Layer3IpRoutingTable->settings->rules next tunnel not specified");
-        exit(1);
+        LOGE("JSON Error: Layer3IpRoutingTable->settings->rules next tunnel not specified");
+        return NULL;
     }
     hash_t  hash_node_name = CALC_HASH_BYTES(temp, strlen(temp));
     node_t *node           = getNode(cfg, hash_node_name);
 
     if (node == NULL)
     {
-        LOGF("JSON Error: Layer3IpRoutingTable->settings->rules node %s not found", temp);
-        exit(1);
+        LOGE("JSON Error: Layer3IpRoutingTable->settings->rules node %s not found", temp);
+        globalFree(temp);
+        return NULL;
     }
 
-    if (node->instance == NULL)
+    if (node->instance == NULL && allow_run)
     {
         runNode(cfg, node, chain_index + 1);
-        if (node->instance == NULL)
-        {
-            exit(1);
-        }
+    }
+    if (node->instance == NULL)
+    {
+        LOGE("Layer3IpRoutingTable: node %s is not running", temp);
     }
     globalFree(temp);
 
-    rule.next = node->instance;
-
-    return rule;
+    return node->instance;
 }
 
-tunnel_t *newLayer3IpRoutingTable(node_instance_context_t *instance_info)
+static void destroyRoutingTable(routing_table_t *table)
 {
-    layer3_ip_overrider_state_t *state = globalMalloc(sizeof(layer3_ip_overrider_state_t));
-    memset(state, 0, sizeof(layer3_ip_overrider_state_t));
-    cJSON *settings = instance_info->node_settings_json;
+    destroyIpLpm(table->lpm4);
+    destroyIpLpm(table->lpm6);
+    globalFree((void *) table->nexts);
+    globalFree(table);
+}
 
-    if (! (cJSON_IsObject(settings) && settings->child != NULL))
+/*
+    every rule has a "next" and an "ip" which is either a single cidr or an array of them, if the same prefix
+    is given by more than one rule, the first rule wins (same as the old linear scan)
+*/
+static routing_table_t *compileRoutingTable(layer3_ip_routing_table_state_t *state, const cJSON *settings,
+                                            bool allow_run)
+{
+    const cJSON *rules = cJSON_GetObjectItemCaseSensitive(settings, "rules");
+    if (! cJSON_IsArray(rules) || cJSON_GetArraySize(rules) <= 0)
     {
-        LOGF("JSON Error: Layer3IpRoutingTable->settings (object field) : The object was empty or invalid");
+        LOGE("JSON Error: Layer3IpRoutingTable->settings->rules (array field) : The arary was empty or invalid");
         return NULL;
     }
+    const uint32_t rules_len = (uint32_t) cJSON_GetArraySize(rules);
+    if (rules_len > kIpLpmMaxValue)
+    {
+        LOGE("Layer3IpRoutingTable: too many rules");
+        return NULL;
+    }
+
+    routing_table_t *table = globalMalloc(sizeof(routing_table_t));
+    *table                 = (routing_table_t) {.lpm4      = newIpLpm(32),
+                                                .lpm6      = newIpLpm(128),
+                                                .nexts     = globalMalloc(sizeof(tunnel_t *) * rules_len),
+                                                .rules_len = rules_len};
+
+    // reverse order, an equal prefix inserted later overwrites the earlier one
+    for (int ri = (int) rules_len - 1; ri >= 0; ri--)
+    {
+        const cJSON *rule_obj = cJSON_GetArrayItem(rules, ri);
+        tunnel_t    *next     = parseRuleNext(state->node_manager_config, state->chain_index, rule_obj, allow_run);
+        if (next == NULL)
+        {
+            destroyRoutingTable(table);
+            return NULL;
+        }
+        table->nexts[ri] = next;
+
+        const cJSON *ip_obj = cJSON_GetObjectItemCaseSensitive(rule_obj, "ip");
+        if (cJSON_IsString(ip_obj) && ip_obj->valuestring != NULL)
+        {
+            if (! insertRuleIp(table, ip_obj->valuestring, (uint32_t) ri + 1))
+            {
+                destroyRoutingTable(table);
+                return NULL;
+            }
+        }
+        else if (cJSON_IsArray(ip_obj))
+        {
+            const cJSON *ip_item = NULL;
+            cJSON_ArrayForEach(ip_item, ip_obj)
+            {
+                if (! cJSON_IsString(ip_item) || ! insertRuleIp(table, ip_item->valuestring, (uint32_t) ri + 1))
+                {
+                    destroyRoutingTable(table);
+                    return NULL;
+                }
+            }
+        }
+        else
+        {
+            LOGE("JSON Error: Layer3IpRoutingTable->settings->rules invalid rule, ip is not a string or array");
+            destroyRoutingTable(table);
+            return NULL;
+        }
+    }
 
     dynamic_value_t def_action = parseDynamicNumericValueFromJsonObject(settings, "default-action", 1, "drop");
 
     if (def_action.status == kDvsConstant)
     {
-        state->default_drop = false;
-        state->default_rule = (int) def_action.status;
+        // the index of the rule that gets the packets matching no rule
+        if (def_action.value >= rules_len)
+        {
+            LOGE("JSON Error: Layer3IpRoutingTable->settings->default-action rule index out of range");
+            destroyDynamicValue(def_action);
+            destroyRoutingTable(table);
+            return NULL;
+        }
+        table->default_next = table->nexts[def_action.value];
     }
     else
     {
-        state->default_drop = true;
+        table->default_next = NULL;
     }
     destroyDynamicValue(def_action);
 
-    dynamic_value_t mode_dv = parseDynamicNumericValueFromJsonObject(settings, "mode", 2, "source-ip", "dest-ip");
+    LOGD("Layer3IpRoutingTable: compiled %u rules, %u v4 and %u v6 prefixes", rules_len, table->lpm4->prefixes_count,
+         table->lpm6->prefixes_count);
 
-    if ((int) mode_dv.status != kDvsDestMode && (int) mode_dv.status != kDvsSourceMode)
+    return table;
+}
+
+// runs once on every worker loop, the worker is past any packet callback that could have loaded the old table
+static void onWorkerQuiescent(hevent_t *ev)
+{
+    retired_table_t *retired = hevent_userdata(ev);
+
+    if (atomic_fetch_sub_explicit(&(retired->pending_workers), 1, memory_order_acq_rel) == 1)
     {
-        LOGF("Layer3IpRoutingTable: Layer3IpRoutingTable->settings->mode (string field)  mode is not set or invalid, "
-             "do you "
-             "want to filter based on source ip or dest ip?");
-        exit(1);
+        destroyRoutingTable(retired->table);
+        globalFree(retired);
     }
-    destroyDynamicValue(mode_dv);
+}
 
+static void swapRoutingTable(layer3_ip_routing_table_state_t *state, routing_table_t *table)
+{
+    hmutex_lock(&(state->reload_lock));
 
-    const cJSON *rules = cJSON_GetObjectItemCaseSensitive(settings, "rules");
-    if (! cJSON_IsArray(rules))
+    routing_table_t *old = atomic_exchange_explicit(&(state->table), table, memory_order_acq_rel);
+
+    retired_table_t *retired = globalMalloc(sizeof(retired_table_t));
+    retired->table           = old;
+    atomic_init(&(retired->pending_workers), getWorkersCount());
+
+    for (tid_t tid = 0; tid < getWorkersCount(); tid++)
     {
-        LOGF("JSON Error: Layer3IpRoutingTable->settings->rules (array field) : The arary was empty or invalid");
-        exit(1);
+        hevent_t ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.loop = getWorkerLoop(tid);
+        ev.cb   = onWorkerQuiescent;
+        hevent_set_userdata(&ev, retired);
+        hloop_post_event(getWorkerLoop(tid), &ev);
     }
 
-    unsigned int i         = 0;
-    const cJSON *list_item = NULL;
-    cJSON_ArrayForEach(list_item, rules)
+    hmutex_unlock(&(state->reload_lock));
+}
+
+tunnel_t *newLayer3IpRoutingTable(node_instance_context_t *instance_info)
+{
+    layer3_ip_routing_table_state_t *state = globalMalloc(sizeof(layer3_ip_routing_table_state_t));
+    memset(state, 0, sizeof(layer3_ip_routing_table_state_t));
+    cJSON *settings = instance_info->node_settings_json;
+
+    if (! (cJSON_IsObject(settings) && settings->child != NULL))
     {
-        state->routes[i++] = parseRule(instance_info->node_manager_config, instance_info->chain_index, list_item);
+        LOGF("JSON Error: Layer3IpRoutingTable->settings (object field) : The object was empty or invalid");
+        return NULL;
     }
 
-    if (i == 0)
+    dynamic_value_t mode_dv = parseDynamicNumericValueFromJsonObject(settings, "mode", 2, "source-ip", "dest-ip");
+
+    if ((int) mode_dv.status != kDvsDestMode && (int) mode_dv.status != kDvsSourceMode)
     {
-        LOGF("Layer3IpRoutingTable: no rules");
+        LOGF("Layer3IpRoutingTable: Layer3IpRoutingTable->settings->mode (string field)  mode is not set or invalid, "
+             "do you "
+             "want to filter based on source ip or dest ip?");
         exit(1);
     }
-    if (i > ARRAY_SIZE(state->routes))
+    destroyDynamicValue(mode_dv);
+
+    state->node_manager_config = instance_info->node_manager_config;
+    state->chain_index         = instance_info->chain_index;
+    hmutex_init(&(state->reload_lock));
+
+    routing_table_t *table = compileRoutingTable(state, settings, true);
+    if (table == NULL)
     {
-        LOGF("Layer3IpRoutingTable: too much rules");
+        LOGF("Layer3IpRoutingTable: could not build the routing table");
         exit(1);
     }
-    state->routes_len = i;
+    atomic_init(&(state->table), table);
 
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = ((int) mode_dv.status == kDvsDestMode) ? &upStreamDestMode : &upStreamSrcMode;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = ((int) mode_dv.status == kDvsDestMode) ? &upStreamDestMode : &upStreamSrcMode;
+    t->downStream     = &downStream;
+    t->fnPacketBatchU = ((int) mode_dv.status == kDvsDestMode) ? &upStreamBatchDestMode : &upStreamBatchSrcMode;
 
     return t;
 }
+
+// the result is a json object allocated with globalMalloc, "ok" tells whether the routes were replaced
+static api_result_t makeApiResult(bool ok, uint32_t rules_len, const char *error)
+{
+    const size_t cap    = 256;
+    char        *result = globalMalloc(cap);
+    int          len;
+
+    if (ok)
+    {
+        len = snprintf(result, cap, "{\"ok\":true,\"rules\":%u}", rules_len);
+    }
+    else
+    {
+        len = snprintf(result, cap, "{\"ok\":false,\"error\":\"%s\"}", error);
+    }
+    return (api_result_t) {.result = result, .result_len = (size_t) len};
+}
+
+/*
+    live reload, msg is a json object in the same format as the settings ("rules" and optional "default-action"),
+    the next nodes of the rules must already be running
+*/
 api_result_t apiLayer3IpRoutingTable(tunnel_t *self, const char *msg)
 {
-    (void) (self);
-    (void) (msg);
-    return (api_result_t) {0};
+    layer3_ip_routing_table_state_t *state = TSTATE(self);
+
+    cJSON *json = cJSON_Parse(msg);
+    if (! cJSON_IsObject(json))
+    {
+        LOGE("Layer3IpRoutingTable: reload failed, the message is not a json object");
+        cJSON_Delete(json);
+        return makeApiResult(false, 0, "the message is not a json object");
+    }
+
+    routing_table_t *table = compileRoutingTable(state, json, false);
+    cJSON_Delete(json);
+
+    if (table == NULL)
+    {
+        LOGE("Layer3IpRoutingTable: reload failed, keeping the current routes");
+        return makeApiResult(false, 0, "invalid rules, the current routes are kept");
+    }
+
+    const uint32_t rules_len = table->rules_len;
+    swapRoutingTable(state, table);
+    LOGI("Layer3IpRoutingTable: routes reloaded, %u rules", rules_len);
+    return makeApiResult(true, rules_len, NULL);
 }
 
 tunnel_t *destroyLayer3IpRoutingTable(tunnel_t *self)
@@ -10,6 +10,7 @@ typedef struct layer3_receiver_state_s
 {
     char     *device_name;
     tunnel_t *device_tunnel;
+    bool      trust_checksums;
 
 } layer3_receiver_state_t;
 
@@ -30,49 +31,77 @@ enum mode_dynamic_value_status
 };
 
 
-static void upStream(tunnel_t *self, context_t *c)
+static bool isValidPacket(shift_buffer_t *buf)
 {
-    // layer3_receiver_state_t *state = TSTATE(self);
-    (void) (self);
-
-    packet_mask *packet = (packet_mask *) (rawBufMut(c->payload));
+    packet_mask *packet = (packet_mask *) (rawBufMut(buf));
 
-    /*      im not sure these checks are necessary    */
-    if (kCheckPackets)
+    if (packet->ip4_header.version == 4)
     {
-        if (packet->ip4_header.version == 4)
+        if (WW_UNLIKELY(bufLen(buf) < sizeof(struct ipv4header)))
         {
-            if (WW_UNLIKELY(bufLen(c->payload) < sizeof(struct ipv4header)))
-            {
-                LOGW("Layer3Receiver: dropped a ipv4 packet that was too small");
-                reuseContextPayload(c);
-                destroyContext(c);
-                return;
-            }
+            LOGW("Layer3Receiver: dropped a ipv4 packet that was too small");
+            return false;
         }
-        else if (packet->ip6_header.version == 6)
-        {
+    }
+    else if (packet->ip6_header.version == 6)
+    {
 
-            if (WW_UNLIKELY(bufLen(c->payload) < sizeof(struct ipv6header)))
-            {
-                LOGW("Layer3Receiver: dropped a ipv6 packet that was too small");
-                reuseContextPayload(c);
-                destroyContext(c);
-                return;
-            }
-        }
-        else
+        if (WW_UNLIKELY(bufLen(buf) < sizeof(struct ipv6header)))
         {
-            LOGW("Layer3Receiver: dropped a non ip protocol packet");
-            reuseContextPayload(c);
-            destroyContext(c);
-            return;
+            LOGW("Layer3Receiver: dropped a ipv6 packet that was too small");
+            return false;
         }
     }
+    else
+    {
+        LOGW("Layer3Receiver: dropped a non ip protocol packet");
+        return false;
+    }
+    return true;
+}
+
+static void upStream(tunnel_t *self, context_t *c)
+{
+    layer3_receiver_state_t *state = TSTATE(self);
+
+    /*      im not sure these checks are necessary    */
+    if (kCheckPackets && ! isValidPacket(c->payload))
+    {
+        reuseContextPayload(c);
+        destroyContext(c);
+        return;
+    }
+
+    // the next nodes update the checksums incrementally instead of the sender recomputing them
+    c->checksum_clean = state->trust_checksums;
 
     self->up->upStream(self->up, c);
 }
 
+static void upStreamBatch(tunnel_t *self, packet_batch_t *batch)
+{
+    layer3_receiver_state_t *state = TSTATE(self);
+
+    const uint16_t count = batch->count;
+    batch->count         = 0;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        shift_buffer_t *buf = batch->bufs[i];
+        if (kCheckPackets && ! isValidPacket(buf))
+        {
+            reuseBuffer(getLineBufferPool(batch->line), buf);
+            continue;
+        }
+        packetBatchPush(batch, buf, state->trust_checksums);
+    }
+
+    if (batch->count > 0)
+    {
+        upStreamPacketBatch(self->up, batch);
+    }
+}
+
 static void downStream(tunnel_t *self, context_t *c)
 {
     (void) (self);
@@ -136,11 +165,17 @@ tunnel_t *newLayer3Receiver(node_instance_context_t *instance_info)
 
     state->device_tunnel = tundevice_node->instance;
 
+    // packets read from a tun device are complete and carry valid checksums, a capture device may hand us packets
+    // with offloaded (partial) checksums, so only those from tun are trusted by default
+    getBoolFromJsonObjectOrDefault(&(state->trust_checksums), settings, "trust-checksums",
+                                   strcmp(tundevice_node->type, "TunDevice") == 0);
+
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = &upStream;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->fnPacketBatchU = &upStreamBatch;
 
     chain(tundevice_node->instance, t);
 
@@ -66,47 +66,47 @@ static void printSendingIPPacketInfo(const unsigned char *buffer, unsigned int l
     LOGD(logbuf);
 }
 
+static void recalculateCheckSums(shift_buffer_t *buf)
+{
+    if (! recalculatePacketCheckSums(rawBufMut(buf)))
+    {
+        LOGF("Layer3Sender: non ip packets is assumed to be pre-filtered by receiver node");
+        exit(1);
+    }
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     layer3_senderstate_t *state = TSTATE(self);
 
     // printSendingIPPacketInfo(rawBuf(c->payload), bufLen(c->payload));
 
-    packet_mask *packet = (packet_mask *) (rawBufMut(c->payload));
-    unsigned int ip_header_len;
-
-    /* Tcp checksum must be recalculated even if ip header is the only changed part of packet */
-
-    if (packet->ip4_header.version == 4)
+    /*
+        Tcp checksum must be recalculated even if ip header is the only changed part of packet, unless every node
+        before us kept the checksums valid with incremental updates (checksum_clean)
+    */
+    if (! c->checksum_clean)
     {
-        ip_header_len = packet->ip4_header.ihl * 4;
+        recalculateCheckSums(c->payload);
+    }
+
+    state->device_tunnel->upStream(state->device_tunnel, c);
+}
 
-        packet->ip4_header.check = 0x0;
-        packet->ip4_header.check = standardCheckSum((void *) packet, packet->ip4_header.ihl * 4);
+static void upStreamBatch(tunnel_t *self, packet_batch_t *batch)
+{
+    layer3_senderstate_t *state = TSTATE(self);
 
-        if (packet->ip4_header.protocol == 6)
-        {
-            struct tcpheader *tcp_header = (struct tcpheader *) (rawBufMut(c->payload) + ip_header_len);
-            tcpCheckSum4(&(packet->ip4_header), tcp_header);
-        }
-    }
-    else if (packet->ip6_header.version == 6)
+    for (uint16_t i = 0; i < batch->count; i++)
     {
-        ip_header_len = sizeof(struct ipv6header);
-
-        if (packet->ip6_header.nexthdr == 6)
+        if (! batch->checksum_clean[i])
         {
-            struct tcpheader *tcp_header = (struct tcpheader *) (rawBufMut(c->payload) + ip_header_len);
-            tcpCheckSum6(&(packet->ip6_header), tcp_header);
+            recalculateCheckSums(batch->bufs[i]);
+            batch->checksum_clean[i] = true;
         }
     }
-    else
-    {
-        LOGF("Layer3Sender: non ip packets is assumed to be pre-filtered by receiver node");
-        exit(1);
-    }
 
-    state->device_tunnel->upStream(state->device_tunnel, c);
+    upStreamPacketBatch(state->device_tunnel, batch);
 }
 
 static void downStream(tunnel_t *self, context_t *c)
@@ -202,9 +202,10 @@ tunnel_t *newLayer3Sender(node_instance_context_t *instance_info)
 
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = &upStream;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->fnPacketBatchU = &upStreamBatch;
 
     // for testing
     // htimer_t *tm = htimer_add(getWorkerLoop(0), onTimer, 500, INFINITE);
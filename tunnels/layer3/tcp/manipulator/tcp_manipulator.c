@@ -93,11 +93,32 @@ static inline void handleDestPortAction(struct tcpheader *tcp_header, dynamic_va
     }
 }
 
-static void upStream(tunnel_t *self, context_t *c)
+// patch the tcp checksum for the words we changed (rfc 1624), so the sender does not need to sum the whole segment
+static inline void updateCheckSum(struct tcpheader *tcp_header, uint16_t old_flags, uint16_t old_source,
+                                  uint16_t old_dest)
 {
-    layer3_tcp_manipulator_state_t *state = TSTATE(self);
+    const uint16_t new_flags = tcpFlagsWord(tcp_header);
+    uint16_t       check     = tcp_header->check;
 
-    packet_mask *packet = (packet_mask *) (rawBufMut(c->payload));
+    if (new_flags != old_flags)
+    {
+        check = checkSumUpdate16(check, old_flags, new_flags);
+    }
+    if (tcp_header->source != old_source)
+    {
+        check = checkSumUpdate16(check, old_source, tcp_header->source);
+    }
+    if (tcp_header->dest != old_dest)
+    {
+        check = checkSumUpdate16(check, old_dest, tcp_header->dest);
+    }
+    tcp_header->check = check;
+}
+
+// returns false when the packet must be dropped, packets that are not tcp pass untouched
+static bool handlePacket(layer3_tcp_manipulator_state_t *state, shift_buffer_t *buf, bool checksum_clean)
+{
+    packet_mask *packet = (packet_mask *) (rawBufMut(buf));
 
     unsigned int ip_header_len;
 
@@ -105,38 +126,32 @@ static void upStream(tunnel_t *self, context_t *c)
     {
         ip_header_len = packet->ip4_header.ihl * 4;
 
-        if (WW_UNLIKELY(bufLen(c->payload) < ip_header_len + sizeof(struct tcpheader)))
+        if (WW_UNLIKELY(bufLen(buf) < ip_header_len + sizeof(struct tcpheader)))
         {
             LOGW("TcpManipulator: dropped an ipv4 packet, length is too short for TCP header");
-            reuseContextPayload(c);
-            destroyContext(c);
-            return;
+            return false;
         }
 
         if (packet->ip4_header.protocol != 6)
         {
             // LOGD("TcpManipulator: ipv4 packet is not TCP");
-            self->up->upStream(self->up, c);
-            return;
+            return true;
         }
     }
     else if (packet->ip6_header.version == 6)
     {
         ip_header_len = sizeof(struct ipv6header);
 
-        if (WW_UNLIKELY(bufLen(c->payload) < ip_header_len + sizeof(struct tcpheader)))
+        if (WW_UNLIKELY(bufLen(buf) < ip_header_len + sizeof(struct tcpheader)))
         {
             LOGW("TcpManipulator: dropped an ipv6 packet, length is too short for TCP header");
-            reuseContextPayload(c);
-            destroyContext(c);
-            return;
+            return false;
         }
 
         if (packet->ip6_header.nexthdr != 6)
         {
             // LOGD("TcpManipulator: ipv6 packet is not TCP");
-            self->up->upStream(self->up, c);
-            return;
+            return true;
         }
     }
     else
@@ -145,19 +160,66 @@ static void upStream(tunnel_t *self, context_t *c)
         exit(1);
     }
 
-    struct tcpheader *tcp_header = (struct tcpheader *) (rawBufMut(c->payload) + ip_header_len);
+    struct tcpheader *tcp_header = (struct tcpheader *) (rawBufMut(buf) + ip_header_len);
+
+    const uint16_t old_flags  = tcpFlagsWord(tcp_header);
+    const uint16_t old_source = tcp_header->source;
+    const uint16_t old_dest   = tcp_header->dest;
 
     handleResetBitAction(tcp_header, &(state->reset_bit_action));
 
     handleSourcePortAction(tcp_header, &(state->source_port_action), state->corrupt_password,
-                           ((const char *) rawBufMut(c->payload) + bufLen(c->payload)));
+                           ((const char *) rawBufMut(buf) + bufLen(buf)));
 
     handleDestPortAction(tcp_header, &(state->dest_port_action), state->corrupt_password,
-                         ((const char *) rawBufMut(c->payload) + bufLen(c->payload)));
+                         ((const char *) rawBufMut(buf) + bufLen(buf)));
+
+    if (checksum_clean)
+    {
+        updateCheckSum(tcp_header, old_flags, old_source, old_dest);
+    }
+    return true;
+}
+
+static void upStream(tunnel_t *self, context_t *c)
+{
+    layer3_tcp_manipulator_state_t *state = TSTATE(self);
+
+    if (! handlePacket(state, c->payload, c->checksum_clean))
+    {
+        reuseContextPayload(c);
+        destroyContext(c);
+        return;
+    }
 
     self->up->upStream(self->up, c);
 }
 
+static void upStreamBatch(tunnel_t *self, packet_batch_t *batch)
+{
+    layer3_tcp_manipulator_state_t *state = TSTATE(self);
+
+    const uint16_t count = batch->count;
+    batch->count         = 0;
+
+    for (uint16_t i = 0; i < count; i++)
+    {
+        shift_buffer_t *buf   = batch->bufs[i];
+        const bool      clean = batch->checksum_clean[i];
+        if (! handlePacket(state, buf, clean))
+        {
+            reuseBuffer(getLineBufferPool(batch->line), buf);
+            continue;
+        }
+        packetBatchPush(batch, buf, clean);
+    }
+
+    if (batch->count > 0)
+    {
+        upStreamPacketBatch(self->up, batch);
+    }
+}
+
 static void downStream(tunnel_t *self, context_t *c)
 {
     (void) (self);
@@ -197,9 +259,10 @@ tunnel_t *newLayer3TcpManipulator(node_instance_context_t *instance_info)
 
     tunnel_t *t = newTunnel();
 
-    t->state      = state;
-    t->upStream   = &upStream;
-    t->downStream = &downStream;
+    t->state          = state;
+    t->upStream       = &upStream;
+    t->downStream     = &downStream;
+    t->fnPacketBatchU = &upStreamBatch;
 
     return t;
 }
@@ -0,0 +1,771 @@
+#include "tcp_terminator.h"
+#include "buffer_pool.h"
+#include "context_queue.h"
+#include "hloop.h"
+#include "loggers/network_logger.h"
+#include "managers/node_manager.h"
+#include "master_pool.h"
+#include "packet_types.h"
+#include "utils/hashutils.h"
+#include "utils/jsonutils.h"
+#include "lwip/init.h"
+#include "lwip/ip.h"
+#include "lwip/netif.h"
+#include "lwip/pbuf.h"
+#include "lwip/tcp.h"
+#include "lwip/timeouts.h"
+#include <stdatomic.h>
+
+/*
+    Terminates the tcp flows of the ip packets with lwIP and turns each accepted flow into a line
+
+    every worker runs its own lwIP (see tunnels/shared/lwip/lwipopts.h), the packets of a flow are always given
+    to the same worker (hash of the 5-tuple), so a pcb and its line never leave their worker
+
+    the listener is bound to port 0 and lwIP is patched to accept any destination (LWIP_TCP_ACCEPT_ANY), the
+    original destination of the flow is given to the next nodes in line->dest_ctx
+
+    the segments lwIP sends back are written directly to the tun device, like Layer3Sender does
+
+    upstream pause holds back tcp_recved, so the window of the client closes instead of us buffering
+
+*/
+
+enum
+{
+    kDefaultMtu           = 1500,
+    kLwipTimerIntervalMs  = 100,
+    kMasterMessagePoolCap = 64
+};
+
+typedef struct layer3_tcp_terminator_worker_s
+{
+    tunnel_t       *tunnel;
+    struct netif    netif;
+    struct tcp_pcb *listen_pcb;
+    htimer_t       *timer;
+    tid_t           tid;
+    bool            initialized;
+
+} layer3_tcp_terminator_worker_t;
+
+typedef struct layer3_tcp_terminator_state_s
+{
+    char                           *device_name;
+    tunnel_t                       *device_tunnel;
+    line_t                        **thread_lines;
+    master_pool_t                  *steer_message_pool;
+    layer3_tcp_terminator_worker_t *workers;
+    int                             mtu;
+
+} layer3_tcp_terminator_state_t;
+
+typedef struct layer3_tcp_terminator_con_state_s
+{
+    tunnel_t        *tunnel;
+    line_t          *line; // NULL when the line is gone and only the queued data is being sent before close
+    struct tcp_pcb  *pcb;
+    context_queue_t *data_queue;
+    uint32_t         held_recved; // bytes given to upstream while paused, the window opens for them on resume
+    bool             write_paused;
+    bool             read_paused;
+
+} layer3_tcp_terminator_con_state_t;
+
+// an input packet given to lwIP without copy, the buffer goes back to the pool when lwIP frees the pbuf
+typedef struct terminator_pbuf_s
+{
+    struct pbuf_custom p;
+    shift_buffer_t    *buf;
+    tid_t              tid;
+
+} terminator_pbuf_t;
+
+struct steer_msg_s
+{
+    tunnel_t       *tunnel;
+    shift_buffer_t *buf;
+};
+
+// lwIP globals are per thread, but a second terminator would share them with the first one on every worker
+static atomic_bool terminator_created = false;
+
+static pool_item_t *allocSteerMsgPoolHandle(struct master_pool_s *pool, void *userdata)
+{
+    (void) userdata;
+    (void) pool;
+    return globalMalloc(sizeof(struct steer_msg_s));
+}
+
+static void destroySteerMsgPoolHandle(struct master_pool_s *pool, master_pool_item_t *item, void *userdata)
+{
+    (void) pool;
+    (void) userdata;
+    globalFree(item);
+}
+
+static void freeInputPbuf(struct pbuf *p)
+{
+    terminator_pbuf_t *tp = (terminator_pbuf_t *) p;
+    if (tp->buf)
+    {
+        reuseBuffer(getWorkerBufferPool(tp->tid), tp->buf);
+    }
+    globalFree(tp);
+}
+
+// consumes the pbuf
+static shift_buffer_t *pbufToBuffer(tid_t tid, struct pbuf *p)
+{
+    shift_buffer_t *buf;
+
+    if (p->next == NULL && p->ref == 1 && (p->flags & PBUF_FLAG_IS_CUSTOM))
+    {
+        // the segment is still inside the buffer its packet was read into, take the buffer back from lwIP
+        terminator_pbuf_t *tp = (terminator_pbuf_t *) p;
+        buf                   = tp->buf;
+        tp->buf               = NULL;
+        shiftr(buf, (uint32_t) ((uint8_t *) p->payload - rawBufMut(buf)));
+        setLen(buf, p->len);
+    }
+    else
+    {
+        buf = popBuffer(getWorkerBufferPool(tid));
+        buf = reserveBufSpace(buf, p->tot_len);
+        setLen(buf, p->tot_len);
+        pbuf_copy_partial(p, rawBufMut(buf), p->tot_len, 0);
+    }
+    pbuf_free(p);
+    return buf;
+}
+
+static void sockAddrFromLwip(sockaddr_u *dest, const ip_addr_t *ip, u16_t port)
+{
+    if (IP_IS_V6(ip))
+    {
+        dest->sin6.sin6_family = AF_INET6;
+        dest->sin6.sin6_port   = htons(port);
+        memcpy(&(dest->sin6.sin6_addr), ip_2_ip6(ip)->addr, sizeof(dest->sin6.sin6_addr));
+    }
+    else
+    {
+        dest->sin.sin_family      = AF_INET;
+        dest->sin.sin_port        = htons(port);
+        dest->sin.sin_addr.s_addr = ip_2_ip4(ip)->addr;
+    }
+}
+
+static err_t onPollRetryClose(void *arg, struct tcp_pcb *pcb);
+
+static void closePcb(struct tcp_pcb *pcb)
+{
+    tcp_arg(pcb, NULL);
+    tcp_recv(pcb, NULL);
+    tcp_sent(pcb, NULL);
+    tcp_err(pcb, NULL);
+    if (tcp_close(pcb) != ERR_OK)
+    {
+        // no memory for the fin segment, lwIP asks again on poll
+        tcp_poll(pcb, onPollRetryClose, 2);
+    }
+}
+
+static err_t onPollRetryClose(void *arg, struct tcp_pcb *pcb)
+{
+    (void) arg;
+    closePcb(pcb);
+    return ERR_OK;
+}
+
+static void openWindow(layer3_tcp_terminator_con_state_t *cstate)
+{
+    while (cstate->held_recved > 0)
+    {
+        u16_t len = (u16_t) min(cstate->held_recved, 0xFFFF);
+        tcp_recved(cstate->pcb, len);
+        cstate->held_recved -= len;
+    }
+}
+
+static void destroyConState(layer3_tcp_terminator_con_state_t *cstate)
+{
+    destroyContextQueue(cstate->data_queue);
+    globalFree(cstate);
+}
+
+// the line is finished, the pcb may still have queued data to send
+static void detachLine(layer3_tcp_terminator_con_state_t *cstate)
+{
+    tunnel_t *self = cstate->tunnel;
+    line_t   *line = cstate->line;
+
+    if (cstate->write_paused)
+    {
+        resumeLineUpSide(line);
+    }
+    LSTATE_DROP(line);
+    doneLineDownSide(line);
+    destroyLine(line);
+    cstate->line = NULL;
+}
+
+static void cleanup(layer3_tcp_terminator_con_state_t *cstate)
+{
+    if (cstate->line)
+    {
+        detachLine(cstate);
+    }
+    if (cstate->pcb)
+    {
+        // unread data makes lwIP reset instead of fin
+        openWindow(cstate);
+        closePcb(cstate->pcb);
+        cstate->pcb = NULL;
+    }
+    destroyConState(cstate);
+}
+
+static void finishByRemote(layer3_tcp_terminator_con_state_t *cstate)
+{
+    tunnel_t  *self = cstate->tunnel;
+    context_t *fc   = newFinContext(cstate->line);
+    cleanup(cstate);
+    self->up->upStream(self->up, fc);
+}
+
+// returns true when all of buf went to the send buffer of the pcb, the written part is shifted out of buf
+static bool writeToPcb(struct tcp_pcb *pcb, shift_buffer_t *buf)
+{
+    while (bufLen(buf) > 0)
+    {
+        u16_t len = (u16_t) min(bufLen(buf), (uint32_t) tcp_sndbuf(pcb));
+        if (len == 0 || tcp_write(pcb, rawBuf(buf), len, TCP_WRITE_FLAG_COPY) != ERR_OK)
+        {
+            return false;
+        }
+        shiftr(buf, len);
+    }
+    return true;
+}
+
+static bool resumeWriteQueue(layer3_tcp_terminator_con_state_t *cstate)
+{
+    context_queue_t *data_queue = cstate->data_queue;
+    while (contextQueueLen(data_queue) > 0)
+    {
+        context_t *cw = contextQueuePop(data_queue);
+        if (! writeToPcb(cstate->pcb, cw->payload))
+        {
+            contextQueuePushFront(data_queue, cw);
+            return false;
+        }
+        reuseContextPayload(cw);
+        destroyContext(cw);
+    }
+    return true;
+}
+
+static err_t onSent(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+    (void) pcb;
+    (void) len;
+    layer3_tcp_terminator_con_state_t *cstate = arg;
+
+    if (! cstate->write_paused)
+    {
+        return ERR_OK;
+    }
+    bool drained = resumeWriteQueue(cstate);
+    tcp_output(cstate->pcb);
+    if (! drained)
+    {
+        return ERR_OK;
+    }
+
+    cstate->write_paused = false;
+    if (cstate->line)
+    {
+        resumeLineUpSide(cstate->line);
+    }
+    else
+    {
+        // upstream finished while its data was waiting for the window
+        closePcb(cstate->pcb);
+        cstate->pcb = NULL;
+        destroyConState(cstate);
+    }
+    return ERR_OK;
+}
+
+static err_t onRecv(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+    (void) err;
+    layer3_tcp_terminator_con_state_t *cstate = arg;
+
+    if (p == NULL)
+    {
+        if (cstate->line)
+        {
+            finishByRemote(cstate);
+        }
+        return ERR_OK;
+    }
+
+    const u16_t len = p->tot_len;
+
+    if (cstate->line == NULL)
+    {
+        tcp_recved(pcb, len);
+        pbuf_free(p);
+        return ERR_OK;
+    }
+
+    tunnel_t       *self = cstate->tunnel;
+    line_t         *line = cstate->line;
+    shift_buffer_t *buf  = pbufToBuffer(line->tid, p);
+
+    if (cstate->read_paused)
+    {
+        cstate->held_recved += len;
+    }
+    else
+    {
+        tcp_recved(pcb, len);
+    }
+
+    context_t *c = newContext(line);
+    c->payload   = buf;
+    self->up->upStream(self->up, c);
+    return ERR_OK;
+}
+
+static void onError(void *arg, err_t err)
+{
+    (void) err;
+    layer3_tcp_terminator_con_state_t *cstate = arg;
+    if (cstate == NULL)
+    {
+        return;
+    }
+    // lwIP already freed the pcb
+    cstate->pcb = NULL;
+    if (cstate->line)
+    {
+        finishByRemote(cstate);
+    }
+    else
+    {
+        destroyConState(cstate);
+    }
+}
+
+static void onLinePaused(void *userdata)
+{
+    layer3_tcp_terminator_con_state_t *cstate = (layer3_tcp_terminator_con_state_t *) (userdata);
+    cstate->read_paused                       = true;
+}
+
+static void onLineResumed(void *userdata)
+{
+    layer3_tcp_terminator_con_state_t *cstate = (layer3_tcp_terminator_con_state_t *) (userdata);
+
+    if (cstate->read_paused)
+    {
+        cstate->read_paused = false;
+        openWindow(cstate);
+        tcp_output(cstate->pcb);
+    }
+}
+
+static err_t onAccept(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+    layer3_tcp_terminator_worker_t *worker = arg;
+    if (err != ERR_OK || pcb == NULL)
+    {
+        return ERR_VAL;
+    }
+
+    tunnel_t                          *self   = worker->tunnel;
+    line_t                            *line   = newLine(worker->tid);
+    layer3_tcp_terminator_con_state_t *cstate = globalMalloc(sizeof(layer3_tcp_terminator_con_state_t));
+
+    *cstate = (layer3_tcp_terminator_con_state_t) {.tunnel       = self,
+                                                   .line         = line,
+                                                   .pcb          = pcb,
+                                                   .data_queue   = newContextQueue(),
+                                                   .held_recved  = 0,
+                                                   .write_paused = false,
+                                                   .read_paused  = false};
+    LSTATE_MUT(line) = cstate;
+
+    const enum socket_address_type address_type = IP_IS_V6(&(pcb->local_ip)) ? kSatIPV6 : kSatIPV4;
+
+    line->src_ctx.address_protocol = kSapTcp;
+    line->src_ctx.address_type     = address_type;
+    sockAddrFromLwip(&(line->src_ctx.address), &(pcb->remote_ip), pcb->remote_port);
+
+    // the destination the client wanted, next nodes can connect there (transparent proxy)
+    line->dest_ctx.address_protocol = kSapTcp;
+    line->dest_ctx.address_type     = address_type;
+    sockAddrFromLwip(&(line->dest_ctx.address), &(pcb->local_ip), pcb->local_port);
+
+    setupLineDownSide(line, onLinePaused, cstate, onLineResumed);
+
+    tcp_arg(pcb, cstate);
+    tcp_recv(pcb, onRecv);
+    tcp_sent(pcb, onSent);
+    tcp_err(pcb, onError);
+    tcp_nagle_disable(pcb);
+
+    // send the init packet
+    lockLine(line);
+    {
+        context_t *context = newInitContext(line);
+        self->up->upStream(self->up, context);
+        if (! isAlive(line))
+        {
+            LOGW("Layer3TcpTerminator: flow just got closed by upstream before anything happend");
+        }
+    }
+    unLockLine(line);
+    return ERR_OK;
+}
+
+static err_t outputPacket(struct netif *netif, struct pbuf *p)
+{
+    layer3_tcp_terminator_worker_t *worker = netif->state;
+    tunnel_t                       *self   = worker->tunnel;
+    layer3_tcp_terminator_state_t  *state  = TSTATE(self);
+
+    shift_buffer_t *buf = popBuffer(getWorkerBufferPool(worker->tid));
+    buf                 = reserveBufSpace(buf, p->tot_len);
+    setLen(buf, p->tot_len);
+    pbuf_copy_partial(p, rawBufMut(buf), p->tot_len, 0);
+
+    context_t *c = newContext(state->thread_lines[worker->tid]);
+    c->payload   = buf;
+    state->device_tunnel->upStream(state->device_tunnel, c);
+    return ERR_OK;
+}
+
+static err_t outputIp4(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr)
+{
+    (void) ipaddr;
+    return outputPacket(netif, p);
+}
+
+static err_t outputIp6(struct netif *netif, struct pbuf *p, const ip6_addr_t *ipaddr)
+{
+    (void) ipaddr;
+    return outputPacket(netif, p);
+}
+
+static err_t initNetif(struct netif *netif)
+{
+    layer3_tcp_terminator_worker_t *worker = netif->state;
+    layer3_tcp_terminator_state_t  *state  = TSTATE(worker->tunnel);
+
+    netif->name[0]    = 'w';
+    netif->name[1]    = 'w';
+    netif->mtu        = (u16_t) state->mtu;
+    netif->output     = outputIp4;
+    netif->output_ip6 = outputIp6;
+    return ERR_OK;
+}
+
+static void onLwipTimer(htimer_t *timer)
+{
+    (void) timer;
+    sys_check_timeouts();
+}
+
+// runs on the worker itself, all lwIP state of this thread is created here
+static void initWorkerStack(layer3_tcp_terminator_worker_t *worker)
+{
+    lwip_init();
+
+    // ip4_route refuses a netif without address, the pcbs always send from the address the client used
+    ip4_addr_t netif_addr;
+    ip4_addr_t netif_mask;
+    IP4_ADDR(&netif_addr, 198, 18, 255, 254);
+    IP4_ADDR(&netif_mask, 255, 255, 255, 255);
+
+    netif_add(&(worker->netif), &netif_addr, &netif_mask, IP4_ADDR_ANY4, worker, initNetif, ip_input);
+    netif_set_default(&(worker->netif));
+    netif_set_link_up(&(worker->netif));
+    netif_set_up(&(worker->netif));
+
+    struct tcp_pcb *pcb = tcp_new_ip_type(IPADDR_TYPE_ANY);
+    // not bound, tcp_bind would pick an ephemeral port but the listener must stay on port 0 to accept any
+    if (pcb == NULL)
+    {
+        LOGF("Layer3TcpTerminator: could not create the lwIP listener");
+        exit(1);
+    }
+    worker->listen_pcb = tcp_listen(pcb);
+    tcp_arg(worker->listen_pcb, worker);
+    tcp_accept(worker->listen_pcb, onAccept);
+
+    worker->timer = htimer_add(getWorkerLoop(worker->tid), onLwipTimer, kLwipTimerIntervalMs, INFINITE);
+
+    worker->initialized = true;
+}
+
+static void inputPacket(layer3_tcp_terminator_worker_t *worker, shift_buffer_t *buf)
+{
+    if (WW_UNLIKELY(! worker->initialized))
+    {
+        initWorkerStack(worker);
+    }
+
+    const u16_t        len = (u16_t) bufLen(buf);
+    terminator_pbuf_t *tp  = globalMalloc(sizeof(terminator_pbuf_t));
+
+    tp->p.custom_free_function = freeInputPbuf;
+    tp->buf                    = buf;
+    tp->tid                    = worker->tid;
+
+    struct pbuf *p = pbuf_alloced_custom(PBUF_RAW, len, PBUF_REF, &(tp->p), rawBufMut(buf), len);
+
+    if (worker->netif.input(p, &(worker->netif)) != ERR_OK)
+    {
+        pbuf_free(p);
+    }
+}
+
+static void onSteeredPacket(hevent_t *ev)
+{
+    struct steer_msg_s            *msg   = hevent_userdata(ev);
+    tid_t                          tid   = (tid_t) (hloop_tid(hevent_loop(ev)));
+    layer3_tcp_terminator_state_t *state = TSTATE(msg->tunnel);
+
+    inputPacket(&(state->workers[tid]), msg->buf);
+
+    reuseMasterPoolItems(state->steer_message_pool, (void **) &msg, 1, msg->tunnel);
+}
+
+static void steerPacket(tunnel_t *self, tid_t target_tid, shift_buffer_t *buf)
+{
+    layer3_tcp_terminator_state_t *state = TSTATE(self);
+    struct steer_msg_s            *msg;
+    popMasterPoolItems(state->steer_message_pool, (const void **) &(msg), 1, self);
+
+    *msg = (struct steer_msg_s) {.tunnel = self, .buf = buf};
+
+    hevent_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.loop = getWorkerLoop(target_tid);
+    ev.cb   = onSteeredPacket;
+    hevent_set_userdata(&ev, msg);
+    hloop_post_event(getWorkerLoop(target_tid), &ev);
+}
+
+// the worker that owns the flow, false if the packet is not tcp
+static bool findFlowOwner(shift_buffer_t *buf, tid_t *owner)
+{
+    packet_mask *packet = (packet_mask *) (rawBufMut(buf));
+    uint8_t      tuple[(2 * sizeof(struct in6_addr)) + (2 * sizeof(uint16_t))];
+    uint32_t     tuple_len;
+
+    if (packet->ip4_header.version == 4)
+    {
+        if (! hasTcpHeader4(&(packet->ip4_header), bufLen(buf)))
+        {
+            return false;
+        }
+        memcpy(tuple, &(packet->ip4_header.saddr), 2 * sizeof(uint32_t));
+        memcpy(tuple + (2 * sizeof(uint32_t)), ((uint8_t *) packet) + (packet->ip4_header.ihl * 4),
+               2 * sizeof(uint16_t));
+        tuple_len = (2 * sizeof(uint32_t)) + (2 * sizeof(uint16_t));
+    }
+    else if (packet->ip6_header.version == 6)
+    {
+        if (! hasTcpHeader6(&(packet->ip6_header), bufLen(buf)))
+        {
+            return false;
+        }
+        memcpy(tuple, &(packet->ip6_header.saddr), 2 * sizeof(struct in6_addr));
+        memcpy(tuple + (2 * sizeof(struct in6_addr)), ((uint8_t *) packet) + sizeof(struct ipv6header),
+               2 * sizeof(uint16_t));
+        tuple_len = sizeof(tuple);
+    }
+    else
+    {
+        return false;
+    }
+
+    *owner = (tid_t) (CALC_HASH_BYTES(tuple, tuple_len) % getWorkersCount());
+    return true;
+}
+
+static void upStream(tunnel_t *self, context_t *c)
+{
+    layer3_tcp_terminator_state_t *state = TSTATE(self);
+
+    tid_t owner;
+    if (! findFlowOwner(c->payload, &owner) || bufLen(c->payload) > 0xFFFF)
+    {
+        // only tcp is terminated here
+        reuseContextPayload(c);
+        destroyContext(c);
+        return;
+    }
+
+    shift_buffer_t *buf = c->payload;
+    tid_t           tid = c->line->tid;
+    dropContexPayload(c);
+    destroyContext(c);
+
+    if (owner == tid)
+    {
+        inputPacket(&(state->workers[tid]), buf);
+    }
+    else
+    {
+        steerPacket(self, owner, buf);
+    }
+}
+
+static void downStream(tunnel_t *self, context_t *c)
+{
+    layer3_tcp_terminator_con_state_t *cstate = CSTATE(c);
+
+    if (c->payload != NULL)
+    {
+        if (cstate->write_paused)
+        {
+            pauseLineUpSide(c->line);
+            contextQueuePush(cstate->data_queue, c);
+            return;
+        }
+        if (! writeToPcb(cstate->pcb, c->payload))
+        {
+            // the rest waits for the client to ack what is in flight
+            pauseLineUpSide(c->line);
+            cstate->write_paused = true;
+            contextQueuePush(cstate->data_queue, c);
+        }
+        else
+        {
+            reuseContextPayload(c);
+            destroyContext(c);
+        }
+        tcp_output(cstate->pcb);
+    }
+    else
+    {
+        if (c->fin)
+        {
+            if (cstate->write_paused)
+            {
+                // keep the pcb until the queued data is sent, onSent closes it
+                detachLine(cstate);
+            }
+            else
+            {
+                cleanup(cstate);
+            }
+            destroyContext(c);
+        }
+        else
+        {
+            destroyContext(c);
+        }
+    }
+}
+
+tunnel_t *newLayer3TcpTerminator(node_instance_context_t *instance_info)
+{
+    if (atomic_exchange(&terminator_created, true))
+    {
+        LOGF("Layer3TcpTerminator: only one Layer3TcpTerminator can be used in a process");
+        exit(1);
+    }
+
+    layer3_tcp_terminator_state_t *state = globalMalloc(sizeof(layer3_tcp_terminator_state_t));
+    memset(state, 0, sizeof(layer3_tcp_terminator_state_t));
+    cJSON *settings = instance_info->node_settings_json;
+
+    if (! (cJSON_IsObject(settings) && settings->child != NULL))
+    {
+        LOGF("JSON Error: Layer3TcpTerminator->settings (object field) : The object was empty or invalid");
+        globalFree(state);
+        return NULL;
+    }
+
+    if (! getStringFromJsonObject(&(state->device_name), settings, "device"))
+    {
+        LOGF("JSON Error: Layer3TcpTerminator->settings->device (string field) : The string was empty or invalid");
+        globalFree(state);
+        return NULL;
+    }
+
+    getIntFromJsonObjectOrDefault(&(state->mtu), settings, "mtu", kDefaultMtu);
+    if (state->mtu < 1280 || state->mtu > 0xFFFF)
+    {
+        LOGF("JSON Error: Layer3TcpTerminator->settings->mtu (number field) : must be between 1280 and 65535");
+        exit(1);
+    }
+
+    hash_t  hash_tdev_name = CALC_HASH_BYTES(state->device_name, strlen(state->device_name));
+    node_t *tundevice_node = getNode(instance_info->node_manager_config, hash_tdev_name);
+
+    if (tundevice_node == NULL)
+    {
+        LOGF("Layer3TcpTerminator: could not find tun device node \"%s\"", state->device_name);
+        globalFree(state);
+        return NULL;
+    }
+
+    if (tundevice_node->instance == NULL)
+    {
+        runNode(instance_info->node_manager_config, tundevice_node, 0);
+    }
+
+    if (tundevice_node->instance == NULL)
+    {
+        globalFree(state);
+        return NULL;
+    }
+
+    state->device_tunnel = tundevice_node->instance;
+
+    tunnel_t *t = newTunnel();
+
+    state->thread_lines = globalMalloc(sizeof(line_t *) * getWorkersCount());
+    state->workers      = globalMalloc(sizeof(layer3_tcp_terminator_worker_t) * getWorkersCount());
+    memset(state->workers, 0, sizeof(layer3_tcp_terminator_worker_t) * getWorkersCount());
+
+    for (unsigned int i = 0; i < getWorkersCount(); i++)
+    {
+        state->thread_lines[i] = newLine(i);
+        state->workers[i]      = (layer3_tcp_terminator_worker_t) {.tunnel = t, .tid = (tid_t) i};
+    }
+
+    state->steer_message_pool = newMasterPoolWithCap(kMasterMessagePoolCap);
+    installMasterPoolAllocCallbacks(state->steer_message_pool, allocSteerMsgPoolHandle, destroySteerMsgPoolHandle);
+
+    t->state      = state;
+    t->upStream   = &upStream;
+    t->downStream = &downStream;
+
+    return t;
+}
+
+api_result_t apiLayer3TcpTerminator(tunnel_t *self, const char *msg)
+{
+    (void) (self);
+    (void) (msg);
+    return (api_result_t) {0};
+}
+
+tunnel_t *destroyLayer3TcpTerminator(tunnel_t *self)
+{
+    (void) (self);
+    return NULL;
+}
+
+tunnel_metadata_t getMetadataLayer3TcpTerminator(void)
+{
+    return (tunnel_metadata_t) {.version = 0001, .flags = 0x0};
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "api.h"
+
+// Layer3Packet ------>  lwIP (one per worker)  ------>  tcp line per accepted flow
+// TunDevice   <------  tcp segments of lwIP   <------  tcp line
+
+tunnel_t *        newLayer3TcpTerminator(node_instance_context_t *instance_info);
+api_result_t      apiLayer3TcpTerminator(tunnel_t *self, const char *msg);
+tunnel_t *        destroyLayer3TcpTerminator(tunnel_t *self);
+tunnel_metadata_t getMetadataLayer3TcpTerminator(void);
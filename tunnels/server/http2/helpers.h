@@ -131,10 +131,13 @@ static http2_server_con_state_t *createHttp2Connection(tunnel_t *self, line_t *l
     nghttp2_settings_entry settings[] = {
         {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, kMaxConcurrentStreams},
         {NGHTTP2_SETTINGS_MAX_FRAME_SIZE, (1U << 18)},
-        {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, (1U << 18)},
+        {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, kHttp2InitialWindowSize},
 
     };
     nghttp2_submit_settings(con->session, NGHTTP2_FLAG_NONE, settings, ARRAY_SIZE(settings));
+    // the connection window would stay at 64 KiB, less than what a single stream may have in flight
+    nghttp2_session_set_local_window_size(con->session, NGHTTP2_FLAG_NONE, 0, kHttp2InitialWindowSize);
+    initHttp2Bdp(&(con->bdp), kHttp2InitialWindowSize, state->max_window_size);
     return con;
 }
 static void deleteHttp2Connection(http2_server_con_state_t *con)
@@ -5,8 +5,14 @@
 #include "loggers/network_logger.h"
 #include "nghttp2/nghttp2.h"
 #include "types.h"
+#include "utils/jsonutils.h"
 #include "utils/mathutils.h"
 
+enum
+{
+    kMaxCoalescedControlWrite = 16 * 1024
+};
+
 static int onStreamClosedCallback(nghttp2_session *session, int32_t stream_id, uint32_t error_code, void *userdata)
 {
     (void) error_code;
@@ -90,15 +96,19 @@ static int onDataChunkRecvCallback(nghttp2_session *session, uint8_t flags, int3
     }
     http2_server_con_state_t *con = (http2_server_con_state_t *) userdata;
 
+    if (http2BdpReceived(&(con->bdp), (uint32_t) len, hloop_now_us(getWorkerLoop(con->line->tid))))
+    {
+        nghttp2_submit_ping(session, NGHTTP2_FLAG_NONE, kHttp2BdpProbeData);
+    }
+
     http2_server_child_con_state_t *stream = nghttp2_session_get_stream_user_data(session, stream_id);
     if (WW_UNLIKELY(! stream))
     {
         return 0;
     }
 
-    shift_buffer_t *buf = popBuffer(getLineBufferPool(con->line));
-    setLen(buf, len);
-    writeRaw(buf, data, len);
+    shift_buffer_t *buf =
+        http2RecvSliceData(&(con->recv_slice), getLineBufferPool(con->line), data, (uint32_t) len);
 
     lockLine(stream->line);
     action_queue_t_push(
@@ -107,6 +117,19 @@ static int onDataChunkRecvCallback(nghttp2_session *session, uint8_t flags, int3
     return 0;
 }
 
+static void onBdpProbeAck(http2_server_con_state_t *con)
+{
+    const uint32_t window = http2BdpProbeAcked(&(con->bdp), hloop_now_us(getWorkerLoop(con->line->tid)));
+    if (window == 0)
+    {
+        return;
+    }
+    // the connection window grows with a WINDOW_UPDATE, the stream windows by the new initial size
+    nghttp2_session_set_local_window_size(con->session, NGHTTP2_FLAG_NONE, 0, (int32_t) window);
+    nghttp2_settings_entry settings[] = {{NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, window}};
+    nghttp2_submit_settings(con->session, NGHTTP2_FLAG_NONE, settings, ARRAY_SIZE(settings));
+}
+
 static int onFrameRecvCallback(nghttp2_session *session, const nghttp2_frame *frame, void *userdata)
 {
     (void) session;
@@ -127,6 +150,10 @@ static int onFrameRecvCallback(nghttp2_session *session, const nghttp2_frame *fr
     case NGHTTP2_SETTINGS:
         break;
     case NGHTTP2_PING:
+        if ((frame->hd.flags & NGHTTP2_FLAG_ACK) && isHttp2BdpProbe(frame->ping.opaque_data))
+        {
+            onBdpProbeAck(con);
+        }
         break;
     case NGHTTP2_RST_STREAM:
     case NGHTTP2_WINDOW_UPDATE:
@@ -222,13 +249,23 @@ static bool sendNgHttp2Data(tunnel_t *self, http2_server_con_state_t *con)
 {
     line_t *main_line = con->line;
     char   *data      = NULL;
-    size_t  len       = nghttp2_session_mem_send(con->session, (const uint8_t **) &data);
+    ssize_t len       = nghttp2_session_mem_send(con->session, (const uint8_t **) &data);
 
     if (len > 0)
     {
-        shift_buffer_t *send_buf = reserveBufSpace(popBuffer(getLineBufferPool(main_line)),len);
+        shift_buffer_t *send_buf = reserveBufSpace(popBuffer(getLineBufferPool(main_line)), len);
         setLen(send_buf, len);
         writeRaw(send_buf, data, len);
+
+        // the other frames nghttp2 has ready (settings, window updates, headers...) go out in the same write
+        while (bufLen(send_buf) < kMaxCoalescedControlWrite &&
+               (len = nghttp2_session_mem_send(con->session, (const uint8_t **) &data)) > 0)
+        {
+            const uint32_t filled = bufLen(send_buf);
+            send_buf              = reserveBufSpace(send_buf, filled + len);
+            setLen(send_buf, filled + len);
+            memcpy(rawBufMut(send_buf) + filled, data, len);
+        }
         context_t *response_data = newContext(main_line);
         response_data->payload   = send_buf;
         self->dw->downStream(self->dw, response_data);
@@ -274,11 +311,11 @@ static void doHttp2Action(const http2_action_t action, http2_server_con_state_t
             {
                 if (stream->grpc_bytes_needed == 0 && bufferStreamLen(stream->grpc_buffer_stream) >= GRPC_MESSAGE_HDLEN)
                 {
-                    shift_buffer_t *gheader_buf = bufferStreamRead(stream->grpc_buffer_stream, GRPC_MESSAGE_HDLEN);
+                    uint8_t         gheader[GRPC_MESSAGE_HDLEN];
                     grpc_message_hd msghd;
-                    grpcMessageHdUnpack(&msghd, rawBuf(gheader_buf));
+                    bufferStreamReadBytes(stream->grpc_buffer_stream, gheader, GRPC_MESSAGE_HDLEN);
+                    grpcMessageHdUnpack(&msghd, gheader);
                     stream->grpc_bytes_needed = msghd.length;
-                    reuseBuffer(getLineBufferPool(con->line), gheader_buf);
                 }
                 if (stream->grpc_bytes_needed > 0 &&
                     bufferStreamLen(stream->grpc_buffer_stream) >= stream->grpc_bytes_needed)
@@ -348,9 +385,12 @@ static void upStream(tunnel_t *self, context_t *c)
 
         while ((len = bufLen(c->payload)) > 0)
         {
-            size_t  consumed = min(1 << 15UL, (ssize_t) len);
-            ssize_t ret      = nghttp2_session_mem_recv2(con->session, (const uint8_t *) rawBuf(c->payload), consumed);
-            shiftr(c->payload, consumed);
+            size_t consumed = min(1 << 15UL, (ssize_t) len);
+            http2RecvSliceBegin(&(con->recv_slice), c->payload);
+            ssize_t  ret  = nghttp2_session_mem_recv2(con->session, (const uint8_t *) rawBuf(c->payload), consumed);
+            uint32_t skip = (uint32_t) consumed;
+            c->payload    = http2RecvSliceEnd(&(con->recv_slice), &skip);
+            shiftr(c->payload, skip);
 
             if (ret != (ssize_t) consumed)
             {
@@ -498,9 +538,14 @@ static void downStream(tunnel_t *self, context_t *c)
 
 tunnel_t *newHttp2Server(node_instance_context_t *instance_info)
 {
-    (void) instance_info;
     http2_server_state_t *state = globalMalloc(sizeof(http2_server_state_t));
     memset(state, 0, sizeof(http2_server_state_t));
+    cJSON *settings = instance_info->node_settings_json;
+
+    // upper bound of the stream and connection receive windows, 0 keeps them fixed
+    int max_window_size;
+    getIntFromJsonObjectOrDefault(&(max_window_size), settings, "max-window-size", kHttp2DefaultMaxWindowSize);
+    state->max_window_size = max(0, max_window_size);
 
     nghttp2_session_callbacks_new(&(state->cbs));
     nghttp2_session_callbacks_set_on_header_callback(state->cbs, onHeaderCallback);
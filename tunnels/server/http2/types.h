@@ -2,6 +2,8 @@
 #include "api.h"
 #include "buffer_stream.h"
 
+#include "http2_bdp.h"
+#include "http2_recv_slice.h"
 #include "http_def.h"
 #include "nghttp2/nghttp2.h"
 
@@ -45,6 +47,8 @@ typedef struct http2_server_con_state_s
 {
     http2_server_child_con_state_t root;
     action_queue_t                 actions;
+    http2_recv_slice_t             recv_slice;
+    http2_bdp_t                    bdp;
     nghttp2_session               *session;
     tunnel_t                      *tunnel;
     line_t                        *line;
@@ -60,5 +64,6 @@ typedef struct http2_server_state_s
     nghttp2_session_callbacks *cbs;
     tunnel_t                  *fallback;
     nghttp2_option            *ngoptions;
+    uint32_t                   max_window_size;
 
 } http2_server_state_t;
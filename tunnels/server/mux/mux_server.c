@@ -1,11 +1,14 @@
 #include "mux_server.h"
 #include "buffer_stream.h"
 #include "loggers/network_logger.h"
+#include "mux_cid_table.h"
 #include "mux_frame.h"
+#include "mux_scheduler.h"
+#include "utils/jsonutils.h"
 
 typedef struct mux_server_state_s
 {
-    void *_;
+    uint8_t max_frame_version;
 
 } mux_server_state_t;
 
@@ -16,6 +19,7 @@ typedef struct mux_server_child_con_state_s
     tunnel_t                            *tunnel;
     line_t                              *line;
     line_t                              *parent;
+    mux_sched_stream_t                   stream;
     uint32_t                             sent_nack;
     uint32_t                             recv_nack;
     uint16_t                             cid;
@@ -26,15 +30,18 @@ typedef struct mux_server_child_con_state_s
 typedef struct mux_server_con_state_s
 {
     struct mux_server_child_con_state_s children_root;
+    mux_cid_table_t                     children; // cid -> child
+    mux_scheduler_t                     scheduler;
 
     tunnel_t        *tunnel;
     line_t          *line;
-    line_t          *current_writing_line;
     buffer_stream_t *read_stream;
     uint16_t         last_cid;
     uint16_t         cid_min;
     uint16_t         cid_max;
     uint16_t         contained;
+    uint8_t          read_version;
+    uint8_t          write_version;
 
 } mux_server_con_state_t;
 
@@ -49,38 +56,88 @@ static void onChildLineResumed(void *arg)
     resumeLineDownSide(stream->parent);
 }
 
-static void onMainLinePaused(void *arg)
+static void writeMainLine(void *carrier, context_t *c)
 {
-    mux_server_con_state_t *con  = (mux_server_con_state_t *) arg;
+    mux_server_con_state_t *con  = (mux_server_con_state_t *) carrier;
     tunnel_t               *self = con->tunnel;
-
-    line_t *wline = con->current_writing_line;
-    if (wline && isAlive(wline))
-    {
-        mux_server_child_con_state_t *child_con = LSTATE(wline);
-        child_con->paused                       = true;
-        pauseLineUpSide(child_con->line);
-    }
+    self->dw->downStream(self->dw, c);
 }
 
-static void onMainLineResumed(void *arg)
+static void flushMainConnection(mux_server_con_state_t *con)
 {
-    mux_server_con_state_t       *con = (mux_server_con_state_t *) arg;
-    mux_server_child_con_state_t *child_con_i;
-    for (child_con_i = con->children_root.next; child_con_i;)
+    muxSchedHold(&(con->scheduler));
+    muxSchedFlush(&(con->scheduler), false);
+
+    // children that were paused for the backlog can write again once it is out
+    mux_server_child_con_state_t *child_con_i = con->children_root.next;
+    while (child_con_i && ! con->scheduler.closed && ! con->scheduler.paused)
     {
+        mux_server_child_con_state_t *next = child_con_i->next;
         if (child_con_i->paused)
         {
             child_con_i->paused = false;
             resumeLineUpSide(child_con_i->line);
         }
-        child_con_i = child_con_i->next;
+        child_con_i = next;
+    }
+
+    if (muxSchedRelease(&(con->scheduler)))
+    {
+        globalFree(con);
+    }
+}
+
+static void onFlushEvent(hevent_t *ev)
+{
+    mux_server_con_state_t *con  = hevent_userdata(ev);
+    con->scheduler.flush_pending = false;
+    if (! con->scheduler.closed)
+    {
+        flushMainConnection(con);
+    }
+    if (muxSchedRelease(&(con->scheduler)))
+    {
+        globalFree(con);
+    }
+}
+
+// child writes of this loop iteration are collected and go out together
+static void requestFlush(mux_server_con_state_t *con)
+{
+    if (con->scheduler.flush_pending)
+    {
+        return;
     }
+    con->scheduler.flush_pending = true;
+    muxSchedHold(&(con->scheduler));
+
+    hevent_t ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.loop = getWorkerLoop(con->line->tid);
+    ev.cb   = onFlushEvent;
+    hevent_set_userdata(&ev, con);
+    hloop_post_event(getWorkerLoop(con->line->tid), &ev);
+}
+
+static void onMainLinePaused(void *arg)
+{
+    mux_server_con_state_t *con = (mux_server_con_state_t *) arg;
+    con->scheduler.paused       = true;
+}
+
+static void onMainLineResumed(void *arg)
+{
+    mux_server_con_state_t *con = (mux_server_con_state_t *) arg;
+    con->scheduler.paused       = false;
+    requestFlush(con);
 }
 
 static void destroyChildConnecton(mux_server_child_con_state_t *child)
 {
-    tunnel_t *self    = child->tunnel;
+    tunnel_t               *self   = child->tunnel;
+    mux_server_con_state_t *parent = LSTATE(child->parent);
+    muxCidTableRemove(&(parent->children), child->cid);
+    muxSchedDropStream(&(parent->scheduler), &(child->stream));
     child->prev->next = child->next;
     if (child->next)
     {
@@ -88,21 +145,22 @@ static void destroyChildConnecton(mux_server_child_con_state_t *child)
     }
     else
     {
-        mux_server_con_state_t *parent = LSTATE(child->parent);
-        parent->children_root.prev     = NULL;
+        parent->children_root.prev = NULL;
     }
     doneLineDownSide(child->line);
     LSTATE_DROP(child->line);
     globalFree(child);
 }
 
-static mux_server_child_con_state_t *createChildConnection(mux_server_con_state_t *parent, tid_t tid)
+static mux_server_child_con_state_t *createChildConnection(mux_server_con_state_t *parent, tid_t tid, cid_t cid)
 {
-    mux_server_child_con_state_t *child = globalMalloc(sizeof(mux_server_con_state_t));
+    tunnel_t                     *self  = parent->tunnel;
+    mux_server_child_con_state_t *child = globalMalloc(sizeof(mux_server_child_con_state_t));
 
     *child = (mux_server_child_con_state_t) {.tunnel = parent->tunnel,
                                              .line   = newLine(tid),
-                                             .cid    = parent->last_cid++,
+                                             .parent = parent->line,
+                                             .cid    = cid,
                                              .next   = parent->children_root.next,
                                              .prev   = &(parent->children_root)
 
@@ -118,7 +176,10 @@ static mux_server_child_con_state_t *createChildConnection(mux_server_con_state_
     {
         child->next->prev = child;
     }
+    initMuxSchedStream(&(child->stream));
     setupLineDownSide(child->line, onChildLinePaused, child, onChildLineResumed);
+    LSTATE_MUT(child->line) = child;
+    muxCidTableInsert(&(parent->children), cid, child);
 
     return child;
 }
@@ -131,7 +192,7 @@ static void destroyMainConnecton(mux_server_con_state_t *con)
     for (child_con_i = con->children_root.next; child_con_i;)
     {
 
-        mux_server_child_con_state_t *next    = child_con_i;
+        mux_server_child_con_state_t *next    = child_con_i->next;
         context_t                    *fin_ctx = newFinContext(child_con_i->line);
         tunnel_t                     *dest    = con->tunnel->up;
 
@@ -139,10 +200,14 @@ static void destroyMainConnecton(mux_server_con_state_t *con)
         dest->upStream(dest, fin_ctx);
         child_con_i = next;
     }
+    dropMuxCidTable(&(con->children));
     destroyBufferStream(con->read_stream);
     doneLineUpSide(con->line);
     LSTATE_DROP(con->line);
-    globalFree(con);
+    if (muxSchedClose(&(con->scheduler)))
+    {
+        globalFree(con);
+    }
 }
 
 static mux_server_con_state_t *createMainConnection(tunnel_t *self, line_t *main_line)
@@ -152,27 +217,63 @@ static mux_server_con_state_t *createMainConnection(tunnel_t *self, line_t *main
     *con = (mux_server_con_state_t) {.tunnel        = self,
                                      .line          = main_line,
                                      .children_root = {0},
-                                     .read_stream   = newBufferStream(getLineBufferPool(main_line))};
+                                     .read_stream   = newBufferStream(getLineBufferPool(main_line)),
+                                     .read_version  = kMuxFrameV1,
+                                     .write_version = kMuxFrameV1};
 
+    initMuxCidTable(&(con->children));
+    initMuxScheduler(&(con->scheduler), writeMainLine, con);
     setupLineDownSide(con->line, onMainLinePaused, con, onMainLineResumed);
 
     LSTATE_MUT(con->line) = con;
     return con;
 }
 
+// the client offered its highest frame version before any other frame, the answer is the last v1 frame we write
+static void answerHello(tunnel_t *self, mux_server_con_state_t *con, shift_buffer_t *buf)
+{
+    mux_server_state_t *state   = TSTATE(self);
+    uint8_t             offered = 0;
+    if (bufLen(buf) >= 1)
+    {
+        readRaw(buf, &offered, 1);
+    }
+    uint8_t version = offered < state->max_frame_version ? offered : state->max_frame_version;
+
+    if (version < kMuxFrameV2 || con->write_version != kMuxFrameV1 || con->children.count != 0)
+    {
+        reuseBuffer(getLineBufferPool(con->line), buf);
+        return;
+    }
+
+    setLen(buf, sizeof(version));
+    writeRaw(buf, &version, sizeof(version));
+    makeMuxFrame(buf, 0, kMuxFlagHello, kMuxFrameV1);
+
+    context_t *answer_ctx = newContext(con->line);
+    answer_ctx->payload   = buf;
+    muxSchedEnqueueControl(&(con->scheduler), answer_ctx);
+    con->write_version = version;
+    requestFlush(con);
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     mux_server_con_state_t *main_con = CSTATE(c);
     if (c->payload != NULL)
     {
         bufferStreamPushContextPayload(main_con->read_stream, c);
-        while (bufferStreamLen(main_con->read_stream) > sizeof(mux_frame_t))
+        while (true)
         {
-            mux_length_t length;
-            bufferStreamViewBytesAt(main_con->read_stream, 0, (uint8_t *) &length, 2);
-            if (WW_UNLIKELY(length < kMuxMinFrameLength))
+            mux_frame_info_t frame;
+            const int        peeked = muxPeekFrame(main_con->read_stream, main_con->read_version, &frame);
+            if (peeked == 0)
             {
-                LOGE("MuxServer: payload length < kMuxMinFrameLength");
+                break;
+            }
+            if (WW_UNLIKELY(peeked < 0))
+            {
+                LOGE("MuxServer: malformed frame header");
                 destroyMainConnecton(main_con);
                 self->dw->downStream(self->dw, newFinContext(c->line));
 
@@ -180,16 +281,96 @@ static void upStream(tunnel_t *self, context_t *c)
                 return;
             }
 
-            if (bufferStreamLen(main_con->read_stream) >= length + sizeof(length))
+            shift_buffer_t *frame_payload = bufferStreamRead(main_con->read_stream, frame.length);
+            shiftr(frame_payload, frame.header_length);
+
+            if (main_con->read_version == kMuxFrameV1 && frame.flags == kMuxFlagHello)
             {
-                shift_buffer_t *frame_payload = bufferStreamRead(main_con->read_stream, length + sizeof(length));
+                answerHello(self, main_con, frame_payload);
+                continue;
+            }
+            if (main_con->read_version == kMuxFrameV1 && frame.flags == kMuxFlagUpgrade)
+            {
+                reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                main_con->read_version = main_con->write_version;
+                continue;
+            }
+
+            if (frame.flags == kMuxFlagPing)
+            {
+                // answered from the control queue, ahead of our data, so the client measures the path
+                makePongFrame(frame_payload, main_con->write_version);
+                context_t *pong_ctx = newContext(main_con->line);
+                pong_ctx->payload   = frame_payload;
+                muxSchedEnqueueControl(&(main_con->scheduler), pong_ctx);
+                requestFlush(main_con);
+                continue;
+            }
+
+            if (frame.flags == kMuxFlagOpen)
+            {
+                if (WW_UNLIKELY(bufLen(frame_payload) <= 0))
+                {
+                    LOGE("MuxServer: payload length <= 0");
+                    reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                    destroyMainConnecton(main_con);
+                    self->dw->downStream(self->dw, newFinContext(c->line));
+                    destroyContext(c);
+                    return;
+                }
+
+                if (WW_UNLIKELY(muxCidTableFind(&(main_con->children), frame.cid) != NULL))
+                {
+                    LOGE("MuxServer: open frame for a cid that is already open: %d", (int) frame.cid);
+                    reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                    destroyMainConnecton(main_con);
+                    self->dw->downStream(self->dw, newFinContext(c->line));
+                    destroyContext(c);
+                    return;
+                }
+
+                mux_server_child_con_state_t *child      = createChildConnection(main_con, c->line->tid, frame.cid);
+                line_t                       *child_line = child->line;
+                lockLine(child_line);
+
+                self->up->upStream(self->up, newInitContext(child->line));
+
+                if (! isAlive(child_line))
+                {
+                    unLockLine(child_line);
+                    reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+                    continue;
+                }
+                unLockLine(child_line);
 
-                mux_frame_t frame;
-                memcpy(&frame, rawBuf(frame_payload), sizeof(mux_frame_t));
-                shiftr(frame_payload, sizeof(mux_frame_t));
+                context_t *data_ctx = newContext(child_line);
+                data_ctx->payload   = frame_payload;
+                self->up->upStream(self->up, data_ctx);
+
+                if (! isAlive(c->line))
+                {
+                    destroyContext(c);
+                    return;
+                }
+                continue;
+            }
 
-                if (frame.flags == kMuxFlagOpen)
+            mux_server_child_con_state_t *child_con_i = muxCidTableFind(&(main_con->children), frame.cid);
+            if (child_con_i != NULL)
+            {
+                switch (frame.flags)
                 {
+                case kMuxFlagClose: {
+                    reuseBuffer(getLineBufferPool(c->line), frame_payload);
+                    context_t *fin_ctx = newFinContext(child_con_i->line);
+                    destroyChildConnecton(child_con_i);
+                    self->up->upStream(self->up, fin_ctx);
+                    frame_payload = NULL;
+                }
+
+                break;
+
+                case kMuxFlagData: {
                     if (WW_UNLIKELY(bufLen(frame_payload) <= 0))
                     {
                         LOGE("MuxServer: payload length <= 0");
@@ -197,103 +378,41 @@ static void upStream(tunnel_t *self, context_t *c)
                         destroyMainConnecton(main_con);
                         self->dw->downStream(self->dw, newFinContext(c->line));
                         destroyContext(c);
-                        continue;
-                    }
-
-                    mux_server_child_con_state_t *child      = createChildConnection(main_con, c->line->tid);
-                    line_t                       *child_line = child->line;
-                    lockLine(child_line);
-
-                    self->up->upStream(self->up, newInitContext(child->line));
-
-                    if (! isAlive(child_line))
-                    {
-                        unLockLine(child_line);
-                        reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                        continue;
+                        return;
                     }
-                    unLockLine(child_line);
 
-                    context_t *data_ctx = newContext(child_line);
+                    context_t *data_ctx = newContext(child_con_i->line);
                     data_ctx->payload   = frame_payload;
                     self->up->upStream(self->up, data_ctx);
-
-                    if (! isAlive(c->line))
-                    {
-                        destroyContext(c);
-                        return;
-                    }
-                    continue;
+                    frame_payload = NULL;
                 }
 
-                mux_server_child_con_state_t *child_con_i;
-                for (child_con_i = main_con->children_root.next; child_con_i;)
-                {
-                    if (child_con_i->cid == frame.cid)
-                    {
+                break;
 
-                        switch (frame.flags)
-                        {
-                        case kMuxFlagClose: {
-                            reuseBuffer(getLineBufferPool(c->line), frame_payload);
-                            context_t *fin_ctx = newFinContext(child_con_i->line);
-                            destroyChildConnecton(child_con_i);
-                            self->dw->downStream(self->dw, fin_ctx);
-                            frame_payload = NULL;
-                        }
-
-                        break;
-
-                        case kMuxFlagData: {
-                            if (WW_UNLIKELY(bufLen(frame_payload) <= 0))
-                            {
-                                LOGE("MuxServer: payload length <= 0");
-                                reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                                destroyMainConnecton(main_con);
-                                self->dw->downStream(self->dw, newFinContext(c->line));
-                                destroyContext(c);
-                                return;
-                            }
-
-                            context_t *data_ctx = newContext(child_con_i->line);
-                            data_ctx->payload   = frame_payload;
-                            self->dw->downStream(self->dw, data_ctx);
-                            frame_payload = NULL;
-                        }
-
-                        break;
-
-                        case kMuxFlagFlow:
-                            LOGE("MuxServer: kMuxFlagFlow not implemented"); // fall through
-                        default:
-                            LOGE("MuxServer: incorrect frame flag");
-                            reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                            destroyMainConnecton(main_con);
-                            self->dw->downStream(self->dw, newFinContext(c->line));
-                            destroyContext(c);
-                            return;
-                            break;
-                        }
-                        break;
-                    }
-                    child_con_i = child_con_i->next;
-                }
-                if (frame_payload != NULL)
-                {
-                    LOGW("MuxServer: a frame could not find consumer cid: %d", (int) frame.cid);
+                case kMuxFlagFlow:
+                    LOGE("MuxServer: kMuxFlagFlow not implemented"); // fall through
+                default:
+                    LOGE("MuxServer: incorrect frame flag");
                     reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
-                }
-                else if (! isAlive(c->line))
-                {
+                    destroyMainConnecton(main_con);
+                    self->dw->downStream(self->dw, newFinContext(c->line));
                     destroyContext(c);
                     return;
+                    break;
                 }
             }
-            else
+            if (frame_payload != NULL)
             {
-                break;
+                LOGW("MuxServer: a frame could not find consumer cid: %d", (int) frame.cid);
+                reuseBuffer(getLineBufferPool(main_con->line), frame_payload);
+            }
+            else if (! isAlive(c->line))
+            {
+                destroyContext(c);
+                return;
             }
         }
+        destroyContext(c);
     }
     else
     {
@@ -319,58 +438,48 @@ static void downStream(tunnel_t *self, context_t *c)
 
     if (c->payload != NULL)
     {
-        line_t                 *current_writing_line = c->line;
-        line_t                 *main_line            = child_con->parent;
-        mux_server_con_state_t *main_con             = LSTATE(main_line);
+        line_t                 *main_line = child_con->parent;
+        mux_server_con_state_t *main_con  = LSTATE(main_line);
 
         switchLine(c, main_line);
 
-        lockLine(main_line);
-        lockLine(current_writing_line);
-        main_con->current_writing_line = current_writing_line;
-
-        while (bufLen(c->payload) > kMuxMaxFrameLength)
+        const uint32_t max_frame = muxMaxFrameLength(main_con->write_version);
+        while (bufLen(c->payload) > max_frame)
         {
             shift_buffer_t *chunk = popBuffer(getContextBufferPool(c));
-            chunk = sliceBufferTo(chunk, c->payload, kMuxMaxFrameLength);
-            makeDataFrame(chunk, child_con->cid);
+            chunk = sliceBufferTo(chunk, c->payload, max_frame);
+            makeDataFrame(chunk, child_con->cid, main_con->write_version);
 
             context_t *data_chunk_ctx = newContextFrom(c);
             data_chunk_ctx->payload   = chunk;
-            self->dw->downStream(self->dw, data_chunk_ctx);
-
-            if (! isAlive(main_line))
-            {
-                unLockLine(main_line);
-                unLockLine(current_writing_line);
-
-                reuseContextPayload(c);
-                destroyContext(c);
-                return;
-            }
+            muxSchedEnqueue(&(main_con->scheduler), &(child_con->stream), data_chunk_ctx);
         }
 
-        makeDataFrame(c->payload, child_con->cid);
-
-        self->up->upStream(self->up, c);
+        makeDataFrame(c->payload, child_con->cid, main_con->write_version);
+        muxSchedEnqueue(&(main_con->scheduler), &(child_con->stream), c);
 
-        if (isAlive(main_line))
+        if (! child_con->paused &&
+            (main_con->scheduler.paused || child_con->stream.queued >= kMuxSchedStreamLimit))
         {
-            main_con->current_writing_line = NULL;
+            child_con->paused = true;
+            pauseLineUpSide(child_con->line);
         }
-
-        unLockLine(main_line);
-        unLockLine(current_writing_line);
+        requestFlush(main_con);
     }
     else
     {
         if (c->fin)
         {
-            context_t *data_fin_ctx = newContext(child_con->parent);
-            data_fin_ctx->payload   = popBuffer(getLineBufferPool(child_con->parent));
-            makeCloseFrame(data_fin_ctx->payload, child_con->cid);
+            mux_server_con_state_t *main_con     = LSTATE(child_con->parent);
+            context_t              *data_fin_ctx = newContext(child_con->parent);
+            data_fin_ctx->payload                = popBuffer(getLineBufferPool(child_con->parent));
+            makeCloseFrame(data_fin_ctx->payload, child_con->cid, main_con->write_version);
+
+            muxSchedRetireStream(&(main_con->scheduler), &(child_con->stream));
+            muxSchedEnqueueControl(&(main_con->scheduler), data_fin_ctx);
             destroyChildConnecton(child_con);
-            self->dw->downStream(self->dw, data_fin_ctx);
+            requestFlush(main_con);
+            destroyContext(c);
             return;
         }
         if (WW_UNLIKELY(c->est))
@@ -383,10 +492,15 @@ static void downStream(tunnel_t *self, context_t *c)
 
 tunnel_t *newMuxServer(node_instance_context_t *instance_info)
 {
-    (void) instance_info;
     mux_server_state_t *state = globalMalloc(sizeof(mux_server_state_t));
     memset(state, 0, sizeof(mux_server_state_t));
 
+    const cJSON *settings = instance_info->node_settings_json;
+
+    int frame_version;
+    getIntFromJsonObjectOrDefault(&frame_version, settings, "frame-version", kMuxFrameV2);
+    state->max_frame_version = (uint8_t) (frame_version >= kMuxFrameV2 ? kMuxFrameV2 : kMuxFrameV1);
+
     tunnel_t *t   = newTunnel();
     t->state      = state;
     t->upStream   = &upStream;
@@ -1,10 +1,15 @@
 #include "openssl_server.h"
 #include "buffer_pool.h"
 #include "buffer_stream.h"
+#include "context_queue.h"
 #include "frand.h"
 #include "loggers/network_logger.h"
 #include "managers/node_manager.h"
+#include "openssl_bio.h"
 #include "openssl_globals.h"
+#include "openssl_handshake_pool.h"
+#include "openssl_record_sizing.h"
+#include "session_cache.h"
 #include "utils/jsonutils.h"
 #include "utils/mathutils.h"
 #include <openssl/bio.h>
@@ -21,28 +26,35 @@ typedef struct
 
 typedef struct oss_server_state_s
 {
-    ssl_ctx_t   *threadlocal_ssl_context;
-    alpn_item_t *alpns;
-    unsigned int alpns_length;
+    ssl_ctx_t            *threadlocal_ssl_context;
+    alpn_item_t          *alpns;
+    unsigned int          alpns_length;
+    oss_session_cache_t  *session_cache;  // shared by the contexts of all workers
+    oss_handshake_pool_t *handshake_pool; // NULL when handshakes run on the workers
 
     // settings
     tunnel_t *fallback;
-    bool      anti_tit; // solve tls in tls using paddings
+    bool      anti_tit;         // solve tls in tls using paddings
+    uint32_t  record_size_ramp; // bytes written in small records after start or idle, 0 for always full
+    uint32_t  record_size_idle_ms;
 
 } oss_server_state_t;
 
 typedef struct oss_server_con_state_s
 {
 
-    buffer_stream_t *fallback_buf;
-    SSL             *ssl;
-    BIO             *rbio;
-    BIO             *wbio;
-    bool             handshake_completed;
-    bool             fallback_mode;
-    bool             fallback_init_sent;
-    bool             init_sent;
-    int              reply_sent_tit;
+    buffer_stream_t     *fallback_buf;
+    SSL                 *ssl;
+    BIO                 *bio;           // owned by ssl
+    oss_handshake_job_t *handshake_job; // the handshake step running on the handshake pool
+    context_queue_t     *queue;         // payloads that came while the handshake step was away
+    bool                 handshake_completed;
+    bool                 fallback_mode;
+    bool                 fallback_init_sent;
+    bool                 init_sent;
+    int                  reply_sent_tit;
+    uint64_t             handshake_cpu_ns;
+    tls_record_sizer_t   record_sizer;
 
     bool fallback_disabled;
 
@@ -81,9 +93,9 @@ enum sslstatus
     kSslstatusFail
 };
 
-static enum sslstatus getSslstatus(SSL *ssl, int n)
+static enum sslstatus sslstatusOf(int ssl_error)
 {
-    switch (SSL_get_error(ssl, n))
+    switch (ssl_error)
     {
     case SSL_ERROR_NONE:
         return kSslstatusOk;
@@ -97,6 +109,11 @@ static enum sslstatus getSslstatus(SSL *ssl, int n)
     }
 }
 
+static enum sslstatus getSslstatus(SSL *ssl, int n)
+{
+    return sslstatusOf(SSL_get_error(ssl, n));
+}
+
 static size_t paddingDecisionCb(SSL *ssl, int type, size_t len, void *arg)
 {
     (void) ssl;
@@ -125,13 +142,32 @@ static size_t paddingDecisionCb(SSL *ssl, int type, size_t len, void *arg)
     return 0;
 }
 
+/*
+    SSL_free drops the session of a connection that was not shut down from the cache, a plain tcp close after a
+    finished handshake is not a reason to make the client do a full handshake next time
+*/
+static void keepSessionResumable(oss_server_con_state_t *cstate)
+{
+    if (cstate->handshake_completed)
+    {
+        SSL_set_shutdown(cstate->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    }
+}
+
 static void cleanup(tunnel_t *self, context_t *c)
 {
     oss_server_con_state_t *cstate = CSTATE(c);
     destroyBufferStream(cstate->fallback_buf);
+    destroyContextQueue(cstate->queue);
+    CSTATE_DROP(c);
+    if (cstate->handshake_job != NULL)
+    {
+        // the step may still call the padding hook with cstate, both go when the job comes back
+        abandonOssHandshake(cstate->handshake_job, cstate);
+        return;
+    }
     SSL_free(cstate->ssl); /* free the SSL object and its BIO's */
     globalFree(cstate);
-    CSTATE_DROP(c);
 }
 
 static void fallbackWrite(tunnel_t *self, context_t *c)
@@ -168,207 +204,246 @@ static void fallbackWrite(tunnel_t *self, context_t *c)
     state->fallback->upStream(state->fallback, c);
 }
 
-static void upStream(tunnel_t *self, context_t *c)
+// sends the records ssl wrote into the bio, false if the line is closed meanwhile
+static bool flushSslOutput(tunnel_t *self, context_t *c)
 {
-    oss_server_state_t     *state  = TSTATE(self);
     oss_server_con_state_t *cstate = CSTATE(c);
+    shift_buffer_t         *buf;
 
-    if (c->payload != NULL)
+    while ((buf = wwBioPopOutput(cstate->bio)) != NULL)
     {
-
-        if (state->fallback != NULL && ! cstate->handshake_completed)
+        context_t *answer = newContextFrom(c);
+        answer->payload   = buf;
+        self->dw->downStream(self->dw, answer);
+        if (! isAlive(c->line))
         {
-            bufferStreamPush(cstate->fallback_buf, duplicateBufferP(getContextBufferPool(c),c->payload));
+            return false;
         }
+    }
+    return true;
+}
 
-        if (cstate->fallback_mode)
+static void disconnect(tunnel_t *self, context_t *c)
+{
+    oss_server_con_state_t *cstate = CSTATE(c);
+    if (cstate->init_sent)
+    {
+        self->up->upStream(self->up, newFinContextFrom(c));
+    }
+
+    context_t *fail_context = newFinContextFrom(c);
+    cleanup(self, c);
+    destroyContext(c);
+    self->dw->downStream(self->dw, fail_context);
+}
+
+// what follows a handshake step, true when the handshake is complete and c can go on reading records
+static bool afterHandshakeStep(tunnel_t *self, context_t *c, enum sslstatus status)
+{
+    oss_server_state_t     *state  = TSTATE(self);
+    oss_server_con_state_t *cstate = CSTATE(c);
+
+    if (status == kSslstatusFail)
+    {
+        if (state->fallback != NULL && ! cstate->fallback_disabled)
         {
-            reuseContextPayload(c);
+            cstate->fallback_mode = true;
             fallbackWrite(self, c);
-            return;
+            return false;
         }
-        
-        enum sslstatus status;
-        int            n;
-        unsigned int   len = bufLen(c->payload);
+        disconnect(self, c);
+        return false;
+    }
 
-        while (len > 0 && isAlive(c->line))
+    /* Did SSL request to write bytes? */
+    if (BIO_wpending(cstate->bio) > 0)
+    {
+        // since then, we should not go to fallback
+        cstate->fallback_disabled = true;
+        if (! flushSslOutput(self, c))
         {
-            n = BIO_write(cstate->rbio, rawBuf(c->payload), (int) len);
+            destroyContext(c);
+            return false;
+        }
+    }
 
-            if (n <= 0)
-            {
-                /* if BIO write fails, assume unrecoverable */
-                reuseContextPayload(c);
-                goto disconnect;
-            }
-            shiftr(c->payload, n);
-            len -= n;
+    if (! SSL_is_init_finished(cstate->ssl))
+    {
+        destroyContext(c);
+        return false;
+    }
 
-            if (! SSL_is_init_finished(cstate->ssl))
-            {
-                n      = SSL_accept(cstate->ssl);
-                status = getSslstatus(cstate->ssl, n);
+    LOGD("OpensslServer: Tls handshake complete");
+    cstate->handshake_completed = true;
+    ossSessionCacheRecordHandshake(state->session_cache, cstate->ssl, cstate->handshake_cpu_ns);
+    emptyBufferStream(cstate->fallback_buf);
+    return true;
+}
 
-                /* Did SSL request to write bytes? */
-                if (status == kSslstatusWantIo)
-                {
-                    do
-                    {
-                        shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                        unsigned int    avail = rCapNoPadding(buf);
-                        n                     = BIO_read(cstate->wbio, rawBufMut(buf), (int) avail);
-                        // assert(-1 == BIO_read(cstate->wbio, rawBuf(buf), avail));
-                        if (n > 0)
-                        {
-                            // since then, we should not go to fallback
-                            cstate->fallback_disabled = true;
-
-                            setLen(buf, n);
-                            context_t *answer = newContextFrom(c);
-                            answer->payload   = buf;
-                            self->dw->downStream(self->dw, answer);
-
-                            if (! isAlive(c->line))
-                            {
-                                reuseContextPayload(c);
-                                destroyContext(c);
-                                return;
-                            }
-                        }
-                        else if (! BIO_should_retry(cstate->wbio))
-                        {
-                            // If BIO_should_retry() is false then the cause is an error condition.
-                            reuseContextPayload(c);
-                            reuseBuffer(getContextBufferPool(c), buf);
-                            goto disconnect;
-                        }
-                        else
-                        {
-                            reuseBuffer(getContextBufferPool(c), buf);
-                        }
-                    } while (n > 0);
-                }
+static void readSslRecords(tunnel_t *self, context_t *c)
+{
+    oss_server_con_state_t *cstate = CSTATE(c);
+    enum sslstatus          status;
+    int                     n;
 
-                if (status == kSslstatusFail)
-                {
-                    reuseContextPayload(c); // payload already buffered
-                    printSSLError();
-                    if (state->fallback != NULL && ! cstate->fallback_disabled)
-                    {
-                        cstate->fallback_mode = true;
-                        fallbackWrite(self, c);
-                        return;
-                    }
-
-                    goto disconnect;
-                }
+    /* The encrypted data is now in the bio so now we can perform actual
+     * read of unencrypted data. */
 
-                if (! SSL_is_init_finished(cstate->ssl))
+    do
+    {
+        shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
+        setLen(buf, 0);
+        unsigned int avail = rCapNoPadding(buf);
+        n                  = SSL_read(cstate->ssl, rawBufMut(buf), (int) avail);
+
+        if (n > 0)
+        {
+            if (WW_UNLIKELY(! cstate->init_sent))
+            {
+                self->up->upStream(self->up, newInitContext(c->line));
+                if (! isAlive(c->line))
                 {
-                    reuseContextPayload(c);
+                    LOGW("OpensslServer: next node instantly closed the init with fin");
+                    reuseBuffer(getContextBufferPool(c), buf);
                     destroyContext(c);
+
                     return;
                 }
+                cstate->init_sent = true;
+            }
 
-                LOGD("OpensslServer: Tls handshake complete");
-                cstate->handshake_completed = true;
-                emptyBufferStream(cstate->fallback_buf);
+            setLen(buf, n);
+            context_t *data_ctx = newContextFrom(c);
+            data_ctx->payload   = buf;
+            self->up->upStream(self->up, data_ctx);
+            if (! isAlive(c->line))
+            {
+                destroyContext(c);
+                return;
             }
+        }
+        else
+        {
+            reuseBuffer(getContextBufferPool(c), buf);
+        }
 
-            /* The encrypted data is now in the input bio so now we can perform actual
-             * read of unencrypted data. */
+    } while (n > 0);
 
-            do
-            {
-                shift_buffer_t *buf = popBuffer(getContextBufferPool(c));
-                setLen(buf, 0);
-                unsigned int avail = rCapNoPadding(buf);
-                n                  = SSL_read(cstate->ssl, rawBufMut(buf), (int) avail);
+    status = getSslstatus(cstate->ssl, n);
 
-                if (n > 0)
-                {
-                    if (WW_UNLIKELY(! cstate->init_sent))
-                    {
-                        self->up->upStream(self->up, newInitContext(c->line));
-                        if (! isAlive(c->line))
-                        {
-                            LOGW("OpensslServer: next node instantly closed the init with fin");
-                            reuseContextPayload(c);
-                            destroyContext(c);
-
-                            return;
-                        }
-                        cstate->init_sent = true;
-                    }
-
-                    setLen(buf, n);
-                    context_t *data_ctx = newContextFrom(c);
-                    data_ctx->payload   = buf;
-                    self->up->upStream(self->up, data_ctx);
-                    if (! isAlive(c->line))
-                    {
-                        reuseContextPayload(c);
-                        destroyContext(c);
-                        return;
-                    }
-                }
-                else
-                {
-                    reuseBuffer(getContextBufferPool(c), buf);
-                }
+    if (status == kSslstatusFail)
+    {
+        disconnect(self, c);
+        return;
+    }
 
-            } while (n > 0);
+    /* Did SSL request to write bytes? This can happen if peer has requested SSL
+     * renegotiation or a key update. */
+    if (! flushSslOutput(self, c))
+    {
+        destroyContext(c);
+        return;
+    }
 
-            status = getSslstatus(cstate->ssl, n);
+    // done with socket data
+    destroyContext(c);
+}
+
+// the handshake step of a line came back from the handshake pool, we are on the worker of the line again
+static void onHandshakeDone(oss_handshake_job_t *job)
+{
+    tunnel_t  *self = job->tunnel;
+    context_t *c    = job->context;
 
-            /* Did SSL request to write bytes? This can happen if peer has requested SSL
-             * renegotiation. */
-            if (status == kSslstatusWantIo)
+    if (job->abandoned)
+    {
+        SSL_free(job->ssl);
+        globalFree(job->userdata); // the con state
+        destroyContext(c);
+        return;
+    }
+
+    oss_server_con_state_t *cstate = CSTATE(c);
+    cstate->handshake_job          = NULL;
+    cstate->handshake_cpu_ns += job->cpu_ns;
+
+    context_t *line_holder = newContextFrom(c);
+    if (afterHandshakeStep(self, c, sslstatusOf(job->ssl_error)))
+    {
+        readSslRecords(self, c);
+    }
+
+    // the payloads that waited, until one of them sends the next step away again
+    while (isAlive(line_holder->line))
+    {
+        cstate = CSTATE(line_holder);
+        if (cstate->handshake_job != NULL || contextQueueLen(cstate->queue) == 0)
+        {
+            break;
+        }
+        self->upStream(self, contextQueuePop(cstate->queue));
+    }
+    destroyContext(line_holder);
+}
+
+static void upStream(tunnel_t *self, context_t *c)
+{
+    oss_server_state_t     *state  = TSTATE(self);
+    oss_server_con_state_t *cstate = CSTATE(c);
+
+    if (c->payload != NULL)
+    {
+        if (cstate->handshake_job != NULL)
+        {
+            contextQueuePush(cstate->queue, c);
+            return;
+        }
+
+        if (state->fallback != NULL && ! cstate->handshake_completed)
+        {
+            bufferStreamPush(cstate->fallback_buf, duplicateBufferP(getContextBufferPool(c),c->payload));
+        }
+
+        if (cstate->fallback_mode)
+        {
+            reuseContextPayload(c);
+            fallbackWrite(self, c);
+            return;
+        }
+
+        /* the bio keeps the buffer, ssl reads the records straight out of it */
+        wwBioPushInput(cstate->bio, c->payload);
+        dropContexPayload(c);
+
+        if (! SSL_is_init_finished(cstate->ssl))
+        {
+            if (state->handshake_pool != NULL)
             {
-                do
+                // c comes back with the job, in onHandshakeDone
+                cstate->handshake_job =
+                    submitOssHandshake(state->handshake_pool, cstate->ssl, cstate->bio, self, c);
+                if (cstate->handshake_job != NULL)
                 {
-                    shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                    unsigned int    avail = rCapNoPadding(buf);
-
-                    n = BIO_read(cstate->wbio, rawBufMut(buf), (int) avail);
-                    if (n > 0)
-                    {
-                        setLen(buf, n);
-                        context_t *answer = newContextFrom(c);
-                        answer->payload   = buf;
-                        self->dw->downStream(self->dw, answer);
-                        if (! isAlive(c->line))
-                        {
-                            reuseContextPayload(c);
-                            destroyContext(c);
-
-                            return;
-                        }
-                    }
-                    else if (! BIO_should_retry(cstate->wbio))
-                    {
-                        // If BIO_should_retry() is false then the cause is an error condition.
-                        reuseBuffer(getContextBufferPool(c), buf);
-                        reuseContextPayload(c);
-                        goto disconnect;
-                    }
-                    else
-                    {
-                        reuseBuffer(getContextBufferPool(c), buf);
-                    }
-                } while (n > 0);
+                    return;
+                }
             }
 
+            const uint64_t cpu_start = threadCpuNs();
+            int            n         = SSL_accept(cstate->ssl);
+            enum sslstatus status    = getSslstatus(cstate->ssl, n);
+            cstate->handshake_cpu_ns += threadCpuNs() - cpu_start;
+
             if (status == kSslstatusFail)
             {
-                reuseContextPayload(c);
-                goto disconnect;
+                printSSLError();
+            }
+            if (! afterHandshakeStep(self, c, status))
+            {
+                return;
             }
         }
-        // done with socket data
-        reuseContextPayload(c);
-        destroyContext(c);
+
+        readSslRecords(self, c);
     }
     else
     {
@@ -378,12 +453,12 @@ static void upStream(tunnel_t *self, context_t *c)
             CSTATE_MUT(c) = globalMalloc(sizeof(oss_server_con_state_t));
             memset(CSTATE(c), 0, sizeof(oss_server_con_state_t));
             cstate               = CSTATE(c);
-            cstate->rbio         = BIO_new(BIO_s_mem());
-            cstate->wbio         = BIO_new(BIO_s_mem());
+            cstate->bio          = newWwBio(getContextBufferPool(c));
             cstate->ssl          = SSL_new(state->threadlocal_ssl_context[c->line->tid]);
             cstate->fallback_buf = newBufferStream(getContextBufferPool(c));
+            cstate->queue        = newContextQueue();
             SSL_set_accept_state(cstate->ssl); /* sets ssl to work in server mode. */
-            SSL_set_bio(cstate->ssl, cstate->rbio, cstate->wbio);
+            SSL_set_bio(cstate->ssl, cstate->bio, cstate->bio);
             if (state->anti_tit)
             {
                 if (1 != SSL_set_record_padding_callback(cstate->ssl, paddingDecisionCb))
@@ -396,6 +471,7 @@ static void upStream(tunnel_t *self, context_t *c)
         }
         else if (c->fin)
         {
+            keepSessionResumable(cstate);
 
             if (cstate->fallback_mode)
             {
@@ -422,19 +498,6 @@ static void upStream(tunnel_t *self, context_t *c)
             }
         }
     }
-
-    return;
-
-disconnect:
-    if (cstate->init_sent)
-    {
-        self->up->upStream(self->up, newFinContextFrom(c));
-    }
-
-    context_t *fail_context = newFinContextFrom(c);
-    cleanup(self, c);
-    destroyContext(c);
-    self->dw->downStream(self->dw, fail_context);
 }
 
 static void downStream(tunnel_t *self, context_t *c)
@@ -485,6 +548,9 @@ static void downStream(tunnel_t *self, context_t *c)
                 cstate->reply_sent_tit++;
                 consume = 128;
             }
+            consume = min(consume, (int) tlsRecordSizeLimit(&(cstate->record_sizer), state->record_size_ramp,
+                                                            state->record_size_idle_ms,
+                                                            hloop_now_ms(getLineLoop(c->line))));
 
             int n  = SSL_write(cstate->ssl, rawBuf(c->payload), consume);
             status = getSslstatus(cstate->ssl, n);
@@ -495,38 +561,14 @@ static void downStream(tunnel_t *self, context_t *c)
                 /* consume the waiting bytes that have been used by SSL */
                 shiftr(c->payload, n);
                 len -= n;
-                /* take the output of the SSL object and queue it for socket write */
-                do
+                tlsRecordSizerSent(&(cstate->record_sizer), (uint32_t) n);
+                /* the records are already in pool buffers, send them */
+                if (! flushSslOutput(self, c))
                 {
-                    shift_buffer_t *buf   = popBuffer(getContextBufferPool(c));
-                    unsigned int    avail = rCapNoPadding(buf);
-                    n                     = BIO_read(cstate->wbio, rawBufMut(buf), (int) avail);
-                    if (n > 0)
-                    {
-                        setLen(buf, n);
-                        context_t *dw_context = newContextFrom(c);
-                        dw_context->payload   = buf;
-                        self->dw->downStream(self->dw, dw_context);
-                        if (! isAlive(c->line))
-                        {
-                            reuseContextPayload(c);
-                            destroyContext(c);
-
-                            return;
-                        }
-                    }
-                    else if (! BIO_should_retry(cstate->wbio))
-                    {
-                        // If BIO_should_retry() is false then the cause is an error condition.
-                        reuseBuffer(getContextBufferPool(c), buf);
-                        reuseContextPayload(c);
-                        goto disconnect;
-                    }
-                    else
-                    {
-                        reuseBuffer(getContextBufferPool(c), buf);
-                    }
-                } while (n > 0);
+                    reuseContextPayload(c);
+                    destroyContext(c);
+                    return;
+                }
             }
 
             if (status == kSslstatusFail)
@@ -554,6 +596,7 @@ static void downStream(tunnel_t *self, context_t *c)
     }
     if (c->fin)
     {
+        keepSessionResumable(cstate);
         cleanup(self, c);
         self->dw->downStream(self->dw, c);
     }
@@ -664,9 +707,46 @@ tunnel_t *newOpenSSLServer(node_instance_context_t *instance_info)
     globalFree(fallback_node);
     getBoolFromJsonObjectOrDefault(&(state->anti_tit), settings, "anti-tls-in-tls", false);
 
+    int record_size_ramp    = 0;
+    int record_size_idle_ms = 0;
+    getIntFromJsonObjectOrDefault(&record_size_ramp, settings, "record-size-ramp", 65536);
+    getIntFromJsonObjectOrDefault(&record_size_idle_ms, settings, "record-size-idle-reset", 1000);
+    if (record_size_ramp < 0 || record_size_idle_ms < 0)
+    {
+        LOGF("JSON Error: OpensslServer->settings->record-size-ramp/record-size-idle-reset (int field) : The data was invalid");
+        exit(1);
+    }
+    state->record_size_ramp    = (uint32_t) record_size_ramp;
+    state->record_size_idle_ms = (uint32_t) record_size_idle_ms;
+
     ssl_param->verify_peer = 0; // no mtls
     ssl_param->endpoint    = kSslServer;
 
+    int session_cache_size  = 0;
+    int ticket_key_lifetime = 0;
+    getIntFromJsonObjectOrDefault(&session_cache_size, settings, "session-cache-size", 20480);
+    getIntFromJsonObjectOrDefault(&ticket_key_lifetime, settings, "ticket-key-lifetime", 3600);
+    if (session_cache_size < 0 || ticket_key_lifetime <= 0)
+    {
+        LOGF("JSON Error: OpensslServer->settings->session-cache-size/ticket-key-lifetime (int field) : The data "
+             "was invalid");
+        exit(1);
+    }
+    state->session_cache = newOssSessionCache((uint32_t) session_cache_size, (uint32_t) ticket_key_lifetime);
+
+    // handshake steps run on this many dedicated threads instead of the workers, 0 keeps them inline
+    int handshake_threads = 0;
+    getIntFromJsonObjectOrDefault(&handshake_threads, settings, "handshake-threads", 0);
+    if (handshake_threads < 0)
+    {
+        LOGF("JSON Error: OpensslServer->settings->handshake-threads (int field) : The data was invalid");
+        exit(1);
+    }
+    if (handshake_threads > 0)
+    {
+        state->handshake_pool = newOssHandshakePool((unsigned int) handshake_threads, onHandshakeDone);
+    }
+
     for (unsigned int i = 0; i < getWorkersCount(); i++)
     {
         state->threadlocal_ssl_context[i] = sslCtxNew(ssl_param);
@@ -677,6 +757,7 @@ tunnel_t *newOpenSSLServer(node_instance_context_t *instance_info)
         }
 
         SSL_CTX_set_alpn_select_cb(state->threadlocal_ssl_context[i], onAlpnSelect, state);
+        attachOssSessionCache(state->session_cache, state->threadlocal_ssl_context[i]);
     }
     // int brotli_alg = TLSEXT_comp_cert_brotli;
     // SSL_set1_cert_comp_preference(state->ssl_context,&brotli_alg,1);
@@ -698,11 +779,28 @@ tunnel_t *newOpenSSLServer(node_instance_context_t *instance_info)
     return t;
 }
 
+// answers with the handshake counters as json, the result is allocated with globalMalloc
 api_result_t apiOpenSSLServer(tunnel_t *self, const char *msg)
 {
-    (void) (self);
     (void) (msg);
-    return (api_result_t) {0};
+    oss_server_state_t *state = TSTATE(self);
+    oss_session_stats_t stats;
+    ossSessionCacheGetStats(state->session_cache, &stats);
+
+    const uint64_t handshakes = stats.handshakes_full + stats.handshakes_resumed;
+    const double   rate       = handshakes == 0 ? 0.0 : (double) stats.handshakes_resumed / (double) handshakes;
+    const size_t   cap        = 512;
+    char          *result     = globalMalloc(cap);
+
+    int len = snprintf(result, cap,
+                       "{\"handshakes-full\":%llu,\"handshakes-resumed\":%llu,\"resumption-rate\":%.4f,"
+                       "\"handshake-cpu-us\":%llu,\"session-cache-hits\":%llu,\"session-cache-misses\":%llu,"
+                       "\"ticket-key-rotations\":%llu}",
+                       (unsigned long long) stats.handshakes_full, (unsigned long long) stats.handshakes_resumed, rate,
+                       (unsigned long long) (stats.handshake_cpu_ns / 1000), (unsigned long long) stats.cache_hits,
+                       (unsigned long long) stats.cache_misses, (unsigned long long) stats.ticket_key_rotations);
+
+    return (api_result_t) {.result = result, .result_len = (size_t) len};
 }
 
 tunnel_t *destroyOpenSSLServer(tunnel_t *self)
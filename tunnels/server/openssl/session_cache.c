@@ -0,0 +1,439 @@
+#include "session_cache.h"
+#include "hmutex.h"
+#include "loggers/network_logger.h"
+#include "utils/mathutils.h"
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <string.h>
+#include <time.h>
+
+#if OPENSSL_VERSION_MAJOR >= 3
+#include <openssl/core_names.h>
+#endif
+
+enum
+{
+    kSessionCacheShards  = 16, // power of 2
+    kMaxSessionDerLen    = 4096,
+    kTicketKeyNameLen    = 16,
+    kTicketKeysCount     = 3,
+    kTicketAesKeyLen     = 32,
+    kTicketHmacKeyLen    = 32,
+    kSessionIdContextLen = 8
+};
+
+typedef struct session_slot_s
+{
+    uint8_t  id[SSL_MAX_SSL_SESSION_ID_LENGTH];
+    uint8_t  id_len;
+    uint32_t der_len;
+    uint8_t *der;
+    uint64_t expire; // seconds
+
+} session_slot_t;
+
+typedef struct session_shard_s
+{
+    hmutex_t        lock;
+    session_slot_t *slots;
+    uint32_t        slots_mask;
+
+} ATTR_ALIGNED_LINE_CACHE session_shard_t;
+
+typedef struct ticket_key_s
+{
+    atomic_uint seq; // seqlock, odd while the key is being written
+    uint8_t     name[kTicketKeyNameLen];
+    uint8_t     aes_key[kTicketAesKeyLen];
+    uint8_t     hmac_key[kTicketHmacKeyLen];
+    uint64_t    created; // seconds
+
+} ticket_key_t;
+
+typedef struct ticket_key_copy_s
+{
+    uint8_t  name[kTicketKeyNameLen];
+    uint8_t  aes_key[kTicketAesKeyLen];
+    uint8_t  hmac_key[kTicketHmacKeyLen];
+    uint64_t created;
+
+} ticket_key_copy_t;
+
+struct oss_session_cache_s
+{
+    session_shard_t *shards; // NULL when the id cache is off, aligned to the line cache inside shards_mem
+    void            *shards_mem;
+    ticket_key_t     keys[kTicketKeysCount];
+    atomic_uint      current_key;
+    atomic_bool      rotating;
+    uint32_t         ticket_key_lifetime;
+    uint8_t          id_context[kSessionIdContextLen];
+
+    atomic_uint_fast64_t handshakes_full;
+    atomic_uint_fast64_t handshakes_resumed;
+    atomic_uint_fast64_t handshake_cpu_ns;
+    atomic_uint_fast64_t cache_hits;
+    atomic_uint_fast64_t cache_misses;
+    atomic_uint_fast64_t ticket_key_rotations;
+};
+
+static uint64_t nowSeconds(void)
+{
+    return (uint64_t) time(NULL);
+}
+
+static oss_session_cache_t *cacheOf(SSL *ssl)
+{
+    return SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl));
+}
+
+// session ids are random, their first bytes are hash enough
+static uint64_t idHash(const uint8_t *id, unsigned int len)
+{
+    uint64_t h = 0;
+    memcpy(&h, id, min(len, (unsigned int) sizeof(h)));
+    return h;
+}
+
+static session_slot_t *slotOf(oss_session_cache_t *cache, const uint8_t *id, unsigned int len, session_shard_t **shard)
+{
+    const uint64_t h = idHash(id, len);
+    *shard           = &(cache->shards[h & (kSessionCacheShards - 1)]);
+    return &((*shard)->slots[(h >> 4) & (*shard)->slots_mask]);
+}
+
+static int onNewSession(SSL *ssl, SSL_SESSION *sess)
+{
+    oss_session_cache_t *cache = cacheOf(ssl);
+    unsigned int         id_len;
+    const uint8_t       *id = SSL_SESSION_get_id(sess, &id_len);
+
+    const int der_len = i2d_SSL_SESSION(sess, NULL);
+    if (id_len == 0 || der_len <= 0 || der_len > kMaxSessionDerLen)
+    {
+        return 0;
+    }
+
+    // serialized before the lock, the lock only swaps the slot
+    uint8_t *der = globalMalloc((size_t) der_len);
+    uint8_t *p   = der;
+    i2d_SSL_SESSION(sess, &p);
+    const uint64_t expire = (uint64_t) SSL_SESSION_get_time(sess) + (uint64_t) SSL_SESSION_get_timeout(sess);
+
+    session_shard_t *shard;
+    session_slot_t  *slot = slotOf(cache, id, id_len, &shard);
+
+    hmutex_lock(&(shard->lock));
+    uint8_t *old = slot->der;
+    memcpy(slot->id, id, id_len);
+    slot->id_len  = (uint8_t) id_len;
+    slot->der     = der;
+    slot->der_len = (uint32_t) der_len;
+    slot->expire  = expire;
+    hmutex_unlock(&(shard->lock));
+
+    if (old != NULL)
+    {
+        globalFree(old);
+    }
+    return 0; // no reference kept, the cache holds the serialized form
+}
+
+static SSL_SESSION *onGetSession(SSL *ssl, const unsigned char *id, int id_len, int *copy)
+{
+    oss_session_cache_t *cache = cacheOf(ssl);
+    uint8_t              der[kMaxSessionDerLen];
+    uint32_t             der_len = 0;
+    *copy                        = 0;
+
+    if (id_len <= 0 || id_len > SSL_MAX_SSL_SESSION_ID_LENGTH)
+    {
+        return NULL;
+    }
+
+    session_shard_t *shard;
+    session_slot_t  *slot = slotOf(cache, id, (unsigned int) id_len, &shard);
+
+    hmutex_lock(&(shard->lock));
+    if (slot->der != NULL && slot->id_len == id_len && memcmp(slot->id, id, (size_t) id_len) == 0 &&
+        slot->expire > nowSeconds())
+    {
+        der_len = slot->der_len;
+        memcpy(der, slot->der, der_len);
+    }
+    hmutex_unlock(&(shard->lock));
+
+    if (der_len == 0)
+    {
+        atomic_fetch_add_explicit(&(cache->cache_misses), 1, memory_order_relaxed);
+        return NULL;
+    }
+    atomic_fetch_add_explicit(&(cache->cache_hits), 1, memory_order_relaxed);
+
+    const uint8_t *p = der;
+    return d2i_SSL_SESSION(NULL, &p, (long) der_len);
+}
+
+static void onRemoveSession(SSL_CTX *ctx, SSL_SESSION *sess)
+{
+    oss_session_cache_t *cache = SSL_CTX_get_app_data(ctx);
+    unsigned int         id_len;
+    const uint8_t       *id = SSL_SESSION_get_id(sess, &id_len);
+    if (id_len == 0)
+    {
+        return;
+    }
+
+    session_shard_t *shard;
+    session_slot_t  *slot = slotOf(cache, id, id_len, &shard);
+    uint8_t         *old  = NULL;
+
+    hmutex_lock(&(shard->lock));
+    if (slot->der != NULL && slot->id_len == id_len && memcmp(slot->id, id, id_len) == 0)
+    {
+        old       = slot->der;
+        slot->der = NULL;
+    }
+    hmutex_unlock(&(shard->lock));
+
+    if (old != NULL)
+    {
+        globalFree(old);
+    }
+}
+
+static void readTicketKey(ticket_key_t *key, ticket_key_copy_t *out)
+{
+    unsigned int before;
+    unsigned int after;
+    do
+    {
+        before = atomic_load_explicit(&(key->seq), memory_order_acquire);
+        memcpy(out->name, key->name, sizeof(out->name));
+        memcpy(out->aes_key, key->aes_key, sizeof(out->aes_key));
+        memcpy(out->hmac_key, key->hmac_key, sizeof(out->hmac_key));
+        out->created = key->created;
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&(key->seq), memory_order_relaxed);
+    } while ((before & 1) != 0 || before != after);
+}
+
+static void writeTicketKey(ticket_key_t *key, uint64_t now)
+{
+    uint8_t fresh[kTicketKeyNameLen + kTicketAesKeyLen + kTicketHmacKeyLen];
+    if (1 != RAND_bytes(fresh, sizeof(fresh)))
+    {
+        LOGF("OpensslServer: RAND_bytes failed while rotating the ticket keys");
+        exit(1);
+    }
+
+    atomic_fetch_add_explicit(&(key->seq), 1, memory_order_acq_rel);
+    atomic_thread_fence(memory_order_release);
+    memcpy(key->name, fresh, kTicketKeyNameLen);
+    memcpy(key->aes_key, fresh + kTicketKeyNameLen, kTicketAesKeyLen);
+    memcpy(key->hmac_key, fresh + kTicketKeyNameLen + kTicketAesKeyLen, kTicketHmacKeyLen);
+    key->created = now;
+    atomic_fetch_add_explicit(&(key->seq), 1, memory_order_release);
+
+    OPENSSL_cleanse(fresh, sizeof(fresh));
+}
+
+// only one worker rotates, the others keep sealing with the current key meanwhile
+static void rotateTicketKeysIfDue(oss_session_cache_t *cache, const ticket_key_copy_t *current, uint64_t now)
+{
+    if (now < current->created + cache->ticket_key_lifetime)
+    {
+        return;
+    }
+    bool expected = false;
+    if (! atomic_compare_exchange_strong(&(cache->rotating), &expected, true))
+    {
+        return;
+    }
+    const unsigned int next = (atomic_load(&(cache->current_key)) + 1) % kTicketKeysCount;
+    writeTicketKey(&(cache->keys[next]), now);
+    atomic_store_explicit(&(cache->current_key), next, memory_order_release);
+    atomic_fetch_add_explicit(&(cache->ticket_key_rotations), 1, memory_order_relaxed);
+    atomic_store(&(cache->rotating), false);
+}
+
+#if OPENSSL_VERSION_MAJOR >= 3
+
+static int setTicketMacKey(EVP_MAC_CTX *hctx, uint8_t *hmac_key)
+{
+    OSSL_PARAM params[3];
+    params[0] = OSSL_PARAM_construct_octet_string(OSSL_MAC_PARAM_KEY, hmac_key, kTicketHmacKeyLen);
+    params[1] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, "sha256", 0);
+    params[2] = OSSL_PARAM_construct_end();
+    return EVP_MAC_CTX_set_params(hctx, params);
+}
+
+static int onTicketKey(SSL *ssl, unsigned char key_name[16], unsigned char *iv, EVP_CIPHER_CTX *ctx,
+                       EVP_MAC_CTX *hctx, int enc)
+{
+    oss_session_cache_t *cache = cacheOf(ssl);
+    ticket_key_copy_t    key;
+    const uint64_t       now = nowSeconds();
+    int                  result;
+
+    if (enc)
+    {
+        readTicketKey(&(cache->keys[atomic_load_explicit(&(cache->current_key), memory_order_acquire)]), &key);
+        rotateTicketKeysIfDue(cache, &key, now);
+        readTicketKey(&(cache->keys[atomic_load_explicit(&(cache->current_key), memory_order_acquire)]), &key);
+
+        if (1 != RAND_bytes(iv, EVP_CIPHER_get_iv_length(EVP_aes_256_cbc())))
+        {
+            result = -1;
+            goto done;
+        }
+        memcpy(key_name, key.name, kTicketKeyNameLen);
+        if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) ||
+            1 != setTicketMacKey(hctx, key.hmac_key))
+        {
+            result = -1;
+            goto done;
+        }
+        result = 1;
+        goto done;
+    }
+
+    const unsigned int current = atomic_load_explicit(&(cache->current_key), memory_order_acquire);
+    for (unsigned int i = 0; i < kTicketKeysCount; i++)
+    {
+        readTicketKey(&(cache->keys[i]), &key);
+        if (key.created == 0 || memcmp(key.name, key_name, kTicketKeyNameLen) != 0)
+        {
+            continue;
+        }
+        // a ring that was not rotated for long must not keep very old keys alive
+        if (now >= key.created + ((uint64_t) kTicketKeysCount * cache->ticket_key_lifetime))
+        {
+            break;
+        }
+        if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL, key.aes_key, iv) ||
+            1 != setTicketMacKey(hctx, key.hmac_key))
+        {
+            result = -1;
+            goto done;
+        }
+        result = (i == current) ? 1 : 2; // 2 renews the ticket with the current key
+        goto done;
+    }
+    result = 0; // unknown key, full handshake
+
+done:
+    OPENSSL_cleanse(&key, sizeof(key));
+    return result;
+}
+
+#endif
+
+oss_session_cache_t *newOssSessionCache(uint32_t capacity, uint32_t ticket_key_lifetime_sec)
+{
+    oss_session_cache_t *cache = globalMalloc(sizeof(oss_session_cache_t));
+    memset(cache, 0, sizeof(oss_session_cache_t));
+
+    cache->ticket_key_lifetime = max(ticket_key_lifetime_sec, 60U);
+    if (1 != RAND_bytes(cache->id_context, sizeof(cache->id_context)))
+    {
+        LOGF("OpensslServer: RAND_bytes failed");
+        exit(1);
+    }
+
+    for (unsigned int i = 0; i < kTicketKeysCount; i++)
+    {
+        atomic_init(&(cache->keys[i].seq), 0);
+    }
+    writeTicketKey(&(cache->keys[0]), nowSeconds());
+    atomic_init(&(cache->current_key), 0);
+    atomic_init(&(cache->rotating), false);
+
+    if (capacity > 0)
+    {
+        uint32_t per_shard = 1;
+        while (per_shard * kSessionCacheShards < capacity)
+        {
+            per_shard <<= 1;
+        }
+        // globalMalloc does not promise line cache alignment, allocate one line more and align the shards into it
+        cache->shards_mem = globalMalloc((sizeof(session_shard_t) * kSessionCacheShards) + kCpuLineCacheSize);
+        cache->shards     = (session_shard_t *) ALIGN2((uintptr_t) cache->shards_mem, kCpuLineCacheSize); // NOLINT
+        for (unsigned int i = 0; i < kSessionCacheShards; i++)
+        {
+            hmutex_init(&(cache->shards[i].lock));
+            cache->shards[i].slots = globalMalloc(sizeof(session_slot_t) * per_shard);
+            memset(cache->shards[i].slots, 0, sizeof(session_slot_t) * per_shard);
+            cache->shards[i].slots_mask = per_shard - 1;
+        }
+    }
+    return cache;
+}
+
+void destroyOssSessionCache(oss_session_cache_t *cache)
+{
+    if (cache->shards != NULL)
+    {
+        for (unsigned int i = 0; i < kSessionCacheShards; i++)
+        {
+            for (uint32_t s = 0; s <= cache->shards[i].slots_mask; s++)
+            {
+                if (cache->shards[i].slots[s].der != NULL)
+                {
+                    globalFree(cache->shards[i].slots[s].der);
+                }
+            }
+            globalFree(cache->shards[i].slots);
+            hmutex_destroy(&(cache->shards[i].lock));
+        }
+        globalFree(cache->shards_mem);
+    }
+    OPENSSL_cleanse(cache->keys, sizeof(cache->keys));
+    globalFree(cache);
+}
+
+void attachOssSessionCache(oss_session_cache_t *cache, SSL_CTX *ctx)
+{
+    SSL_CTX_set_app_data(ctx, cache);
+
+    // the same context on every worker, otherwise sessions of one worker are rejected by the others
+    SSL_CTX_set_session_id_context(ctx, cache->id_context, sizeof(cache->id_context));
+
+    if (cache->shards != NULL)
+    {
+        SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER | SSL_SESS_CACHE_NO_INTERNAL |
+                                                SSL_SESS_CACHE_NO_AUTO_CLEAR);
+        SSL_CTX_sess_set_new_cb(ctx, onNewSession);
+        SSL_CTX_sess_set_get_cb(ctx, onGetSession);
+        SSL_CTX_sess_set_remove_cb(ctx, onRemoveSession);
+    }
+
+#if OPENSSL_VERSION_MAJOR >= 3
+    SSL_CTX_set_tlsext_ticket_key_evp_cb(ctx, onTicketKey);
+#else
+    LOGW("OpensslServer: session ticket keys are per worker before OpenSSL 3");
+#endif
+}
+
+void ossSessionCacheRecordHandshake(oss_session_cache_t *cache, SSL *ssl, uint64_t cpu_ns)
+{
+    if (SSL_session_reused(ssl))
+    {
+        atomic_fetch_add_explicit(&(cache->handshakes_resumed), 1, memory_order_relaxed);
+    }
+    else
+    {
+        atomic_fetch_add_explicit(&(cache->handshakes_full), 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&(cache->handshake_cpu_ns), cpu_ns, memory_order_relaxed);
+}
+
+void ossSessionCacheGetStats(oss_session_cache_t *cache, oss_session_stats_t *stats)
+{
+    stats->handshakes_full      = atomic_load_explicit(&(cache->handshakes_full), memory_order_relaxed);
+    stats->handshakes_resumed   = atomic_load_explicit(&(cache->handshakes_resumed), memory_order_relaxed);
+    stats->handshake_cpu_ns     = atomic_load_explicit(&(cache->handshake_cpu_ns), memory_order_relaxed);
+    stats->cache_hits           = atomic_load_explicit(&(cache->cache_hits), memory_order_relaxed);
+    stats->cache_misses         = atomic_load_explicit(&(cache->cache_misses), memory_order_relaxed);
+    stats->ticket_key_rotations = atomic_load_explicit(&(cache->ticket_key_rotations), memory_order_relaxed);
+}
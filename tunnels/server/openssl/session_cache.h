@@ -0,0 +1,43 @@
+#pragma once
+#include "ww.h"
+#include <openssl/ssl.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    Resumption state shared by the ssl contexts of every worker of one OpenSSLServer
+
+    each worker has its own SSL_CTX, so without this a client that comes back on another worker cannot resume
+
+    session id cache:   tls 1.2 session ids (and 1.3 clients when tickets are off), sharded by the id, a shard is a
+                        direct mapped table under its own mutex, sessions are serialized outside the lock and only
+                        the pointer swap or a memcpy happens inside it
+    ticket keys:        one ring of 3 keys for all contexts, new tickets are sealed with the newest one, the older
+                        two still open tickets (and ask for a renewal), the ring rotates itself on the first ticket
+                        issued after the lifetime of the newest key has passed
+
+*/
+
+typedef struct oss_session_cache_s oss_session_cache_t;
+
+typedef struct oss_session_stats_s
+{
+    uint64_t handshakes_full;
+    uint64_t handshakes_resumed;
+    uint64_t handshake_cpu_ns; // thread cpu time spent in SSL_accept until the handshakes finished
+    uint64_t cache_hits;
+    uint64_t cache_misses;
+    uint64_t ticket_key_rotations;
+
+} oss_session_stats_t;
+
+// capacity 0 leaves the session id cache out, tickets are still shared
+oss_session_cache_t *newOssSessionCache(uint32_t capacity, uint32_t ticket_key_lifetime_sec);
+void                 destroyOssSessionCache(oss_session_cache_t *cache);
+
+// installs the callbacks into the context of a worker, the cache must outlive the context
+void attachOssSessionCache(oss_session_cache_t *cache, SSL_CTX *ctx);
+
+void ossSessionCacheRecordHandshake(oss_session_cache_t *cache, SSL *ssl, uint64_t cpu_ns);
+void ossSessionCacheGetStats(oss_session_cache_t *cache, oss_session_stats_t *stats);
@@ -4,6 +4,7 @@
 #include "buffer_stream.h"
 #include "loggers/network_logger.h"
 #include "node.h"
+#include "protobuf_frame.h"
 #include "shiftbuffer.h"
 #include "tunnel.h"
 #include "uleb128.h"
@@ -30,9 +31,10 @@ typedef struct protobuf_server_state_s
 
 typedef struct protobuf_server_con_state_s
 {
-    buffer_stream_t *stream_buf;
-    size_t           bytes_sent_nack;
-    size_t           bytes_received_nack;
+    buffer_stream_t        *stream_buf;
+    protobuf_frame_reader_t reader;
+    size_t                  bytes_sent_nack;
+    size_t                  bytes_received_nack;
 
 } protobuf_server_con_state_t;
 
@@ -53,44 +55,33 @@ static void upStream(tunnel_t *self, context_t *c)
 
         while (true)
         {
-            if (bufferStreamLen(bstream) < 2)
+            const enum protobuf_frame_status_e status = protobufFrameParse(&(cstate->reader), bstream, kMaxPacketSize);
+            if (status == kProtobufFrameIncomplete)
             {
                 destroyContext(c);
                 return;
             }
-            shift_buffer_t *full_data = bufferStreamFullRead(bstream);
-            uint8_t         flags;
-            readUnAlignedUI8(full_data, &flags);
-            shiftr(full_data, 1); // first byte is  (protobuf flag)
-
-            const uint8_t *uleb_data    = rawBuf(full_data);
-            uint64_t       data_len     = 0;
-            size_t         bytes_passed = readUleb128ToUint64(uleb_data, uleb_data + bufLen(full_data), &data_len);
-
-            if (data_len == 0 || (bufLen(full_data) - (bytes_passed)) < data_len)
+            if (status == kProtobufFrameTooLarge)
             {
-                shiftl(full_data, 1); // bring the data back to its original form
-
-                bufferStreamPush(bstream, full_data);
-                destroyContext(c);
-                return;
+                LOGE("ProtoBufServer: rejected, size too large");
+                goto disconnect;
             }
-
-            if (data_len > kMaxPacketSize)
+            if (status == kProtobufFrameMalformed)
             {
-                LOGE("ProtoBufServer: rejected, size too large");
-                reuseBuffer(getContextBufferPool(c), full_data);
+                LOGE("ProtoBufServer: rejected, invalid length");
                 goto disconnect;
             }
 
-            shiftr(full_data, bytes_passed);
+            const uint8_t   flags     = cstate->reader.flags;
+            const uint64_t  data_len  = cstate->reader.data_len;
+            shift_buffer_t *full_data = protobufFrameRead(&(cstate->reader), bstream);
 
             if (flags == 0x1 && data_len == sizeof(uint32_t))
             {
                 uint32_t consumed;
                 memcpy(&consumed, rawBuf(full_data), sizeof(uint32_t));
                 consumed = ntohl(consumed);
-                shiftr(full_data, sizeof(uint32_t));
+                reuseBuffer(getContextBufferPool(c), full_data);
 
                 cstate->bytes_sent_nack -= consumed;
 
@@ -98,18 +89,14 @@ static void upStream(tunnel_t *self, context_t *c)
                 {
                     resumeLineUpSide(c->line);
                 }
-
-                if (bufLen(full_data) > 0)
-                {
-                    bufferStreamPush(bstream, full_data);
-                }
-                else
-                {
-                    reuseBuffer(getContextBufferPool(c), full_data);
-                }
             }
             else if (flags == '\n')
             {
+                if (data_len == 0)
+                {
+                    reuseBuffer(getContextBufferPool(c), full_data);
+                    continue;
+                }
 
                 cstate->bytes_received_nack += (size_t) data_len;
                 if (cstate->bytes_received_nack >= kMaxRecvBeforeAck)
@@ -137,19 +124,9 @@ static void upStream(tunnel_t *self, context_t *c)
                     }
                 }
 
+                // the frame was read on its own, its payload goes on as it is
                 context_t *upstream_ctx = newContextFrom(c);
-                upstream_ctx->payload   = popBuffer(getContextBufferPool(c));
-
-                upstream_ctx->payload = sliceBufferTo(upstream_ctx->payload, full_data, data_len);
-
-                if (bufLen(full_data) > 0)
-                {
-                    bufferStreamPush(bstream, full_data);
-                }
-                else
-                {
-                    reuseBuffer(getContextBufferPool(c), full_data);
-                }
+                upstream_ctx->payload   = full_data;
                 self->up->upStream(self->up, upstream_ctx);
 
                 if (! isAlive(c->line))
@@ -162,7 +139,6 @@ static void upStream(tunnel_t *self, context_t *c)
             {
                 LOGE("ProtoBufServer: rejected, invalid flag");
                 reuseBuffer(getContextBufferPool(c), full_data);
-
                 goto disconnect;
             }
         }
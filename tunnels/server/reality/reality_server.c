@@ -31,6 +31,7 @@ typedef struct reality_server_state_s
     uint32_t     counter_threshold;
     char        *password;
     unsigned int password_length;
+    int          protocol;
 
 } reality_server_state_t;
 
@@ -42,6 +43,8 @@ typedef struct reality_server_con_state_s
     EVP_CIPHER_CTX            *cipher_context;
     buffer_stream_t           *read_stream;
     uint8_t                    giveup_counter;
+    reality_aead_t             aead_up;
+    reality_aead_t             aead_dw;
     enum connection_auth_state auth_state;
     uint32_t                   reply_sent_tit;
 
@@ -56,11 +59,49 @@ static void cleanup(tunnel_t *self, context_t *c)
     // EVP_MD_CTX_free(cstate->sign_context);
     EVP_MD_free(cstate->msg_digest);
     EVP_PKEY_free(cstate->sign_key);
+    destroyRealityAead(&(cstate->aead_up));
+    destroyRealityAead(&(cstate->aead_dw));
 
     globalFree(cstate);
     CSTATE_DROP(c);
 }
 
+static shift_buffer_t *sealRecord(reality_server_state_t *state, reality_server_con_state_t *cstate,
+                                  shift_buffer_t *buf, buffer_pool_t *pool)
+{
+    if (state->protocol == kRealityProtocolAead)
+    {
+        buf = realityAeadSeal(&(cstate->aead_dw), buf, state->password, false, pool);
+    }
+    else
+    {
+        buf = genericEncrypt(buf, cstate->cipher_context, state->context_password, pool);
+        signMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
+        assert(bufLen(buf) % 16 == 0);
+    }
+    appendTlsHeader(buf);
+    return buf;
+}
+
+// the record without its tls header, decrypted in place for protocol 2
+static shift_buffer_t *openRecord(reality_server_state_t *state, reality_server_con_state_t *cstate,
+                                  shift_buffer_t *buf, buffer_pool_t *pool, bool *ok)
+{
+    if (state->protocol == kRealityProtocolAead)
+    {
+        // the server speaks the cipher the client picked
+        *ok                    = realityAeadOpen(&(cstate->aead_up), buf, state->password, true, 0);
+        cstate->aead_dw.cipher = cstate->aead_up.cipher;
+        return buf;
+    }
+    *ok = verifyMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
+    if (*ok)
+    {
+        buf = genericDecrypt(buf, cstate->cipher_context, state->context_password, pool);
+    }
+    return buf;
+}
+
 static void upStream(tunnel_t *self, context_t *c)
 {
     reality_server_state_t     *state  = TSTATE(self);
@@ -87,7 +128,9 @@ static void upStream(tunnel_t *self, context_t *c)
                     shift_buffer_t *record_buf = bufferStreamRead(cstate->read_stream, kTLSHeaderlen + length);
                     shiftr(record_buf, kTLSHeaderlen);
 
-                    if (verifyMessage(record_buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key))
+                    bool verified = false;
+                    record_buf    = openRecord(state, cstate, record_buf, getContextBufferPool(c), &verified);
+                    if (verified)
                     {
                         reuseContextPayload(c);
                         cstate->auth_state = kConAuthorized;
@@ -102,8 +145,6 @@ static void upStream(tunnel_t *self, context_t *c)
                             return;
                         }
 
-                        record_buf = genericDecrypt(record_buf, cstate->cipher_context, state->context_password,
-                                                    getContextBufferPool(c));
                         context_t *plain_data_ctx = newContextFrom(c);
                         plain_data_ctx->payload   = record_buf;
                         self->up->upStream(self->up, plain_data_ctx);
@@ -156,16 +197,18 @@ static void upStream(tunnel_t *self, context_t *c)
                     bool is_tls_33 = tls_ver_b == kTLSVersion12;
                     shiftr(buf, kTLSHeaderlen);
 
-                    if (! verifyMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key) ||
-                        ! is_tls_applicationdata || ! is_tls_33)
+                    bool verified = false;
+                    if (is_tls_applicationdata && is_tls_33)
+                    {
+                        buf = openRecord(state, cstate, buf, getContextBufferPool(c), &verified);
+                    }
+                    if (! verified)
                     {
                         LOGE("RealityServer: verifyMessage failed");
                         reuseBuffer(getContextBufferPool(c), buf);
                         goto failed;
                     }
 
-                    buf = genericDecrypt(buf, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-
                     context_t *plain_data_ctx = newContextFrom(c);
                     plain_data_ctx->payload   = buf;
                     self->up->upStream(self->up, plain_data_ctx);
@@ -197,6 +240,11 @@ static void upStream(tunnel_t *self, context_t *c)
             cstate->msg_digest     = (EVP_MD *) EVP_get_digestbynid(MSG_DIGEST_ALG);
             int sk_size            = EVP_MD_size(cstate->msg_digest);
             cstate->sign_key       = EVP_PKEY_new_mac_key(EVP_PKEY_HMAC, NULL, state->hashes, sk_size);
+            if (state->protocol == kRealityProtocolAead)
+            {
+                initRealityAead(&(cstate->aead_up), 0);
+                initRealityAead(&(cstate->aead_dw), 0);
+            }
 
             state->dest->upStream(state->dest, c);
         }
@@ -237,15 +285,14 @@ static void downStream(tunnel_t *self, context_t *c)
         case kConAuthorized: {
             shift_buffer_t *buf           = c->payload;
             c->payload                    = NULL;
-            const unsigned int chunk_size = (kMaxSSLChunkSize - (kSignLen + (2 * kEncryptionBlockSize) + kIVlen));
+            const unsigned int chunk_size =
+                state->protocol == kRealityProtocolAead
+                    ? (kMaxSSLChunkSize - (kAeadPreambleLen + kAeadTagLen))
+                    : (kMaxSSLChunkSize - (kSignLen + (2 * kEncryptionBlockSize) + kIVlen));
 
             if (bufLen(buf) < chunk_size)
             {
-                buf = genericEncrypt(buf, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-                signMessage(buf, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
-                appendTlsHeader(buf);
-                assert(bufLen(buf) % 16 == 5);
-                c->payload = buf;
+                c->payload = sealRecord(state, cstate, buf, getContextBufferPool(c));
                 self->dw->downStream(self->dw, c);
             }
             else
@@ -255,13 +302,8 @@ static void downStream(tunnel_t *self, context_t *c)
                     const uint16_t  remain = (uint16_t) min(bufLen(buf), chunk_size);
                     shift_buffer_t *chunk  = popBuffer(getContextBufferPool(c));
                     chunk = sliceBufferTo(chunk, buf, remain);
-                    chunk =
-                        genericEncrypt(chunk, cstate->cipher_context, state->context_password, getContextBufferPool(c));
-                    signMessage(chunk, cstate->msg_digest, cstate->sign_context, cstate->sign_key);
-                    appendTlsHeader(chunk);
                     context_t *cout = newContextFrom(c);
-                    cout->payload   = chunk;
-                    assert(bufLen(chunk) % 16 == 5);
+                    cout->payload   = sealRecord(state, cstate, chunk, getContextBufferPool(c));
                     self->dw->downStream(self->dw, cout);
                 }
                 reuseBuffer(getContextBufferPool(c), buf);
@@ -327,6 +369,13 @@ tunnel_t *newRealityServer(node_instance_context_t *instance_info)
     }
     // memset already made buff 0
     memcpy(state->context_password, state->password, state->password_length);
+
+    getIntFromJsonObjectOrDefault(&(state->protocol), settings, "protocol", kRealityProtocolCbcHmac);
+    if (state->protocol != kRealityProtocolCbcHmac && state->protocol != kRealityProtocolAead)
+    {
+        LOGF("JSON Error: RealityServer->settings->protocol (int field) : only 1 and 2 are supported");
+        return NULL;
+    }
     if (EVP_MAX_MD_SIZE % sizeof(uint64_t) != 0)
     {
         LOGF("Assert Error: RealityServer-> EVP_MAX_MD_SIZE not a multiple of 8");
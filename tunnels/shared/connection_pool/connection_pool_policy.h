@@ -0,0 +1,90 @@
+#pragma once
+#include "cJSON.h"
+#include "utils/jsonutils.h"
+#include "utils/mathutils.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Sizing policy of a per worker pool of carrier connections (mux and http2 clients)
+
+    a new stream goes to the connection with the lowest load score among the ones that are not busy; the pool
+    opens another connection while it is below min-connections or when every connection is busy, up to
+    max-connections; connections without streams for idle-timeout are closed while the pool is above
+    min-connections
+
+    the owner keeps the connections and decides what load and busy mean for them, this only makes the choices
+
+*/
+
+typedef struct connection_pool_policy_s
+{
+    uint32_t min_connections;
+    uint32_t max_connections;
+    uint32_t idle_timeout; // ms
+
+} connection_pool_policy_t;
+
+// the load of a connection, lower is better; sets *busy when it should not take a new stream unless all are busy
+typedef uint64_t (*ConnectionPoolLoadFn)(void *owner, void *con, bool *busy);
+
+// "min-connections", "max-connections" and "idle-timeout" of the node settings
+static inline void parseConnectionPoolPolicy(connection_pool_policy_t *policy, const cJSON *settings)
+{
+    int min_connections;
+    int max_connections;
+    int idle_timeout;
+    getIntFromJsonObjectOrDefault(&min_connections, settings, "min-connections", 1);
+    getIntFromJsonObjectOrDefault(&max_connections, settings, "max-connections", 8);
+    getIntFromJsonObjectOrDefault(&idle_timeout, settings, "idle-timeout", 30000);
+    policy->min_connections = (uint32_t) max(1, min_connections);
+    policy->max_connections = (uint32_t) max((int) policy->min_connections, max_connections);
+    policy->idle_timeout    = (uint32_t) max(0, idle_timeout);
+}
+
+/*
+    the connection a new stream should go to, NULL when the owner has to open a new one for it (the pool is below
+    min-connections, or every connection is busy and the pool is below max-connections)
+*/
+static inline void *connectionPoolPick(const connection_pool_policy_t *policy, void *const *cons, size_t count,
+                                       ConnectionPoolLoadFn load_fn, void *owner)
+{
+    void    *best            = NULL;
+    void    *least_busy      = NULL;
+    uint64_t best_load       = UINT64_MAX;
+    uint64_t least_busy_load = UINT64_MAX;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        bool           busy = false;
+        const uint64_t load = load_fn(owner, cons[i], &busy);
+
+        if (busy)
+        {
+            if (least_busy == NULL || load < least_busy_load)
+            {
+                least_busy_load = load;
+                least_busy      = cons[i];
+            }
+        }
+        else if (best == NULL || load < best_load)
+        {
+            best_load = load;
+            best      = cons[i];
+        }
+    }
+
+    if (count < policy->min_connections || (best == NULL && count < policy->max_connections))
+    {
+        return NULL;
+    }
+    return best != NULL ? best : least_busy;
+}
+
+// true when a connection without streams since idle_since should be closed, count is the size of its pool
+static inline bool connectionPoolShouldRetire(const connection_pool_policy_t *policy, size_t count,
+                                              bool has_streams, uint64_t idle_since, uint64_t now)
+{
+    return ! has_streams && count > policy->min_connections && now - idle_since >= policy->idle_timeout;
+}
@@ -0,0 +1,96 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+    Flow control window tuning from a bandwidth delay product estimate
+
+    when data arrives and no probe is out, a ping is sent and the bytes received until its ack counted; that sample
+    is what the peer managed to send in one round trip, if it filled most of the window the window was the limit and
+    it grows to twice the sample, the bandwidth seen must also be a new maximum so a slow round trip alone does not
+    grow it; the windows never go above max_window, once there no more probes are sent
+
+    the owner applies a new window to the connection (WINDOW_UPDATE) and to the streams (SETTINGS_INITIAL_WINDOW_SIZE)
+
+*/
+
+enum http2_window_sizes_e
+{
+    kHttp2InitialWindowSize    = 1 << 18,
+    kHttp2DefaultMaxWindowSize = 16 * 1024 * 1024,
+    kHttp2MaxWindowSize        = 0x7fffffff // rfc 7540, 6.9.1
+};
+
+// opaque data of the probe pings, keepalive pings carry zeros
+static const uint8_t kHttp2BdpProbeData[8] = {'w', 'w', 'b', 'd', 'p', 0, 0, 1};
+
+typedef struct http2_bdp_s
+{
+    uint64_t probe_sent_us;
+    uint64_t sample;        // bytes received since the probe was sent
+    uint64_t max_bandwidth; // bytes per second
+    uint32_t window;
+    uint32_t max_window;
+    bool     probing;
+
+} http2_bdp_t;
+
+static inline void initHttp2Bdp(http2_bdp_t *bdp, uint32_t window, uint32_t max_window)
+{
+    *bdp = (http2_bdp_t) {.window = window, .max_window = max_window};
+}
+
+static inline bool isHttp2BdpProbe(const uint8_t *opaque_data)
+{
+    return memcmp(opaque_data, kHttp2BdpProbeData, sizeof(kHttp2BdpProbeData)) == 0;
+}
+
+// true when a probe ping should be sent now
+static inline bool http2BdpReceived(http2_bdp_t *bdp, uint32_t bytes, uint64_t now_us)
+{
+    if (bdp->probing)
+    {
+        bdp->sample += bytes;
+        return false;
+    }
+    if (bdp->window >= bdp->max_window)
+    {
+        return false;
+    }
+    bdp->probing       = true;
+    bdp->sample        = bytes;
+    bdp->probe_sent_us = now_us;
+    return true;
+}
+
+// returns the window to switch to, 0 when it stays as it is
+static inline uint32_t http2BdpProbeAcked(http2_bdp_t *bdp, uint64_t now_us)
+{
+    if (! bdp->probing)
+    {
+        return 0;
+    }
+    bdp->probing = false;
+
+    const uint64_t rtt_us    = now_us > bdp->probe_sent_us ? now_us - bdp->probe_sent_us : 1;
+    const uint64_t bandwidth = bdp->sample * 1000000 / rtt_us;
+
+    if (bdp->sample * 3 < (uint64_t) bdp->window * 2 || bandwidth <= bdp->max_bandwidth)
+    {
+        return 0;
+    }
+    bdp->max_bandwidth = bandwidth;
+
+    uint64_t window = bdp->sample * 2;
+    if (window > bdp->max_window)
+    {
+        window = bdp->max_window;
+    }
+    if (window <= bdp->window)
+    {
+        return 0;
+    }
+    bdp->window = (uint32_t) window;
+    return bdp->window;
+}
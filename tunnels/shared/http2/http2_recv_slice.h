@@ -0,0 +1,78 @@
+#pragma once
+#include "buffer_pool.h"
+#include "shiftbuffer.h"
+#include <stdint.h>
+
+/*
+    Receive side slicing of http2 data frames
+
+    nghttp2 hands the data chunks out as pointers into the carrier buffer it is reading, instead of copying a chunk
+    into a fresh buffer the carrier buffer itself can become the chunk: the bytes after the chunk (the rest of the
+    carrier buffer) move to a new buffer which the carrier continues with, and the old one is trimmed to the chunk
+
+    that is done when the rest is smaller than the chunk, so the smaller side is always the one copied; the memory
+    of the taken buffer is not touched, nghttp2 can keep parsing what follows the chunk out of it until
+    nghttp2_session_mem_recv2() returns; only one chunk per recv call can take the buffer
+
+*/
+
+typedef struct http2_recv_slice_s
+{
+    shift_buffer_t *buf;   // the carrier buffer given to nghttp2, or what is left of it once a chunk took it
+    uint32_t        taken; // bytes of the original buffer up to the end of the chunk that took it
+
+} http2_recv_slice_t;
+
+static inline void http2RecvSliceBegin(http2_recv_slice_t *slice, shift_buffer_t *buf)
+{
+    slice->buf   = buf;
+    slice->taken = 0;
+}
+
+// called from the data chunk callback, returns a buffer holding the chunk
+static inline shift_buffer_t *http2RecvSliceData(http2_recv_slice_t *slice, buffer_pool_t *pool, const uint8_t *data,
+                                                 uint32_t len)
+{
+    shift_buffer_t *buf = slice->buf;
+
+    if (buf != NULL && slice->taken == 0)
+    {
+        const uintptr_t start = (uintptr_t) rawBuf(buf);
+        const uintptr_t end   = start + bufLen(buf);
+        const uintptr_t chunk = (uintptr_t) data;
+
+        if (chunk >= start && chunk + len <= end && end - (chunk + len) < len)
+        {
+            const uint32_t offset = (uint32_t) (chunk - start);
+            const uint32_t rest   = (uint32_t) (end - (chunk + len));
+
+            shift_buffer_t *remainder = reserveBufSpace(popBuffer(pool), rest);
+            setLen(remainder, rest);
+            writeRaw(remainder, data + len, rest);
+
+            shiftr(buf, offset);
+            setLen(buf, len);
+            slice->buf   = remainder;
+            slice->taken = offset + len;
+            return buf;
+        }
+    }
+
+    shift_buffer_t *copy = reserveBufSpace(popBuffer(pool), len);
+    setLen(copy, len);
+    writeRaw(copy, data, len);
+    return copy;
+}
+
+/*
+    called once nghttp2_session_mem_recv2() returned, gives the buffer the carrier continues with and turns the
+    bytes nghttp2 consumed from the original buffer into bytes to skip in that one
+*/
+static inline shift_buffer_t *http2RecvSliceEnd(http2_recv_slice_t *slice, uint32_t *consumed)
+{
+    shift_buffer_t *buf = slice->buf;
+    *consumed -= slice->taken;
+    slice->buf   = NULL;
+    slice->taken = 0;
+    return buf;
+}
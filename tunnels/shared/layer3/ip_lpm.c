@@ -0,0 +1,134 @@
+#include "ip_lpm.h"
+#include "managers/memory_manager.h"
+#include <assert.h>
+#include <string.h>
+
+enum
+{
+    kIpLpmInitialChunksCap = 64
+};
+
+static inline uint32_t makeLeaf(uint8_t depth, uint32_t value)
+{
+    return ((uint32_t) depth << kIpLpmDepthShift) | value;
+}
+
+static inline uint8_t leafDepth(uint32_t e)
+{
+    return (uint8_t) (e >> kIpLpmDepthShift);
+}
+
+static inline uint32_t *chunkAt(ip_lpm_t *lpm, uint32_t child)
+{
+    return &(lpm->entries[kIpLpmFirstLevelLen + ((child & ~(uint32_t) kIpLpmChildFlag) << kIpLpmChunkStride)]);
+}
+
+static uint32_t newChunk(ip_lpm_t *lpm, uint32_t inherited_leaf)
+{
+    if (lpm->chunks_count == lpm->chunks_cap)
+    {
+        lpm->chunks_cap *= 2;
+        lpm->entries = globalRealloc(lpm->entries, sizeof(uint32_t) * (kIpLpmFirstLevelLen +
+                                                                       ((size_t) lpm->chunks_cap * kIpLpmChunkLen)));
+    }
+    const uint32_t child = lpm->chunks_count++ | (uint32_t) kIpLpmChildFlag;
+    uint32_t      *chunk = chunkAt(lpm, child);
+
+    // the new level starts with whatever the expanded shorter prefix pointed to
+    for (unsigned int i = 0; i < kIpLpmChunkLen; i++)
+    {
+        chunk[i] = inherited_leaf;
+    }
+    return child;
+}
+
+// overwrite every leaf (also inside the deeper levels) that belongs to a shorter or equal prefix
+static void fillRange(ip_lpm_t *lpm, uint32_t *level, uint32_t from, uint32_t count, uint32_t leaf)
+{
+    for (uint32_t i = from; i < from + count; i++)
+    {
+        if (level[i] & kIpLpmChildFlag)
+        {
+            fillRange(lpm, chunkAt(lpm, level[i]), 0, kIpLpmChunkLen, leaf);
+        }
+        else if (leafDepth(level[i]) <= leafDepth(leaf))
+        {
+            level[i] = leaf;
+        }
+    }
+}
+
+static uint32_t readBits(const uint8_t *addr, unsigned int offset, unsigned int count)
+{
+    assert(count == kIpLpmFirstStride || count == kIpLpmChunkStride);
+    if (count == kIpLpmFirstStride)
+    {
+        return ((uint32_t) addr[offset / 8] << 8) | addr[(offset / 8) + 1];
+    }
+    return addr[offset / 8];
+}
+
+bool ipLpmInsert(ip_lpm_t *lpm, const uint8_t *addr, uint8_t prefix_len, uint32_t value)
+{
+    if (prefix_len > lpm->addr_bits || value == 0 || value > kIpLpmMaxValue)
+    {
+        return false;
+    }
+
+    const uint32_t leaf   = makeLeaf(prefix_len, value);
+    unsigned int   offset = 0;
+    unsigned int   stride = kIpLpmFirstStride;
+    uint32_t       child  = 0;
+    bool           first  = true;
+
+    while (true)
+    {
+        uint32_t *level = first ? lpm->entries : chunkAt(lpm, child);
+        uint32_t  index = readBits(addr, offset, stride);
+
+        if (prefix_len <= offset + stride)
+        {
+            // the prefix ends in this level, expand it over all slots it covers
+            const unsigned int free_bits = offset + stride - prefix_len;
+            index                        = (index >> free_bits) << free_bits;
+            fillRange(lpm, level, index, 1U << free_bits, leaf);
+            lpm->prefixes_count++;
+            return true;
+        }
+
+        if (! (level[index] & kIpLpmChildFlag))
+        {
+            const uint32_t new_child = newChunk(lpm, level[index]);
+            // entries may have moved
+            level        = first ? lpm->entries : chunkAt(lpm, child);
+            level[index] = new_child;
+        }
+
+        child  = level[index];
+        first  = false;
+        offset += stride;
+        stride = kIpLpmChunkStride;
+    }
+}
+
+ip_lpm_t *newIpLpm(uint8_t addr_bits)
+{
+    assert(addr_bits == 32 || addr_bits == 128);
+
+    ip_lpm_t *lpm = globalMalloc(sizeof(ip_lpm_t));
+    *lpm          = (ip_lpm_t) {.addr_bits      = addr_bits,
+                                .chunks_count   = 0,
+                                .chunks_cap     = kIpLpmInitialChunksCap,
+                                .prefixes_count = 0,
+                                .entries        = globalMalloc(sizeof(uint32_t) * (kIpLpmFirstLevelLen +
+                                                                          (kIpLpmInitialChunksCap * kIpLpmChunkLen)))};
+
+    memset(lpm->entries, 0, sizeof(uint32_t) * kIpLpmFirstLevelLen);
+    return lpm;
+}
+
+void destroyIpLpm(ip_lpm_t *lpm)
+{
+    globalFree(lpm->entries);
+    globalFree(lpm);
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "ww.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    Longest prefix match table, a multibit trie with a 16 bit first level and 8 bit levels after that
+
+    ipv4 lookup costs at most 3 memory reads and ipv6 at most 15, no matter how many prefixes are inserted,
+    because prefixes are expanded into the levels at insert time (controlled prefix expansion)
+
+    every entry is 32 bit:
+        - child entry: kIpLpmChildFlag | index of the 256 entry chunk of the next level
+        - leaf entry:  (prefix length << kIpLpmDepthShift) | value
+
+    value 0 means no match, so users store (index + 1) of whatever the prefix points to
+
+    the table is built once and then only read, it is safe to read from all workers, to change the routes
+    build a new one and swap the pointer
+
+*/
+
+enum
+{
+    kIpLpmChildFlag     = (int) (1U << 31),
+    kIpLpmDepthShift    = 23,
+    kIpLpmValueMask     = (1 << kIpLpmDepthShift) - 1,
+    kIpLpmFirstStride   = 16,
+    kIpLpmFirstLevelLen = 1 << kIpLpmFirstStride,
+    kIpLpmChunkStride   = 8,
+    kIpLpmChunkLen      = 1 << kIpLpmChunkStride,
+    kIpLpmMaxValue      = kIpLpmValueMask
+};
+
+typedef struct ip_lpm_s
+{
+    uint32_t *entries;
+    uint32_t  chunks_count;
+    uint32_t  chunks_cap;
+    uint32_t  prefixes_count;
+    uint8_t   addr_bits;
+
+} ip_lpm_t;
+
+ip_lpm_t *newIpLpm(uint8_t addr_bits);
+void      destroyIpLpm(ip_lpm_t *lpm);
+
+// addr is in network order, only the first prefix_len bits of it are used
+bool ipLpmInsert(ip_lpm_t *lpm, const uint8_t *addr, uint8_t prefix_len, uint32_t value);
+
+static inline uint32_t ipLpmChunkEntry(const ip_lpm_t *lpm, uint32_t child, uint8_t byte)
+{
+    return lpm->entries[kIpLpmFirstLevelLen + ((child & ~(uint32_t) kIpLpmChildFlag) << kIpLpmChunkStride) + byte];
+}
+
+// addr is in network order, returns the value of the longest matching prefix or 0
+static inline uint32_t ipLpmLookup4(const ip_lpm_t *lpm, uint32_t addr)
+{
+    const uint8_t *a = (const uint8_t *) &addr;
+    uint32_t       e = lpm->entries[((uint32_t) a[0] << 8) | a[1]];
+
+    if (WW_UNLIKELY(e & kIpLpmChildFlag))
+    {
+        e = ipLpmChunkEntry(lpm, e, a[2]);
+        if (e & kIpLpmChildFlag)
+        {
+            e = ipLpmChunkEntry(lpm, e, a[3]);
+        }
+    }
+    return e & kIpLpmValueMask;
+}
+
+// addr is 16 bytes in network order, returns the value of the longest matching prefix or 0
+static inline uint32_t ipLpmLookup6(const ip_lpm_t *lpm, const uint8_t *addr)
+{
+    uint32_t e = lpm->entries[((uint32_t) addr[0] << 8) | addr[1]];
+
+    for (unsigned int i = 2; (e & kIpLpmChildFlag) && i < 16; i++)
+    {
+        e = ipLpmChunkEntry(lpm, e, addr[i]);
+    }
+    return e & kIpLpmValueMask;
+}
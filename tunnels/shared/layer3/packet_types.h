@@ -1,7 +1,10 @@
 
+#include "checksum.h"
 #include "hsocket.h"
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 struct ipv4header
 {
@@ -78,24 +81,112 @@ struct tcpheader
     uint16_t urg_ptr; // Urgent pointer
 } __attribute__((packed));
 
-static inline uint16_t standardCheckSum(uint8_t *buf, int len)
+/*
+    ones' complement sum of the 16 bit words of buf added to sum, not folded and not inverted, so it can be
+    continued over another buffer (pseudo header + segment) without copying them next to each other
+
+    the result is byte order independent (rfc 1071), words are read as they are in memory
+*/
+static inline uint64_t checkSumAccumulate(const void *buf, int len, uint64_t sum)
 {
-    unsigned int sum = 0;
-    uint16_t    *ptr = (uint16_t *) buf;
+    const uint8_t *ptr = (const uint8_t *) buf;
     while (len > 1)
     {
-        sum += *ptr++;
+        // memcpy keeps it legal to sum any struct (pseudo headers) as words, compiles to a plain load
+        uint16_t word;
+        memcpy(&word, ptr, sizeof(word));
+        sum += word;
+        ptr += 2;
         len -= 2;
     }
     if (len)
     {
-        sum += *(uint8_t *) ptr;
+        sum += *ptr;
     }
+    return sum;
+}
+
+static inline uint16_t checkSumFinish(uint64_t sum)
+{
+    sum = (sum >> 32) + (sum & 0xffffffff);
+    sum = (sum >> 16) + (sum & 0xffff);
     sum = (sum >> 16) + (sum & 0xffff);
     sum += (sum >> 16);
     return (uint16_t) (~sum);
 }
 
+// full checksum of a buffer with the fastest kernel of this cpu (checksum.h)
+static inline uint16_t standardCheckSum(uint8_t *buf, int len)
+{
+    return (uint16_t) ~checkSumPartial(buf, (uint32_t) len, 0);
+}
+
+/*
+    Incremental checksum update (rfc 1624, eqn 3):  HC' = ~(~HC + ~m + m')
+
+    used when only a few fields of a packet change, the old and new values are taken as they are in memory
+*/
+static inline uint16_t checkSumUpdate16(uint16_t check, uint16_t old_word, uint16_t new_word)
+{
+    uint32_t sum = (uint32_t) (uint16_t) ~check + (uint16_t) ~old_word + new_word;
+    sum          = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
+static inline uint16_t checkSumUpdate32(uint16_t check, uint32_t old_value, uint32_t new_value)
+{
+    uint32_t sum = (uint32_t) (uint16_t) ~check + (uint16_t) ~old_value + (uint16_t) ~(old_value >> 16) +
+                   (uint16_t) new_value + (uint16_t) (new_value >> 16);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum += (sum >> 16);
+    return (uint16_t) ~sum;
+}
+
+// len must be even, used for ipv6 addresses
+static inline uint16_t checkSumUpdateBytes(uint16_t check, const void *old_bytes, const void *new_bytes, int len)
+{
+    uint64_t sum = (uint16_t) ~check;
+    for (int i = 0; i < len; i += 2)
+    {
+        uint16_t old_word;
+        uint16_t new_word;
+        memcpy(&old_word, (const uint8_t *) old_bytes + i, sizeof(old_word));
+        memcpy(&new_word, (const uint8_t *) new_bytes + i, sizeof(new_word));
+        sum += (uint16_t) ~old_word;
+        sum += new_word;
+    }
+    return checkSumFinish(sum);
+}
+
+// the 16 bit word that holds the bit fields after the tcp ack number (data offset and flags)
+static inline uint16_t tcpFlagsWord(const struct tcpheader *tcp_header)
+{
+    uint16_t word;
+    memcpy(&word, ((const uint8_t *) tcp_header) + 12, sizeof(word));
+    return word;
+}
+
+// the 16 bit word that holds ttl and protocol of an ipv4 header
+static inline uint16_t ip4ProtocolWord(const struct ipv4header *ip_header)
+{
+    uint16_t word;
+    memcpy(&word, ((const uint8_t *) ip_header) + 8, sizeof(word));
+    return word;
+}
+
+// true if the packet carries a complete tcp header that its checksum can be updated in
+static inline bool hasTcpHeader4(const struct ipv4header *ip_header, uint32_t packet_len)
+{
+    return ip_header->protocol == IPPROTO_TCP && (ip_header->frag_off & htons(0x1FFF)) == 0 &&
+           packet_len >= (uint32_t) (ip_header->ihl * 4) + sizeof(struct tcpheader);
+}
+
+static inline bool hasTcpHeader6(const struct ipv6header *ip6_header, uint32_t packet_len)
+{
+    return ip6_header->nexthdr == IPPROTO_TCP && packet_len >= sizeof(struct ipv6header) + sizeof(struct tcpheader);
+}
+
 /** Swap the bytes in an u16_t: much like lwip_htons() for little-endian */
 #ifndef SWAP_BYTES_IN_WORD
 #define SWAP_BYTES_IN_WORD(w) ((((w) & 0xff) << 8) | (((w) & 0xff00) >> 8))
@@ -161,10 +252,9 @@ struct pseudo_header_s
     uint16_t tcp_length;
 };
 
+// full recompute, the pseudo header is summed separately and passed to the kernel, the segment is never copied
 static void tcpCheckSum4(struct ipv4header *ip_header, struct tcpheader *tcp_header)
 {
-
-    tcp_header->check = 0;
     struct pseudo_header_s psd_header;
     psd_header.dest_addr   = ip_header->daddr;
     psd_header.src_addr    = ip_header->saddr;
@@ -173,16 +263,9 @@ static void tcpCheckSum4(struct ipv4header *ip_header, struct tcpheader *tcp_hea
     psd_header.tcp_length  = htons(ntohs(ip_header->tot_len) - ip_header->ihl * 4);
     int tcp_total_length   = ntohs(psd_header.tcp_length);
 
-
-    char tcp_buf[4096];
-    assert(sizeof(psd_header) + tcp_total_length < 4096);
-
-    memcpy(tcp_buf, &psd_header, sizeof(struct pseudo_header_s));
-    memcpy(tcp_buf + sizeof(struct pseudo_header_s), tcp_header, tcp_total_length);
-
     tcp_header->check = 0;
-    // Calculate the checksum
-    tcp_header->check = standardCheckSum((uint8_t *) tcp_buf, (int) sizeof(struct pseudo_header_s) + tcp_total_length);
+    uint64_t sum      = checkSumAccumulate(&psd_header, (int) sizeof(struct pseudo_header_s), 0);
+    tcp_header->check = (uint16_t) ~checkSumPartial(tcp_header, (uint32_t) tcp_total_length, sum);
 }
 
 struct pseudo_header6_s
@@ -196,7 +279,6 @@ struct pseudo_header6_s
 
 static void tcpCheckSum6(struct ipv6header *ip6_header, struct tcpheader *tcp_header)
 {
-    tcp_header->check = 0;
     struct pseudo_header6_s psd_header;
     memcpy(&psd_header.src_addr, &ip6_header->saddr, sizeof(psd_header.src_addr));
     memcpy(&psd_header.dest_addr, &ip6_header->daddr, sizeof(psd_header.dest_addr));
@@ -204,12 +286,41 @@ static void tcpCheckSum6(struct ipv6header *ip6_header, struct tcpheader *tcp_he
     memset(psd_header.zero, 0, sizeof(psd_header.zero));
     psd_header.next_header = ip6_header->nexthdr;
 
-    int  pseudo_header_len = sizeof(psd_header);
-    long tcp_total_length  = ntohl(psd_header.tcp_length);
-    char tcp_buf[4096];
-    memcpy(tcp_buf, &psd_header, pseudo_header_len);
-    assert(pseudo_header_len + tcp_total_length < 4096);
-    memcpy(tcp_buf + pseudo_header_len, tcp_header, tcp_total_length);
+    int tcp_total_length = (int) ntohl(psd_header.tcp_length);
+
+    tcp_header->check = 0;
+    uint64_t sum      = checkSumAccumulate(&psd_header, (int) sizeof(psd_header), 0);
+    tcp_header->check = (uint16_t) ~checkSumPartial(tcp_header, (uint32_t) tcp_total_length, sum);
+}
+
+/*
+    Recomputes the ip header checksum and the tcp checksum of a packet, for the nodes that hand packets out of the
+    layer3 chain (they must be valid by then), returns false if the packet is not ipv4 or ipv6
+*/
+static bool recalculatePacketCheckSums(uint8_t *packet_bytes)
+{
+    packet_mask *packet = (packet_mask *) packet_bytes;
 
-    tcp_header->check = standardCheckSum((uint8_t *) tcp_buf, (int) (pseudo_header_len + tcp_total_length));
+    if (packet->ip4_header.version == 4)
+    {
+        const unsigned int ip_header_len = packet->ip4_header.ihl * 4;
+
+        packet->ip4_header.check = 0x0;
+        packet->ip4_header.check = standardCheckSum((void *) packet, (int) ip_header_len);
+
+        if (packet->ip4_header.protocol == 6)
+        {
+            tcpCheckSum4(&(packet->ip4_header), (struct tcpheader *) (packet_bytes + ip_header_len));
+        }
+        return true;
+    }
+    if (packet->ip6_header.version == 6)
+    {
+        if (packet->ip6_header.nexthdr == 6)
+        {
+            tcpCheckSum6(&(packet->ip6_header), (struct tcpheader *) (packet_bytes + sizeof(struct ipv6header)));
+        }
+        return true;
+    }
+    return false;
 }
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define LWIP_TIMEVAL_PRIVATE  0
+#define LWIP_ERRNO_STDINCLUDE 1
+#define LWIP_ERRNO_INCLUDE    <errno.h>
+
+typedef unsigned int sys_prot_t;
+
+uint32_t lwipPortRand(void);
+#define LWIP_RAND() (lwipPortRand())
+
+#define LWIP_PLATFORM_DIAG(x)                                                                                          \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        printf x;                                                                                                      \
+    } while (0)
+
+#define LWIP_PLATFORM_ASSERT(x)                                                                                        \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        fprintf(stderr, "lwip assertion \"%s\" failed at line %d in %s\n", x, __LINE__, __FILE__);                    \
+        abort();                                                                                                       \
+    } while (0)
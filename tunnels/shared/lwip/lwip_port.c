@@ -0,0 +1,27 @@
+#include "lwip/sys.h"
+#include <time.h>
+
+// NO_SYS port, lwIP only needs a millisecond clock and a random source
+
+u32_t sys_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u32_t) ((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+// used for initial sequence numbers and ports, each worker has its own state like the rest of lwIP
+uint32_t lwipPortRand(void)
+{
+    static _Thread_local uint32_t state = 0;
+    if (state == 0)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        state = (uint32_t) ts.tv_nsec | 1;
+    }
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
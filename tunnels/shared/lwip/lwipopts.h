@@ -0,0 +1,104 @@
+#pragma once
+
+/*
+    lwIP configuration for the userspace tcp stack of the layer3 nodes (Layer3TcpTerminator)
+
+    every worker runs its own lwIP instance (all lwIP globals are LWIP_THREAD_LOCAL), there is no tcpip thread
+    and no locking, a flow lives and dies on the worker that owns it
+
+    memory comes from the c allocator (mimalloc), so pools are only limits and are safe to use from all workers
+*/
+
+#include <stdint.h>
+
+// one lwIP per worker thread
+#define LWIP_THREAD_LOCAL _Thread_local
+
+// accept tcp syn to any address/port on our netif, the listener is bound to port 0
+#define LWIP_TCP_ACCEPT_ANY 1
+
+#define NO_SYS                  1
+#define LWIP_TIMERS             1
+#define SYS_LIGHTWEIGHT_PROT    0
+#define LWIP_NETCONN            0
+#define LWIP_SOCKET             0
+#define LWIP_NETIF_API          0
+#define LWIP_SINGLE_NETIF       1
+#define LWIP_NETIF_LOOPBACK     0
+#define LWIP_HAVE_LOOPIF        0
+#define LWIP_STATS              0
+#define LWIP_CALLBACK_API       1
+#define LWIP_TCPIP_CORE_LOCKING 0
+
+// the system headers already provide htons and friends
+#define LWIP_DONT_PROVIDE_BYTEORDER_FUNCTIONS 1
+
+// received packets are handed to lwIP inside the shift_buffer they were read into (zero copy input)
+#define LWIP_SUPPORT_CUSTOM_PBUF 1
+
+#define MEM_LIBC_MALLOC  1
+#define MEMP_MEM_MALLOC  1
+#define MEM_ALIGNMENT    8
+#define MEMP_NUM_TCP_PCB 8192
+#define MEMP_NUM_TCP_SEG 16384
+#define PBUF_POOL_SIZE   1024
+
+#define LWIP_IPV4 1
+#define LWIP_IPV6 1
+
+#define LWIP_ARP      0
+#define LWIP_ETHERNET 0
+#define LWIP_ICMP     1
+#define LWIP_RAW      0
+#define LWIP_UDP      0
+#define LWIP_DHCP     0
+#define LWIP_AUTOIP   0
+#define LWIP_ACD      0
+#define LWIP_IGMP     0
+#define LWIP_DNS      0
+
+#define LWIP_IPV6_MLD                 0
+#define LWIP_IPV6_AUTOCONFIG          0
+#define LWIP_IPV6_DHCP6               0
+#define LWIP_IPV6_SEND_ROUTER_SOLICIT 0
+#define LWIP_IPV6_DUP_DETECT_ATTEMPTS 0
+#define LWIP_ND6_QUEUEING             0
+
+// the os already reassembled what it gave to the tun device, packets we emit are at most one mss
+#define IP_REASSEMBLY    0
+#define IP_FRAG          0
+#define LWIP_IPV6_REASS  0
+#define LWIP_IPV6_FRAG   0
+#define IP_DEFAULT_TTL   64
+
+#define LWIP_TCP            1
+// glibc netinet/tcp.h has its own TCP_MSS, this one must win where both are included
+#undef TCP_MSS
+#define TCP_MSS             1440
+#define LWIP_WND_SCALE      1
+#define TCP_RCV_SCALE       4
+#define TCP_WND             (0xFFFF * 8)
+#define TCP_SND_BUF         (0xFFFF * 8)
+#define TCP_SND_QUEUELEN    ((4 * TCP_SND_BUF) / TCP_MSS)
+#define TCP_SNDLOWAT        (0xFFFF - (4 * TCP_MSS) - 1)
+#define TCP_OVERSIZE        TCP_MSS
+#define TCP_LISTEN_BACKLOG  0
+#define LWIP_TCP_KEEPALIVE  1
+#define TCP_QUEUE_OOSEQ     1
+#define LWIP_TCP_SACK_OUT   1
+#define TCP_CALCULATE_EFF_SEND_MSS 1
+
+// packets come from the kernel through a tun device, the kernel already verified them
+#define CHECKSUM_CHECK_IP     0
+#define CHECKSUM_CHECK_TCP    0
+#define CHECKSUM_CHECK_ICMP   0
+#define CHECKSUM_CHECK_ICMP6  0
+#define CHECKSUM_GEN_IP       1
+#define CHECKSUM_GEN_TCP      1
+#define CHECKSUM_GEN_ICMP     1
+#define CHECKSUM_GEN_ICMP6    1
+
+// use the runtime dispatched kernels of ww (checksum.h), they return the same folded, non inverted sum
+uint16_t checkSumPartial(const void *buf, uint32_t len, uint64_t initial);
+#define LWIP_CHKSUM(dataptr, len) checkSumPartial((dataptr), (uint32_t) (len), 0)
+
@@ -0,0 +1,83 @@
+#pragma once
+#include "mux_frame.h"
+#include "utils/probeutils.h"
+#include "ww.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+    Child streams of a mux carrier indexed by cid
+
+    open addressing (utils/probeutils.h), the cid itself is the hash since cids are handed out in sequence and
+    fill the table without collisions; the table doubles when it gets 3/4 full
+
+*/
+
+enum
+{
+    kMuxCidTableInitialSlots = 16 // power of 2
+};
+
+typedef struct mux_cid_table_s
+{
+    probe_slot_t *slots;
+    uint32_t      mask;
+    uint32_t      count;
+
+} mux_cid_table_t;
+
+static inline void initMuxCidTable(mux_cid_table_t *table)
+{
+    table->slots = globalMalloc(sizeof(probe_slot_t) * kMuxCidTableInitialSlots);
+    memset(table->slots, 0, sizeof(probe_slot_t) * kMuxCidTableInitialSlots);
+    table->mask  = kMuxCidTableInitialSlots - 1;
+    table->count = 0;
+}
+
+static inline void dropMuxCidTable(mux_cid_table_t *table)
+{
+    globalFree(table->slots);
+    table->slots = NULL;
+}
+
+static inline void *muxCidTableFind(const mux_cid_table_t *table, cid_t cid)
+{
+    const uint32_t slot = probeTableFind(table->slots, table->mask, cid);
+    return slot == UINT32_MAX ? NULL : table->slots[slot].value;
+}
+
+// the cid must not be in the table
+static inline void muxCidTableInsert(mux_cid_table_t *table, cid_t cid, void *child)
+{
+    if ((table->count + 1) * 4 > (table->mask + 1) * 3)
+    {
+        probe_slot_t  *old      = table->slots;
+        const uint32_t old_size = table->mask + 1;
+
+        table->slots = globalMalloc(sizeof(probe_slot_t) * old_size * 2);
+        memset(table->slots, 0, sizeof(probe_slot_t) * old_size * 2);
+        table->mask = (old_size * 2) - 1;
+        for (uint32_t i = 0; i < old_size; i++)
+        {
+            if (old[i].value != NULL)
+            {
+                probeTablePlace(table->slots, table->mask, old[i].key, old[i].value);
+            }
+        }
+        globalFree(old);
+    }
+    probeTablePlace(table->slots, table->mask, cid, child);
+    table->count++;
+}
+
+static inline void muxCidTableRemove(mux_cid_table_t *table, cid_t cid)
+{
+    const uint32_t slot = probeTableFind(table->slots, table->mask, cid);
+    if (slot == UINT32_MAX)
+    {
+        return;
+    }
+    probeTableRemoveSlot(table->slots, table->mask, slot);
+    table->count--;
+}
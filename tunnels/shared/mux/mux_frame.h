@@ -1,7 +1,25 @@
 #pragma once
+#include "buffer_stream.h"
 #include "shiftbuffer.h"
 #include <stdint.h>
 
+/*
+    Mux framing
+
+    v1: | length 2 | cid 2 | flags 1 | data |  length counts what follows it
+
+    v2: | length varint | cid varint | flags 1 | data |  same layout with the length and cid as 7 bit groups,
+        least significant first, the high bit marks that another byte follows; small frames need 3 header bytes
+        and a frame can carry up to kMuxFrameV2MaxFrameLength
+
+    every carrier starts with v1, the client sends a hello (its highest version as the payload, cid 0) before any
+    other frame; an old server drops it as a frame of an unknown cid, a new one answers with a hello carrying
+    the version it picked and writes everything after that answer with it; the client reads with the picked
+    version after the answer, and once its queued v1 frames are out it writes an upgrade frame, the last v1
+    frame it sends
+
+*/
+
 typedef uint16_t mux_length_t;
 typedef uint16_t cid_t;
 
@@ -17,35 +35,185 @@ typedef struct __attribute__((__packed__))
 
 enum
 {
-    kMuxFlagOpen  = 0,
-    kMuxFlagClose = 1,
-    kMuxFlagFlow  = 2,
-    kMuxFlagData  = 3,
+    kMuxFlagOpen    = 0,
+    kMuxFlagClose   = 1,
+    kMuxFlagFlow    = 2,
+    kMuxFlagData    = 3,
+    kMuxFlagPing    = 4, // cid is ignored, the payload goes back in a pong frame as it is
+    kMuxFlagPong    = 5,
+    kMuxFlagHello   = 6, // always v1, see above
+    kMuxFlagUpgrade = 7, // always v1, the client writes with the negotiated version after it
     kMuxMinFrameLength = (sizeof(mux_frame_t) - sizeof(mux_length_t)),
     kMuxMaxFrameLength = (1U << (8*sizeof(mux_length_t))) - (1+kMuxMinFrameLength)
 };
 
+enum mux_frame_versions_e
+{
+    kMuxFrameV1               = 1,
+    kMuxFrameV2               = 2,
+    kMuxFrameV2MaxFrameLength = 1U << 20, // data bytes
+    kMuxFrameV2MaxHeader      = 4 + 3 + 1 // length, cid, flags
+};
 
+typedef struct mux_frame_info_s
+{
+    uint32_t length;        // the whole frame, header included
+    uint32_t header_length; // bytes before the data
+    cid_t    cid;
+    uint8_t  flags;
 
+} mux_frame_info_t;
+
+static inline uint32_t muxMaxFrameLength(uint8_t version)
+{
+    return version >= kMuxFrameV2 ? kMuxFrameV2MaxFrameLength : kMuxMaxFrameLength;
+}
 
+static inline uint8_t muxVarintSize(uint32_t value)
+{
+    uint8_t size = 1;
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
 
-static void makeOpenFrame(shift_buffer_t *buf, cid_t cid)
+static inline void muxWriteVarint(uint8_t *dest, uint32_t value)
 {
-    shiftl(buf, sizeof(mux_frame_t));
-    mux_frame_t frame = {.length = bufLen(buf) - sizeof(frame.length), .cid = cid, .flags = kMuxFlagOpen};
-    writeRaw(buf, &frame, sizeof(mux_frame_t));
+    while (value >= 0x80)
+    {
+        *dest++ = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    *dest = (uint8_t) value;
 }
 
-static void makeCloseFrame(shift_buffer_t *buf, cid_t cid)
+// bytes taken by the varint, 0 when src ends before it does, -1 when it is longer than max_bytes
+static inline int muxReadVarint(const uint8_t *src, uint32_t available, uint8_t max_bytes, uint32_t *value)
 {
-    shiftl(buf, sizeof(mux_frame_t));
-    mux_frame_t frame = {.length = sizeof(mux_frame_t) - sizeof(frame.length), .cid = cid, .flags = kMuxFlagClose};
-    writeRaw(buf, &frame, sizeof(mux_frame_t));
+    uint32_t result = 0;
+    for (uint8_t i = 0; i < max_bytes; i++)
+    {
+        if (i >= available)
+        {
+            return 0;
+        }
+        result |= (uint32_t) (src[i] & 0x7F) << (7 * i);
+        if ((src[i] & 0x80) == 0)
+        {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return -1;
 }
 
-static void makeDataFrame(shift_buffer_t *buf, cid_t cid)
+// the buffer holds the data, the header is written in front of it
+static void makeMuxFrame(shift_buffer_t *buf, cid_t cid, uint8_t flags, uint8_t version)
 {
+    if (version >= kMuxFrameV2)
+    {
+        const uint8_t  cid_size   = muxVarintSize(cid);
+        const uint32_t length     = bufLen(buf) + cid_size + 1;
+        const uint8_t  length_len = muxVarintSize(length);
+
+        shiftl(buf, length_len + cid_size + 1);
+        uint8_t *header = rawBufMut(buf);
+        muxWriteVarint(header, length);
+        muxWriteVarint(header + length_len, cid);
+        header[length_len + cid_size] = flags;
+        return;
+    }
     shiftl(buf, sizeof(mux_frame_t));
-    mux_frame_t frame = {.length = bufLen(buf) - sizeof(frame.length), .cid = cid, .flags = kMuxFlagData};
+    mux_frame_t frame = {.length = bufLen(buf) - sizeof(frame.length), .cid = cid, .flags = flags};
     writeRaw(buf, &frame, sizeof(mux_frame_t));
 }
+
+static void makeOpenFrame(shift_buffer_t *buf, cid_t cid, uint8_t version)
+{
+    makeMuxFrame(buf, cid, kMuxFlagOpen, version);
+}
+
+static void makeCloseFrame(shift_buffer_t *buf, cid_t cid, uint8_t version)
+{
+    makeMuxFrame(buf, cid, kMuxFlagClose, version);
+}
+
+static void makeDataFrame(shift_buffer_t *buf, cid_t cid, uint8_t version)
+{
+    makeMuxFrame(buf, cid, kMuxFlagData, version);
+}
+
+static void makePingFrame(shift_buffer_t *buf, uint8_t version)
+{
+    makeMuxFrame(buf, 0, kMuxFlagPing, version);
+}
+
+static void makePongFrame(shift_buffer_t *buf, uint8_t version)
+{
+    makeMuxFrame(buf, 0, kMuxFlagPong, version);
+}
+
+/*
+    looks at the next frame of the stream without consuming it, 1 when the whole frame is there, 0 when more
+    bytes are needed and -1 for a malformed header
+*/
+static int muxPeekFrame(buffer_stream_t *stream, uint8_t version, mux_frame_info_t *info)
+{
+    const size_t available = bufferStreamLen(stream);
+
+    if (version >= kMuxFrameV2)
+    {
+        uint8_t        header[kMuxFrameV2MaxHeader];
+        const uint32_t viewed = (uint32_t) (available < sizeof(header) ? available : sizeof(header));
+        uint32_t       length;
+        uint32_t       cid;
+        if (viewed == 0)
+        {
+            return 0;
+        }
+        bufferStreamViewBytesAt(stream, 0, header, viewed);
+
+        const int length_len = muxReadVarint(header, viewed, 4, &length);
+        if (length_len <= 0)
+        {
+            return length_len;
+        }
+        if (length < 2 || length > kMuxFrameV2MaxFrameLength + 3 + 1)
+        {
+            return -1;
+        }
+        const int cid_size = muxReadVarint(header + length_len, viewed - length_len, 3, &cid);
+        if (cid_size < 0 || (cid_size > 0 && (cid > UINT16_MAX || length < (uint32_t) cid_size + 1)))
+        {
+            return -1;
+        }
+        if (cid_size == 0 || viewed < (uint32_t) (length_len + cid_size + 1))
+        {
+            return 0;
+        }
+        *info = (mux_frame_info_t) {.length        = length_len + length,
+                                    .header_length = length_len + cid_size + 1,
+                                    .cid           = (cid_t) cid,
+                                    .flags         = header[length_len + cid_size]};
+        return available >= info->length ? 1 : 0;
+    }
+
+    if (available < sizeof(mux_frame_t))
+    {
+        return 0;
+    }
+    mux_frame_t frame;
+    bufferStreamViewBytesAt(stream, 0, (uint8_t *) &frame, sizeof(mux_frame_t));
+    if (frame.length < kMuxMinFrameLength)
+    {
+        return -1;
+    }
+    *info = (mux_frame_info_t) {.length        = frame.length + sizeof(frame.length),
+                                .header_length = sizeof(mux_frame_t),
+                                .cid           = frame.cid,
+                                .flags         = frame.flags};
+    return available >= info->length ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+#pragma once
+#include "context_queue.h"
+#include "mux_frame.h"
+#include "shiftbuffer.h"
+#include "tunnel.h"
+#include "ww.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+    Output scheduler of a mux carrier
+
+    child writes are not written to the carrier right away, each child stream queues its frames and the carrier
+    is flushed once per loop iteration; the flush serves the streams with deficit round robin, a bulk stream gets
+    one quantum per round like everyone else so the frames of interactive streams go out ahead of its backlog
+
+    frames up to kMuxSchedPackLimit are packed into shared carrier writes of at most kMuxSchedWriteBudget bytes,
+    bigger frames (never more than muxMaxFrameLength() of the carrier) are written on their own without a copy
+
+    close frames and whatever a closing stream still had queued go to the control queue, it is written first
+
+    the carrier state holds the scheduler, a posted flush event or a running flush hold it too; when the carrier
+    is closed meanwhile muxSchedClose() returns false and the last muxSchedRelease() tells the owner to free it
+
+*/
+
+enum
+{
+    kMuxSchedQuantum     = 16 * 1024,
+    kMuxSchedPackLimit   = 4 * 1024,
+    kMuxSchedWriteBudget = 32 * 1024,
+    kMuxSchedStreamLimit = 256 * 1024 // a child with this much queued is paused until a flush drains it
+};
+
+typedef void (*MuxCarrierWriteCb)(void *carrier, context_t *c);
+
+typedef struct mux_sched_stream_s
+{
+    struct mux_sched_stream_s *next, *prev; // active streams, in round robin order
+    context_queue_t           *frames;      // contexts of the carrier line with one frame each
+    uint32_t                   queued;      // bytes
+    uint32_t                   deficit;
+    bool                       active;
+
+} mux_sched_stream_t;
+
+typedef struct mux_scheduler_s
+{
+    mux_sched_stream_t *head, *tail;
+    context_queue_t    *control;
+    context_t          *packing; // the carrier write being filled during a flush
+    MuxCarrierWriteCb   write;
+    void               *carrier;
+    uint64_t            queued; // bytes of every queue
+    uint32_t            holds;
+    bool                flush_pending;
+    bool                paused; // the carrier asked us to stop writing
+    bool                closed;
+
+} mux_scheduler_t;
+
+static inline void initMuxScheduler(mux_scheduler_t *s, MuxCarrierWriteCb write, void *carrier)
+{
+    *s = (mux_scheduler_t) {.control = newContextQueue(), .write = write, .carrier = carrier};
+}
+
+static inline void initMuxSchedStream(mux_sched_stream_t *st)
+{
+    *st = (mux_sched_stream_t) {.frames = newContextQueue()};
+}
+
+static inline void muxSchedLink(mux_scheduler_t *s, mux_sched_stream_t *st)
+{
+    st->active = true;
+    st->next   = NULL;
+    st->prev   = s->tail;
+    if (s->tail)
+    {
+        s->tail->next = st;
+    }
+    else
+    {
+        s->head = st;
+    }
+    s->tail = st;
+}
+
+static inline void muxSchedUnLink(mux_scheduler_t *s, mux_sched_stream_t *st)
+{
+    if (st->prev)
+    {
+        st->prev->next = st->next;
+    }
+    else
+    {
+        s->head = st->next;
+    }
+    if (st->next)
+    {
+        st->next->prev = st->prev;
+    }
+    else
+    {
+        s->tail = st->prev;
+    }
+    st->next    = NULL;
+    st->prev    = NULL;
+    st->active  = false;
+    st->deficit = 0;
+}
+
+// c must be on the carrier line and carry one complete frame
+static inline void muxSchedEnqueue(mux_scheduler_t *s, mux_sched_stream_t *st, context_t *c)
+{
+    st->queued += bufLen(c->payload);
+    s->queued += bufLen(c->payload);
+    contextQueuePush(st->frames, c);
+    if (! st->active)
+    {
+        muxSchedLink(s, st);
+    }
+}
+
+static inline void muxSchedEnqueueControl(mux_scheduler_t *s, context_t *c)
+{
+    s->queued += bufLen(c->payload);
+    contextQueuePush(s->control, c);
+}
+
+// the stream is closing on our side, what it queued goes out before its close frame
+static inline void muxSchedRetireStream(mux_scheduler_t *s, mux_sched_stream_t *st)
+{
+    if (st->active)
+    {
+        muxSchedUnLink(s, st);
+    }
+    while (contextQueueLen(st->frames) > 0)
+    {
+        contextQueuePush(s->control, contextQueuePop(st->frames));
+    }
+    st->queued = 0;
+}
+
+// the stream is gone, frames it still had queued are dropped
+static inline void muxSchedDropStream(mux_scheduler_t *s, mux_sched_stream_t *st)
+{
+    if (st->active)
+    {
+        muxSchedUnLink(s, st);
+    }
+    s->queued -= st->queued;
+    destroyContextQueue(st->frames);
+    st->frames = NULL;
+    st->queued = 0;
+}
+
+static inline void muxSchedHold(mux_scheduler_t *s)
+{
+    s->holds++;
+}
+
+// true when the carrier was closed and this was the last hold, the owner frees the carrier state then
+static inline bool muxSchedRelease(mux_scheduler_t *s)
+{
+    s->holds--;
+    return s->closed && s->holds == 0;
+}
+
+// every stream must be dropped before, true when the carrier state can be freed right away
+static inline bool muxSchedClose(mux_scheduler_t *s)
+{
+    assert(s->head == NULL);
+    if (s->packing)
+    {
+        reuseContextPayload(s->packing);
+        destroyContext(s->packing);
+        s->packing = NULL;
+    }
+    destroyContextQueue(s->control);
+    s->control = NULL;
+    s->closed  = true;
+    return s->holds == 0;
+}
+
+static inline void muxSchedWritePacked(mux_scheduler_t *s)
+{
+    context_t *c = s->packing;
+    s->packing   = NULL;
+    s->write(s->carrier, c);
+}
+
+/*
+    true if the frame can be appended to the packed write without growing its buffer, the room is counted from rCap
+    because a sliced or reserved payload can already reach into its right padding (rCapNoPadding would wrap)
+*/
+static inline bool muxSchedFitsPacking(mux_scheduler_t *s, uint32_t len)
+{
+    shift_buffer_t *packed = s->packing->payload;
+    return len <= kMuxSchedPackLimit && bufLen(packed) + len <= kMuxSchedWriteBudget &&
+           rCap(packed) - bufLen(packed) >= (uint32_t) packed->r_pad + len;
+}
+
+static inline void muxSchedEmit(mux_scheduler_t *s, context_t *c)
+{
+    const uint32_t len = bufLen(c->payload);
+    s->queued -= len;
+
+    if (s->packing != NULL && ! muxSchedFitsPacking(s, len))
+    {
+        muxSchedWritePacked(s);
+        if (s->closed)
+        {
+            reuseContextPayload(c);
+            destroyContext(c);
+            return;
+        }
+    }
+    if (len > kMuxSchedPackLimit)
+    {
+        s->write(s->carrier, c);
+        return;
+    }
+    if (s->packing == NULL)
+    {
+        s->packing = c;
+        return;
+    }
+    concatBufferNoCheck(s->packing->payload, c->payload);
+    reuseContextPayload(c);
+    destroyContext(c);
+}
+
+/*
+    writes the queued frames until everything is out or the carrier pauses, drain ignores the pause (used right
+    before the carrier is closed); the caller must hold the scheduler and check closed afterwards
+*/
+static inline void muxSchedFlush(mux_scheduler_t *s, bool drain)
+{
+    while (! s->closed && (drain || ! s->paused))
+    {
+        if (contextQueueLen(s->control) > 0)
+        {
+            muxSchedEmit(s, contextQueuePop(s->control));
+            continue;
+        }
+
+        mux_sched_stream_t *st = s->head;
+        if (st == NULL)
+        {
+            break;
+        }
+        st->deficit += kMuxSchedQuantum;
+
+        while (contextQueueLen(st->frames) > 0)
+        {
+            context_t     *c   = contextQueuePop(st->frames);
+            const uint32_t len = bufLen(c->payload);
+            if (len > st->deficit)
+            {
+                contextQueuePushFront(st->frames, c);
+                break;
+            }
+            st->deficit -= len;
+            st->queued -= len;
+            muxSchedEmit(s, c);
+            // a write can close the carrier and free every child with it
+            if (s->closed || (! drain && s->paused))
+            {
+                break;
+            }
+        }
+        if (s->closed)
+        {
+            return;
+        }
+
+        if (contextQueueLen(st->frames) == 0)
+        {
+            muxSchedUnLink(s, st);
+        }
+        else
+        {
+            // the round of this stream is over, it goes behind the others with the deficit it has left
+            const uint32_t deficit = st->deficit;
+            muxSchedUnLink(s, st);
+            muxSchedLink(s, st);
+            st->deficit = deficit;
+        }
+    }
+
+    if (! s->closed && s->packing != NULL)
+    {
+        muxSchedWritePacked(s);
+    }
+}
@@ -0,0 +1,189 @@
+#include "openssl_bio.h"
+#include "buffer_stream.h"
+#include "loggers/network_logger.h"
+#include "utils/mathutils.h"
+#include <openssl/crypto.h>
+
+typedef struct ww_bio_data_s
+{
+    buffer_pool_t   *pool;
+    buffer_stream_t *in;
+    buffer_stream_t *out_ready; // filled output buffers, in order
+    shift_buffer_t  *out;       // output buffer being filled
+
+} ww_bio_data_t;
+
+static BIO_METHOD *ww_bio_method      = NULL;
+static CRYPTO_ONCE ww_bio_method_once = CRYPTO_ONCE_STATIC_INIT;
+
+static int wwBioWrite(BIO *bio, const char *data, int len)
+{
+    ww_bio_data_t *d = BIO_get_data(bio);
+    BIO_clear_retry_flags(bio);
+
+    int written = 0;
+    while (written < len)
+    {
+        if (d->out == NULL)
+        {
+            d->out = popBuffer(d->pool);
+            setLen(d->out, 0);
+        }
+
+        const uint32_t room = rCapNoPadding(d->out) - bufLen(d->out);
+        if (room == 0)
+        {
+            bufferStreamPush(d->out_ready, d->out);
+            d->out = NULL;
+            continue;
+        }
+
+        const uint32_t part = min(room, (uint32_t) (len - written));
+        const uint32_t olen = bufLen(d->out);
+        setLen(d->out, olen + part);
+        memcpy(((uint8_t *) rawBufMut(d->out)) + olen, data + written, part);
+        written += (int) part;
+    }
+    return written;
+}
+
+static int wwBioRead(BIO *bio, char *dest, int len)
+{
+    ww_bio_data_t *d = BIO_get_data(bio);
+    BIO_clear_retry_flags(bio);
+
+    const size_t available = bufferStreamLen(d->in);
+    if (available == 0)
+    {
+        BIO_set_retry_read(bio);
+        return -1;
+    }
+
+    const size_t n = min(available, (size_t) len);
+    bufferStreamReadBytes(d->in, (uint8_t *) dest, n);
+    return (int) n;
+}
+
+static long wwBioCtrl(BIO *bio, int cmd, long num, void *ptr)
+{
+    (void) num;
+    (void) ptr;
+    ww_bio_data_t *d = BIO_get_data(bio);
+
+    switch (cmd)
+    {
+    case BIO_CTRL_PENDING:
+        return (long) bufferStreamLen(d->in);
+    case BIO_CTRL_WPENDING:
+        return (long) (bufferStreamLen(d->out_ready) + (d->out != NULL ? bufLen(d->out) : 0));
+    case BIO_CTRL_FLUSH:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int wwBioCreate(BIO *bio)
+{
+    BIO_set_data(bio, NULL);
+    BIO_set_init(bio, 1);
+    return 1;
+}
+
+static int wwBioDestroy(BIO *bio)
+{
+    ww_bio_data_t *d = BIO_get_data(bio);
+    if (d == NULL)
+    {
+        return 1;
+    }
+    destroyBufferStream(d->in);
+    destroyBufferStream(d->out_ready);
+    if (d->out != NULL)
+    {
+        reuseBuffer(d->pool, d->out);
+    }
+    globalFree(d);
+    BIO_set_data(bio, NULL);
+    return 1;
+}
+
+static void createWwBioMethod(void)
+{
+    ww_bio_method = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_SOURCE_SINK, "ww shift buffer bio");
+    if (ww_bio_method == NULL || ! BIO_meth_set_write(ww_bio_method, wwBioWrite) ||
+        ! BIO_meth_set_read(ww_bio_method, wwBioRead) || ! BIO_meth_set_ctrl(ww_bio_method, wwBioCtrl) ||
+        ! BIO_meth_set_create(ww_bio_method, wwBioCreate) || ! BIO_meth_set_destroy(ww_bio_method, wwBioDestroy))
+    {
+        LOGF("OpenSSL Bio: could not create the bio method");
+        exit(1);
+    }
+}
+
+BIO *newWwBio(buffer_pool_t *pool)
+{
+    if (! CRYPTO_THREAD_run_once(&ww_bio_method_once, createWwBioMethod))
+    {
+        LOGF("OpenSSL Bio: could not create the bio method");
+        exit(1);
+    }
+
+    BIO *bio = BIO_new(ww_bio_method);
+    if (bio == NULL)
+    {
+        LOGF("OpenSSL Bio: BIO_new failed");
+        exit(1);
+    }
+
+    ww_bio_data_t *d = globalMalloc(sizeof(ww_bio_data_t));
+    *d               = (ww_bio_data_t) {.pool      = pool,
+                                        .in        = newBufferStream(pool),
+                                        .out_ready = newBufferStream(pool),
+                                        .out       = NULL};
+    BIO_set_data(bio, d);
+    return bio;
+}
+
+void wwBioPushInput(BIO *bio, shift_buffer_t *buf)
+{
+    ww_bio_data_t *d = BIO_get_data(bio);
+    if (bufLen(buf) == 0)
+    {
+        reuseBuffer(d->pool, buf);
+        return;
+    }
+    bufferStreamPush(d->in, buf);
+}
+
+void wwBioPushInputBytes(BIO *bio, const uint8_t *data, size_t len)
+{
+    ww_bio_data_t *d = BIO_get_data(bio);
+
+    while (len > 0)
+    {
+        shift_buffer_t *buf  = popBuffer(d->pool);
+        const size_t    part = min(len, (size_t) rCapNoPadding(buf));
+        setLen(buf, (uint32_t) part);
+        memcpy(rawBufMut(buf), data, part);
+        bufferStreamPush(d->in, buf);
+        data += part;
+        len -= part;
+    }
+}
+
+shift_buffer_t *wwBioPopOutput(BIO *bio)
+{
+    ww_bio_data_t *d = BIO_get_data(bio);
+
+    if (bufferStreamLen(d->out_ready) > 0)
+    {
+        return bufferStreamIdealRead(d->out_ready);
+    }
+    if (d->out != NULL && bufLen(d->out) > 0)
+    {
+        shift_buffer_t *buf = d->out;
+        d->out              = NULL;
+        return buf;
+    }
+    return NULL;
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "buffer_pool.h"
+#include "shiftbuffer.h"
+#include <openssl/bio.h>
+
+/*
+    A BIO that moves the cipher text of a line as shift buffers instead of through BIO_s_mem
+
+    memory bio:   socket buffer -> BIO_write copy -> ssl record buffer -> ... -> BIO_read copy -> pool buffer
+    this bio:     socket buffer -> ssl record buffer -> ... -> pool buffer that is sent as is
+
+    received buffers are queued as they are and ssl reads its records straight out of them, the records ssl
+    writes go straight into pool buffers (left padding kept for the nodes before) that are then handed to the
+    next node, so one copy per record and direction is gone on each side
+
+    use one bio for both ends of the SSL object: SSL_set_bio(ssl, bio, bio)
+*/
+
+BIO *newWwBio(buffer_pool_t *pool);
+
+// takes the ownership of the buffer
+void wwBioPushInput(BIO *bio, shift_buffer_t *buf);
+
+// the next buffer of what ssl has written, NULL when there is nothing left; the caller owns it
+shift_buffer_t *wwBioPopOutput(BIO *bio);
+
+// copies the bytes into pool buffers and queues them as input
+void wwBioPushInputBytes(BIO *bio, const uint8_t *data, size_t len);
@@ -67,6 +67,48 @@ void opensslGlobalInit(void)
 
 typedef void *ssl_ctx_t; ///> SSL_CTX
 
+/*
+    the bundled cacert.pem parsed once, every context that verifies against it holds a reference to this one store
+    instead of parsing the ~150 certificates again and keeping its own copies (one context per worker)
+*/
+static X509_STORE *bundled_ca_store      = NULL;
+static CRYPTO_ONCE bundled_ca_store_once = CRYPTO_ONCE_STATIC_INIT;
+
+static void createBundledCaStore(void)
+{
+    bundled_ca_store = X509_STORE_new();
+    if (bundled_ca_store == NULL)
+    {
+        return;
+    }
+
+    BIO *bio = BIO_new_mem_buf(cacert_bytes, (int) cacert_len);
+    X509 *x  = NULL;
+    while (true)
+    {
+        x = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL);
+        if (x == NULL)
+        {
+            break;
+        }
+        X509_STORE_add_cert(bundled_ca_store, x);
+        X509_free(x);
+        x = NULL;
+    }
+    ERR_clear_error(); // the end of the bundle is reported as a pem error
+
+    BIO_free(bio);
+}
+
+static X509_STORE *getBundledCaStore(void)
+{
+    if (! CRYPTO_THREAD_run_once(&bundled_ca_store_once, createBundledCaStore))
+    {
+        return NULL;
+    }
+    return bundled_ca_store;
+}
+
 ssl_ctx_t sslCtxNew(ssl_ctx_opt_t *param)
 {
     opensslGlobalInit();
@@ -141,24 +183,18 @@ ssl_ctx_t sslCtxNew(ssl_ctx_opt_t *param)
     {
         // SSL_CTX_set_default_verify_paths(ctx);
         // alternative: use the boundeled cacert.pem
-        BIO *bio = BIO_new(BIO_s_mem());
-        int  n   = BIO_write(bio, cacert_bytes, (int) cacert_len);
-        assert(n == (int) cacert_len);
-        (void) n;
-        X509 *x = NULL;
-        while (true)
+        X509_STORE *store = getBundledCaStore();
+        if (store == NULL)
         {
-            x = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL);
-            if (x == NULL)
-            {
-                break;
-            }
-            X509_STORE_add_cert(SSL_CTX_get_cert_store(ctx), x);
-            X509_free(x);
-            x = NULL;
+            LOGE("OpenSSL Error: could not load the bundled ca certificates");
+            goto error;
         }
-
-        BIO_free(bio);
+#if OPENSSL_VERSION_MAJOR >= 3
+        SSL_CTX_set1_cert_store(ctx, store);
+#else
+        X509_STORE_up_ref(store);
+        SSL_CTX_set_cert_store(ctx, store);
+#endif
     }
 
 #ifdef SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
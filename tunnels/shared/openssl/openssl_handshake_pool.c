@@ -0,0 +1,172 @@
+#include "openssl_handshake_pool.h"
+#include "hloop.h"
+#include "hmutex.h"
+#include "hthread.h"
+#include "loggers/network_logger.h"
+#include "openssl_bio.h"
+#include "openssl_globals.h"
+#include <openssl/err.h>
+#include <stdatomic.h>
+
+enum
+{
+    kMaxQueuedHandshakes = 1024
+};
+
+struct oss_handshake_pool_s
+{
+    hmutex_t             lock;
+    hsem_t               jobs; // counts the queued jobs, the threads sleep on it
+    oss_handshake_job_t *head;
+    oss_handshake_job_t *tail;
+    atomic_uint          queued;
+    OssHandshakeDoneCb   on_done;
+    unsigned int         threads_count;
+    hthread_t           *threads;
+};
+
+static void runJob(oss_handshake_job_t *job)
+{
+    // the error queue is per thread, whatever the step leaves is printed and cleared here
+    ERR_clear_error();
+    const uint64_t cpu_start = threadCpuNs();
+    const int      n         = SSL_do_handshake(job->ssl);
+    job->ssl_error           = SSL_get_error(job->ssl, n);
+    job->cpu_ns              = threadCpuNs() - cpu_start;
+
+    if (job->ssl_error != SSL_ERROR_NONE && job->ssl_error != SSL_ERROR_WANT_READ &&
+        job->ssl_error != SSL_ERROR_WANT_WRITE)
+    {
+        printSSLError();
+    }
+    ERR_clear_error();
+}
+
+// owner side, moves what ssl wrote into the ww bio and gives the ww bio back to ssl
+static void restoreBio(oss_handshake_job_t *job)
+{
+    char *data = NULL;
+    long  len  = BIO_get_mem_data(job->out, &data);
+    if (len > 0)
+    {
+        BIO_write(job->bio, data, (int) len);
+    }
+    len = BIO_get_mem_data(job->in, &data);
+    if (len > 0)
+    {
+        wwBioPushInputBytes(job->bio, (const uint8_t *) data, (size_t) len);
+    }
+
+    // the reference the job kept goes to the read side, the write side takes another one
+    SSL_set0_rbio(job->ssl, job->bio);
+    BIO_up_ref(job->bio);
+    SSL_set0_wbio(job->ssl, job->bio);
+    job->in  = NULL;
+    job->out = NULL;
+}
+
+static void onJobDone(hevent_t *ev)
+{
+    oss_handshake_pool_t *pool = hevent_userdata(ev);
+    oss_handshake_job_t  *job  = (oss_handshake_job_t *) ev->privdata;
+
+    restoreBio(job);
+    pool->on_done(job);
+    globalFree(job);
+}
+
+static HTHREAD_ROUTINE(handshakeThread) // NOLINT
+{
+    oss_handshake_pool_t *pool = userdata;
+
+    for (;;)
+    {
+        hsem_wait(&(pool->jobs));
+        hmutex_lock(&(pool->lock));
+        oss_handshake_job_t *job = pool->head;
+        pool->head               = job->next;
+        if (pool->head == NULL)
+        {
+            pool->tail = NULL;
+        }
+        atomic_fetch_sub_explicit(&(pool->queued), 1, memory_order_relaxed);
+        hmutex_unlock(&(pool->lock));
+
+        runJob(job);
+
+        hevent_t ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.loop     = getWorkerLoop(job->owner);
+        ev.cb       = onJobDone;
+        ev.privdata = job;
+        hevent_set_userdata(&ev, pool);
+        hloop_post_event(getWorkerLoop(job->owner), &ev);
+    }
+    return 0;
+}
+
+oss_handshake_pool_t *newOssHandshakePool(unsigned int threads_count, OssHandshakeDoneCb on_done)
+{
+    assert(threads_count > 0);
+    oss_handshake_pool_t *pool = globalMalloc(sizeof(oss_handshake_pool_t));
+    memset(pool, 0, sizeof(oss_handshake_pool_t));
+    hmutex_init(&(pool->lock));
+    hsem_init(&(pool->jobs), 0);
+    atomic_init(&(pool->queued), 0);
+    pool->on_done       = on_done;
+    pool->threads_count = threads_count;
+    pool->threads       = globalMalloc(sizeof(hthread_t) * threads_count);
+
+    for (unsigned int i = 0; i < threads_count; i++)
+    {
+        pool->threads[i] = hthread_create(handshakeThread, pool);
+    }
+    return pool;
+}
+
+oss_handshake_job_t *submitOssHandshake(oss_handshake_pool_t *pool, SSL *ssl, BIO *bio, tunnel_t *self,
+                                        context_t *c)
+{
+    // the bound does not need to be exact, a few submits racing past it are fine
+    if (atomic_load_explicit(&(pool->queued), memory_order_relaxed) >= kMaxQueuedHandshakes)
+    {
+        return NULL;
+    }
+
+    oss_handshake_job_t *job = globalMalloc(sizeof(oss_handshake_job_t));
+    *job                     = (oss_handshake_job_t) {.ssl     = ssl,
+                                                      .bio     = bio,
+                                                      .in      = BIO_new(BIO_s_mem()),
+                                                      .out     = BIO_new(BIO_s_mem()),
+                                                      .owner   = c->line->tid,
+                                                      .tunnel  = self,
+                                                      .context = c};
+
+    char chunk[4096];
+    int  n;
+    while (BIO_pending(bio) > 0 && (n = BIO_read(bio, chunk, sizeof(chunk))) > 0)
+    {
+        BIO_write(job->in, chunk, n);
+    }
+
+    // ssl holds two references of the ww bio (read and write side), the job keeps one while it is away
+    BIO_up_ref(bio);
+    SSL_set0_rbio(ssl, job->in);
+    SSL_set0_wbio(ssl, job->out);
+
+    hmutex_lock(&(pool->lock));
+    if (pool->tail == NULL)
+    {
+        pool->head = job;
+    }
+    else
+    {
+        pool->tail->next = job;
+    }
+    pool->tail = job;
+    atomic_fetch_add_explicit(&(pool->queued), 1, memory_order_relaxed);
+    hmutex_unlock(&(pool->lock));
+    hsem_post(&(pool->jobs));
+
+    return job;
+}
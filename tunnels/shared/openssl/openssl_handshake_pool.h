@@ -0,0 +1,66 @@
+#pragma once
+#include "tunnel.h"
+#include "ww.h"
+#include <openssl/ssl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+    Runs SSL handshake steps on a few dedicated threads instead of the worker loop
+
+    a full handshake is mostly the private key signature and the key exchange, running that inline stalls every
+    other line of the worker for as long as it takes, which is what hurts during connection storms
+
+    owner:      the ww bio of the ssl is swapped for two memory bios (its pending input moves into the first), the
+                job is queued, the owner must not touch the ssl until the job comes back
+    handshake:  one SSL_do_handshake step with the memory bios
+    owner:      the records written go into the ww bio, input that was not read goes back into it, the ww bio is
+                put back in place and the done callback runs on the owner worker
+
+    the queue is bounded, when it is full the submit fails and the caller does the step inline
+
+*/
+
+typedef struct oss_handshake_job_s
+{
+    struct oss_handshake_job_s *next;
+    SSL                        *ssl;
+    BIO                        *bio; // the ww bio of ssl
+    BIO                        *in;
+    BIO                        *out;
+    tid_t                       owner;
+    tunnel_t                   *tunnel;
+    context_t                  *context;
+    int                         ssl_error; // SSL_get_error of the step, taken on the handshake thread
+    uint64_t                    cpu_ns;
+    void                       *userdata;  // owner data that has to live as long as the ssl, set on abandon
+    bool                        abandoned; // the line closed meanwhile, the done callback only frees things
+
+} oss_handshake_job_t;
+
+// called on the owner worker with the ww bio back in place, the job is freed after it returns
+typedef void (*OssHandshakeDoneCb)(oss_handshake_job_t *job);
+
+typedef struct oss_handshake_pool_s oss_handshake_pool_t;
+
+oss_handshake_pool_t *newOssHandshakePool(unsigned int threads_count, OssHandshakeDoneCb on_done);
+
+// NULL when the queue is full, the ssl is untouched then
+oss_handshake_job_t *submitOssHandshake(oss_handshake_pool_t *pool, SSL *ssl, BIO *bio, tunnel_t *self,
+                                        context_t *c);
+
+// the owner is closing the line while the job is in flight, the ssl and userdata are left to the done callback
+static inline void abandonOssHandshake(oss_handshake_job_t *job, void *userdata)
+{
+    job->abandoned = true;
+    job->userdata  = userdata;
+}
+
+// cpu time of the calling thread in ns, what the jobs and the inline steps are measured with
+static inline uint64_t threadCpuNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+}
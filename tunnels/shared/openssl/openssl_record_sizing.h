@@ -0,0 +1,48 @@
+#pragma once
+#include <stdint.h>
+
+/*
+    Dynamic tls record sizing
+
+    a record can only be decrypted once all of it has arrived, so at the start of a line and after it was idle
+    (small congestion window) records that fit in one tcp segment let the other side read the first bytes right
+    away; once ramp_bytes were written without an idle gap the records grow to full size, bulk transfers keep the
+    lower per record overhead
+
+    the writer caps each SSL_write by tlsRecordSizeLimit() and reports what it wrote with tlsRecordSizerSent()
+
+*/
+
+enum tls_record_sizes_e
+{
+    kTlsSmallRecordSize = 1400,
+    kTlsFullRecordSize  = 16384
+};
+
+typedef struct tls_record_sizer_s
+{
+    uint64_t sent; // bytes since the line started or was last idle
+    uint64_t last_write_ms;
+
+} tls_record_sizer_t;
+
+// ramp_bytes 0 turns the sizing off
+static inline uint32_t tlsRecordSizeLimit(tls_record_sizer_t *sizer, uint32_t ramp_bytes, uint32_t idle_ms,
+                                          uint64_t now_ms)
+{
+    if (ramp_bytes == 0)
+    {
+        return kTlsFullRecordSize;
+    }
+    if (now_ms - sizer->last_write_ms >= idle_ms)
+    {
+        sizer->sent = 0;
+    }
+    sizer->last_write_ms = now_ms;
+    return sizer->sent < ramp_bytes ? kTlsSmallRecordSize : kTlsFullRecordSize;
+}
+
+static inline void tlsRecordSizerSent(tls_record_sizer_t *sizer, uint32_t bytes)
+{
+    sizer->sent += bytes;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include "buffer_stream.h"
+#include "uleb128.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+
+    incremental reader of the protobuf frames (1 byte flag, uleb128 length, payload)
+
+    the header is peeked out of the buffer stream once and remembered, later chunks of the same frame only compare
+    the buffered length against it; the frame is taken out with a single bufferStreamRead() when all of it is there
+
+*/
+
+enum protobuf_frame_status_e
+{
+    kProtobufFrameIncomplete,
+    kProtobufFrameReady,
+    kProtobufFrameTooLarge,
+    kProtobufFrameMalformed
+};
+
+enum
+{
+    kProtobufFrameMaxHeader = 1 + 10 // flag + uleb128 of a 64 bit length
+};
+
+typedef struct protobuf_frame_reader_s
+{
+    uint64_t data_len;   // payload bytes of the current frame
+    uint8_t  header_len; // 0 until the header of the current frame is parsed
+    uint8_t  flags;
+
+} protobuf_frame_reader_t;
+
+static inline enum protobuf_frame_status_e protobufFrameParse(protobuf_frame_reader_t *reader,
+                                                              buffer_stream_t *bstream, uint64_t max_data_len)
+{
+    const size_t available = bufferStreamLen(bstream);
+
+    if (reader->header_len == 0)
+    {
+        if (available < 2)
+        {
+            return kProtobufFrameIncomplete;
+        }
+        uint8_t      header[kProtobufFrameMaxHeader];
+        const size_t peek = available < sizeof(header) ? available : sizeof(header);
+        bufferStreamViewBytesAt(bstream, 0, header, peek);
+
+        uint64_t     data_len = 0;
+        const size_t uleb_len = readUleb128ToUint64(header + 1, header + peek, &data_len);
+        if (uleb_len == 0)
+        {
+            return peek == sizeof(header) ? kProtobufFrameMalformed : kProtobufFrameIncomplete;
+        }
+        if (data_len > max_data_len)
+        {
+            return kProtobufFrameTooLarge;
+        }
+        reader->flags      = header[0];
+        reader->data_len   = data_len;
+        reader->header_len = (uint8_t) (1 + uleb_len);
+    }
+
+    return available >= reader->header_len + reader->data_len ? kProtobufFrameReady : kProtobufFrameIncomplete;
+}
+
+// only after protobufFrameParse() returned ready, the returned buffer holds the payload of the frame
+static inline shift_buffer_t *protobufFrameRead(protobuf_frame_reader_t *reader, buffer_stream_t *bstream)
+{
+    shift_buffer_t *frame = bufferStreamRead(bstream, reader->header_len + reader->data_len);
+    shiftr(frame, reader->header_len);
+    reader->header_len = 0;
+    return frame;
+}
@@ -3,11 +3,18 @@
 #include "frand.h"
 #include "openssl_globals.h" /* These helpers depened on openssl */
 #include "shiftbuffer.h"
+#include "utils/mathutils.h"
 #include <assert.h>
 #include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/rand.h>
 #include <stddef.h>
 #include <stdint.h>
 
+#if defined(__linux__) && defined(__aarch64__)
+#include <sys/auxv.h>
+#endif
+
 #define MSG_DIGEST_ALG NID_sha256 //"SHA256"
 
 enum reality_consts
@@ -22,6 +29,45 @@ enum reality_consts
     kTLSHeaderlen         = 1 + 2 + 2,
 };
 
+/*
+    protocol 1: every record is aes-128-cbc with a random iv, then hmac-sha256 over it, both into new buffers
+
+    protocol 2: every record is sealed in place with an aead, nothing is allocated or copied per record
+
+        record:               tls header | [preamble] | cipher text | tag 16
+        preamble:             cipher id 1 | salt 16, only in the first record of each direction
+        key of a direction:   hkdf-sha256(password, salt, "reality v2 c2s" or "reality v2 s2c")
+        nonce:                32 zero bits | little endian record counter of the direction
+
+    the client picks aes-128-gcm when the cpu has aes instructions and chacha20-poly1305 otherwise, the server
+    answers with the cipher the client picked, the key schedule of a direction is expanded once per connection
+*/
+enum reality_protocols
+{
+    kRealityProtocolCbcHmac = 1,
+    kRealityProtocolAead    = 2
+};
+
+enum reality_aead_consts
+{
+    kAeadCipherAes128Gcm        = 1,
+    kAeadCipherChaCha20Poly1305 = 2,
+    kAeadKeyLen                 = 32,
+    kAeadSaltLen                = 16,
+    kAeadNonceLen               = 12,
+    kAeadTagLen                 = 16,
+    kAeadPreambleLen            = 1 + kAeadSaltLen
+};
+
+typedef struct reality_aead_s
+{
+    EVP_CIPHER_CTX *ctx;
+    uint64_t        counter;
+    uint8_t         cipher;
+    bool            ready; // the key of this direction is derived and expanded into ctx
+
+} reality_aead_t;
+
 static bool verifyMessage(shift_buffer_t *buf, EVP_MD *msg_digest, EVP_MD_CTX *sign_context, EVP_PKEY *sign_key)
 {
     if (bufLen(buf) < kSignLen)
@@ -175,3 +221,205 @@ static void appendTlsHeader(shift_buffer_t *buf)
     shiftl(buf, sizeof(uint8_t));
     writeUnAlignedUI8(buf, kTLS12ApplicationData);
 }
+
+static bool cpuHasAesInstructions(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("aes");
+#elif defined(__linux__) && defined(__aarch64__) && defined(HWCAP_AES)
+    return (getauxval(AT_HWCAP) & HWCAP_AES) != 0;
+#else
+    return false;
+#endif
+}
+
+static const EVP_CIPHER *aeadCipherOf(uint8_t cipher)
+{
+    switch (cipher)
+    {
+    case kAeadCipherAes128Gcm:
+        return EVP_aes_128_gcm();
+    case kAeadCipherChaCha20Poly1305:
+        return EVP_chacha20_poly1305();
+    default:
+        return NULL;
+    }
+}
+
+// cipher is what this side sends with, the receiving side leaves it 0 and takes it from the first record
+static void initRealityAead(reality_aead_t *aead, uint8_t cipher)
+{
+    aead->ctx     = EVP_CIPHER_CTX_new();
+    aead->counter = 0;
+    aead->cipher  = cipher;
+    aead->ready   = false;
+}
+
+static void destroyRealityAead(reality_aead_t *aead)
+{
+    EVP_CIPHER_CTX_free(aead->ctx);
+    aead->ctx = NULL;
+}
+
+static bool deriveRealityAeadKey(reality_aead_t *aead, bool encrypt, const char *password, bool client_to_server,
+                                 const uint8_t *salt)
+{
+    static const char kInfoC2S[] = "reality v2 c2s";
+    static const char kInfoS2C[] = "reality v2 s2c";
+
+    const EVP_CIPHER *cipher = aeadCipherOf(aead->cipher);
+    if (cipher == NULL)
+    {
+        return false;
+    }
+
+    uint8_t       key[kAeadKeyLen];
+    size_t        key_len = kAeadKeyLen;
+    EVP_PKEY_CTX *pctx    = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+    const char   *info    = client_to_server ? kInfoC2S : kInfoS2C;
+
+    if (pctx == NULL || EVP_PKEY_derive_init(pctx) != 1 || EVP_PKEY_CTX_set_hkdf_md(pctx, EVP_sha256()) != 1 ||
+        EVP_PKEY_CTX_set1_hkdf_salt(pctx, salt, kAeadSaltLen) != 1 ||
+        EVP_PKEY_CTX_set1_hkdf_key(pctx, (const uint8_t *) password, (int) strlen(password)) != 1 ||
+        EVP_PKEY_CTX_add1_hkdf_info(pctx, (const uint8_t *) info, (int) (sizeof(kInfoC2S) - 1)) != 1 ||
+        EVP_PKEY_derive(pctx, key, &key_len) != 1)
+    {
+        printSSLErrorAndAbort();
+    }
+    EVP_PKEY_CTX_free(pctx);
+
+    // the key is expanded here once, records only set a new nonce
+    if (1 != EVP_CipherInit_ex(aead->ctx, cipher, NULL, NULL, NULL, encrypt ? 1 : 0) ||
+        1 != EVP_CIPHER_CTX_ctrl(aead->ctx, EVP_CTRL_AEAD_SET_IVLEN, kAeadNonceLen, NULL) ||
+        1 != EVP_CipherInit_ex(aead->ctx, NULL, NULL, key, NULL, encrypt ? 1 : 0))
+    {
+        printSSLErrorAndAbort();
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+
+    aead->ready = true;
+    return true;
+}
+
+static void makeRealityAeadNonce(uint8_t nonce[kAeadNonceLen], uint64_t counter)
+{
+    memset(nonce, 0, 4);
+    for (int i = 0; i < 8; i++)
+    {
+        nonce[4 + i] = (uint8_t) (counter >> (8 * i));
+    }
+}
+
+/*
+    seals the record in the buffer it came in, the tag goes to the right of the data and the preamble (first
+    record only) to the left, the tls header is not added here
+*/
+static shift_buffer_t *realityAeadSeal(reality_aead_t *aead, shift_buffer_t *buf, const char *password,
+                                       bool client_to_server, buffer_pool_t *pool)
+{
+    uint8_t salt[kAeadSaltLen];
+    bool    first = ! aead->ready;
+    if (first)
+    {
+        if (1 != RAND_bytes(salt, sizeof(salt)) ||
+            ! deriveRealityAeadKey(aead, true, password, client_to_server, salt))
+        {
+            printSSLErrorAndAbort();
+        }
+    }
+
+    const uint32_t len = bufLen(buf);
+    if (WW_UNLIKELY(rCap(buf) < len + kAeadTagLen))
+    {
+        // not reserveBufSpace, the new buffer must keep the left room the preamble and tls header go into
+        const uint16_t  left   = (uint16_t) max(lCap(buf), kAeadPreambleLen + kTLSHeaderlen);
+        shift_buffer_t *bigger = newShiftBufferWithPad(len + kAeadTagLen, left, buf->r_pad);
+        setLen(bigger, len);
+        memcpy(rawBufMut(bigger), rawBuf(buf), len);
+        reuseBuffer(pool, buf);
+        buf = bigger;
+    }
+
+    uint8_t nonce[kAeadNonceLen];
+    makeRealityAeadNonce(nonce, aead->counter++);
+
+    uint8_t *data    = rawBufMut(buf);
+    int      out_len = 0;
+    if (1 != EVP_EncryptInit_ex(aead->ctx, NULL, NULL, NULL, nonce) ||
+        1 != EVP_EncryptUpdate(aead->ctx, data, &out_len, data, (int) len) ||
+        1 != EVP_EncryptFinal_ex(aead->ctx, data + out_len, &out_len) ||
+        1 != EVP_CIPHER_CTX_ctrl(aead->ctx, EVP_CTRL_AEAD_GET_TAG, kAeadTagLen, data + len))
+    {
+        printSSLErrorAndAbort();
+    }
+    setLen(buf, len + kAeadTagLen);
+
+    if (first)
+    {
+        shiftl(buf, kAeadSaltLen);
+        writeRaw(buf, salt, kAeadSaltLen);
+        shiftl(buf, 1);
+        writeUnAlignedUI8(buf, aead->cipher);
+    }
+    return buf;
+}
+
+/*
+    opens the record in place (tls header already shifted away), false if it does not authenticate
+
+    expected_cipher 0 accepts any cipher this build supports (the server), the first record that fails leaves
+    the direction unkeyed so the next one can still be the first
+*/
+static bool realityAeadOpen(reality_aead_t *aead, shift_buffer_t *buf, const char *password, bool client_to_server,
+                            uint8_t expected_cipher)
+{
+    if (! aead->ready)
+    {
+        if (bufLen(buf) < kAeadPreambleLen + kAeadTagLen)
+        {
+            return false;
+        }
+        const uint8_t *preamble = rawBuf(buf);
+        if (expected_cipher != 0 && preamble[0] != expected_cipher)
+        {
+            return false;
+        }
+        aead->cipher = preamble[0];
+        if (! deriveRealityAeadKey(aead, false, password, client_to_server, preamble + 1))
+        {
+            return false;
+        }
+        shiftr(buf, kAeadPreambleLen);
+        aead->counter = 0;
+    }
+
+    if (bufLen(buf) < kAeadTagLen)
+    {
+        return false;
+    }
+
+    const uint32_t len = bufLen(buf) - kAeadTagLen;
+    uint8_t        nonce[kAeadNonceLen];
+    makeRealityAeadNonce(nonce, aead->counter);
+
+    uint8_t *data    = rawBufMut(buf);
+    int      out_len = 0;
+    bool     ok      = 1 == EVP_DecryptInit_ex(aead->ctx, NULL, NULL, NULL, nonce) &&
+              1 == EVP_CIPHER_CTX_ctrl(aead->ctx, EVP_CTRL_AEAD_SET_TAG, kAeadTagLen, data + len) &&
+              1 == EVP_DecryptUpdate(aead->ctx, data, &out_len, data, (int) len) &&
+              1 == EVP_DecryptFinal_ex(aead->ctx, data + out_len, &out_len);
+
+    if (! ok)
+    {
+        if (aead->counter == 0)
+        {
+            aead->ready = false;
+        }
+        return false;
+    }
+
+    aead->counter++;
+    setLen(buf, len);
+    return true;
+}
@@ -0,0 +1,370 @@
+#include "crypto.h"
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <string.h>
+#include <time.h>
+
+// BLAKE2s, straight from RFC 7693
+
+static const uint32_t kBlake2sIv[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A,
+                                       0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19};
+
+static const uint8_t kBlake2sSigma[10][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15}, {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4}, {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13}, {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11}, {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5}, {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0}};
+
+static inline uint32_t rotr32(uint32_t x, int n)
+{
+    return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t rotl32(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+#define BLAKE2S_G(a, b, c, d, x, y)                                                                                    \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        v[a] = v[a] + v[b] + (x);                                                                                      \
+        v[d] = rotr32(v[d] ^ v[a], 16);                                                                                \
+        v[c] = v[c] + v[d];                                                                                            \
+        v[b] = rotr32(v[b] ^ v[c], 12);                                                                                \
+        v[a] = v[a] + v[b] + (y);                                                                                      \
+        v[d] = rotr32(v[d] ^ v[a], 8);                                                                                 \
+        v[c] = v[c] + v[d];                                                                                            \
+        v[b] = rotr32(v[b] ^ v[c], 7);                                                                                 \
+    } while (0)
+
+static void blake2sCompress(wireguard_blake2s_ctx *ctx, bool last)
+{
+    uint32_t v[16];
+    uint32_t m[16];
+
+    for (int i = 0; i < 8; i++)
+    {
+        v[i]     = ctx->h[i];
+        v[i + 8] = kBlake2sIv[i];
+    }
+    v[12] ^= ctx->t[0];
+    v[13] ^= ctx->t[1];
+    if (last)
+    {
+        v[14] = ~v[14];
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        m[i] = U8TO32_LITTLE(&ctx->b[4 * i]);
+    }
+    for (int i = 0; i < 10; i++)
+    {
+        const uint8_t *s = kBlake2sSigma[i];
+        BLAKE2S_G(0, 4, 8, 12, m[s[0]], m[s[1]]);
+        BLAKE2S_G(1, 5, 9, 13, m[s[2]], m[s[3]]);
+        BLAKE2S_G(2, 6, 10, 14, m[s[4]], m[s[5]]);
+        BLAKE2S_G(3, 7, 11, 15, m[s[6]], m[s[7]]);
+        BLAKE2S_G(0, 5, 10, 15, m[s[8]], m[s[9]]);
+        BLAKE2S_G(1, 6, 11, 12, m[s[10]], m[s[11]]);
+        BLAKE2S_G(2, 7, 8, 13, m[s[12]], m[s[13]]);
+        BLAKE2S_G(3, 4, 9, 14, m[s[14]], m[s[15]]);
+    }
+    for (int i = 0; i < 8; ++i)
+    {
+        ctx->h[i] ^= v[i] ^ v[i + 8];
+    }
+}
+
+void wireguard_blake2s_init(wireguard_blake2s_ctx *ctx, size_t outlen, const void *key, size_t keylen)
+{
+    for (int i = 0; i < 8; i++)
+    {
+        ctx->h[i] = kBlake2sIv[i];
+    }
+    // parameter block: digest length, key length, fanout = depth = 1
+    ctx->h[0] ^= 0x01010000 ^ ((uint32_t) keylen << 8) ^ (uint32_t) outlen;
+    ctx->t[0]   = 0;
+    ctx->t[1]   = 0;
+    ctx->c      = 0;
+    ctx->outlen = outlen;
+    memset(ctx->b, 0, sizeof(ctx->b));
+
+    if (keylen > 0)
+    {
+        // the key is hashed as a zero padded first block
+        wireguard_blake2s_update(ctx, key, keylen);
+        ctx->c = kBlake2sBlockLen;
+    }
+}
+
+void wireguard_blake2s_update(wireguard_blake2s_ctx *ctx, const void *in, size_t inlen)
+{
+    const uint8_t *p = in;
+    for (size_t i = 0; i < inlen; i++)
+    {
+        if (ctx->c == kBlake2sBlockLen)
+        {
+            ctx->t[0] += (uint32_t) ctx->c;
+            if (ctx->t[0] < ctx->c)
+            {
+                ctx->t[1]++;
+            }
+            blake2sCompress(ctx, false);
+            ctx->c = 0;
+        }
+        ctx->b[ctx->c++] = p[i];
+    }
+}
+
+void wireguard_blake2s_final(wireguard_blake2s_ctx *ctx, void *out)
+{
+    uint8_t *o = out;
+
+    ctx->t[0] += (uint32_t) ctx->c;
+    if (ctx->t[0] < ctx->c)
+    {
+        ctx->t[1]++;
+    }
+    while (ctx->c < kBlake2sBlockLen)
+    {
+        ctx->b[ctx->c++] = 0;
+    }
+    blake2sCompress(ctx, true);
+
+    for (size_t i = 0; i < ctx->outlen; i++)
+    {
+        o[i] = (uint8_t) ((ctx->h[i >> 2] >> (8 * (i & 3))) & 0xFF);
+    }
+    crypto_zero(ctx, sizeof(*ctx));
+}
+
+void wireguard_blake2s(void *out, size_t outlen, const void *key, size_t keylen, const void *in, size_t inlen)
+{
+    wireguard_blake2s_ctx ctx;
+    wireguard_blake2s_init(&ctx, outlen, key, keylen);
+    wireguard_blake2s_update(&ctx, in, inlen);
+    wireguard_blake2s_final(&ctx, out);
+}
+
+// HChaCha20, derives the XChaCha20 sub key from the first 16 bytes of the 24 byte nonce
+
+#define CHACHA_QR(a, b, c, d)                                                                                          \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        x[a] += x[b];                                                                                                  \
+        x[d] = rotl32(x[d] ^ x[a], 16);                                                                                \
+        x[c] += x[d];                                                                                                  \
+        x[b] = rotl32(x[b] ^ x[c], 12);                                                                                \
+        x[a] += x[b];                                                                                                  \
+        x[d] = rotl32(x[d] ^ x[a], 8);                                                                                 \
+        x[c] += x[d];                                                                                                  \
+        x[b] = rotl32(x[b] ^ x[c], 7);                                                                                 \
+    } while (0)
+
+static void hchacha20(uint8_t *out, const uint8_t *nonce, const uint8_t *key)
+{
+    uint32_t x[16] = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+
+    for (int i = 0; i < 8; i++)
+    {
+        x[4 + i] = U8TO32_LITTLE(key + (4 * i));
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        x[12 + i] = U8TO32_LITTLE(nonce + (4 * i));
+    }
+    for (int i = 0; i < 10; i++)
+    {
+        CHACHA_QR(0, 4, 8, 12);
+        CHACHA_QR(1, 5, 9, 13);
+        CHACHA_QR(2, 6, 10, 14);
+        CHACHA_QR(3, 7, 11, 15);
+        CHACHA_QR(0, 5, 10, 15);
+        CHACHA_QR(1, 6, 11, 12);
+        CHACHA_QR(2, 7, 8, 13);
+        CHACHA_QR(3, 4, 9, 14);
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        U32TO8_LITTLE(out + (4 * i), x[i]);
+        U32TO8_LITTLE(out + 16 + (4 * i), x[12 + i]);
+    }
+    crypto_zero(x, sizeof(x));
+}
+
+/*
+    one cipher context per thread and direction, only key and nonce change per packet so the
+    cipher is fetched once and every packet is a re-init plus a single update
+*/
+static _Thread_local EVP_CIPHER_CTX *encrypt_ctx;
+static _Thread_local EVP_CIPHER_CTX *decrypt_ctx;
+
+static EVP_CIPHER_CTX *getCipherCtx(EVP_CIPHER_CTX **slot, int enc)
+{
+    if (*slot == NULL)
+    {
+        *slot = EVP_CIPHER_CTX_new();
+        EVP_CipherInit_ex(*slot, EVP_chacha20_poly1305(), NULL, NULL, NULL, enc);
+    }
+    return *slot;
+}
+
+static inline void makeNonce(uint8_t *nonce, uint64_t counter)
+{
+    memset(nonce, 0, 4);
+    U64TO8_LITTLE(nonce + 4, counter);
+}
+
+void wireguard_aead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                            uint64_t nonce, const uint8_t *key)
+{
+    EVP_CIPHER_CTX *ctx = getCipherCtx(&encrypt_ctx, 1);
+    uint8_t         iv[12];
+    int             outl = 0;
+    int             finl = 0;
+
+    makeNonce(iv, nonce);
+    EVP_CipherInit_ex(ctx, NULL, NULL, key, iv, 1);
+    if (ad_len > 0)
+    {
+        EVP_CipherUpdate(ctx, NULL, &outl, ad, (int) ad_len);
+    }
+    outl = 0;
+    if (src_len > 0)
+    {
+        EVP_CipherUpdate(ctx, dst, &outl, src, (int) src_len);
+    }
+    EVP_CipherFinal_ex(ctx, dst + outl, &finl);
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, kChaChaPolyTagLen, dst + src_len);
+}
+
+bool wireguard_aead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                            uint64_t nonce, const uint8_t *key)
+{
+    if (src_len < kChaChaPolyTagLen)
+    {
+        return false;
+    }
+
+    EVP_CIPHER_CTX *ctx     = getCipherCtx(&decrypt_ctx, 0);
+    const size_t    enc_len = src_len - kChaChaPolyTagLen;
+    uint8_t         iv[12];
+    uint8_t         tag[kChaChaPolyTagLen];
+    uint8_t         empty[1];
+    int             outl = 0;
+    int             finl = 0;
+
+    // the tag is copied out first, with dst == src it is the only part that is not overwritten but be safe
+    memcpy(tag, src + enc_len, kChaChaPolyTagLen);
+    makeNonce(iv, nonce);
+
+    EVP_CipherInit_ex(ctx, NULL, NULL, key, iv, 0);
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, kChaChaPolyTagLen, tag);
+    if (ad_len > 0)
+    {
+        EVP_CipherUpdate(ctx, NULL, &outl, ad, (int) ad_len);
+    }
+    outl = 0;
+    if (enc_len > 0)
+    {
+        EVP_CipherUpdate(ctx, dst, &outl, src, (int) enc_len);
+    }
+    return EVP_CipherFinal_ex(ctx, dst != NULL ? dst + outl : empty, &finl) == 1;
+}
+
+void wireguard_xaead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                             const uint8_t *nonce, const uint8_t *key)
+{
+    uint8_t subkey[kBlake2sKeyLen];
+    hchacha20(subkey, nonce, key);
+    wireguard_aead_encrypt(dst, src, src_len, ad, ad_len, U8TO64_LITTLE(nonce + 16), subkey);
+    crypto_zero(subkey, sizeof(subkey));
+}
+
+bool wireguard_xaead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                             const uint8_t *nonce, const uint8_t *key)
+{
+    uint8_t subkey[kBlake2sKeyLen];
+    hchacha20(subkey, nonce, key);
+    bool result = wireguard_aead_decrypt(dst, src, src_len, ad, ad_len, U8TO64_LITTLE(nonce + 16), subkey);
+    crypto_zero(subkey, sizeof(subkey));
+    return result;
+}
+
+int wireguard_x25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point)
+{
+    int           result = -1;
+    size_t        outlen = 32;
+    EVP_PKEY     *priv   = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, NULL, scalar, 32);
+    EVP_PKEY     *pub    = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, point, 32);
+    EVP_PKEY_CTX *ctx    = priv != NULL ? EVP_PKEY_CTX_new(priv, NULL) : NULL;
+
+    if (ctx != NULL && pub != NULL && EVP_PKEY_derive_init(ctx) == 1 && EVP_PKEY_derive_set_peer(ctx, pub) == 1 &&
+        EVP_PKEY_derive(ctx, out, &outlen) == 1 && outlen == 32)
+    {
+        result = 0;
+    }
+    else
+    {
+        // libcrypto refuses low order points, the callers compare the result against zero
+        memset(out, 0, 32);
+    }
+
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(pub);
+    EVP_PKEY_free(priv);
+    return result;
+}
+
+void wireguard_random_bytes(void *bytes, size_t size)
+{
+    RAND_bytes(bytes, (int) size);
+}
+
+uint32_t wireguard_sys_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) (((uint64_t) ts.tv_sec * 1000) + ((uint64_t) ts.tv_nsec / 1000000));
+}
+
+void wireguard_tai64n_now(uint8_t *output)
+{
+    // 64 bit big endian seconds since 1970 plus 2^62, then 32 bit big endian nano seconds
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    uint64_t seconds = 0x400000000000000aULL + (uint64_t) ts.tv_sec;
+    uint32_t nanos   = (uint32_t) ts.tv_nsec;
+    for (int i = 0; i < 8; i++)
+    {
+        output[i] = (uint8_t) (seconds >> (56 - (8 * i)));
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        output[8 + i] = (uint8_t) (nanos >> (24 - (8 * i)));
+    }
+}
+
+void crypto_zero(void *dest, size_t len)
+{
+    volatile uint8_t *p = dest;
+    while (len--)
+    {
+        *p++ = 0;
+    }
+}
+
+bool crypto_equal(const void *a, const void *b, size_t size)
+{
+    const uint8_t *pa   = a;
+    const uint8_t *pb   = b;
+    uint8_t        diff = 0;
+    for (size_t i = 0; i < size; i++)
+    {
+        diff |= pa[i] ^ pb[i];
+    }
+    return diff == 0;
+}
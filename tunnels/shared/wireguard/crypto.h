@@ -0,0 +1,82 @@
+#pragma once
+
+/*
+    The primitives the Noise code in wireguard.c needs, with the names it was written against
+
+    BLAKE2s and HChaCha20 are small enough to live here, the AEAD and X25519 go to libcrypto
+*/
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define U8TO32_LITTLE(p)                                                                                               \
+    (((uint32_t) ((p)[0])) | ((uint32_t) ((p)[1]) << 8) | ((uint32_t) ((p)[2]) << 16) | ((uint32_t) ((p)[3]) << 24))
+
+#define U32TO8_LITTLE(p, v)                                                                                            \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        (p)[0] = (uint8_t) ((v));                                                                                      \
+        (p)[1] = (uint8_t) ((v) >> 8);                                                                                 \
+        (p)[2] = (uint8_t) ((v) >> 16);                                                                                \
+        (p)[3] = (uint8_t) ((v) >> 24);                                                                                \
+    } while (0)
+
+#define U64TO8_LITTLE(p, v)                                                                                            \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        U32TO8_LITTLE((p), (uint32_t) ((v)));                                                                          \
+        U32TO8_LITTLE((p) + 4, (uint32_t) ((v) >> 32));                                                                \
+    } while (0)
+
+#define U8TO64_LITTLE(p) (((uint64_t) U8TO32_LITTLE(p)) | ((uint64_t) U8TO32_LITTLE((p) + 4) << 32))
+
+enum wireguard_crypto_consts
+{
+    kBlake2sBlockLen  = 64,
+    kBlake2sOutLen    = 32,
+    kBlake2sKeyLen    = 32,
+    kChaChaPolyTagLen = 16
+};
+
+typedef struct wireguard_blake2s_ctx_s
+{
+    uint8_t  b[kBlake2sBlockLen];
+    uint32_t h[8];
+    uint32_t t[2];
+    size_t   c;
+    size_t   outlen;
+
+} wireguard_blake2s_ctx;
+
+void wireguard_blake2s_init(wireguard_blake2s_ctx *ctx, size_t outlen, const void *key, size_t keylen);
+void wireguard_blake2s_update(wireguard_blake2s_ctx *ctx, const void *in, size_t inlen);
+void wireguard_blake2s_final(wireguard_blake2s_ctx *ctx, void *out);
+void wireguard_blake2s(void *out, size_t outlen, const void *key, size_t keylen, const void *in, size_t inlen);
+
+// returns 0 on success, the shared point is zeroed if the peer gave a low order point
+int wireguard_x25519(uint8_t *out, const uint8_t *scalar, const uint8_t *point);
+
+/*
+    ChaCha20-Poly1305 as WireGuard uses it, nonce is 32 zero bits then the little endian counter
+
+    dst may be the same pointer as src, encrypt writes src_len + 16 bytes (the tag after the cipher text)
+    and decrypt takes src_len including the tag and writes src_len - 16 bytes
+*/
+void wireguard_aead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                            uint64_t nonce, const uint8_t *key);
+bool wireguard_aead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                            uint64_t nonce, const uint8_t *key);
+
+// XChaCha20-Poly1305, only the cookie reply uses it
+void wireguard_xaead_encrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                             const uint8_t *nonce, const uint8_t *key);
+bool wireguard_xaead_decrypt(uint8_t *dst, const uint8_t *src, size_t src_len, const uint8_t *ad, size_t ad_len,
+                             const uint8_t *nonce, const uint8_t *key);
+
+void     wireguard_random_bytes(void *bytes, size_t size);
+uint32_t wireguard_sys_now(void);
+void     wireguard_tai64n_now(uint8_t *output);
+
+void crypto_zero(void *dest, size_t len);
+bool crypto_equal(const void *a, const void *b, size_t size);
@@ -8,14 +8,16 @@
 
     their license files are placed next to this file
 */
+#include "utils/probeutils.h"
+#include <stdbool.h>
 #include <stddef.h>
-#include "lwip_types.h"
+#include <stdint.h>
 
 enum wg_general_limits
 {
-    // Peers are allocated statically inside the device structure to avoid malloc
-    kWgMaxPeers  = 1,
-    kWgMaxSrcIPs = 2,
+    // The peers array of a device is allocated once when the tunnel is created
+    kWgMaxPeers  = 65536,
+    kWgMaxSrcIPs = 16,
     // Per device limit on accepting (valid) initiation requests - per peer
     kMaxInitiationPerSecond = 2
 };
@@ -54,6 +56,13 @@ enum wg_message_consts
     kWgMsgTransportData  = 4
 };
 
+enum wg_replay_consts
+{
+    // RFC 6479 sliding window, one word is always being rotated in so the usable window is one word shorter
+    kWgReplayWindowWords = 32,
+    kWgReplayWindowSize  = (kWgReplayWindowWords - 1) * 64
+};
+
 typedef struct wireguard_keypair_s
 {
     uint64_t replay_counter;
@@ -62,14 +71,14 @@ typedef struct wireguard_keypair_s
     uint32_t remote_index;
     uint32_t last_tx;
     uint32_t last_rx;
-    uint32_t kepair_ms;
-    uint32_t replay_mitmap;
+    uint32_t keypair_millis;
     bool     valid;
-    bool     is_client_side;
+    bool     initiator;
     bool     sending_valid;
     bool     receiving_valid;
     uint8_t  sending_key[kWgSessionKeyLen];
     uint8_t  receiving_key[kWgSessionKeyLen];
+    uint64_t replay_bitmap[kWgReplayWindowWords];
 
 } wireguard_keypair_t;
 
@@ -77,7 +86,7 @@ typedef struct wireguard_handshake_s
 {
     bool     valid;
     bool     initiator;
-    uint32_t local_port;
+    uint32_t local_index;
     uint32_t remote_index;
     uint8_t  ephemeral_private[kWgPrivateKeyLen];
     uint8_t  remote_ephemeral[kWgPublicKeyLen];
@@ -86,30 +95,18 @@ typedef struct wireguard_handshake_s
 
 } wireguard_handshake_t;
 
-typedef struct wireguard_allowed_ip_s
-{
-    bool      valid;
-    ip_addr_t ip;
-    ip_addr_t mask;
-
-} wireguard_allowed_ip_t;
-
-struct wireguard_peer_s
+/*
+    Only the Noise and session state lives here, the endpoint, allowed ips and the line that carries
+    the datagrams belong to the tunnel that owns the device
+*/
+typedef struct wireguard_peer_s
 {
     bool valid;  // Is this peer initialised?
     bool active; // Should we be actively trying to connect?
 
-    // This is the configured IP of the peer (endpoint)
-    ip_addr_t connect_ip;
-    uint16_t  connect_port;
-    // This is the latest received IP/port
-    ip_addr_t ip;
-    uint16_t  port;
     // keep-alive interval in seconds, 0 is disable
     uint16_t keepalive_interval;
 
-    struct wireguard_allowed_ip_s allowed_source_ips[kWgMaxSrcIPs];
-
     uint8_t public_key[kWgPublicKeyLen];
     uint8_t preshared_key[kWgSessionKeyLen];
 
@@ -117,15 +114,15 @@ struct wireguard_peer_s
     uint8_t public_key_dh[kWgPublicKeyLen];
 
     // Session keypairs
-    struct wireguard_keypair_s curr_keypair;
-    struct wireguard_keypair_s prev_keypair;
-    struct wireguard_keypair_s next_keypair;
+    wireguard_keypair_t curr_keypair;
+    wireguard_keypair_t prev_keypair;
+    wireguard_keypair_t next_keypair;
 
     // 5.1 Silence is a Virtue: The responder keeps track of the greatest timestamp received per peer
     uint8_t greatest_timestamp[kWgTai64Len];
 
     // The active handshake that is happening
-    struct wireguard_handshake_s handshake;
+    wireguard_handshake_t handshake;
 
     // Decrypted cookie from the responder
     uint32_t cookie_millis;
@@ -150,14 +147,14 @@ struct wireguard_peer_s
 
     // We set this flag on RX/TX of packets if we think that we should initiate a new handshake
     bool send_handshake;
-};
 
-struct wireguard_device
-{
-    // Maybe have a "Device private" member to abstract these?
-    struct netif   *netif;
-    struct udp_pcb *udp_pcb;
+} wireguard_peer_t;
+
+// A slot of the receiver index table, the key is the local index and the value is the wireguard_peer_t holding it
+typedef probe_slot_t wireguard_index_entry_t;
 
+typedef struct wireguard_device_s
+{
     uint8_t public_key[kWgPublicKeyLen];
     uint8_t private_key[kWgPrivateKeyLen];
 
@@ -168,11 +165,19 @@ struct wireguard_device
     uint8_t label_cookie_key[kWgSessionKeyLen];
     uint8_t label_mac1_key[kWgSessionKeyLen];
 
-    // List of peers associated with this device
-    struct wireguard_peer_s peers[kWgMaxPeers];
+    // List of peers associated with this device, allocated by the owner with room for kWgMaxPeers
+    wireguard_peer_t *peers;
+    uint32_t          peers_count;
+
+    // Local index -> peer, open addressing with wireguard_index_table_len(peers_count) slots allocated by the owner
+    // Only the handshake functions, keypair_update and keypair_release change it, they need the same serialization
+    wireguard_index_entry_t *index_table;
+    uint32_t                 index_table_mask;
+    uint32_t                 index_table_count;
 
     bool valid;
-};
+
+} wireguard_device_t;
 
 enum wireguard_message_constants
 {
@@ -222,7 +227,6 @@ struct message_cookie_reply
 // 5.4.6 Subsequent Messages: Transport Data Messages
 struct message_transport_data
 {
-    
     uint8_t  type;
     uint8_t  reserved[3];
     uint32_t receiver;
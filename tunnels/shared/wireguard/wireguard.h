@@ -12,43 +12,48 @@
 #include "defs.h"
 
 // Initialise the WireGuard system - need to call this before anything else
-void wireguard_init();
-bool wireguard_device_init(struct wireguard_device *device, const uint8_t *private_key);
-bool wireguard_peer_init(struct wireguard_device *device, struct wireguard_peer *peer, const uint8_t *public_key, const uint8_t *preshared_key);
+void wireguard_init(void);
+bool wireguard_device_init(wireguard_device_t *device, const uint8_t *private_key);
+bool wireguard_peer_init(wireguard_device_t *device, wireguard_peer_t *peer, const uint8_t *public_key, const uint8_t *preshared_key);
 
-struct wireguard_peer *peer_alloc(struct wireguard_device *device);
-uint8_t wireguard_peer_index(struct wireguard_device *device, struct wireguard_peer *peer);
-struct wireguard_peer *peer_lookup_by_pubkey(struct wireguard_device *device, uint8_t *public_key);
-struct wireguard_peer *peer_lookup_by_peer_index(struct wireguard_device *device, uint8_t peer_index);
-struct wireguard_peer *peer_lookup_by_receiver(struct wireguard_device *device, uint32_t receiver);
-struct wireguard_peer *peer_lookup_by_handshake(struct wireguard_device *device, uint32_t receiver);
+// Slots the owner allocates for device->index_table (zeroed, index_table_mask = len - 1)
+uint32_t wireguard_index_table_len(uint32_t peers_count);
 
-void wireguard_start_session(struct wireguard_peer *peer, bool initiator);
+wireguard_peer_t *peer_alloc(wireguard_device_t *device);
+uint32_t wireguard_peer_index(wireguard_device_t *device, wireguard_peer_t *peer);
+wireguard_peer_t *peer_lookup_by_pubkey(wireguard_device_t *device, uint8_t *public_key);
+wireguard_peer_t *peer_lookup_by_peer_index(wireguard_device_t *device, uint32_t peer_index);
+wireguard_peer_t *peer_lookup_by_receiver(wireguard_device_t *device, uint32_t receiver);
+wireguard_peer_t *peer_lookup_by_handshake(wireguard_device_t *device, uint32_t receiver);
 
-void keypair_update(struct wireguard_peer *peer, struct wireguard_keypair *received_keypair);
-void keypair_destroy(struct wireguard_keypair *keypair);
+void wireguard_start_session(wireguard_device_t *device, wireguard_peer_t *peer, bool initiator);
 
-struct wireguard_keypair *get_peer_keypair_for_idx(struct wireguard_peer *peer, uint32_t idx);
-bool wireguard_check_replay(struct wireguard_keypair *keypair, uint64_t seq);
+// keypair_update and keypair_release change the receiver index table, so they need the handshake serialization
+void keypair_update(wireguard_device_t *device, wireguard_peer_t *peer, wireguard_keypair_t *received_keypair);
+void keypair_release(wireguard_device_t *device, wireguard_peer_t *peer, wireguard_keypair_t *keypair);
+void keypair_destroy(wireguard_keypair_t *keypair);
+
+wireguard_keypair_t *get_peer_keypair_for_idx(wireguard_peer_t *peer, uint32_t idx);
+bool wireguard_check_replay(wireguard_keypair_t *keypair, uint64_t seq);
 
 uint8_t wireguard_get_message_type(const uint8_t *data, size_t len);
 
-struct wireguard_peer *wireguard_process_initiation_message(struct wireguard_device *device, struct message_handshake_initiation *msg);
-bool wireguard_process_handshake_response(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_response *src);
-bool wireguard_process_cookie_message(struct wireguard_device *device, struct wireguard_peer *peer, struct message_cookie_reply *src);
+wireguard_peer_t *wireguard_process_initiation_message(wireguard_device_t *device, struct message_handshake_initiation *msg);
+bool wireguard_process_handshake_response(wireguard_device_t *device, wireguard_peer_t *peer, struct message_handshake_response *src);
+bool wireguard_process_cookie_message(wireguard_device_t *device, wireguard_peer_t *peer, struct message_cookie_reply *src);
 
-bool wireguard_create_handshake_initiation(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_initiation *dst);
-bool wireguard_create_handshake_response(struct wireguard_device *device, struct wireguard_peer *peer, struct message_handshake_response *dst);
-void wireguard_create_cookie_reply(struct wireguard_device *device, struct message_cookie_reply *dst, const uint8_t *mac1, uint32_t index, uint8_t *source_addr_port, size_t source_length);
+bool wireguard_create_handshake_initiation(wireguard_device_t *device, wireguard_peer_t *peer, struct message_handshake_initiation *dst);
+bool wireguard_create_handshake_response(wireguard_device_t *device, wireguard_peer_t *peer, struct message_handshake_response *dst);
+void wireguard_create_cookie_reply(wireguard_device_t *device, struct message_cookie_reply *dst, const uint8_t *mac1, uint32_t index, uint8_t *source_addr_port, size_t source_length);
 
 
-bool wireguard_check_mac1(struct wireguard_device *device, const uint8_t *data, size_t len, const uint8_t *mac1);
-bool wireguard_check_mac2(struct wireguard_device *device, const uint8_t *data, size_t len, uint8_t *source_addr_port, size_t source_length, const uint8_t *mac2);
+bool wireguard_check_mac1(wireguard_device_t *device, const uint8_t *data, size_t len, const uint8_t *mac1);
+bool wireguard_check_mac2(wireguard_device_t *device, const uint8_t *data, size_t len, uint8_t *source_addr_port, size_t source_length, const uint8_t *mac2);
 
 bool wireguard_expired(uint32_t created_millis, uint32_t valid_seconds);
 
-void wireguard_encrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len, struct wireguard_keypair *keypair);
-bool wireguard_decrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len, uint64_t counter, struct wireguard_keypair *keypair);
+void wireguard_encrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len, wireguard_keypair_t *keypair);
+bool wireguard_decrypt_packet(uint8_t *dst, const uint8_t *src, size_t src_len, uint64_t counter, wireguard_keypair_t *keypair);
 
 bool wireguard_base64_decode(const char *str, uint8_t *out, size_t *outlen);
 bool wireguard_base64_encode(const uint8_t *in, size_t inlen, char *out, size_t *outlen);
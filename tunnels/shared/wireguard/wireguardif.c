@@ -209,7 +209,7 @@ static void wireguardif_process_response_message(struct wireguard_device *device
 		// Update the peer location
 		update_peer_addr(peer, addr, port);
 
-		wireguard_start_session(peer, true);
+		wireguard_start_session(device, peer, true);
 		wireguardif_send_keepalive(device, peer);
 
 		// Set the IF-UP flag on netif
@@ -401,7 +401,7 @@ static void wireguardif_send_handshake_response(struct wireguard_device *device,
 
 	if (wireguard_create_handshake_response(device, peer, &packet)) {
 
-		wireguard_start_session(peer, false);
+		wireguard_start_session(device, peer, false);
 
 		// Send this packet out!
 		pbuf = pbuf_alloc(PBUF_TRANSPORT, sizeof(struct message_handshake_response), PBUF_RAM);
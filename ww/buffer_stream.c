@@ -2,6 +2,7 @@
 #include "buffer_pool.h"
 #include "shiftbuffer.h"
 #include "stc/common.h"
+#include "utils/mathutils.h"
 #include <assert.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -45,49 +46,99 @@ void destroyBufferStream(buffer_stream_t *self)
 
 void bufferStreamPush(buffer_stream_t *self, shift_buffer_t *buf)
 {
-    
+
     BUFFER_WONT_BE_REUSED(buf);
-    
+
     if (self->size > 0 && bufLen(buf) <= kConcatMaxThreshould)
     {
         shift_buffer_t *last = queue_pull_back(&self->q);
 
-        if (rCapNoPadding(last) >= bufLen(buf))
+        // counted from rCap, the data (or the position) of last may already be inside its right padding and
+        // rCapNoPadding() would wrap; the padding is still left free after the append
+        if (rCap(last) - bufLen(last) >= (uint32_t) last->r_pad + bufLen(buf))
         {
             self->size += bufLen(buf);
             concatBufferNoCheck(last, buf);
-            destroyShiftBuffer(buf);
+            queue_push_back(&self->q, last);
+            reuseBuffer(self->pool, buf);
             return;
         }
+        queue_push_back(&self->q, last);
     }
 
     queue_push_back(&self->q, buf);
     self->size += bufLen(buf);
 }
 
+/*
+    b is the front buffer (already pulled) and holds more than bytes, the first bytes are returned and the rest
+    stays at the front; whichever side is smaller is the one copied
+*/
+static shift_buffer_t *splitFront(buffer_stream_t *self, shift_buffer_t *b, size_t bytes)
+{
+    const size_t rest = bufLen(b) - bytes;
+
+    if (rest < bytes)
+    {
+        shift_buffer_t *tail = reserveBufSpace(popBuffer(self->pool), rest);
+        setLen(tail, rest);
+        memcpy(rawBufMut(tail), ((uint8_t *) rawBuf(b)) + bytes, rest);
+        setLen(b, bytes);
+        queue_push_front(&self->q, tail);
+        return b;
+    }
+
+    shift_buffer_t *head = sliceBufferTo(popBuffer(self->pool), b, bytes);
+    queue_push_front(&self->q, b);
+    return head;
+}
+
 shift_buffer_t *bufferStreamRead(buffer_stream_t *self, size_t bytes)
 {
     assert(self->size >= bytes && bytes > 0);
     self->size -= bytes;
 
-    shift_buffer_t *container = queue_pull_front(&self->q);
+    shift_buffer_t *first = queue_pull_front(&self->q);
+
+    if (bufLen(first) == bytes)
+    {
+        return first;
+    }
+    if (bufLen(first) > bytes)
+    {
+        return splitFront(self, first, bytes);
+    }
 
-    while (true)
+    // the read spans buffers, they are copied once into the first one if it has the room or into a new one
+    shift_buffer_t *dest = first;
+    if (rCap(first) < (size_t) first->r_pad + bytes)
     {
-        size_t available = bufLen(container);
-        if (available > bytes)
+        queue_push_front(&self->q, first);
+        dest = reserveBufSpace(popBuffer(self->pool), bytes);
+        setLen(dest, 0);
+    }
+
+    size_t filled = bufLen(dest);
+    while (filled < bytes)
+    {
+        shift_buffer_t *b    = queue_pull_front(&self->q);
+        const size_t    take = min(bufLen(b), bytes - filled);
+
+        setLen(dest, filled + take);
+        memcpy(rawBufMut(dest) + filled, rawBuf(b), take);
+        filled += take;
+
+        if (take == bufLen(b))
         {
-            shift_buffer_t *slice = popBuffer(self->pool);
-            slice = sliceBufferTo(slice, container, bytes);
-            queue_push_front(&self->q, container);
-            return slice;
+            reuseBuffer(self->pool, b);
         }
-        if (available == bytes)
+        else
         {
-            return container;
+            shiftr(b, take);
+            queue_push_front(&self->q, b);
         }
-        container = appendBufferMerge(self->pool, container, queue_pull_front(&self->q));
     }
+    return dest;
 }
 
 shift_buffer_t *bufferStreamIdealRead(buffer_stream_t *self)
@@ -98,6 +149,21 @@ shift_buffer_t *bufferStreamIdealRead(buffer_stream_t *self)
     return container;
 }
 
+// the front buffer as it is, only split when it holds more than max_bytes
+shift_buffer_t *bufferStreamReadSegment(buffer_stream_t *self, size_t max_bytes)
+{
+    assert(self->size > 0 && max_bytes > 0);
+    shift_buffer_t *b = queue_pull_front(&self->q);
+
+    if (bufLen(b) > max_bytes)
+    {
+        self->size -= max_bytes;
+        return splitFront(self, b, max_bytes);
+    }
+    self->size -= bufLen(b);
+    return b;
+}
+
 uint8_t bufferStreamViewByteAt(buffer_stream_t *self, size_t at)
 {
     assert(self->size > at && self->size != 0);
@@ -121,30 +187,79 @@ uint8_t bufferStreamViewByteAt(buffer_stream_t *self, size_t at)
 
 void bufferStreamViewBytesAt(buffer_stream_t *self, size_t at, uint8_t *buf, size_t len)
 {
-    size_t bufferstream_i = at;
-    assert(self->size >= (bufferstream_i + len) && self->size != 0);
-    unsigned int buf_i = 0;
-    c_foreach(qi, queue, self->q)
+    assert(self->size >= (at + len) && self->size != 0);
+
+    c_foreach(i, queue, self->q)
     {
+        shift_buffer_t *b    = *i.ref;
+        const size_t    blen = bufLen(b);
 
-        shift_buffer_t *b    = *qi.ref;
-        size_t          blen = bufLen(b);
+        if (at >= blen)
+        {
+            at -= blen;
+            continue;
+        }
+
+        const size_t take = min(len, blen - at);
+        memcpy(buf, ((uint8_t *) rawBuf(b)) + at, take);
+        buf += take;
+        len -= take;
+        at = 0;
 
-        if (len - buf_i <= blen - bufferstream_i)
+        if (len == 0)
         {
-            memcpy(buf + buf_i, ((char *) rawBuf(b)) + bufferstream_i, len - buf_i);
             return;
         }
+    }
+}
+
+// position of the first byte equal to value at or after at, -1 when none of the buffered bytes is
+ssize_t bufferStreamFindByte(buffer_stream_t *self, size_t at, uint8_t value)
+{
+    size_t offset = 0;
+
+    c_foreach(i, queue, self->q)
+    {
+        shift_buffer_t *b    = *i.ref;
+        const size_t    blen = bufLen(b);
 
-        while (bufferstream_i < blen)
+        if (at < offset + blen)
         {
-            buf[buf_i++] = ((uint8_t *) rawBuf(b))[bufferstream_i++];
-            if (buf_i == len)
+            const uint8_t *data  = rawBuf(b);
+            const size_t   start = at > offset ? at - offset : 0;
+            const uint8_t *found = memchr(data + start, value, blen - start);
+            if (found != NULL)
             {
-                return;
+                return (ssize_t) (offset + (size_t) (found - data));
             }
         }
+        offset += blen;
+    }
+    return -1;
+}
+
+// copies the first len bytes out and consumes them, for readers that need them in their own memory anyway
+void bufferStreamReadBytes(buffer_stream_t *self, uint8_t *dest, size_t len)
+{
+    assert(self->size >= len);
+    self->size -= len;
+
+    while (len > 0)
+    {
+        shift_buffer_t *b    = queue_pull_front(&self->q);
+        size_t          blen = bufLen(b);
+
+        if (blen > len)
+        {
+            memcpy(dest, rawBuf(b), len);
+            shiftr(b, len);
+            queue_push_front(&self->q, b);
+            return;
+        }
 
-        bufferstream_i -= blen;
+        memcpy(dest, rawBuf(b), blen);
+        dest += blen;
+        len -= blen;
+        reuseBuffer(self->pool, b);
     }
 }
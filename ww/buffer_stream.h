@@ -12,6 +12,10 @@
     you can for example check byte index 1 or 5 of the buffers without concating them, then
     you'll be able to read only when your protocol is satisfied, the size you want
 
+    peeking (view, find) never merges the buffers; a read that spans buffers copies each byte once, a read that
+    ends inside a buffer splits it and copies the smaller side; bufferStreamReadSegment() hands the queued
+    buffers out one by one for readers that can take the data in pieces
+
 
 */
 
@@ -33,8 +37,11 @@ void             destroyBufferStream(buffer_stream_t *self);
 void             bufferStreamPush(buffer_stream_t *self, shift_buffer_t *buf);
 shift_buffer_t  *bufferStreamRead(buffer_stream_t *self, size_t bytes);
 shift_buffer_t  *bufferStreamIdealRead(buffer_stream_t *self);
+shift_buffer_t  *bufferStreamReadSegment(buffer_stream_t *self, size_t max_bytes);
 uint8_t          bufferStreamViewByteAt(buffer_stream_t *self, size_t at);
 void             bufferStreamViewBytesAt(buffer_stream_t *self, size_t at, uint8_t *buf, size_t len);
+ssize_t          bufferStreamFindByte(buffer_stream_t *self, size_t at, uint8_t value);
+void             bufferStreamReadBytes(buffer_stream_t *self, uint8_t *dest, size_t len);
 
 static inline size_t bufferStreamLen(buffer_stream_t *self)
 {
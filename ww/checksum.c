@@ -0,0 +1,270 @@
+#include "checksum.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CHECKSUM_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) || (defined(__ARM_NEON) && defined(__arm__))
+#define CHECKSUM_NEON 1
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#endif
+#endif
+
+static inline uint64_t foldTo32(uint64_t sum)
+{
+    sum = (sum >> 32) + (sum & 0xffffffff);
+    return (sum >> 32) + (sum & 0xffffffff);
+}
+
+static inline uint16_t foldTo16(uint64_t sum)
+{
+    sum = foldTo32(sum);
+    sum = (sum >> 16) + (sum & 0xffff);
+    sum = (sum >> 16) + (sum & 0xffff);
+    return (uint16_t) sum;
+}
+
+// the part that is shorter than a vector, also the whole job for the scalar kernel
+static inline uint64_t sumTail(const uint8_t *ptr, uint32_t len, uint64_t sum)
+{
+    while (len >= 16)
+    {
+        uint32_t w[4];
+        memcpy(w, ptr, sizeof(w));
+        sum += (uint64_t) w[0] + w[1] + w[2] + w[3];
+        ptr += 16;
+        len -= 16;
+    }
+    while (len >= 4)
+    {
+        uint32_t w;
+        memcpy(&w, ptr, sizeof(w));
+        sum += w;
+        ptr += 4;
+        len -= 4;
+    }
+    if (len >= 2)
+    {
+        uint16_t w;
+        memcpy(&w, ptr, sizeof(w));
+        sum += w;
+        ptr += 2;
+        len -= 2;
+    }
+    if (len)
+    {
+        // the odd byte is padded with a zero byte after it, as it sits in memory
+        uint16_t w      = 0;
+        *(uint8_t *) &w = *ptr;
+        sum += w;
+    }
+    return sum;
+}
+
+static uint16_t checkSumScalar(const void *buf, uint32_t len, uint64_t initial)
+{
+    return foldTo16(sumTail(buf, len, foldTo32(initial)));
+}
+
+#if defined(CHECKSUM_X86)
+
+__attribute__((target("sse4.1"))) static uint16_t checkSumSse41(const void *buf, uint32_t len, uint64_t initial)
+{
+    const uint8_t *ptr  = buf;
+    __m128i        acc0 = _mm_setzero_si128();
+    __m128i        acc1 = _mm_setzero_si128();
+
+    while (len >= 32)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *) ptr);
+        __m128i b = _mm_loadu_si128((const __m128i *) (ptr + 16));
+
+        acc0 = _mm_add_epi64(acc0, _mm_cvtepu32_epi64(a));
+        acc1 = _mm_add_epi64(acc1, _mm_cvtepu32_epi64(_mm_srli_si128(a, 8)));
+        acc0 = _mm_add_epi64(acc0, _mm_cvtepu32_epi64(b));
+        acc1 = _mm_add_epi64(acc1, _mm_cvtepu32_epi64(_mm_srli_si128(b, 8)));
+
+        ptr += 32;
+        len -= 32;
+    }
+    acc0 = _mm_add_epi64(acc0, acc1);
+
+    uint64_t lanes[2];
+    _mm_storeu_si128((__m128i *) lanes, acc0);
+
+    uint64_t sum = foldTo32(initial) + foldTo32(lanes[0]) + foldTo32(lanes[1]);
+    return foldTo16(sumTail(ptr, len, sum));
+}
+
+__attribute__((target("avx2"))) static uint16_t checkSumAvx2(const void *buf, uint32_t len, uint64_t initial)
+{
+    if (len < 128)
+    {
+        // ip/tcp headers and small packets, reducing the lanes costs more than the vector loop saves
+        return checkSumScalar(buf, len, initial);
+    }
+
+    const uint8_t *ptr  = buf;
+    const __m256i  zero = _mm256_setzero_si256();
+    __m256i        acc0 = _mm256_setzero_si256();
+    __m256i        acc1 = _mm256_setzero_si256();
+
+    while (len >= 64)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *) ptr);
+        __m256i b = _mm256_loadu_si256((const __m256i *) (ptr + 32));
+
+        // interleaving with zero widens the 32 bit words to 64 bit lanes, the order of words does not matter
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+
+        ptr += 64;
+        len -= 64;
+    }
+    if (len >= 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *) ptr);
+
+        acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+        acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+
+        ptr += 32;
+        len -= 32;
+    }
+    acc0 = _mm256_add_epi64(acc0, acc1);
+
+    uint64_t lanes[4];
+    _mm256_storeu_si256((__m256i *) lanes, acc0);
+
+    uint64_t sum = foldTo32(initial) + foldTo32(lanes[0]) + foldTo32(lanes[1]) + foldTo32(lanes[2]) +
+                   foldTo32(lanes[3]);
+    return foldTo16(sumTail(ptr, len, sum));
+}
+
+#endif
+
+#if defined(CHECKSUM_NEON)
+
+static uint16_t checkSumNeon(const void *buf, uint32_t len, uint64_t initial)
+{
+    const uint8_t *ptr  = buf;
+    uint64x2_t     acc0 = vdupq_n_u64(0);
+    uint64x2_t     acc1 = vdupq_n_u64(0);
+
+    while (len >= 32)
+    {
+        // pairwise add of 32 bit words into the 64 bit accumulators
+        acc0 = vpadalq_u32(acc0, vld1q_u32((const uint32_t *) ptr));
+        acc1 = vpadalq_u32(acc1, vld1q_u32((const uint32_t *) (ptr + 16)));
+
+        ptr += 32;
+        len -= 32;
+    }
+    acc0 = vaddq_u64(acc0, acc1);
+
+    uint64_t sum = foldTo32(initial) + foldTo32(vgetq_lane_u64(acc0, 0)) + foldTo32(vgetq_lane_u64(acc0, 1));
+    return foldTo16(sumTail(ptr, len, sum));
+}
+
+#endif
+
+static bool isKernelSupported(enum checksum_kernels kernel)
+{
+    switch (kernel)
+    {
+    case kChecksumKernelScalar:
+        return true;
+#if defined(CHECKSUM_X86)
+    case kChecksumKernelSse41:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse4.1");
+    case kChecksumKernelAvx2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+#if defined(CHECKSUM_NEON)
+    case kChecksumKernelNeon:
+#if defined(__linux__) && defined(__aarch64__) && defined(HWCAP_ASIMD)
+        return (getauxval(AT_HWCAP) & HWCAP_ASIMD) != 0;
+#elif defined(__linux__) && defined(__arm__) && defined(HWCAP_NEON)
+        return (getauxval(AT_HWCAP) & HWCAP_NEON) != 0;
+#else
+        return true;
+#endif
+#endif
+    default:
+        return false;
+    }
+}
+
+checksum_kernel_t getCheckSumKernel(enum checksum_kernels kernel)
+{
+    if (! isKernelSupported(kernel))
+    {
+        return NULL;
+    }
+
+    switch (kernel)
+    {
+    case kChecksumKernelScalar:
+        return checkSumScalar;
+#if defined(CHECKSUM_X86)
+    case kChecksumKernelSse41:
+        return checkSumSse41;
+    case kChecksumKernelAvx2:
+        return checkSumAvx2;
+#endif
+#if defined(CHECKSUM_NEON)
+    case kChecksumKernelNeon:
+        return checkSumNeon;
+#endif
+    default:
+        return NULL;
+    }
+}
+
+const char *getCheckSumKernelName(enum checksum_kernels kernel)
+{
+    static const char *const kNames[kChecksumKernelsCount] = {"scalar", "sse4.1", "avx2", "neon"};
+
+    return kernel < kChecksumKernelsCount ? kNames[kernel] : "unknown";
+}
+
+static uint16_t checkSumResolve(const void *buf, uint32_t len, uint64_t initial);
+
+// starts with the resolver, the first call replaces it with the best kernel (like an ifunc)
+static checksum_kernel_t selected_kernel = checkSumResolve;
+
+static uint16_t checkSumResolve(const void *buf, uint32_t len, uint64_t initial)
+{
+    static const enum checksum_kernels kPreference[] = {kChecksumKernelAvx2, kChecksumKernelNeon,
+                                                        kChecksumKernelSse41, kChecksumKernelScalar};
+
+    checksum_kernel_t kernel = checkSumScalar;
+    for (size_t i = 0; i < sizeof(kPreference) / sizeof(kPreference[0]); i++)
+    {
+        checksum_kernel_t k = getCheckSumKernel(kPreference[i]);
+        if (k != NULL)
+        {
+            kernel = k;
+            break;
+        }
+    }
+
+    // every thread that races here picks the same kernel, so a plain store is enough
+    __atomic_store_n(&selected_kernel, kernel, __ATOMIC_RELAXED);
+    return kernel(buf, len, initial);
+}
+
+uint16_t checkSumPartial(const void *buf, uint32_t len, uint64_t initial)
+{
+    return __atomic_load_n(&selected_kernel, __ATOMIC_RELAXED)(buf, len, initial);
+}
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+
+/*
+    Internet checksum (rfc 1071) kernels
+
+    the kernel is picked once at runtime from what the cpu supports (cpuid / hwcap), not from compile flags,
+    so one binary runs the avx2 kernel on a new x86 and the 64 bit scalar one on an old one
+
+    every kernel sums 32 bit words into 64 bit lanes and folds at the end, which gives the same result as the
+    classic 16 bit loop (ones' complement sum is independent of the word size and of byte order)
+
+    results are folded to 16 bit but NOT inverted, so a pseudo header sum can be passed as initial and the
+    segment is never copied next to it, invert the final result to get the checksum field value
+
+*/
+
+typedef uint16_t (*checksum_kernel_t)(const void *buf, uint32_t len, uint64_t initial);
+
+enum checksum_kernels
+{
+    kChecksumKernelScalar,
+    kChecksumKernelSse41,
+    kChecksumKernelAvx2,
+    kChecksumKernelNeon,
+    kChecksumKernelsCount
+};
+
+// sum of buf with the best kernel for this cpu, len can be odd only for the last part of a chained sum
+uint16_t checkSumPartial(const void *buf, uint32_t len, uint64_t initial);
+
+// returns NULL if the kernel is not built for this architecture or the cpu does not support it
+checksum_kernel_t getCheckSumKernel(enum checksum_kernels kernel);
+const char       *getCheckSumKernelName(enum checksum_kernels kernel);
@@ -45,6 +45,12 @@ void contextQueuePush(context_queue_t *self, context_t *context)
     queue_push_back(&self->q, context);
 }
 
+// puts back a context that was popped but could only be partially consumed
+void contextQueuePushFront(context_queue_t *self, context_t *context)
+{
+    queue_push_front(&self->q, context);
+}
+
 context_t *contextQueuePop(context_queue_t *self)
 {
     context_t *context = queue_pull_front(&self->q);
@@ -10,21 +10,36 @@ struct capture_device_s;
 
 typedef void (*CaptureReadEventHandle)(struct capture_device_s *cdev, void *userdata, shift_buffer_t *buf, tid_t tid);
 
+/*
+    Each netfilter queue of the range (iptables --queue-balance) gets its own socket and reader thread,
+    packets of a queue are always delivered to the same worker, so a flow stays on one worker
+*/
+typedef struct capture_queue_s
+{
+    struct capture_device_s *cdev;
+    buffer_pool_t           *reader_buffer_pool;
+    uint8_t                 *overflow_buf;
+    hthread_t                read_thread;
+    int                      socket;
+    uint16_t                 queue_number;
+    tid_t                    distribute_tid;
+
+} capture_queue_t;
+
 typedef struct capture_device_s
 {
-    char     *name;
-    int       socket;
-    uint32_t  queue_number;
-    bool      drop_captured_packet;
-    void     *userdata;
-    hthread_t read_thread;
-    hthread_t write_thread;
+    char            *name;
+    capture_queue_t *queues;
+    uint32_t         queue_number;
+    uint32_t         queues_count;
+    bool             drop_captured_packet;
+    void            *userdata;
+    hthread_t        write_thread;
 
     hthread_routine routine_reader;
     hthread_routine routine_writer;
 
     master_pool_t  *reader_message_pool;
-    buffer_pool_t  *reader_buffer_pool;
     buffer_pool_t  *writer_buffer_pool;
 
     CaptureReadEventHandle read_event_callback;
@@ -38,6 +53,6 @@ typedef struct capture_device_s
 bool bringCaptureDeviceUP(capture_device_t *cdev);
 bool bringCaptureDeviceDown(capture_device_t *cdev);
 
-capture_device_t *createCaptureDevice(const char *name, uint32_t queue_number, void *userdata,
+capture_device_t *createCaptureDevice(const char *name, uint32_t queue_number, uint32_t queues_count, void *userdata,
                                       CaptureReadEventHandle cb);
 bool              writeToCaptureDevce(capture_device_t *cdev, shift_buffer_t *buf);
@@ -15,14 +15,24 @@
 #include <netinet/ip.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <unistd.h>
 
 enum
 {
-    kReadPacketSize              = 1500,
-    kEthDataLen                  = 1500,
     kMasterMessagePoolCap        = 64,
-    kQueueLen                    = 512,
-    kCaptureWriteChannelQueueMax = 128
+    kQueueLen                    = 4096,
+    kCaptureWriteChannelQueueMax = 128,
+    kMaxCopyRange                = 0xFFFF, // a GSO packet is up to 64k
+    kNetlinkHeadRoom             = 512,    // netlink header + attributes that come before the payload
+    kNetlinkOverflowSize         = kMaxCopyRange + kNetlinkHeadRoom,
+    kVerdictBatchMax             = 64
+};
+
+struct netfilter_attr
+{
+    const void *data;
+    size_t      size;
+    uint16_t    type;
 };
 
 struct msg_event
@@ -71,12 +81,16 @@ static void distributePacketPayload(capture_device_t *cdev, tid_t target_tid, sh
 }
 
 /*
- * Send a message to the netfilter system and wait for an acknowledgement.
+ * Send a message with one or more attributes to the netfilter system and optionally wait for an acknowledgement.
  */
-static bool netfilterSendMessage(int netfilter_socket, uint16_t nl_type, int nfa_type, uint16_t res_id, bool ack,
-                                 void *msg, size_t size)
+static bool netfilterSendMessageAttrs(int netfilter_socket, uint16_t nl_type, uint16_t res_id, bool ack,
+                                      const struct netfilter_attr *attrs, unsigned int attrs_count)
 {
-    size_t  nl_size = NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct nfgenmsg))) + NFA_ALIGN(NFA_LENGTH(size));
+    size_t nl_size = NLMSG_ALIGN(NLMSG_LENGTH(sizeof(struct nfgenmsg)));
+    for (unsigned int i = 0; i < attrs_count; i++)
+    {
+        nl_size += NFA_ALIGN(NFA_LENGTH(attrs[i].size));
+    }
     uint8_t buff[nl_size];
     memset(buff, 0, nl_size);
     struct nlmsghdr *nl_hdr = (struct nlmsghdr *) buff;
@@ -92,13 +106,15 @@ static bool netfilterSendMessage(int netfilter_socket, uint16_t nl_type, int nfa
     nl_gen_msg->nfgen_family    = AF_UNSPEC;
     nl_gen_msg->res_id          = htons(res_id);
 
-    struct nfattr *nl_attr     = (struct nfattr *) (buff + NLMSG_ALIGN(nl_hdr->nlmsg_len));
-    size_t         nl_attr_len = NFA_LENGTH(size);
-    nl_hdr->nlmsg_len          = NLMSG_ALIGN(nl_hdr->nlmsg_len) + NFA_ALIGN(nl_attr_len);
-    nl_attr->nfa_type          = nfa_type;
-    nl_attr->nfa_len           = NFA_LENGTH(size);
+    for (unsigned int i = 0; i < attrs_count; i++)
+    {
+        struct nfattr *nl_attr = (struct nfattr *) (buff + NLMSG_ALIGN(nl_hdr->nlmsg_len));
+        nl_hdr->nlmsg_len      = NLMSG_ALIGN(nl_hdr->nlmsg_len) + NFA_ALIGN(NFA_LENGTH(attrs[i].size));
+        nl_attr->nfa_type      = attrs[i].type;
+        nl_attr->nfa_len       = NFA_LENGTH(attrs[i].size);
 
-    memmove(NFA_DATA(nl_attr), msg, size);
+        memmove(NFA_DATA(nl_attr), attrs[i].data, attrs[i].size);
+    }
 
     struct sockaddr_nl nl_addr;
     memset(&nl_addr, 0x0, sizeof(nl_addr));
@@ -142,6 +158,16 @@ static bool netfilterSendMessage(int netfilter_socket, uint16_t nl_type, int nfa
     return false;
 }
 
+/*
+ * Send a message to the netfilter system and wait for an acknowledgement.
+ */
+static bool netfilterSendMessage(int netfilter_socket, uint16_t nl_type, int nfa_type, uint16_t res_id, bool ack,
+                                 void *msg, size_t size)
+{
+    struct netfilter_attr attr = {.type = (uint16_t) nfa_type, .data = msg, .size = size};
+    return netfilterSendMessageAttrs(netfilter_socket, nl_type, res_id, ack, &attr, 1);
+}
+
 /*
  * Set a netfilter configuration option.
  */
@@ -166,34 +192,82 @@ static bool netfilterSetParams(int netfilter_socket, uint16_t qnumber, uint8_t m
  */
 static bool netfilterSetQueueLength(int netfilter_socket, uint16_t qnumber, uint32_t qlen)
 {
+    qlen = htonl(qlen);
     return netfilterSendMessage(netfilter_socket, NFQNL_MSG_CONFIG, NFQA_CFG_QUEUE_MAXLEN, qnumber, true, &qlen,
                                 sizeof(qlen));
 }
 
+
+/*
+ * Ask netfilter to deliver GSO packets without segmenting them first.
+ */
+static bool netfilterSetGSO(int netfilter_socket, uint16_t qnumber)
+{
+    uint32_t              flags    = htonl(NFQA_CFG_F_GSO);
+    uint32_t              mask     = htonl(NFQA_CFG_F_GSO);
+    struct netfilter_attr attrs[2] = {{.type = NFQA_CFG_FLAGS, .data = &flags, .size = sizeof(flags)},
+                                      {.type = NFQA_CFG_MASK, .data = &mask, .size = sizeof(mask)}};
+
+    return netfilterSendMessageAttrs(netfilter_socket, NFQNL_MSG_CONFIG, qnumber, true, attrs, 2);
+}
+
+/*
+ * Give one verdict to every queued packet with an id lower than or equal to packet_id (network order).
+ */
+static bool netfilterSendBatchVerdict(int netfilter_socket, uint16_t qnumber, uint32_t packet_id, uint32_t verdict)
+{
+    struct nfqnl_msg_verdict_hdr nl_verdict = {.verdict = htonl(verdict), .id = packet_id};
+    return netfilterSendMessage(netfilter_socket, NFQNL_MSG_VERDICT_BATCH, NFQA_VERDICT_HDR, qnumber, false,
+                                &nl_verdict, sizeof(nl_verdict));
+}
+
 /*
  * Get a packet from netfilter.
+
+ * The netlink message is received directly into the buffer, on success the buffer is shifted so that it only
+ * contains the ip packet, only packets that do not fit the buffer are copied (from the overflow area)
  */
-static int netfilterGetPacket(int netfilter_socket, uint16_t qnumber, shift_buffer_t *buff)
+static int netfilterGetPacket(capture_queue_t *queue, shift_buffer_t **buff_ptr, uint32_t *packet_id, int flags)
 {
-    // Read a message from netlink
-    char               nl_buff[512 + kEthDataLen + sizeof(struct ethhdr) + sizeof(struct nfqnl_msg_packet_hdr)];
+    shift_buffer_t *buff = *buff_ptr;
+
     struct sockaddr_nl nl_addr;
-    socklen_t          nl_addr_len = sizeof(nl_addr);
-    ssize_t            result =
-        recvfrom(netfilter_socket, nl_buff, sizeof(nl_buff), 0, (struct sockaddr *) &nl_addr, &nl_addr_len);
+    struct iovec       iov[2] = {{.iov_base = rawBufMut(buff), .iov_len = rCapNoPadding(buff)},
+                                 {.iov_base = queue->overflow_buf, .iov_len = kNetlinkOverflowSize}};
+    struct msghdr      msg    = {.msg_name    = &nl_addr,
+                                 .msg_namelen = sizeof(nl_addr),
+                                 .msg_iov     = iov,
+                                 .msg_iovlen  = 2};
 
+    ssize_t result = recvmsg(queue->socket, &msg, flags);
+
+    if (result < 0)
+    {
+        return -1;
+    }
     if (result <= (int) sizeof(struct nlmsghdr))
     {
         errno = EINVAL;
         return -1;
     }
-    if (nl_addr_len != sizeof(nl_addr) || nl_addr.nl_pid != 0)
+    if (msg.msg_namelen != sizeof(nl_addr) || nl_addr.nl_pid != 0)
     {
         errno = EINVAL;
-        return false;
+        return -1;
     }
 
-    struct nlmsghdr *nl_hdr = (struct nlmsghdr *) nl_buff;
+    if ((size_t) result > iov[0].iov_len)
+    {
+        // rare, the packet did not fit into the pool buffer
+        setLen(buff, iov[0].iov_len);
+        buff = reserveBufSpace(buff, (uint32_t) result);
+        memcpy(rawBufMut(buff) + iov[0].iov_len, queue->overflow_buf, (size_t) result - iov[0].iov_len);
+        *buff_ptr = buff;
+    }
+    setLen(buff, (uint32_t) result);
+
+    uint8_t         *nl_buff = rawBufMut(buff);
+    struct nlmsghdr *nl_hdr  = (struct nlmsghdr *) nl_buff;
     if (NFNL_SUBSYS_ID(nl_hdr->nlmsg_type) != NFNL_SUBSYS_QUEUE)
     {
         errno = EINVAL;
@@ -204,7 +278,7 @@ static int netfilterGetPacket(int netfilter_socket, uint16_t qnumber, shift_buff
         errno = EINVAL;
         return -1;
     }
-    if (nl_hdr->nlmsg_len < sizeof(struct nfgenmsg))
+    if (nl_hdr->nlmsg_len < sizeof(struct nfgenmsg) || nl_hdr->nlmsg_len > (uint32_t) result)
     {
         errno = EINVAL;
         return -1;
@@ -222,6 +296,7 @@ static int netfilterGetPacket(int netfilter_socket, uint16_t qnumber, shift_buff
     bool                         found_data = false, found_pkt_hdr = false;
     uint8_t                     *nl_data      = NULL;
     size_t                       nl_data_size = 0;
+    uint32_t                     nl_cap_len   = 0;
     struct nfqnl_msg_packet_hdr *nl_pkt_hdr   = NULL;
     while (NFA_OK(nl_attr, nl_attr_size))
     {
@@ -246,6 +321,11 @@ static int netfilterGetPacket(int netfilter_socket, uint16_t qnumber, shift_buff
             }
             found_pkt_hdr = true;
             nl_pkt_hdr    = (struct nfqnl_msg_packet_hdr *) NFA_DATA(nl_attr);
+            *packet_id    = nl_pkt_hdr->packet_id;
+            break;
+        case NFQA_CAP_LEN:
+            memcpy(&nl_cap_len, NFA_DATA(nl_attr), sizeof(nl_cap_len));
+            nl_cap_len = ntohl(nl_cap_len);
             break;
         }
         nl_attr = NFA_NEXT(nl_attr, nl_attr_size);
@@ -255,67 +335,83 @@ static int netfilterGetPacket(int netfilter_socket, uint16_t qnumber, shift_buff
         errno = EINVAL;
         return -1;
     }
-
-    // Tell netlink to drop the packet
-    struct nfqnl_msg_verdict_hdr nl_verdict;
-    nl_verdict.verdict = htonl(NF_DROP);
-    nl_verdict.id      = nl_pkt_hdr->packet_id;
-    if (! netfilterSendMessage(netfilter_socket, NFQNL_MSG_VERDICT, NFQA_VERDICT_HDR, qnumber, false, &nl_verdict,
-                               sizeof(nl_verdict)))
+    if (nl_cap_len != 0 && nl_cap_len != nl_data_size)
     {
+        // truncated by the copy range, the packet is not usable
+        errno = EMSGSIZE;
         return -1;
     }
 
-    // Copy the packet's contents to the output buffer.
-    // Also add a phony ethernet header.
-    setLen(buff, nl_data_size);
-    // struct ethhdr *eth_header = (struct ethhdr *) buff;
-    // memset(&eth_header->h_dest, 0x0, ETH_ALEN);
-    // memset(&eth_header->h_source, 0x0, ETH_ALEN);
-    // eth_header->h_proto = htons(ETH_P_IP);
-
-    struct iphdr *ip_header = (struct iphdr *) rawBufMut(buff);
-    memmove(ip_header, nl_data, nl_data_size);
+    // No copy, the buffer is shifted to where the ip packet starts
+    shiftr(buff, (uint32_t) (nl_data - nl_buff));
+    setLen(buff, (uint32_t) nl_data_size);
 
     return (int) (nl_data_size);
 }
 
 static HTHREAD_ROUTINE(routineReadFromCapture) // NOLINT
 {
-    capture_device_t *cdev           = userdata;
-    tid_t             distribute_tid = 0;
+    capture_queue_t  *queue = userdata;
+    capture_device_t *cdev  = queue->cdev;
     shift_buffer_t   *buf;
     ssize_t           nread;
 
     while (atomic_load_explicit(&(cdev->running), memory_order_relaxed))
     {
-        buf = popSmallBuffer(cdev->reader_buffer_pool);
+        uint32_t last_packet_id = 0;
+        bool     has_verdict    = false;
 
-        buf = reserveBufSpace(buf, kReadPacketSize);
+        // block for the first packet, then drain what is already queued and give all of them 1 verdict
+        for (unsigned int i = 0; i < kVerdictBatchMax; i++)
+        {
+            uint32_t packet_id = 0;
 
-        nread = netfilterGetPacket(cdev->socket, cdev->queue_number, buf);
+            buf = popBuffer(queue->reader_buffer_pool);
+            resetBuffer(buf);
 
-        if (nread == 0)
-        {
-            reuseBuffer(cdev->reader_buffer_pool, buf);
-            LOGW("CaptureDevice: Exit read routine due to End Of File");
-            return 0;
-        }
+            nread = netfilterGetPacket(queue, &buf, &packet_id, i == 0 ? 0 : MSG_DONTWAIT);
 
-        if (nread < 0)
-        {
-            reuseBuffer(cdev->reader_buffer_pool, buf);
-            LOGW("CaptureDevice: failed to read a packet from netfilter socket, retrying...");
-            continue;
-        }
+            if (packet_id != 0)
+            {
+                last_packet_id = packet_id;
+                has_verdict    = true;
+            }
+
+            if (nread == 0)
+            {
+                reuseBuffer(queue->reader_buffer_pool, buf);
+                LOGW("CaptureDevice: Exit read routine due to End Of File");
+                return 0;
+            }
 
-        setLen(buf, nread);
+            if (nread < 0)
+            {
+                reuseBuffer(queue->reader_buffer_pool, buf);
+                if (errno == EAGAIN || errno == EWOULDBLOCK)
+                {
+                    break;
+                }
+                LOGW("CaptureDevice: failed to read a packet from netfilter queue %u, retrying...",
+                     (unsigned int) queue->queue_number);
+                continue;
+            }
 
-        distributePacketPayload(cdev, distribute_tid++, buf);
+            distributePacketPayload(cdev, queue->distribute_tid, buf);
 
-        if (distribute_tid >= WORKERS_COUNT)
+            if (cdev->queues_count == 1)
+            {
+                // a single queue has no flow affinity, so spread the packets across workers
+                queue->distribute_tid++;
+                if (queue->distribute_tid >= WORKERS_COUNT)
+                {
+                    queue->distribute_tid = 0;
+                }
+            }
+        }
+
+        if (has_verdict && ! netfilterSendBatchVerdict(queue->socket, queue->queue_number, last_packet_id, NF_DROP))
         {
-            distribute_tid = 0;
+            LOGW("CaptureDevice: failed to send verdict to netfilter queue %u", (unsigned int) queue->queue_number);
         }
     }
 
@@ -340,7 +436,8 @@ static HTHREAD_ROUTINE(routineWriteToCapture) // NOLINT
 
         struct sockaddr_in to_addr = {.sin_family = AF_INET, .sin_addr.s_addr = ip_header->daddr};
 
-        nwrite = sendto(cdev->socket, ip_header, bufLen(buf), 0, (struct sockaddr *) (&to_addr), sizeof(to_addr));
+        nwrite = sendto(cdev->queues[0].socket, ip_header, bufLen(buf), 0, (struct sockaddr *) (&to_addr),
+                        sizeof(to_addr));
 
         reuseBuffer(cdev->writer_buffer_pool, buf);
 
@@ -391,7 +488,10 @@ bool bringCaptureDeviceUP(capture_device_t *cdev)
 
     LOGD("CaptureDevice: device %s is now up", cdev->name);
 
-    cdev->read_thread  = hthread_create(cdev->routine_reader, cdev);
+    for (unsigned int i = 0; i < cdev->queues_count; i++)
+    {
+        cdev->queues[i].read_thread = hthread_create(cdev->routine_reader, &(cdev->queues[i]));
+    }
     cdev->write_thread = hthread_create(cdev->routine_writer, cdev);
     return true;
 }
@@ -407,32 +507,35 @@ bool bringCaptureDeviceDown(capture_device_t *cdev)
 
     LOGD("CaptureDevice: device %s is now down", cdev->name);
 
-    hthread_join(cdev->read_thread);
+    for (unsigned int i = 0; i < cdev->queues_count; i++)
+    {
+        hthread_join(cdev->queues[i].read_thread);
+    }
     hthread_join(cdev->write_thread);
 
     shift_buffer_t *buf;
     while (hchanRecv(cdev->writer_buffer_channel, &buf))
     {
-        reuseBuffer(cdev->reader_buffer_pool, buf);
+        reuseBuffer(cdev->writer_buffer_pool, buf);
     }
 
     return true;
 }
 
-capture_device_t *createCaptureDevice(const char *name, uint32_t queue_number, void *userdata,
-                                      CaptureReadEventHandle cb)
+static int openNetfilterQueue(uint32_t queue_number)
 {
-
     int socket_netfilter = socket(AF_NETLINK, SOCK_RAW, NETLINK_NETFILTER);
     if (socket_netfilter < 0)
     {
         LOGE("CaptureDevice: unable to create a netfilter socket");
+        return -1;
     }
 
+    // port id 0 lets the kernel pick a unique id, each queue has its own socket
     struct sockaddr_nl nl_addr;
     memset(&nl_addr, 0x0, sizeof(nl_addr));
     nl_addr.nl_family = AF_NETLINK;
-    nl_addr.nl_pid    = getpid();
+    nl_addr.nl_pid    = 0;
 
     if (bind(socket_netfilter, (struct sockaddr *) &nl_addr, sizeof(nl_addr)) != 0)
     {
@@ -451,20 +554,47 @@ capture_device_t *createCaptureDevice(const char *name, uint32_t queue_number, v
     {
         LOGE("CaptureDevice: unable to bind netfilter to queue number %u", queue_number);
     }
-    uint32_t range = kEthDataLen + sizeof(struct ethhdr) + sizeof(struct nfqnl_msg_packet_hdr);
-    if (! netfilterSetParams(socket_netfilter, queue_number, NFQNL_COPY_PACKET, range))
+    if (! netfilterSetParams(socket_netfilter, queue_number, NFQNL_COPY_PACKET, kMaxCopyRange))
     {
         LOGE("CaptureDevice: unable to set netfilter into copy packet mode with maximum "
              "buffer size %u",
-             range);
+             kMaxCopyRange);
+    }
+    if (! netfilterSetGSO(socket_netfilter, queue_number))
+    {
+        LOGW("CaptureDevice: unable to enable GSO on netfilter queue %u, packets will be segmented by the kernel",
+             queue_number);
     }
     if (! netfilterSetQueueLength(socket_netfilter, queue_number, kQueueLen))
     {
         LOGE("CaptureDevice: unable to set netfilter queue maximum length to %u", kQueueLen);
     }
 
-    buffer_pool_t *reader_bpool = createBufferPool(GSTATE.masterpool_buffer_pools_large,
-                                                   GSTATE.masterpool_buffer_pools_small, GSTATE.ram_profile);
+    return socket_netfilter;
+}
+
+capture_device_t *createCaptureDevice(const char *name, uint32_t queue_number, uint32_t queues_count, void *userdata,
+                                      CaptureReadEventHandle cb)
+{
+    assert(queues_count > 0);
+
+    // the sockets are the only part that can fail, they are opened before anything else is allocated
+    capture_queue_t *queues = globalMalloc(sizeof(capture_queue_t) * queues_count);
+
+    for (unsigned int i = 0; i < queues_count; i++)
+    {
+        int socket_netfilter = openNetfilterQueue(queue_number + i);
+        if (socket_netfilter < 0)
+        {
+            for (unsigned int j = 0; j < i; j++)
+            {
+                close(queues[j].socket);
+            }
+            globalFree(queues);
+            return NULL;
+        }
+        queues[i] = (capture_queue_t) {.socket = socket_netfilter};
+    }
 
     buffer_pool_t *writer_bpool =
         createBufferPool(GSTATE.masterpool_buffer_pools_large, GSTATE.masterpool_buffer_pools_small, 1);
@@ -476,16 +606,29 @@ capture_device_t *createCaptureDevice(const char *name, uint32_t queue_number, v
                                 .up                    = false,
                                 .routine_reader        = routineReadFromCapture,
                                 .routine_writer        = routineWriteToCapture,
-                                .socket                = socket_netfilter,
+                                .queues                = queues,
                                 .queue_number          = queue_number,
+                                .queues_count          = queues_count,
                                 .read_event_callback   = cb,
                                 .userdata              = userdata,
                                 .writer_buffer_channel = hchanOpen(sizeof(void *), kCaptureWriteChannelQueueMax),
                                 .reader_message_pool   = newMasterPoolWithCap(kMasterMessagePoolCap),
-                                .reader_buffer_pool    = reader_bpool,
                                 .writer_buffer_pool    = writer_bpool};
 
     installMasterPoolAllocCallbacks(cdev->reader_message_pool, allocCaptureMsgPoolHandle, destroyCaptureMsgPoolHandle);
 
+    for (unsigned int i = 0; i < queues_count; i++)
+    {
+        // every reader thread needs its own pool, they are not thread safe
+        cdev->queues[i] = (capture_queue_t) {
+            .cdev               = cdev,
+            .socket             = queues[i].socket,
+            .queue_number       = (uint16_t) (queue_number + i),
+            .distribute_tid     = (tid_t) (i % WORKERS_COUNT),
+            .overflow_buf       = globalMalloc(kNetlinkOverflowSize),
+            .reader_buffer_pool = createBufferPool(GSTATE.masterpool_buffer_pools_large,
+                                                   GSTATE.masterpool_buffer_pools_small, GSTATE.ram_profile)};
+    }
+
     return cdev;
 }
@@ -16,7 +16,14 @@ typedef void *tun_handle_t; // Windows handle (void* can hold HANDLE)
 
 struct tun_device_s;
 
-typedef void (*TunReadEventHandle)(struct tun_device_s *tdev, void *userdata, shift_buffer_t *buf, tid_t tid);
+enum
+{
+    kTunReadBatchMax = 64
+};
+
+// the reader drains the device and gives up to kTunReadBatchMax packets to a worker in one call
+typedef void (*TunReadEventHandle)(struct tun_device_s *tdev, void *userdata, shift_buffer_t **bufs, uint16_t count,
+                                   tid_t tid);
 
 typedef struct tun_device_s
 {
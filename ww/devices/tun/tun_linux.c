@@ -10,6 +10,7 @@
 #include <linux/if_tun.h>
 #include <linux/ipv6.h>
 #include <netinet/ip.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -19,6 +20,8 @@
 enum
 {
     kReadPacketSize          = 1500,
+    kReadHeadroom            = 16, // room for a tunnel header in front of the packet (the wireguard transport header)
+    kReadPollTimeoutMs       = 500,
     kMasterMessagePoolCap    = 64,
     kTunWriteChannelQueueMax = 256
 };
@@ -26,7 +29,8 @@ enum
 struct msg_event
 {
     tun_device_t   *tdev;
-    shift_buffer_t *buf;
+    uint16_t        count;
+    shift_buffer_t *bufs[kTunReadBatchMax];
 };
 
 static void printIPPacketInfo(const char *devname, const unsigned char *buffer)
@@ -96,17 +100,19 @@ static void localThreadEventReceived(hevent_t *ev)
     struct msg_event *msg = hevent_userdata(ev);
     tid_t             tid = (tid_t) (hloop_tid(hevent_loop(ev)));
 
-    msg->tdev->read_event_callback(msg->tdev, msg->tdev->userdata, msg->buf, tid);
+    msg->tdev->read_event_callback(msg->tdev, msg->tdev->userdata, msg->bufs, msg->count, tid);
 
     reuseMasterPoolItems(msg->tdev->reader_message_pool, (void **) &msg, 1, msg->tdev);
 }
 
-static void distributePacketPayload(tun_device_t *tdev, tid_t target_tid, shift_buffer_t *buf)
+static void distributePacketPayloads(tun_device_t *tdev, tid_t target_tid, shift_buffer_t **bufs, uint16_t count)
 {
     struct msg_event *msg;
     popMasterPoolItems(tdev->reader_message_pool, (const void **) &(msg), 1, tdev);
 
-    *msg = (struct msg_event) {.tdev = tdev, .buf = buf};
+    msg->tdev  = tdev;
+    msg->count = count;
+    memcpy(msg->bufs, bufs, sizeof(shift_buffer_t *) * count);
 
     hevent_t ev;
     memset(&ev, 0, sizeof(ev));
@@ -120,6 +126,8 @@ static HTHREAD_ROUTINE(routineReadFromTun) // NOLINT
 {
     tun_device_t   *tdev           = userdata;
     tid_t           distribute_tid = 0;
+    shift_buffer_t *bufs[kTunReadBatchMax];
+    uint16_t        count = 0;
     shift_buffer_t *buf;
     ssize_t         nread;
 
@@ -127,28 +135,54 @@ static HTHREAD_ROUTINE(routineReadFromTun) // NOLINT
     {
         buf = popSmallBuffer(tdev->reader_buffer_pool);
 
+        if (lCap(buf) < kReadHeadroom)
+        {
+            setLen(buf, kReadHeadroom);
+            shiftr(buf, kReadHeadroom);
+        }
         buf = reserveBufSpace(buf, kReadPacketSize);
 
+        // the handle is non-blocking, we read until the device is drained and then hand the batch to a worker
         nread = read(tdev->handle, rawBufMut(buf), kReadPacketSize);
 
         if (nread == 0)
         {
             reuseBuffer(tdev->reader_buffer_pool, buf);
             LOGW("TunDevice: Exit read routine due to End Of File");
-            return 0;
+            break;
         }
 
         if (nread < 0)
         {
             reuseBuffer(tdev->reader_buffer_pool, buf);
 
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                if (count > 0)
+                {
+                    distributePacketPayloads(tdev, distribute_tid, bufs, count);
+                    count = 0;
+                    if (++distribute_tid >= WORKERS_COUNT)
+                    {
+                        distribute_tid = 0;
+                    }
+                }
+                else
+                {
+                    // times out so the running flag is checked while the device is idle
+                    struct pollfd pfd = {.fd = tdev->handle, .events = POLLIN};
+                    poll(&pfd, 1, kReadPollTimeoutMs);
+                }
+                continue;
+            }
+
             LOGE("TunDevice: reading a packet from TUN device failed, code: %d", (int) nread);
-            if (errno == EINVAL || errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+            if (errno == EINVAL || errno == EINTR)
             {
                 continue;
             }
             LOGE("TunDevice: Exit read routine due to critical error");
-            return 0;
+            break;
         }
 
         setLen(buf, nread);
@@ -158,14 +192,24 @@ static HTHREAD_ROUTINE(routineReadFromTun) // NOLINT
             LOGD("TunDevice: read %zd bytes from device %s", nread, tdev->name);
         }
 
-        distributePacketPayload(tdev, distribute_tid++, buf);
+        bufs[count++] = buf;
 
-        if (distribute_tid >= WORKERS_COUNT)
+        if (count == kTunReadBatchMax)
         {
-            distribute_tid = 0;
+            distributePacketPayloads(tdev, distribute_tid, bufs, count);
+            count = 0;
+            if (++distribute_tid >= WORKERS_COUNT)
+            {
+                distribute_tid = 0;
+            }
         }
     }
 
+    for (uint16_t i = 0; i < count; i++)
+    {
+        reuseBuffer(tdev->reader_buffer_pool, bufs[i]);
+    }
+
     return 0;
 }
 
@@ -187,6 +231,15 @@ static HTHREAD_ROUTINE(routineWriteToTun) // NOLINT
 
         nwrite = write(tdev->handle, rawBuf(buf), bufLen(buf));
 
+        while (nwrite < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) &&
+               atomic_load_explicit(&(tdev->running), memory_order_relaxed))
+        {
+            // the handle is non-blocking for the reader, wait for room instead of dropping the packet
+            struct pollfd pfd = {.fd = tdev->handle, .events = POLLOUT};
+            poll(&pfd, 1, kReadPollTimeoutMs);
+            nwrite = write(tdev->handle, rawBuf(buf), bufLen(buf));
+        }
+
         reuseBuffer(tdev->writer_buffer_pool, buf);
 
         if (nwrite == 0)
@@ -345,6 +398,14 @@ tun_device_t *createTunDevice(const char *name, bool offload, void *userdata, Tu
         return NULL;
     }
 
+    // the reader drains every queued packet into one batch, it must not block on the last read
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK) < 0)
+    {
+        LOGE("TunDevice: setting the device non-blocking failed");
+        close(fd);
+        return NULL;
+    }
+
     buffer_pool_t *reader_bpool =
         createBufferPool(GSTATE.masterpool_buffer_pools_large, GSTATE.masterpool_buffer_pools_small, 
                          (0) + GSTATE.ram_profile);
@@ -104,11 +104,11 @@
 #endif /* LWIP_DHCP */
 
 /** The IP header ID of the next outgoing IP packet */
-static u16_t ip_id;
+static LWIP_THREAD_LOCAL u16_t ip_id;
 
 #if LWIP_MULTICAST_TX_OPTIONS
 /** The default netif used for multicast */
-static struct netif *ip4_default_multicast_netif;
+static LWIP_THREAD_LOCAL struct netif *ip4_default_multicast_netif;
 
 /**
  * @ingroup ip4
@@ -413,6 +413,13 @@ ip4_input_accept(struct netif *netif)
                          ip4_addr_get_u32(netif_ip4_addr(netif)) & ip4_addr_get_u32(netif_ip4_netmask(netif)),
                          ip4_addr_get_u32(ip4_current_dest_addr()) & ~ip4_addr_get_u32(netif_ip4_netmask(netif))));
 
+#if LWIP_TCP_ACCEPT_ANY
+  /* everything routed to this netif is ours */
+  if (netif_is_up(netif)) {
+    return 1;
+  }
+#endif /* LWIP_TCP_ACCEPT_ANY */
+
   /* interface is up and configured? */
   if ((netif_is_up(netif)) && (!ip4_addr_isany_val(*netif_ip4_addr(netif)))) {
     /* unicast to this interface address? */
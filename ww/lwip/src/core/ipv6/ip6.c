@@ -468,6 +468,13 @@ ip6_forward(struct pbuf *p, struct ip6_hdr *iphdr, struct netif *inp)
 static int
 ip6_input_accept(struct netif *netif)
 {
+#if LWIP_TCP_ACCEPT_ANY
+  /* everything routed to this netif is ours */
+  if (netif_is_up(netif)) {
+    return 1;
+  }
+#endif /* LWIP_TCP_ACCEPT_ANY */
+
   /* interface is up? */
   if (netif_is_up(netif)) {
     u8_t i;
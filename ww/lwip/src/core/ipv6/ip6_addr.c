@@ -217,7 +217,7 @@ fix_byte_order_and_return:
 char *
 ip6addr_ntoa(const ip6_addr_t *addr)
 {
-  static char str[40];
+  static LWIP_THREAD_LOCAL char str[40];
   return ip6addr_ntoa_r(addr, str, 40);
 }
 
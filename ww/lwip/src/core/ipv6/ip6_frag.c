@@ -100,8 +100,8 @@ PACK_STRUCT_END
 #endif
 
 /* static variables */
-static struct ip6_reassdata *reassdatagrams;
-static u16_t ip6_reass_pbufcount;
+static LWIP_THREAD_LOCAL struct ip6_reassdata *reassdatagrams;
+static LWIP_THREAD_LOCAL u16_t ip6_reass_pbufcount;
 
 /* Forward declarations. */
 static void ip6_reass_free_complete_datagram(struct ip6_reassdata *ipr);
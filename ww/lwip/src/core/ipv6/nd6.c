@@ -86,26 +86,26 @@
 #endif
 
 /* Router tables. */
-struct nd6_neighbor_cache_entry neighbor_cache[LWIP_ND6_NUM_NEIGHBORS];
-struct nd6_destination_cache_entry destination_cache[LWIP_ND6_NUM_DESTINATIONS];
-struct nd6_prefix_list_entry prefix_list[LWIP_ND6_NUM_PREFIXES];
-struct nd6_router_list_entry default_router_list[LWIP_ND6_NUM_ROUTERS];
+LWIP_THREAD_LOCAL struct nd6_neighbor_cache_entry neighbor_cache[LWIP_ND6_NUM_NEIGHBORS];
+LWIP_THREAD_LOCAL struct nd6_destination_cache_entry destination_cache[LWIP_ND6_NUM_DESTINATIONS];
+LWIP_THREAD_LOCAL struct nd6_prefix_list_entry prefix_list[LWIP_ND6_NUM_PREFIXES];
+LWIP_THREAD_LOCAL struct nd6_router_list_entry default_router_list[LWIP_ND6_NUM_ROUTERS];
 
 /* Default values, can be updated by a RA message. */
-u32_t reachable_time = LWIP_ND6_REACHABLE_TIME;
-u32_t retrans_timer = LWIP_ND6_RETRANS_TIMER; /* @todo implement this value in timer */
+LWIP_THREAD_LOCAL u32_t reachable_time = LWIP_ND6_REACHABLE_TIME;
+LWIP_THREAD_LOCAL u32_t retrans_timer = LWIP_ND6_RETRANS_TIMER; /* @todo implement this value in timer */
 
 #if LWIP_ND6_QUEUEING
-static u8_t nd6_queue_size = 0;
+static LWIP_THREAD_LOCAL u8_t nd6_queue_size = 0;
 #endif
 
 /* Index for cache entries. */
-static netif_addr_idx_t nd6_cached_destination_index;
+static LWIP_THREAD_LOCAL netif_addr_idx_t nd6_cached_destination_index;
 
 /* Multicast address holder. */
-static ip6_addr_t multicast_address;
+static LWIP_THREAD_LOCAL ip6_addr_t multicast_address;
 
-static u8_t nd6_tmr_rs_reduction;
+static LWIP_THREAD_LOCAL u8_t nd6_tmr_rs_reduction;
 
 /* Static buffer to parse RA packet options */
 union ra_options {
@@ -116,7 +116,7 @@ union ra_options {
   struct rdnss_option   rdnss;
 #endif
 };
-static union ra_options nd6_ra_buffer;
+static LWIP_THREAD_LOCAL union ra_options nd6_ra_buffer;
 
 /* Forward declarations. */
 static s8_t nd6_find_neighbor_cache_entry(const ip6_addr_t *ip6addr);
@@ -1698,7 +1698,7 @@ nd6_select_router(const ip6_addr_t *ip6addr, struct netif *netif)
 {
   struct netif *router_netif;
   s8_t i, j, valid_router;
-  static s8_t last_router;
+  static LWIP_THREAD_LOCAL s8_t last_router;
 
   LWIP_UNUSED_ARG(ip6addr); /* @todo match preferred routes!! (must implement ND6_OPTION_TYPE_ROUTE_INFO) */
 
@@ -106,19 +106,19 @@
 #endif /* LWIP_NETIF_LINK_CALLBACK */
 
 #if LWIP_NETIF_EXT_STATUS_CALLBACK
-static netif_ext_callback_t *ext_callback;
+static LWIP_THREAD_LOCAL netif_ext_callback_t *ext_callback;
 #endif
 
 #if !LWIP_SINGLE_NETIF
-struct netif *netif_list;
+LWIP_THREAD_LOCAL struct netif *netif_list;
 #endif /* !LWIP_SINGLE_NETIF */
-struct netif *netif_default;
+LWIP_THREAD_LOCAL struct netif *netif_default;
 
 #define netif_index_to_num(index)   ((index) - 1)
-static u8_t netif_num;
+static LWIP_THREAD_LOCAL u8_t netif_num;
 
 #if LWIP_NUM_NETIF_CLIENT_DATA > 0
-static u8_t netif_client_id;
+static LWIP_THREAD_LOCAL u8_t netif_client_id;
 #endif
 
 #define NETIF_REPORT_TYPE_IPV4  0x01
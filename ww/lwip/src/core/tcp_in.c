@@ -71,21 +71,21 @@
 /* These variables are global to all functions involved in the input
    processing of TCP segments. They are set by the tcp_input()
    function. */
-static struct tcp_seg inseg;
-static struct tcp_hdr *tcphdr;
-static u16_t tcphdr_optlen;
-static u16_t tcphdr_opt1len;
-static u8_t *tcphdr_opt2;
-static u16_t tcp_optidx;
-static u32_t seqno, ackno;
-static tcpwnd_size_t recv_acked;
-static u16_t tcplen;
-static u8_t flags;
-
-static u8_t recv_flags;
-static struct pbuf *recv_data;
-
-struct tcp_pcb *tcp_input_pcb;
+static LWIP_THREAD_LOCAL struct tcp_seg inseg;
+static LWIP_THREAD_LOCAL struct tcp_hdr *tcphdr;
+static LWIP_THREAD_LOCAL u16_t tcphdr_optlen;
+static LWIP_THREAD_LOCAL u16_t tcphdr_opt1len;
+static LWIP_THREAD_LOCAL u8_t *tcphdr_opt2;
+static LWIP_THREAD_LOCAL u16_t tcp_optidx;
+static LWIP_THREAD_LOCAL u32_t seqno, ackno;
+static LWIP_THREAD_LOCAL tcpwnd_size_t recv_acked;
+static LWIP_THREAD_LOCAL u16_t tcplen;
+static LWIP_THREAD_LOCAL u8_t flags;
+
+static LWIP_THREAD_LOCAL u8_t recv_flags;
+static LWIP_THREAD_LOCAL struct pbuf *recv_data;
+
+LWIP_THREAD_LOCAL struct tcp_pcb *tcp_input_pcb;
 
 /* Forward declarations. */
 static err_t tcp_process(struct tcp_pcb *pcb);
@@ -323,7 +323,7 @@ tcp_input(struct pbuf *p, struct netif *inp)
         continue;
       }
 
-      if (lpcb->local_port == tcphdr->dest) {
+      if (lpcb->local_port == tcphdr->dest || (LWIP_TCP_ACCEPT_ANY && lpcb->local_port == 0)) {
         if (IP_IS_ANY_TYPE_VAL(lpcb->local_ip)) {
           /* found an ANY TYPE (IPv4/IPv6) match */
 #if SO_REUSE
@@ -675,7 +675,7 @@ tcp_listen_input(struct tcp_pcb_listen *pcb)
     /* Set up the new PCB. */
     ip_addr_copy(npcb->local_ip, *ip_current_dest_addr());
     ip_addr_copy(npcb->remote_ip, *ip_current_src_addr());
-    npcb->local_port = pcb->local_port;
+    npcb->local_port = tcphdr->dest;
     npcb->remote_port = tcphdr->src;
     npcb->state = SYN_RCVD;
     npcb->rcv_nxt = seqno + 1;
@@ -136,7 +136,7 @@ struct ip_globals
   /** Destination IP address of current_header */
   ip_addr_t current_iphdr_dest;
 };
-extern struct ip_globals ip_data;
+extern LWIP_THREAD_LOCAL struct ip_globals ip_data;
 
 
 /** Get the interface that accepted the current packet.
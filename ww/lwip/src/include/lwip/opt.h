@@ -88,6 +88,24 @@
 #if !defined NO_SYS || defined __DOXYGEN__
 #define NO_SYS                          0
 #endif
+
+/**
+ * LWIP_THREAD_LOCAL: storage class of the global state of the stack. Define it
+ * to _Thread_local to run one independent stack per thread (NO_SYS==1 only,
+ * every thread calls lwip_init(), adds its own netif and runs its own timers)
+ */
+#if !defined LWIP_THREAD_LOCAL || defined __DOXYGEN__
+#define LWIP_THREAD_LOCAL
+#endif
+
+/**
+ * LWIP_TCP_ACCEPT_ANY==1: accept IP packets to any destination address on an
+ * up netif, and let a TCP listener bound to port 0 accept connections to any
+ * port (transparent termination of routed traffic, e.g. behind a tun device)
+ */
+#if !defined LWIP_TCP_ACCEPT_ANY || defined __DOXYGEN__
+#define LWIP_TCP_ACCEPT_ANY             0
+#endif
 /**
  * @}
  */
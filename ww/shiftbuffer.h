@@ -101,6 +101,13 @@ static inline uint32_t bufLen(const shift_buffer_t *const b)
     return b->len;
 }
 
+// moves the cursor back to the left padding and drops the content, used before receiving into a reused buffer
+static inline void resetBuffer(shift_buffer_t *const b)
+{
+    b->curpos = b->l_pad;
+    b->len    = 0;
+}
+
 static inline void consume(shift_buffer_t *const b, const uint32_t bytes)
 {
     setLen(b, bufLen(b) - bytes);
@@ -29,6 +29,42 @@ void chain(tunnel_t *from, tunnel_t *to)
     to->chain_index = from->chain_index + 1;
 }
 
+/*
+    `to` gets the whole batch in one call if it has a batch routine, otherwise one context per packet through the
+    upStream/downStream routine every node sets, the checksum_clean flag of each packet goes with its context
+*/
+void upStreamPacketBatch(tunnel_t *to, packet_batch_t *batch)
+{
+    if (to->fnPacketBatchU != NULL)
+    {
+        to->fnPacketBatchU(to, batch);
+        return;
+    }
+    for (uint16_t i = 0; i < batch->count; i++)
+    {
+        context_t *c      = newContext(batch->line);
+        c->payload        = batch->bufs[i];
+        c->checksum_clean = batch->checksum_clean[i];
+        to->upStream(to, c);
+    }
+}
+
+void downStreamPacketBatch(tunnel_t *to, packet_batch_t *batch)
+{
+    if (to->fnPacketBatchD != NULL)
+    {
+        to->fnPacketBatchD(to, batch);
+        return;
+    }
+    for (uint16_t i = 0; i < batch->count; i++)
+    {
+        context_t *c      = newContext(batch->line);
+        c->payload        = batch->bufs[i];
+        c->checksum_clean = batch->checksum_clean[i];
+        to->downStream(to, c);
+    }
+}
+
 static void defaultUpStreamInit(tunnel_t *self, line_t *line)
 {
     assert(self->up != NULL);
@@ -136,6 +136,7 @@ typedef struct context_s
     bool            init;
     bool            est;
     bool            fin;
+    bool            checksum_clean; // layer3: payload checksums are valid and were kept valid by incremental updates
 } context_t;
 
 struct tunnel_s;
@@ -160,6 +161,28 @@ typedef void (*TunnelFlowRoutinePause)(struct tunnel_s *, line_t *line);
 typedef void (*TunnelFlowRoutineResume)(struct tunnel_s *, line_t *line);
 typedef void (*TunnelFlowGatherBufInfo)(struct tunnel_s *, tunnel_buffinfo_t *info);
 
+enum
+{
+    kPacketBatchCap = 64
+};
+
+/*
+    A vector of packets on the same line, layer3 nodes pass it in one call instead of one context per packet
+
+    the node that receives a batch owns its buffers (like the payload of a context), it can drop packets from it
+    and pass the rest on, the batch itself belongs to the caller and is only valid during the call
+*/
+typedef struct packet_batch_s
+{
+    line_t         *line;
+    uint16_t        count;
+    bool            checksum_clean[kPacketBatchCap]; // context_t.checksum_clean of each packet
+    shift_buffer_t *bufs[kPacketBatchCap];
+
+} packet_batch_t;
+
+typedef void (*TunnelFlowRoutinePacketBatch)(struct tunnel_s *, packet_batch_t *batch);
+
 /*
     Tunnel is just a doubly linked list, it has its own state, per connection state is stored in line structure
     which later gets accessed by the chain_index which is fixed
@@ -186,6 +209,11 @@ typedef struct tunnel_s
     TunnelFlowRoutineResume  fnResumeD;
     TunnelFlowGatherBufInfo  fnGBufInfoU;
     TunnelFlowGatherBufInfo  fnGBufInfoD;
+
+    // optional, NULL when the tunnel only takes packets one context at a time (see upStreamPacketBatch)
+    TunnelFlowRoutinePacketBatch fnPacketBatchU;
+    TunnelFlowRoutinePacketBatch fnPacketBatchD;
+
     TunnelStatusCb           onChainingComplete;
     TunnelStatusCb           beforeChainStart;
     TunnelStatusCb           onChainStart;
@@ -205,6 +233,8 @@ void      destroyTunnel(tunnel_t *self);
 void      chain(tunnel_t *from, tunnel_t *to);
 void      chainDown(tunnel_t *from, tunnel_t *to);
 void      chainUp(tunnel_t *from, tunnel_t *to);
+void      upStreamPacketBatch(tunnel_t *to, packet_batch_t *batch);
+void      downStreamPacketBatch(tunnel_t *to, packet_batch_t *batch);
 
 static inline void setTunnelState(tunnel_t *self, void *state)
 {
@@ -474,6 +504,14 @@ static inline void reuseContextPayload(context_t *const c)
     dropContexPayload(c);
 }
 
+static inline void packetBatchPush(packet_batch_t *const batch, shift_buffer_t *const buf, const bool checksum_clean)
+{
+    assert(batch->count < kPacketBatchCap);
+    batch->checksum_clean[batch->count] = checksum_clean;
+    batch->bufs[batch->count]           = buf;
+    batch->count++;
+}
+
 static inline bool isUpPiped(const line_t *const l)
 {
     return l->up_piped;
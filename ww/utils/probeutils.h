@@ -0,0 +1,68 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+    Open addressing over a power of 2 array of probe_slot_t
+
+    linear probing with the low bits of the key as the hash, so it only suits keys that are random or handed out
+    in sequence; removal shifts the following entries back so a lookup never walks tombstones
+
+    the owner keeps the array, its mask and its count and decides when to grow it, these only move slots around
+*/
+
+typedef struct probe_slot_s
+{
+    void    *value; // NULL for an empty slot
+    uint32_t key;
+
+} probe_slot_t;
+
+// the slot that holds key, UINT32_MAX when it is not in the table
+static inline uint32_t probeTableFind(const probe_slot_t *slots, uint32_t mask, uint32_t key)
+{
+    uint32_t slot = key & mask;
+    while (slots[slot].value != NULL)
+    {
+        if (slots[slot].key == key)
+        {
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return UINT32_MAX;
+}
+
+// the key must not be in the table and the table must have a free slot
+static inline void probeTablePlace(probe_slot_t *slots, uint32_t mask, uint32_t key, void *value)
+{
+    uint32_t slot = key & mask;
+    while (slots[slot].value != NULL)
+    {
+        slot = (slot + 1) & mask;
+    }
+    slots[slot] = (probe_slot_t) {.value = value, .key = key};
+}
+
+// empties the slot, which must be in use, and closes the gap it leaves in the probe sequences that run over it
+static inline void probeTableRemoveSlot(probe_slot_t *slots, uint32_t mask, uint32_t hole)
+{
+    uint32_t slot = hole;
+    while (true)
+    {
+        slot = (slot + 1) & mask;
+        if (slots[slot].value == NULL)
+        {
+            break;
+        }
+        // an entry can move back into the hole only if the hole is not before its home slot
+        const uint32_t home = slots[slot].key & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask))
+        {
+            slots[hole] = slots[slot];
+            hole        = slot;
+        }
+    }
+    slots[hole] = (probe_slot_t) {0};
+}